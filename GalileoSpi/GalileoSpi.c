@@ -3,6 +3,11 @@
   This module specifies the SPI busses on the Galileo board used in DXE
   mode.
 
+  The SPI driver stack uses the board configuration after ExitBootServices.
+  The configuration is copied into runtime pool and the pointers within the
+  copy are converted when the operating system switches to virtual
+  addresses.
+
 Copyright (c) 2016-2017, Intel Corporation. All rights reserved.<BR>
 This program and the accompanying materials are licensed and made available
 under the terms and conditions of the BSD License which accompanies this
@@ -15,8 +20,12 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
 #include "GalileoSpi.h"
+#include <Guid/EventGroup.h>
 #include <IndustryStandard/Pci.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/MemoryAllocationLib.h>
 #include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeLib.h>
 
 #define SPI_FLASH_DRIVER_GUID           gEfiSpiNorFlashDriverGuid
 
@@ -36,6 +45,166 @@ static CONST EFI_SPI_CONFIGURATION_PROTOCOL SpiConfiguration = {
   &SpiBusses[0]
 };
 
+//
+// Runtime copy of the SPI configuration
+//
+typedef struct {
+  EFI_SPI_CONFIGURATION_PROTOCOL SpiConfiguration;
+  UINT32 PeripheralCount;
+  EFI_SPI_BUS **BusList;
+  EFI_SPI_BUS *Busses;
+  EFI_SPI_PERIPHERAL *Peripherals;
+} RUNTIME_SPI_CONFIGURATION;
+
+RUNTIME_SPI_CONFIGURATION *mRuntimeConfiguration;
+
+/**
+  Copy the SPI configuration into runtime pool.
+
+  The copy links the busses and peripherals to each other, so that every
+  pointer into the configuration references the copy.
+
+  @param[in] Configuration  Address of the board's SPI configuration
+
+  @return  The address of the runtime copy or NULL when the allocation fails
+
+**/
+STATIC
+RUNTIME_SPI_CONFIGURATION *
+EFIAPI
+GalileoSpiRuntimeCopy (
+  IN CONST EFI_SPI_CONFIGURATION_PROTOCOL *Configuration
+  )
+{
+  EFI_SPI_BUS *Bus;
+  UINT32 BusIndex;
+  RUNTIME_SPI_CONFIGURATION *Copy;
+  UINTN Length;
+  EFI_SPI_PERIPHERAL *Peripheral;
+  UINT32 PeripheralCount;
+  CONST EFI_SPI_PERIPHERAL *SpiPeripheral;
+
+  //
+  // Count the SPI peripherals
+  //
+  PeripheralCount = 0;
+  for (BusIndex = 0; BusIndex < Configuration->BusCount; BusIndex++) {
+    SpiPeripheral = Configuration->BusList[BusIndex]->PeripheralList;
+    while (SpiPeripheral != NULL) {
+      PeripheralCount += 1;
+      SpiPeripheral = SpiPeripheral->NextSpiPeripheral;
+    }
+  }
+
+  //
+  // Allocate the data structures
+  //
+  Length = sizeof (RUNTIME_SPI_CONFIGURATION)
+         + (Configuration->BusCount * (sizeof (EFI_SPI_BUS *)
+                                       + sizeof (EFI_SPI_BUS)))
+         + (PeripheralCount * sizeof (EFI_SPI_PERIPHERAL));
+  Copy = AllocateRuntimeZeroPool (Length);
+  if (Copy == NULL) {
+    return NULL;
+  }
+  Copy->PeripheralCount = PeripheralCount;
+  Copy->BusList = (EFI_SPI_BUS **)(Copy + 1);
+  Copy->Busses = (EFI_SPI_BUS *)&Copy->BusList[Configuration->BusCount];
+  Copy->Peripherals = (EFI_SPI_PERIPHERAL *)
+                      &Copy->Busses[Configuration->BusCount];
+
+  //
+  // Copy the busses and their peripherals
+  //
+  Peripheral = Copy->Peripherals;
+  for (BusIndex = 0; BusIndex < Configuration->BusCount; BusIndex++) {
+    Bus = &Copy->Busses[BusIndex];
+    CopyMem (Bus, Configuration->BusList[BusIndex], sizeof (*Bus));
+    Copy->BusList[BusIndex] = Bus;
+    SpiPeripheral = Bus->PeripheralList;
+    if (SpiPeripheral != NULL) {
+      Bus->PeripheralList = Peripheral;
+    }
+    while (SpiPeripheral != NULL) {
+      CopyMem (Peripheral, SpiPeripheral, sizeof (*Peripheral));
+      Peripheral->SpiBus = Bus;
+      SpiPeripheral = SpiPeripheral->NextSpiPeripheral;
+      if (SpiPeripheral != NULL) {
+        Peripheral->NextSpiPeripheral = Peripheral + 1;
+      }
+      Peripheral += 1;
+    }
+  }
+  Copy->SpiConfiguration.BusCount = Configuration->BusCount;
+  *(VOID **)&Copy->SpiConfiguration.BusList = Copy->BusList;
+  return Copy;
+}
+
+/**
+  Convert the SPI configuration pointers to virtual addresses.
+
+  This routine is called at TPL_NOTIFY.
+
+  @param[in]  Event             Event whose notification function is being
+                                invoked.
+  @param[in]  Context           Pointer to the notification function's context.
+
+**/
+VOID
+EFIAPI
+GalileoSpiVirtualAddressChange (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  EFI_SPI_BUS *Bus;
+  UINT32 Index;
+  EFI_SPI_PERIPHERAL *Peripheral;
+
+  //
+  // Convert the pointers within each SPI peripheral
+  //
+  for (Index = 0; Index < mRuntimeConfiguration->PeripheralCount; Index++) {
+    Peripheral = &mRuntimeConfiguration->Peripherals[Index];
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                       (VOID **)&Peripheral->NextSpiPeripheral);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Peripheral->FriendlyName);
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                       (VOID **)&Peripheral->SpiPeripheralDriverGuid);
+    EfiConvertPointer (0, (VOID **)&Peripheral->SpiPart);
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                       (VOID **)&Peripheral->ConfigurationData);
+    EfiConvertPointer (0, (VOID **)&Peripheral->SpiBus);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Peripheral->ChipSelect);
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                       (VOID **)&Peripheral->ChipSelectParameter);
+  }
+
+  //
+  // Convert the pointers within each SPI bus
+  //
+  for (Index = 0; Index < mRuntimeConfiguration->SpiConfiguration.BusCount;
+       Index++) {
+    Bus = &mRuntimeConfiguration->Busses[Index];
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Bus->FriendlyName);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Bus->PeripheralList);
+    EfiConvertPointer (0, (VOID **)&Bus->ControllerPath);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Bus->Clock);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Bus->ClockParameter);
+    EfiConvertPointer (0, (VOID **)&mRuntimeConfiguration->BusList[Index]);
+  }
+
+  //
+  // Convert the bus list
+  //
+  EfiConvertPointer (0,
+                     (VOID **)&mRuntimeConfiguration->SpiConfiguration.BusList);
+  EfiConvertPointer (0, (VOID **)&mRuntimeConfiguration->BusList);
+  EfiConvertPointer (0, (VOID **)&mRuntimeConfiguration->Busses);
+  EfiConvertPointer (0, (VOID **)&mRuntimeConfiguration->Peripherals);
+  EfiConvertPointer (0, (VOID **)&mRuntimeConfiguration);
+}
+
 /**
   The entry point for the Galileo SPI module.
 
@@ -53,8 +222,37 @@ GalileoSpiEntryPoint (
   IN EFI_SYSTEM_TABLE     *SystemTable
   )
 {
+  EFI_EVENT Event;
+  EFI_STATUS Status;
+
+  //
+  // Copy the SPI bus configuration into runtime pool
+  //
+  mRuntimeConfiguration = GalileoSpiRuntimeCopy (&SpiConfiguration);
+  if (mRuntimeConfiguration == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI configuration!\n"));
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Convert the configuration when switching to virtual addresses
+  //
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  GalileoSpiVirtualAddressChange,
+                  NULL,
+                  &gEfiEventVirtualAddressChangeGuid,
+                  &Event
+                  );
+  if (EFI_ERROR (Status)) {
+    FreePool (mRuntimeConfiguration);
+    mRuntimeConfiguration = NULL;
+    return Status;
+  }
+
   //
   // Make the SPI bus configuration available to the SPI driver stack
   //
-  return SbcInitialize(&SpiConfiguration);
+  return SbcInitialize(&mRuntimeConfiguration->SpiConfiguration);
 }
@@ -18,7 +18,8 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Winbond/W25Q64FV.h>
 
 static LEGACY_SPI_CONFIG BiosFlashChipSelect = {
-  SPIADDR_CSC_SS0
+  SPIADDR_CSC_SS0,              // ChipSelect
+  8 * BIT20                     // MemoryMappedBytes
 };
 
 static CONST EFI_SPI_NOR_FLASH_CONFIGURATION_DATA BiosFlashConfig = {
@@ -29,7 +30,10 @@ static CONST EFI_SPI_NOR_FLASH_CONFIGURATION_DATA BiosFlashConfig = {
   WINBOND_W25Q64FV_READ_03_FREQUENCY,   // Opcode 03 read frequency, use maximum
   256,                                  // WritePageBytes
   SPI_NOR_ENABLE_WRITE_OR_ERASE,        // Write status prefix opcode
-  { 0xEF, 0x40, 0x17 }                  // Manufacture and device ID
+  { 0xEF, 0x40, 0x17 },                 // Manufacture and device ID
+  SPI_NOR_SUPPORTS_SUSPEND_RESUME,      // Attributes
+  SPI_NOR_SUSPEND,                      // Suspend opcode
+  SPI_NOR_RESUME                        // Resume opcode
 };
 
 static CONST EFI_SPI_PERIPHERAL BiosFlash = {
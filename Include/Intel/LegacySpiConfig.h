@@ -27,6 +27,14 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 ///
 typedef struct _LEGACY_SPI_CONFIG {
   UINT32 ChipSelect;
+
+  ///
+  /// Number of bytes at the start of the flash part which are decoded into
+  /// the memory mapped window ending at 4 GiB.  Flash address zero is mapped
+  /// to 4 GiB - MemoryMappedBytes.  Zero leaves the caching of the window
+  /// unchanged.
+  ///
+  UINT32 MemoryMappedBytes;
 } LEGACY_SPI_CONFIG;
 
 typedef struct {
@@ -0,0 +1,82 @@
+/** @file
+
+  This file declares the routines which check and compare flash buffers.
+
+  The routines use wide loads for the bulk of the buffer: 32-bit loads on
+  IA32 and 128-bit SSE2 loads on X64.  The buffers may be in RAM or in the
+  memory mapped flash window.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __FLASH_BUFFER_LIB_H__
+#define __FLASH_BUFFER_LIB_H__
+
+/**
+  Determine if a buffer contains only erased (0xff) bytes.
+
+  @param[in]  Buffer            Address of the buffer
+  @param[in]  Length            Number of bytes in the buffer
+
+  @retval TRUE                  All of the bytes are 0xff or Length is zero
+  @retval FALSE                 The buffer contains data
+
+**/
+BOOLEAN
+EFIAPI
+IsBlank (
+  IN CONST VOID *Buffer,
+  IN UINTN Length
+  );
+
+/**
+  Compare the contents of two buffers.
+
+  This routine is a replacement for CompareMem which uses wide loads.
+
+  @param[in]  DestinationBuffer Address of the first buffer
+  @param[in]  SourceBuffer      Address of the second buffer
+  @param[in]  Length            Number of bytes to compare
+
+  @retval 0                     The buffers are identical or Length is zero
+  @retval other                 The value of the first mismatched byte in
+                                DestinationBuffer minus the value of the
+                                corresponding byte in SourceBuffer
+
+**/
+INTN
+EFIAPI
+CompareRange (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN Length
+  );
+
+/**
+  Locate the first byte which differs between two buffers.
+
+  @param[in]  DestinationBuffer Address of the first buffer
+  @param[in]  SourceBuffer      Address of the second buffer
+  @param[in]  Length            Number of bytes to compare
+
+  @return  The offset of the first byte which differs, or Length when the
+           buffers are identical
+
+**/
+UINTN
+EFIAPI
+FindFirstDifference (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN Length
+  );
+
+#endif  //  __FLASH_BUFFER_LIB_H__
@@ -0,0 +1,69 @@
+/** @file
+
+  This file declares the routine which copies data between SPI flash parts.
+
+  The copy is pipelined: the destination erases each chunk in the background
+  while the chunk is read from the source, and the next chunk is read while
+  the chunk is programmed.  Two chunks of data are held in RAM.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __SPI_FLASH_COPY_LIB_H__
+#define __SPI_FLASH_COPY_LIB_H__
+
+#include <Protocol/SpiNorFlash.h>
+
+/**
+  Copy a region of one SPI flash part into another SPI flash part.
+
+  This routine must be called at TPL_APPLICATION.
+
+  The destination region is erased and then programmed with the data from
+  the source region.  The source and destination must be different SPI flash
+  parts since the source is read while the destination is busy.  Source must
+  not be another protocol instance of the destination flash part: the two
+  instances would share the SPI IO instance of the part and the source reads
+  would be sent to the busy part.
+
+  @param[in]  Destination       Pointer to the EFI_SPI_NOR_FLASH_PROTOCOL
+                                structure of the flash part to program
+  @param[in]  DestinationAddress  Address in the destination flash, a
+                                multiple of 4 KiB
+  @param[in]  Source            Pointer to the EFI_SPI_NOR_FLASH_PROTOCOL
+                                structure of the flash part to read
+  @param[in]  SourceAddress     Address in the source flash
+  @param[in]  LengthInBytes     Number of bytes to copy, a multiple of 4 KiB
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The data was copied successfully
+  @retval EFI_INVALID_PARAMETER Destination or Source is NULL
+  @retval EFI_INVALID_PARAMETER DestinationAddress or LengthInBytes is not a
+                                multiple of 4 KiB
+  @retval EFI_INVALID_PARAMETER A region extends beyond the end of its flash
+  @retval EFI_INVALID_PARAMETER Destination and Source are the same flash part
+                                or share the same SPI peripheral
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the chunk buffers
+  @retval other                 A read, erase or write operation failed
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashCopy (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *Destination,
+  IN UINT32 DestinationAddress,
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *Source,
+  IN UINT32 SourceAddress,
+  IN UINT32 LengthInBytes
+  );
+
+#endif  //  __SPI_FLASH_COPY_LIB_H__
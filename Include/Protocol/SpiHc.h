@@ -174,6 +174,20 @@ EFI_STATUS
 ///
 #define HC_TRANSFER_SIZE_INCLUDES_ADDRESS       0x00000100
 
+///
+/// The chip select only changes state when the ChipSelect routine is called.
+/// The SPI bus layer may perform multiple host controller transactions while
+/// the chip select remains asserted, allowing transactions larger than
+/// MaximumTransferBytes.
+///
+#define HC_SUPPORTS_CHIP_SELECT_HOLD            0x00000200
+
+///
+/// The SPI host controller accepts EFI_SPI_BUS_TRANSACTION structures with
+/// the command phases described by the Phases field.
+///
+#define HC_SUPPORTS_TRANSACTION_PHASES          0x00000400
+
 ///
 /// Macro to specify a supported frame size in bits per frame
 ///
@@ -56,6 +56,49 @@ typedef enum _EFI_SPI_TRANSACTION_TYPE {
   SPI_TRANSACTION_WRITE_THEN_READ
 } EFI_SPI_TRANSACTION_TYPE;
 
+///
+/// The EFI_SPI_TRANSACTION_PHASES data structure describes the command phases
+/// of a SPI flash transaction: opcode, address and dummy cycles.  The command
+/// phases are sent before the data phase, each phase using its own bus width.
+///
+typedef struct _EFI_SPI_TRANSACTION_PHASES
+{
+  ///
+  /// Opcode sent to the SPI peripheral
+  ///
+  UINT8 Opcode;
+
+  ///
+  /// SPI bus width in bits for the opcode: 1, 2, 4
+  ///
+  UINT8 OpcodeBusWidth;
+
+  ///
+  /// Number of address bytes: 0, 3, 4
+  ///
+  UINT8 AddressBytes;
+
+  ///
+  /// SPI bus width in bits for the address: 1, 2, 4
+  ///
+  UINT8 AddressBusWidth;
+
+  ///
+  /// Address sent to the SPI peripheral most significant byte first
+  ///
+  UINT32 Address;
+
+  ///
+  /// Number of SCLK cycles between the address and the data phase
+  ///
+  UINT8 DummyCycles;
+
+  ///
+  /// SPI bus width in bits for the data: 1, 2, 4
+  ///
+  UINT8 DataBusWidth;
+} EFI_SPI_TRANSACTION_PHASES;
+
 ///
 /// The EFI_SPI_BUS_TRANSACTION data structure contains the description of
 /// the SPI transaction to perform on the host controller.
@@ -116,6 +159,16 @@ typedef struct _EFI_SPI_BUS_TRANSACTION
   /// * Frame sizes 17-32 bits: UINT32 (four bytes) per frame
   ///
   UINT8 *ReadBuffer;
+
+  ///
+  /// Command phases of the transaction or NULL when the write buffer contains
+  /// the opcode and address.  Only passed to SPI host controllers which set
+  /// HC_SUPPORTS_TRANSACTION_PHASES.  When not NULL, the FrameSize is 8, the
+  /// buffers only contain the data phase and the TransactionType is either
+  /// SPI_TRANSACTION_READ_ONLY or SPI_TRANSACTION_WRITE_ONLY.  WriteBytes is
+  /// zero for a write-only transaction without a data phase.
+  ///
+  CONST EFI_SPI_TRANSACTION_PHASES *Phases;
 } EFI_SPI_BUS_TRANSACTION;
 
 /**
@@ -238,6 +291,248 @@ EFI_STATUS
   IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral
   );
 
+/**
+  Validate a SPI transaction once for repeated use.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  SPI peripheral drivers often perform the same transaction many times, only
+  changing the data in the buffers.  This routine performs the parameter
+  validation, the clock frequency selection and the conversion set up once,
+  allocating any buffers needed by the SPI bus layer.  The returned handle is
+  passed to ExecutePrepared to perform the transaction and to ReleasePrepared
+  to free the resources.  The handle is only valid for this SPI IO protocol
+  instance and the current SPI peripheral.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  TransactionType   Type of SPI transaction specified by one of the
+                                EFI_SPI_TRANSACTION_TYPE values.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use the
+                                maximum clock frequency supported by the SPI
+                                controller and part.
+  @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
+  @param[in]  FrameSize         Frame size in bits, range: 1 - 32
+  @param[in]  WriteBytes        The length of the write buffer in bytes.
+                                Specify zero for read-only operations.
+  @param[in]  ReadBytes         The length of the read buffer in bytes.
+                                Specify zero for write-only operations.
+  @param[out] Prepared          Address to receive the prepared transaction
+                                handle.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The transaction was prepared successfully
+  @retval EFI_INVALID_PARAMETER Prepared is NULL
+  @retval EFI_INVALID_PARAMETER A transaction parameter is not valid, see
+                                EFI_SPI_IO_PROTOCOL_TRANSACTION
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for the prepared
+                                transaction
+  @retval EFI_UNSUPPORTED       The FrameSize is not supported by the SPI
+                                bus layer or the SPI host controller.
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_IO_PROTOCOL_PREPARE_TRANSACTION) (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN EFI_SPI_TRANSACTION_TYPE TransactionType,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN UINT32 BusWidth,
+  IN UINT32 FrameSize,
+  IN UINT32 WriteBytes,
+  IN UINT32 ReadBytes,
+  OUT VOID **Prepared
+  );
+
+/**
+  Perform a prepared SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The buffer lengths and the other transaction parameters were supplied to
+  PrepareTransaction.  Only the buffers are supplied on each call.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  Prepared          Handle returned by PrepareTransaction
+  @param[in]  WriteBuffer       The buffer containing data to be sent from the
+                                host to the SPI chip.  Specify NULL for read
+                                only operations.
+  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
+                                during the transaction.  Specify NULL for write
+                                only operations.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_INVALID_PARAMETER Prepared is not a valid handle for this SPI IO
+                                protocol instance
+  @retval EFI_INVALID_PARAMETER The SPI peripheral was updated after the
+                                transaction was prepared
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_IO_PROTOCOL_EXECUTE_PREPARED) (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN VOID *Prepared,
+  IN UINT8 *WriteBuffer,
+  OUT UINT8 *ReadBuffer
+  );
+
+/**
+  Release the resources associated with a prepared SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  Prepared          Handle returned by PrepareTransaction
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The prepared transaction was released
+  @retval EFI_INVALID_PARAMETER Prepared is not a valid handle for this SPI IO
+                                protocol instance
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_IO_PROTOCOL_RELEASE_PREPARED) (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN VOID *Prepared
+  );
+
+///
+/// Description of one portion of the data sent by a segmented write
+///
+typedef struct _EFI_SPI_IO_WRITE_SEGMENT {
+  ///
+  /// Number of bytes in WriteBuffer to send to the SPI chip
+  ///
+  UINT32 WriteBytes;
+
+  ///
+  /// Address of the data to send to the SPI chip
+  ///
+  UINT8 *WriteBuffer;
+} EFI_SPI_IO_WRITE_SEGMENT;
+
+/**
+  Send data from multiple buffers to the SPI chip using a single write-only
+  SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The chip select remains asserted while the segments are sent in order, so
+  the SPI chip sees a single write-only transaction.  The data is sent
+  directly from the caller's buffers using 8-bit frames, allowing a command
+  header and the payload data to be sent without copying them into a single
+  buffer.  This routine is only available when SPI_IO_SUPPORTS_STREAMING is
+  set.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+                                Debugging may be turned on for a single SPI
+                                transaction. Only this transaction will display
+                                debugging messages. All other transactions with
+                                this value set to FALSE will not display any
+                                debugging messages.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use
+                                the maximum clock frequency supported by the
+                                SPI controller and part. Specify a non-zero
+                                value only when a specific SPI transaction
+                                requires a reduced clock rate.
+  @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
+  @param[in]  SegmentCount      Number of entries in the Segments array
+  @param[in]  Segments          Array of buffers to send to the SPI chip
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_INVALID_PARAMETER SegmentCount is zero or Segments is NULL
+  @retval EFI_INVALID_PARAMETER A segment has zero WriteBytes or a NULL
+                                WriteBuffer
+  @retval EFI_INVALID_PARAMETER BusWidth not supported by SPI peripheral or
+                                SPI host controller
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_UNSUPPORTED       The SPI host controller is not able to hold
+                                the chip select asserted across multiple
+                                transfers
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_IO_PROTOCOL_WRITE_SEGMENTS) (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN UINT32 BusWidth,
+  IN UINT32 SegmentCount,
+  IN CONST EFI_SPI_IO_WRITE_SEGMENT *Segments
+  );
+
+/**
+  Perform a SPI flash transaction described by its phases.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The opcode, address and dummy cycles are described by Phases instead of
+  being placed at the start of the write buffer, so the buffers only contain
+  the data.  SPI host controllers which set HC_SUPPORTS_TRANSACTION_PHASES
+  receive the phases directly, SPI_IO_SUPPORTS_TRANSACTION_PHASES is set for
+  these controllers.  For other controllers the SPI bus layer sends the
+  command phases before the data using 8-bit frames, in which case all of the
+  bus widths must match and the dummy cycles must fill whole bytes.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use
+                                the maximum clock frequency supported by the
+                                SPI controller and part.
+  @param[in]  Phases            Pointer to the description of the command
+                                phases
+  @param[in]  WriteBytes        The length of the WriteBuffer in bytes.  Must
+                                be zero when ReadBytes is non-zero.  Specify
+                                zero for commands without data.
+  @param[in]  WriteBuffer       The data to send to the SPI chip
+  @param[in]  ReadBytes         The length of the ReadBuffer in bytes.
+                                Specify zero for write operations.
+  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_BAD_BUFFER_SIZE   The data does not fit in a single transaction
+  @retval EFI_INVALID_PARAMETER Phases is NULL or describes invalid phases
+  @retval EFI_INVALID_PARAMETER A bus width is not supported by the SPI
+                                peripheral or SPI host controller
+  @retval EFI_INVALID_PARAMETER Both WriteBytes and ReadBytes are non-zero
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for SPI transaction
+  @retval EFI_UNSUPPORTED       The SPI bus layer is not able to send the
+                                phases to this SPI host controller
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_IO_PROTOCOL_PHASE_TRANSACTION) (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN CONST EFI_SPI_TRANSACTION_PHASES *Phases,
+  IN UINT32 WriteBytes,
+  IN UINT8 *WriteBuffer,
+  IN UINT32 ReadBytes,
+  OUT UINT8 *ReadBuffer
+  );
+
 ///
 /// Transaction attributes
 ///
@@ -262,6 +557,25 @@ EFI_STATUS
 ///
 #define SPI_IO_TRANSFER_SIZE_INCLUDES_ADDRESS   0x00000008
 
+///
+/// Transactions larger than the host controller's maximum transfer size are
+/// streamed by the SPI bus layer with the chip select asserted.  The opcode
+/// and address are sent once and MaximumTransferBytes does not limit the
+/// transaction size.  WriteSegments is also available.
+///
+#define SPI_IO_SUPPORTS_STREAMING               0x00000010
+
+///
+/// The SPI host controller receives the phases passed to PhaseTransaction,
+/// the SPI bus layer does not build a command buffer.
+///
+#define SPI_IO_SUPPORTS_TRANSACTION_PHASES      0x00000020
+
+///
+/// PrepareTransaction, ExecutePrepared and ReleasePrepared are available.
+///
+#define SPI_IO_SUPPORTS_PREPARED_TRANSACTIONS   0x00000040
+
 ///
 /// Support managed SPI data transactions between the SPI controller and a SPI
 /// chip.
@@ -289,7 +603,8 @@ struct _EFI_SPI_IO_PROTOCOL {
   UINT32 FrameSizeSupportMask;
 
   ///
-  /// Maximum transfer size in bytes: 1 - 0xffffffff
+  /// Maximum transfer size in bytes: 1 - 0xffffffff.  The value is 0xffffffff
+  /// when SPI_IO_SUPPORTS_STREAMING is set.
   ///
   UINT32 MaximumTransferBytes;
 
@@ -305,6 +620,11 @@ struct _EFI_SPI_IO_PROTOCOL {
 
   EFI_SPI_IO_PROTOCOL_TRANSACTION Transaction;
   EFI_SPI_IO_PROTOCOL_UPDATE_SPI_PERIPHERAL UpdateSpiPeripheral;
+  EFI_SPI_IO_PROTOCOL_PREPARE_TRANSACTION PrepareTransaction;
+  EFI_SPI_IO_PROTOCOL_EXECUTE_PREPARED ExecutePrepared;
+  EFI_SPI_IO_PROTOCOL_RELEASE_PREPARED ReleasePrepared;
+  EFI_SPI_IO_PROTOCOL_WRITE_SEGMENTS WriteSegments;
+  EFI_SPI_IO_PROTOCOL_PHASE_TRANSACTION PhaseTransaction;
 };
 
 #endif  //  __SPI_IO_H__
@@ -118,6 +118,7 @@ EFI_STATUS
 
   @retval EFI_SUCCESS           The status write was successful.
   @retval EFI_OUT_OF_RESOURCES  Failed to allocate the write buffer.
+  @retval EFI_NOT_READY         An asynchronous erase is in progress.
 
 **/
 typedef
@@ -150,6 +151,7 @@ EFI_STATUS
   @retval EFI_INVALID_PARAMETER The LengthInBytes > This->FlashSize
                                                     - FlashAddress
   @retval EFI_OUT_OF_RESOURCES  Insufficient memory to copy buffer.
+  @retval EFI_NOT_READY         An asynchronous erase is in progress.
 
 **/
 typedef
@@ -180,6 +182,7 @@ EFI_STATUS
   @retval EFI_INVALID_PARAMETER FlashAddress >= This->FlashSize
   @retval EFI_INVALID_PARAMETER BlockCount * 4 KiB > This->FlashSize
                                                      - FlashAddress
+  @retval EFI_NOT_READY         An asynchronous erase is in progress
 **/
 typedef
 EFI_STATUS
@@ -189,6 +192,103 @@ EFI_STATUS
   IN UINT32 BlockCount
   );
 
+/**
+  Start erasing one or more 4KiB regions in the SPI flash.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  This routine issues the first erase command and returns without waiting
+  for the erase to complete.  4 KiB blocks are erased until the address is
+  aligned to EraseBlockBytes, then the larger blocks are used while enough
+  of the region remains.  A timer event polls the flash status and issues
+  the next erase command when the previous block is erased.  When the
+  entire region is erased or an error occurs, the status is placed in
+  EraseStatus and Event is signaled.  Reads are serviced while the erase is
+  in progress, other write and erase requests return EFI_NOT_READY.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_PROTOCOL data
+                                structure.
+  @param[in]  FlashAddress      Address within a 4 KiB block to start erasing
+  @param[in]  BlockCount        Number of 4 KiB blocks to erase
+  @param[in]  Event             Event to signal when the erase completes
+  @param[out] EraseStatus       Address of the buffer to receive the status of
+                                the erase operation.  The value is valid after
+                                Event is signaled.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The erase was started successfully.
+  @retval EFI_INVALID_PARAMETER FlashAddress >= This->FlashSize
+  @retval EFI_INVALID_PARAMETER BlockCount * 4 KiB > This->FlashSize
+                                                     - FlashAddress
+  @retval EFI_INVALID_PARAMETER Event or EraseStatus is NULL
+  @retval EFI_NOT_READY         Another write or erase operation is in
+                                progress
+  @retval EFI_UNSUPPORTED       Asynchronous erase is not available in SMM or
+                                after ExitBootServices
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_NOR_FLASH_PROTOCOL_ERASE_ASYNC) (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN UINT32 FlashAddress,
+  IN UINT32 BlockCount,
+  IN EFI_EVENT Event,
+  OUT EFI_STATUS *EraseStatus
+  );
+
+/**
+  Perform work while the flash part is busy.
+
+  This routine is called at the TPL of the write or erase request.
+
+  The SPI NOR flash driver calls this routine between the status polls of a
+  page program or block erase operation.  The routine should return within
+  BudgetInNanoSeconds, the expected time until the flash part completes the
+  operation.  The budget never exceeds the time remaining before the driver
+  times out the operation.  The routine must not write or erase the busy
+  flash part, these requests return EFI_NOT_READY while the routine is
+  running.
+
+  @param[in]  Context           Context value passed to SetBusyCallback
+  @param[in]  BudgetInNanoSeconds  Expected remaining busy time in nanoseconds
+
+**/
+typedef
+VOID
+(EFIAPI *EFI_SPI_NOR_FLASH_BUSY_CALLBACK) (
+  IN VOID *Context,
+  IN UINT64 BudgetInNanoSeconds
+  );
+
+/**
+  Register the routine to call while the flash part is busy.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The callback replaces any previously registered callback.  The callback is
+  removed when the system switches to virtual addressing.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_PROTOCOL data
+                                structure.
+  @param[in]  BusyCallback      Routine to call between the status polls,
+                                NULL to remove the callback
+  @param[in]  Context           Value to pass to BusyCallback
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The callback was registered successfully.
+  @retval EFI_NOT_READY         Called from the busy callback
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_NOR_FLASH_PROTOCOL_SET_BUSY_CALLBACK) (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN EFI_SPI_NOR_FLASH_BUSY_CALLBACK BusyCallback OPTIONAL,
+  IN VOID *Context OPTIONAL
+  );
+
 ///
 /// The EFI_SPI_NOR_FLASH_PROTOCOL exists in the SPI peripheral layer.  This
 /// protocol manipulates the SPI NOR flash parts using a common set of
@@ -226,6 +326,14 @@ struct _EFI_SPI_NOR_FLASH_PROTOCOL {
   ///
   UINT32 EraseBlockBytes;
 
+  ///
+  /// Worst case latency in nanoseconds of a ReadData or LfReadData call which
+  /// arrived during an erase or program operation, zero when no read arrived
+  /// during an operation.  Memory mapped reads of the flash do not go through
+  /// this protocol and are not measured.
+  ///
+  UINT64 MaximumReadLatency;
+
   EFI_SPI_NOR_FLASH_PROTOCOL_GET_FLASH_ID GetFlashId;
   EFI_SPI_NOR_FLASH_PROTOCOL_READ_DATA ReadData;
   EFI_SPI_NOR_FLASH_PROTOCOL_READ_DATA LfReadData;
@@ -233,6 +341,8 @@ struct _EFI_SPI_NOR_FLASH_PROTOCOL {
   EFI_SPI_NOR_FLASH_PROTOCOL_WRITE_STATUS WriteStatus;
   EFI_SPI_NOR_FLASH_PROTOCOL_WRITE_DATA WriteData;
   EFI_SPI_NOR_FLASH_PROTOCOL_ERASE Erase;
+  EFI_SPI_NOR_FLASH_PROTOCOL_ERASE_ASYNC EraseAsync;
+  EFI_SPI_NOR_FLASH_PROTOCOL_SET_BUSY_CALLBACK SetBusyCallback;
 };
 
 typedef struct _EFI_SPI_NOR_FLASH_CONFIGURATION_DATA {
@@ -275,8 +385,31 @@ typedef struct _EFI_SPI_NOR_FLASH_CONFIGURATION_DATA {
   /// Manufacture and device ID, specify all zeros for generic flash part.
   ///
   UINT8 DeviceId [3];
+
+  ///
+  /// Flash part attributes
+  ///
+  UINT32 Attributes;
+
+  ///
+  /// Opcodes which suspend and resume an erase or program operation, only
+  /// used when SPI_NOR_SUPPORTS_SUSPEND_RESUME is set in Attributes
+  ///
+  UINT8 SuspendOpcode;
+  UINT8 ResumeOpcode;
 } EFI_SPI_NOR_FLASH_CONFIGURATION_DATA;
 
+///
+/// Flash part attributes
+///
+
+///
+/// The flash part allows reads while an erase or program operation is
+/// suspended.  The suspended operation continues when the resume opcode is
+/// sent.
+///
+#define SPI_NOR_SUPPORTS_SUSPEND_RESUME 0x00000001
+
 ///
 /// Write status
 /// One prefix byte, one command byte and one or two bytes of data to send
@@ -327,18 +460,42 @@ typedef struct _EFI_SPI_NOR_FLASH_CONFIGURATION_DATA {
 ///
 #define SPI_NOR_ERASE_32KB              0x52
 
+///
+/// Resume a suspended erase or program operation, alternate opcode
+/// One command byte to send
+///
+#define SPI_NOR_RESUME_ALTERNATE        0x30
+
 ///
 /// Chip erase
 /// One prefix byte and one command byte to send
 ///
 #define SPI_NOR_CHIP_ERASE              0x60
 
+///
+/// Suspend an erase or program operation
+/// One command byte to send
+///
+#define SPI_NOR_SUSPEND                 0x75
+
+///
+/// Resume a suspended erase or program operation
+/// One command byte to send
+///
+#define SPI_NOR_RESUME                  0x7a
+
 ///
 /// Read the three bytes of manufacture and device ID
 /// One command byte to send followed by 3 bytes of data to receive
 ///
 #define SPI_NOR_READ_MANUFACTURE_ID     0x9f
 
+///
+/// Suspend an erase or program operation, alternate opcode
+/// One command byte to send
+///
+#define SPI_NOR_SUSPEND_ALTERNATE       0xb0
+
 ///
 /// Erase 64 KBytes
 /// One prefix byte, one command byte and 3 address bytes to send
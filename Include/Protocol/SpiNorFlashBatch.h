@@ -0,0 +1,147 @@
+/** @file
+
+  This module declares the SPI NOR flash batch protocol interface.
+
+Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __SPI_NOR_FLASH_BATCH_H__
+#define __SPI_NOR_FLASH_BATCH_H__
+
+#include <Uefi.h>
+
+typedef struct _EFI_SPI_NOR_FLASH_BATCH_PROTOCOL
+                                              EFI_SPI_NOR_FLASH_BATCH_PROTOCOL;
+
+///
+/// Operations which may be placed in a batch
+///
+typedef enum {
+  ///
+  /// Read LengthInBytes of data from FlashAddress into Buffer
+  ///
+  SPI_NOR_FLASH_BATCH_READ,
+
+  ///
+  /// Write LengthInBytes of data from Buffer to FlashAddress
+  ///
+  SPI_NOR_FLASH_BATCH_WRITE,
+
+  ///
+  /// Erase LengthInBytes starting at FlashAddress.  FlashAddress and
+  /// LengthInBytes must be multiples of 4 KiB and Buffer is not used.
+  ///
+  SPI_NOR_FLASH_BATCH_ERASE
+} EFI_SPI_NOR_FLASH_BATCH_OPERATION;
+
+///
+/// Description of a single flash operation within a batch
+///
+typedef struct _EFI_SPI_NOR_FLASH_BATCH_REQUEST {
+  ///
+  /// Type of flash operation
+  ///
+  EFI_SPI_NOR_FLASH_BATCH_OPERATION Operation;
+
+  ///
+  /// Index of the SPI NOR flash part in the order the SMM SPI NOR flash
+  /// driver started the parts, zero (0) selects the first part
+  ///
+  UINT32 PartIndex;
+
+  ///
+  /// Address in the flash to start the operation
+  ///
+  UINT32 FlashAddress;
+
+  ///
+  /// Length of the operation in bytes
+  ///
+  UINT32 LengthInBytes;
+
+  ///
+  /// Address of the data buffer for read and write operations
+  ///
+  UINT8 *Buffer;
+
+  ///
+  /// Completion status of the operation, set by the Submit routine
+  ///
+  EFI_STATUS Status;
+} EFI_SPI_NOR_FLASH_BATCH_REQUEST;
+
+/**
+  Submit a batch of flash operations to the SMM SPI NOR flash driver.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  This routine places the requests into a communication buffer shared with the
+  SMM SPI NOR flash driver and generates a single SMI to process all of the
+  requests which fit into the buffer.  Larger batches are split across as few
+  SMIs as possible.  The requests are performed in order and the completion
+  status of each request is returned in its Status field.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_BATCH_PROTOCOL
+                                data structure.
+  @param[in]  RequestCount      Number of requests in the Requests array
+  @param[in, out] Requests      Array of flash requests
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           All of the requests completed successfully.
+  @retval EFI_INVALID_PARAMETER Requests is NULL
+  @retval EFI_UNSUPPORTED       Called after ExitBootServices
+  @retval EFI_ACCESS_DENIED     Called after SMM was locked
+  @retval other                 The Status value of the first request which
+                                failed
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_NOR_FLASH_BATCH_PROTOCOL_SUBMIT) (
+  IN CONST EFI_SPI_NOR_FLASH_BATCH_PROTOCOL *This,
+  IN UINT32 RequestCount,
+  IN OUT EFI_SPI_NOR_FLASH_BATCH_REQUEST *Requests
+  );
+
+///
+/// The EFI_SPI_NOR_FLASH_BATCH_PROTOCOL exists in the DXE environment when
+/// the SPI NOR flash part is owned by the SMM SPI NOR flash driver.  This
+/// protocol allows a DXE client to perform multiple flash operations with a
+/// single SMI instead of one SMI per operation.
+///
+/// The requests are not authenticated, so the SMM SPI NOR flash driver only
+/// accepts them until SMM is locked at the end of DXE.  This protocol is
+/// intended for DXE drivers which update the flash before the lock.  Flash
+/// update applications which run during BDS must use an authenticated update
+/// path provided by the platform.
+///
+struct _EFI_SPI_NOR_FLASH_BATCH_PROTOCOL {
+  ///
+  /// Maximum number of operations performed by a single SMI
+  ///
+  UINT32 MaximumRequests;
+
+  ///
+  /// Maximum number of read and write data bytes transferred by a single SMI
+  ///
+  UINT32 MaximumDataBytes;
+
+  EFI_SPI_NOR_FLASH_BATCH_PROTOCOL_SUBMIT Submit;
+};
+
+///
+/// Reference to variable defined in the .DEC file
+///
+extern EFI_GUID gEfiSpiNorFlashBatchProtocolGuid;
+extern EFI_GUID gEfiSpiSmmNorFlashBatchCommunicationGuid;
+
+#endif	// __SPI_NOR_FLASH_BATCH_H__
@@ -0,0 +1,72 @@
+/** @file
+
+  This module declares the SPI peripheral stub protocol interface.
+
+Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __SPI_PERIPHERAL_STUB_H__
+#define __SPI_PERIPHERAL_STUB_H__
+
+#include <Protocol/SpiConfiguration.h>
+
+typedef struct _EFI_SPI_PERIPHERAL_STUB_PROTOCOL
+                                              EFI_SPI_PERIPHERAL_STUB_PROTOCOL;
+
+/**
+  Create the SPI IO protocol for the SPI peripheral.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  The SPI bus layer installs the EFI_SPI_IO_PROTOCOL and the device path on
+  the handle containing this stub.  The SPI IO protocol is installed using
+  the SpiPeripheralDriverGuid of the SPI peripheral, the same as when the SPI
+  bus layer enumerates the SPI peripherals during its startup.
+
+  @param[in]  This              Pointer to an EFI_SPI_PERIPHERAL_STUB_PROTOCOL
+                                structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI IO protocol was installed
+  @retval EFI_ALREADY_STARTED   The SPI IO protocol is already installed
+  @retval EFI_UNSUPPORTED       Called after ExitBootServices
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory to create the SPI IO
+                                protocol
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_PERIPHERAL_STUB_PROTOCOL_CONNECT) (
+  IN CONST EFI_SPI_PERIPHERAL_STUB_PROTOCOL *This
+  );
+
+///
+/// The EFI_SPI_PERIPHERAL_STUB_PROTOCOL is installed on the child handle of
+/// a SPI peripheral when the SPI bus layer defers the creation of the SPI IO
+/// protocol.  A SPI peripheral driver compares the SpiPeripheralDriverGuid
+/// value with its own GUID and calls Connect for the matching SPI peripherals.
+///
+struct _EFI_SPI_PERIPHERAL_STUB_PROTOCOL {
+  ///
+  /// Address of the SPI peripheral described by this stub
+  ///
+  CONST EFI_SPI_PERIPHERAL *SpiPeripheral;
+
+  EFI_SPI_PERIPHERAL_STUB_PROTOCOL_CONNECT Connect;
+};
+
+///
+/// Reference to variable defined in the .DEC file
+///
+extern EFI_GUID gEfiSpiPeripheralStubProtocolGuid;
+
+#endif	// __SPI_PERIPHERAL_STUB_H__
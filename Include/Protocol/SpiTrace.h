@@ -0,0 +1,167 @@
+/** @file
+
+  This module declares the SPI transaction trace protocol interface.
+
+Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __SPI_TRACE_H__
+#define __SPI_TRACE_H__
+
+#include <Uefi.h>
+
+typedef struct _EFI_SPI_TRACE_PROTOCOL EFI_SPI_TRACE_PROTOCOL;
+
+#define EFI_SPI_TRACE_SIGNATURE     SIGNATURE_32 ('S', 'P', 'T', 'R')
+
+///
+/// Events recorded in the trace ring
+///
+typedef enum {
+  ///
+  /// The SPI bus layer started a transaction for a SPI peripheral driver
+  ///
+  SPI_TRACE_TRANSACTION_START,
+
+  ///
+  /// The SPI bus layer completed the transaction, Status is valid
+  ///
+  SPI_TRACE_TRANSACTION_END,
+
+  ///
+  /// A transaction phase was handed to the SPI host controller
+  ///
+  SPI_TRACE_PHASE_START,
+
+  ///
+  /// The SPI host controller completed the phase, Status is valid
+  ///
+  SPI_TRACE_PHASE_END
+} EFI_SPI_TRACE_EVENT;
+
+///
+/// Fixed size record describing a transaction or transaction phase
+///
+typedef struct {
+  ///
+  /// Performance counter value when the record was written
+  ///
+  UINT64 Timestamp;
+
+  ///
+  /// Enumeration index of the SPI peripheral
+  ///
+  UINT16 PartIndex;
+
+  ///
+  /// EFI_SPI_TRACE_EVENT value
+  ///
+  UINT8 Event;
+
+  ///
+  /// EFI_SPI_TRANSACTION_TYPE value
+  ///
+  UINT8 TransactionType;
+
+  ///
+  /// SCLK frequency in Hertz, zero (0) when not yet known
+  ///
+  UINT32 ClockHz;
+
+  UINT32 WriteBytes;
+  UINT32 ReadBytes;
+
+  ///
+  /// First bytes sent to the SPI peripheral, the opcode and address when
+  /// the transaction uses phases
+  ///
+  UINT8 Data[4];
+
+  ///
+  /// Low 32 bits of the EFI_STATUS value, BIT31 is set for errors
+  ///
+  UINT32 Status;
+} EFI_SPI_TRACE_RECORD;
+
+///
+/// Header of the trace ring, followed by RecordCount records
+///
+typedef struct {
+  UINT32 Signature;
+
+  ///
+  /// Number of records in the ring, a power of two
+  ///
+  UINT32 RecordCount;
+
+  ///
+  /// Total number of records written, the next record is written at
+  /// NextRecord modulo RecordCount
+  ///
+  UINT32 NextRecord;
+  UINT32 Reserved;
+
+  ///
+  /// Performance counter frequency in Hertz and the counter limits
+  ///
+  UINT64 TimerFrequency;
+  UINT64 TimerStartValue;
+  UINT64 TimerEndValue;
+} EFI_SPI_TRACE_HEADER;
+
+/**
+  Copy the trace ring into a buffer.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The buffer receives the EFI_SPI_TRACE_HEADER followed by the records in
+  ring order.  The oldest record is at NextRecord modulo RecordCount once the
+  ring has wrapped.
+
+  @param[in]      This          Pointer to an EFI_SPI_TRACE_PROTOCOL structure.
+  @param[in, out] BufferSize    On input the size of the buffer in bytes, on
+                                output the number of bytes required
+  @param[out]     Buffer        Buffer to receive the trace ring
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The trace ring was copied into the buffer
+  @retval EFI_BUFFER_TOO_SMALL  The buffer is too small, BufferSize contains
+                                the required size
+  @retval EFI_INVALID_PARAMETER BufferSize is NULL
+  @retval EFI_NOT_READY         The trace ring is not available
+
+**/
+typedef
+EFI_STATUS
+(EFIAPI *EFI_SPI_TRACE_PROTOCOL_DUMP) (
+  IN CONST EFI_SPI_TRACE_PROTOCOL *This,
+  IN OUT UINTN *BufferSize,
+  OUT VOID *Buffer
+  );
+
+///
+/// The EFI_SPI_TRACE_PROTOCOL is installed by the SPI bus layer when the
+/// transaction trace is built into the driver.  Each record is a fixed size
+/// binary record written into a preallocated ring, the host side decoder
+/// (SpiBus/SpiTraceDecode.py) converts a dump of the ring into a timeline.
+///
+struct _EFI_SPI_TRACE_PROTOCOL {
+  EFI_SPI_TRACE_PROTOCOL_DUMP Dump;
+};
+
+///
+/// Reference to variable defined in the .DEC file
+///
+extern EFI_GUID gEfiSpiTraceProtocolGuid;
+extern EFI_GUID gEfiSpiSmmTraceProtocolGuid;
+
+#endif	// __SPI_TRACE_H__
@@ -0,0 +1,175 @@
+/** @file
+
+  This module implements the flash buffer check and compare routines.
+
+  The head of the buffer is processed a byte at a time until the first buffer
+  is aligned.  The processor specific kernel then processes the aligned blocks
+  and the tail of the buffer is processed a byte at a time.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "FlashBufferInternal.h"
+
+/**
+  Determine if a buffer contains only erased (0xff) bytes.
+
+  @param[in]  Buffer            Address of the buffer
+  @param[in]  Length            Number of bytes in the buffer
+
+  @retval TRUE                  All of the bytes are 0xff or Length is zero
+  @retval FALSE                 The buffer contains data
+
+**/
+BOOLEAN
+EFIAPI
+IsBlank (
+  IN CONST VOID *Buffer,
+  IN UINTN Length
+  )
+{
+  CONST UINT8 *Bytes;
+  UINTN BlockCount;
+
+  Bytes = (CONST UINT8 *)Buffer;
+
+  //
+  // Check the bytes before the first aligned block
+  //
+  while ((Length > 0)
+    && ((((UINTN)Bytes) & (FLASH_BUFFER_BLOCK_SIZE - 1)) != 0)) {
+    if (*Bytes != 0xff) {
+      return FALSE;
+    }
+    Bytes += 1;
+    Length -= 1;
+  }
+
+  //
+  // Check the aligned blocks
+  //
+  BlockCount = Length / FLASH_BUFFER_BLOCK_SIZE;
+  if (BlockCount > 0) {
+    if (!InternalIsBlankBlocks (Bytes, BlockCount)) {
+      return FALSE;
+    }
+    Bytes += BlockCount * FLASH_BUFFER_BLOCK_SIZE;
+    Length -= BlockCount * FLASH_BUFFER_BLOCK_SIZE;
+  }
+
+  //
+  // Check the remaining bytes
+  //
+  while (Length > 0) {
+    if (*Bytes != 0xff) {
+      return FALSE;
+    }
+    Bytes += 1;
+    Length -= 1;
+  }
+  return TRUE;
+}
+
+/**
+  Locate the first byte which differs between two buffers.
+
+  @param[in]  DestinationBuffer Address of the first buffer
+  @param[in]  SourceBuffer      Address of the second buffer
+  @param[in]  Length            Number of bytes to compare
+
+  @return  The offset of the first byte which differs, or Length when the
+           buffers are identical
+
+**/
+UINTN
+EFIAPI
+FindFirstDifference (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN Length
+  )
+{
+  UINTN BlockCount;
+  CONST UINT8 *Destination;
+  UINTN Offset;
+  CONST UINT8 *Source;
+
+  Destination = (CONST UINT8 *)DestinationBuffer;
+  Source = (CONST UINT8 *)SourceBuffer;
+  Offset = 0;
+
+  //
+  // Compare the bytes before the first aligned block
+  //
+  while ((Offset < Length)
+    && ((((UINTN)&Destination[Offset]) & (FLASH_BUFFER_BLOCK_SIZE - 1)) != 0)) {
+    if (Destination[Offset] != Source[Offset]) {
+      return Offset;
+    }
+    Offset += 1;
+  }
+
+  //
+  // Skip over the identical aligned blocks
+  //
+  BlockCount = (Length - Offset) / FLASH_BUFFER_BLOCK_SIZE;
+  if (BlockCount > 0) {
+    Offset += FLASH_BUFFER_BLOCK_SIZE * InternalFindDifferentBlock (
+                                          &Destination[Offset],
+                                          &Source[Offset],
+                                          BlockCount
+                                          );
+  }
+
+  //
+  // Locate the difference within the block or the remaining bytes
+  //
+  while (Offset < Length) {
+    if (Destination[Offset] != Source[Offset]) {
+      return Offset;
+    }
+    Offset += 1;
+  }
+  return Length;
+}
+
+/**
+  Compare the contents of two buffers.
+
+  This routine is a replacement for CompareMem which uses wide loads.
+
+  @param[in]  DestinationBuffer Address of the first buffer
+  @param[in]  SourceBuffer      Address of the second buffer
+  @param[in]  Length            Number of bytes to compare
+
+  @retval 0                     The buffers are identical or Length is zero
+  @retval other                 The value of the first mismatched byte in
+                                DestinationBuffer minus the value of the
+                                corresponding byte in SourceBuffer
+
+**/
+INTN
+EFIAPI
+CompareRange (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN Length
+  )
+{
+  UINTN Offset;
+
+  Offset = FindFirstDifference (DestinationBuffer, SourceBuffer, Length);
+  if (Offset >= Length) {
+    return 0;
+  }
+  return (INTN)((CONST UINT8 *)DestinationBuffer)[Offset]
+       - (INTN)((CONST UINT8 *)SourceBuffer)[Offset];
+}
@@ -0,0 +1,68 @@
+/** @file
+
+  This file declares the processor specific kernels of the flash buffer
+  library.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#ifndef __FLASH_BUFFER_INTERNAL_H__
+#define __FLASH_BUFFER_INTERNAL_H__
+
+#include <Base.h>
+#include <Library/FlashBufferLib.h>
+
+///
+/// Number of bytes processed by each iteration of the kernels, the kernels
+/// require that the first buffer is aligned on this boundary
+///
+#define FLASH_BUFFER_BLOCK_SIZE     16
+
+/**
+  Determine if a series of blocks contains only erased (0xff) bytes.
+
+  @param[in]  Buffer            Address of the first block, aligned on a
+                                FLASH_BUFFER_BLOCK_SIZE boundary
+  @param[in]  BlockCount        Number of FLASH_BUFFER_BLOCK_SIZE blocks
+
+  @retval TRUE                  All of the bytes are 0xff
+  @retval FALSE                 At least one block contains data
+
+**/
+BOOLEAN
+EFIAPI
+InternalIsBlankBlocks (
+  IN CONST VOID *Buffer,
+  IN UINTN BlockCount
+  );
+
+/**
+  Locate the first block which differs between two series of blocks.
+
+  @param[in]  DestinationBuffer Address of the first block, aligned on a
+                                FLASH_BUFFER_BLOCK_SIZE boundary
+  @param[in]  SourceBuffer      Address of the first block in the other
+                                buffer, no alignment required
+  @param[in]  BlockCount        Number of FLASH_BUFFER_BLOCK_SIZE blocks
+
+  @return  The index of the first block which differs, or BlockCount when
+           all of the blocks are identical
+
+**/
+UINTN
+EFIAPI
+InternalFindDifferentBlock (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN BlockCount
+  );
+
+#endif  //  __FLASH_BUFFER_INTERNAL_H__
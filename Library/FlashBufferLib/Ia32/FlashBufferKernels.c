@@ -0,0 +1,92 @@
+/** @file
+
+  This module implements the flash buffer kernels using 32-bit loads.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "FlashBufferInternal.h"
+
+/**
+  Determine if a series of blocks contains only erased (0xff) bytes.
+
+  @param[in]  Buffer            Address of the first block, aligned on a
+                                FLASH_BUFFER_BLOCK_SIZE boundary
+  @param[in]  BlockCount        Number of FLASH_BUFFER_BLOCK_SIZE blocks
+
+  @retval TRUE                  All of the bytes are 0xff
+  @retval FALSE                 At least one block contains data
+
+**/
+BOOLEAN
+EFIAPI
+InternalIsBlankBlocks (
+  IN CONST VOID *Buffer,
+  IN UINTN BlockCount
+  )
+{
+  CONST UINT32 *Data;
+
+  //
+  // AND the four words of each block together so that only a single branch
+  // is taken per block
+  //
+  Data = (CONST UINT32 *)Buffer;
+  while (BlockCount-- > 0) {
+    if ((Data[0] & Data[1] & Data[2] & Data[3]) != 0xffffffff) {
+      return FALSE;
+    }
+    Data += FLASH_BUFFER_BLOCK_SIZE / sizeof (*Data);
+  }
+  return TRUE;
+}
+
+/**
+  Locate the first block which differs between two series of blocks.
+
+  @param[in]  DestinationBuffer Address of the first block, aligned on a
+                                FLASH_BUFFER_BLOCK_SIZE boundary
+  @param[in]  SourceBuffer      Address of the first block in the other
+                                buffer, no alignment required
+  @param[in]  BlockCount        Number of FLASH_BUFFER_BLOCK_SIZE blocks
+
+  @return  The index of the first block which differs, or BlockCount when
+           all of the blocks are identical
+
+**/
+UINTN
+EFIAPI
+InternalFindDifferentBlock (
+  IN CONST VOID *DestinationBuffer,
+  IN CONST VOID *SourceBuffer,
+  IN UINTN BlockCount
+  )
+{
+  CONST UINT32 *Destination;
+  UINTN Index;
+  CONST UINT32 *Source;
+
+  //
+  // IA32 supports unaligned loads, OR the differences of the four words of
+  // each block together so that only a single branch is taken per block
+  //
+  Destination = (CONST UINT32 *)DestinationBuffer;
+  Source = (CONST UINT32 *)SourceBuffer;
+  for (Index = 0; Index < BlockCount; Index++) {
+    if (((Destination[0] ^ Source[0]) | (Destination[1] ^ Source[1])
+      | (Destination[2] ^ Source[2]) | (Destination[3] ^ Source[3])) != 0) {
+      break;
+    }
+    Destination += FLASH_BUFFER_BLOCK_SIZE / sizeof (*Destination);
+    Source += FLASH_BUFFER_BLOCK_SIZE / sizeof (*Source);
+  }
+  return Index;
+}
@@ -0,0 +1,322 @@
+/** @file
+
+  This module implements the copy between SPI flash parts.
+
+  Copying an image with read-all, erase-all and program-all holds the entire
+  image in RAM and leaves both SPI buses idle for most of the copy.  This
+  copy works in chunks of the destination erase block size using two chunk
+  buffers.  The erase of each chunk runs in the background using EraseAsync
+  while the rest of the chunk is read from the source, which is typically on
+  another SPI bus.  While the chunk is programmed into the destination, the
+  busy callback reads the next chunk into the other buffer between the page
+  program status polls.  Hiding the reads allows the copy to approach the
+  erase and program rate of the destination.
+
+  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+  This program and the accompanying materials are licensed and made available
+  under the terms and conditions of the BSD License which accompanies this
+  distribution.  The full text of the license may be found at
+  http://opensource.org/licenses/bsd-license.php
+
+  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include <Uefi.h>
+#include <Library/BaseLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DebugLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/SpiFlashCopyLib.h>
+#include <Library/TimerLib.h>
+#include <Library/UefiBootServicesTableLib.h>
+
+//
+// Number of bytes read from the source by each read during a page program
+//
+#define SPI_FLASH_COPY_PIECE_BYTES  256
+
+//
+// Source read state for the chunk being read
+//
+typedef struct _SPI_FLASH_COPY_READ {
+  CONST EFI_SPI_NOR_FLASH_PROTOCOL *Source;
+  UINT32 SourceAddress;
+  UINT8 *Buffer;
+  UINT32 ChunkBytes;
+  UINT32 BytesRead;
+
+  //
+  // Duration in nanoseconds of the last piece read during a page program
+  //
+  UINT64 PieceNs;
+  EFI_STATUS Status;
+} SPI_FLASH_COPY_READ;
+
+/**
+  Read the next portion of the chunk from the source.
+
+  @param[in]  Read              Pointer to a SPI_FLASH_COPY_READ structure
+  @param[in]  MaximumBytes      Maximum number of bytes to read
+
+**/
+STATIC
+VOID
+EFIAPI
+SpiFlashCopyRead (
+  IN SPI_FLASH_COPY_READ *Read,
+  IN UINT32 MaximumBytes
+  )
+{
+  UINT32 ReadBytes;
+
+  ReadBytes = Read->ChunkBytes - Read->BytesRead;
+  if (ReadBytes > MaximumBytes) {
+    ReadBytes = MaximumBytes;
+  }
+  if ((ReadBytes == 0) || EFI_ERROR (Read->Status)) {
+    return;
+  }
+  Read->Status = Read->Source->ReadData (Read->Source,
+                                         Read->SourceAddress + Read->BytesRead,
+                                         ReadBytes,
+                                         &Read->Buffer[Read->BytesRead]);
+  Read->BytesRead += ReadBytes;
+}
+
+/**
+  Read the next chunk from the source while the destination is programming.
+
+  @param[in]  Context           Pointer to a SPI_FLASH_COPY_READ structure
+  @param[in]  BudgetInNanoSeconds  Expected remaining busy time in nanoseconds
+
+**/
+STATIC
+VOID
+EFIAPI
+SpiFlashCopyReadAhead (
+  IN VOID *Context,
+  IN UINT64 BudgetInNanoSeconds
+  )
+{
+  UINT64 EndTime;
+  SPI_FLASH_COPY_READ *Read;
+  UINT64 StartTime;
+
+  //
+  // Read pieces of the chunk while the previous piece fits in the budget.
+  // The flash driver limits the budget to the time remaining before its
+  // operation timeout, so the reads can not cause a false timeout.
+  //
+  Read = (SPI_FLASH_COPY_READ *)Context;
+  while ((Read->BytesRead < Read->ChunkBytes) && (!EFI_ERROR (Read->Status))
+    && (BudgetInNanoSeconds >= Read->PieceNs)) {
+    StartTime = GetTimeInNanoSecond (GetPerformanceCounter ());
+    SpiFlashCopyRead (Read, SPI_FLASH_COPY_PIECE_BYTES);
+    EndTime = GetTimeInNanoSecond (GetPerformanceCounter ());
+    Read->PieceNs = EndTime - StartTime;
+    if (Read->PieceNs >= BudgetInNanoSeconds) {
+      break;
+    }
+    BudgetInNanoSeconds -= Read->PieceNs;
+  }
+}
+
+
+/**
+  Copy a region of one SPI flash part into another SPI flash part.
+
+  This routine must be called at TPL_APPLICATION.
+
+  The destination region is erased and then programmed with the data from
+  the source region.  The source and destination must be different SPI flash
+  parts since the source is read while the destination is busy.  Source must
+  not be another protocol instance of the destination flash part: the two
+  instances would share the SPI IO instance of the part and the source reads
+  would be sent to the busy part.
+
+  @param[in]  Destination       Pointer to the EFI_SPI_NOR_FLASH_PROTOCOL
+                                structure of the flash part to program
+  @param[in]  DestinationAddress  Address in the destination flash, a
+                                multiple of 4 KiB
+  @param[in]  Source            Pointer to the EFI_SPI_NOR_FLASH_PROTOCOL
+                                structure of the flash part to read
+  @param[in]  SourceAddress     Address in the source flash
+  @param[in]  LengthInBytes     Number of bytes to copy, a multiple of 4 KiB
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The data was copied successfully
+  @retval EFI_INVALID_PARAMETER Destination or Source is NULL
+  @retval EFI_INVALID_PARAMETER DestinationAddress or LengthInBytes is not a
+                                multiple of 4 KiB
+  @retval EFI_INVALID_PARAMETER A region extends beyond the end of its flash
+  @retval EFI_INVALID_PARAMETER Destination and Source are the same flash part
+                                or share the same SPI peripheral
+  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the chunk buffers
+  @retval other                 A read, erase or write operation failed
+
+**/
+EFI_STATUS
+EFIAPI
+SpiFlashCopy (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *Destination,
+  IN UINT32 DestinationAddress,
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *Source,
+  IN UINT32 SourceAddress,
+  IN UINT32 LengthInBytes
+  )
+{
+  UINT8 *Buffer;
+  UINT8 *Buffers;
+  UINT32 ChunkBytes;
+  UINT32 ChunkSize;
+  EFI_EVENT EraseEvent;
+  EFI_STATUS EraseStatus;
+  BOOLEAN Erasing;
+  UINTN Index;
+  UINT32 NextOffset;
+  UINT32 Offset;
+  SPI_FLASH_COPY_READ Read;
+  EFI_STATUS Status;
+
+  //
+  // Validate the inputs
+  //
+  if ((Destination == NULL) || (Source == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The source is read while the destination is erasing and programming,
+  // reading the busy part would rely on suspending the erase
+  //
+  if ((Destination == Source)
+    || (Destination->SpiPeripheral == Source->SpiPeripheral)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy requires two flash parts\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  if (((DestinationAddress & (SIZE_4KB - 1)) != 0)
+    || ((LengthInBytes & (SIZE_4KB - 1)) != 0)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy requires 4 KiB alignment\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  if ((DestinationAddress > Destination->FlashSize)
+    || (LengthInBytes > Destination->FlashSize - DestinationAddress)
+    || (SourceAddress > Source->FlashSize)
+    || (LengthInBytes > Source->FlashSize - SourceAddress)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy region beyond end of flash\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  if (LengthInBytes == 0) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Use the destination erase block size for the chunks so that the erase
+  // uses the large erase blocks
+  //
+  ChunkSize = Destination->EraseBlockBytes;
+  if (ChunkSize < SIZE_4KB) {
+    ChunkSize = SIZE_4KB;
+  }
+  Buffers = AllocatePool (2 * ChunkSize);
+  if (Buffers == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate the copy buffers!\n"));
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Status = gBS->CreateEvent (0, 0, NULL, NULL, &EraseEvent);
+  if (EFI_ERROR (Status)) {
+    FreePool (Buffers);
+    return Status;
+  }
+
+  //
+  // Describe the first chunk, ending at the next erase block boundary
+  //
+  ZeroMem (&Read, sizeof (Read));
+  Read.Source = Source;
+  Read.SourceAddress = SourceAddress;
+  Read.Buffer = Buffers;
+  Read.ChunkBytes = ChunkSize - (DestinationAddress % ChunkSize);
+  if (Read.ChunkBytes > LengthInBytes) {
+    Read.ChunkBytes = LengthInBytes;
+  }
+  Read.Status = EFI_SUCCESS;
+
+  for (Offset = 0; Offset < LengthInBytes; Offset = NextOffset) {
+    Buffer = Read.Buffer;
+    ChunkBytes = Read.ChunkBytes;
+    NextOffset = Offset + ChunkBytes;
+
+    //
+    // Start erasing the chunk in the destination, erase synchronously when
+    // the asynchronous erase is not available
+    //
+    Status = Destination->EraseAsync (Destination, DestinationAddress + Offset,
+                                      ChunkBytes >> 12, EraseEvent,
+                                      &EraseStatus);
+    Erasing = (BOOLEAN)(!EFI_ERROR (Status));
+    if (Status == EFI_UNSUPPORTED) {
+      Status = Destination->Erase (Destination, DestinationAddress + Offset,
+                                   ChunkBytes >> 12);
+    }
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy erase failed, Status: %r\n",
+              Status));
+      break;
+    }
+
+    //
+    // Read the rest of the chunk from the source while the destination is
+    // erasing
+    //
+    SpiFlashCopyRead (&Read, MAX_UINT32);
+    Status = Read.Status;
+
+    //
+    // Wait for the erase to complete
+    //
+    if (Erasing) {
+      gBS->WaitForEvent (1, &EraseEvent, &Index);
+      if (!EFI_ERROR (Status)) {
+        Status = EraseStatus;
+      }
+    }
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy chunk failed, Status: %r\n",
+              Status));
+      break;
+    }
+
+    //
+    // Describe the next chunk, which is read into the other buffer
+    //
+    Read.SourceAddress = SourceAddress + NextOffset;
+    Read.Buffer = (Buffer == Buffers) ? &Buffers[ChunkSize] : Buffers;
+    Read.ChunkBytes = ChunkSize;
+    if (Read.ChunkBytes > LengthInBytes - NextOffset) {
+      Read.ChunkBytes = LengthInBytes - NextOffset;
+    }
+    Read.BytesRead = 0;
+
+    //
+    // Program the chunk into the destination, reading the next chunk
+    // between the page program status polls
+    //
+    Destination->SetBusyCallback (Destination, SpiFlashCopyReadAhead, &Read);
+    Status = Destination->WriteData (Destination, DestinationAddress + Offset,
+                                     ChunkBytes, Buffer);
+    Destination->SetBusyCallback (Destination, NULL, NULL);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "ERROR - SpiFlashCopy write failed, Status: %r\n",
+              Status));
+      break;
+    }
+  }
+
+  gBS->CloseEvent (EraseEvent);
+  FreePool (Buffers);
+  return Status;
+}
@@ -436,8 +436,8 @@ Arguments:
                     supposed to be placed at the top end of the BIOS Region (in Descriptor Mode) or
                     the flash (in Non Descriptor Mode)
   DataByteCount     Number of bytes in the data portion of the SPI cycle. This function may break the
-                    data transfer into multiple operations. This function ensures each operation does
-                    not cross 256 byte flash address boundary.
+                    data transfer into multiple operations. This function ensures each write operation
+                    does not cross 256 byte flash address boundary.
                     *NOTE: if there is some SPI chip that has a stricter address boundary requirement
                     (e.g., its write page size is < 256 byte), then the caller cannot rely on this
                     function to cut the data transfer at proper address boundaries, and it's the
@@ -618,6 +618,134 @@ Returns:
   }
 }
 
+STATIC
+UINT32
+SpiDataCycleCount (
+  IN     UINTN              HardwareSpiAddr,
+  IN     UINT32             DataByteCount,
+  IN     UINT32             Boundary
+  )
+/*++
+
+Routine Description:
+
+  Determine the number of bytes to transfer in the next SPI data cycle.
+
+  Valid settings for the number of bytes during each data portion of the
+  PCH SPI cycles are: 0, 1, 2, 3, 4, 5, 6, 7, 8, 16, 24, 32, 40, 48, 56, 64.
+  Taking the largest valid count on each cycle transfers any length in the
+  fewest cycles, so the only split to avoid is an unnecessary one at the
+  boundary.  Only write operations need the 256 byte page boundary, reads
+  are split at the 4 KB controller boundary instead.
+
+Arguments:
+
+  HardwareSpiAddr   Flash linear address of the next byte to transfer.
+  DataByteCount     Number of bytes remaining in the transfer.
+  Boundary          Power of two address boundary which the cycle may not cross.
+
+Returns:
+
+  Number of bytes to transfer in the next SPI data cycle.
+
+--*/
+{
+  UINT32        SpiDataCount;
+
+  SpiDataCount = Boundary - ((UINT32) HardwareSpiAddr & (Boundary - 1));
+  if (SpiDataCount > DataByteCount) {
+    SpiDataCount = DataByteCount;
+  }
+  if (SpiDataCount >= SPI_DATA_BUFFER_SIZE) {
+    SpiDataCount = SPI_DATA_BUFFER_SIZE;
+  } else if ((SpiDataCount &~0x07) != 0) {
+    SpiDataCount = SpiDataCount &~0x07;
+  }
+  return SpiDataCount;
+}
+
+STATIC
+VOID
+SpiDataBufferWrite (
+  IN     UINTN              PchRootComplexBar,
+  IN     UINT32             SpiDataCount,
+  IN     CONST UINT8        *Buffer
+  )
+/*++
+
+Routine Description:
+
+  Load the data for the next SPI cycle into the SPI data buffer.
+
+  The data buffer is filled using 32-bit writes followed by a single read to
+  flush the posted writes to the controller.  A full 64 byte cycle uses 17
+  MMIO accesses instead of 128 with byte writes and read backs.
+
+Arguments:
+
+  PchRootComplexBar Base address of the root complex registers.
+  SpiDataCount      Number of bytes to load, 1 - 64.
+  Buffer            Data to send during the SPI cycle, no alignment required.
+
+Returns:
+
+  None.
+
+--*/
+{
+  UINT32        Index;
+
+  for (Index = 0; (Index + sizeof (UINT32)) <= SpiDataCount; Index += sizeof (UINT32)) {
+    MmioWrite32 (
+      PchRootComplexBar + R_QNC_RCRB_SPID0 + Index,
+      ReadUnaligned32 ((CONST UINT32 *) &Buffer[Index])
+      );
+  }
+  for (; Index < SpiDataCount; Index++) {
+    MmioWrite8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index, Buffer[Index]);
+  }
+  MmioRead8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + SpiDataCount - 1);
+}
+
+STATIC
+VOID
+SpiDataBufferRead (
+  IN     UINTN              PchRootComplexBar,
+  IN     UINT32             SpiDataCount,
+  OUT    UINT8              *Buffer
+  )
+/*++
+
+Routine Description:
+
+  Get the data received during the SPI cycle from the SPI data buffer using
+  32-bit reads.
+
+Arguments:
+
+  PchRootComplexBar Base address of the root complex registers.
+  SpiDataCount      Number of bytes to get, 1 - 64.
+  Buffer            Receives the data, no alignment required.
+
+Returns:
+
+  None.
+
+--*/
+{
+  UINT32        Index;
+
+  for (Index = 0; (Index + sizeof (UINT32)) <= SpiDataCount; Index += sizeof (UINT32)) {
+    WriteUnaligned32 (
+      (UINT32 *) &Buffer[Index],
+      MmioRead32 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index)
+      );
+  }
+  for (; Index < SpiDataCount; Index++) {
+    Buffer[Index] = MmioRead8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index);
+  }
+}
+
 EFI_STATUS
 SendSpiCmd (
   IN     EFI_SPI_PROTOCOL   *This,
@@ -653,8 +781,8 @@ Arguments:
                     supposed to be placed at the top end of the BIOS Region (in Descriptor Mode) or
                     the flash (in Non Descriptor Mode)
   DataByteCount     Number of bytes in the data portion of the SPI cycle. This function may break the
-                    data transfer into multiple operations. This function ensures each operation does
-                    not cross 256 byte flash address boundary.
+                    data transfer into multiple operations. This function ensures each write operation
+                    does not cross 256 byte flash address boundary.
                     *NOTE: if there is some SPI chip that has a stricter address boundary requirement
                     (e.g., its write page size is < 256 byte), then the caller cannot rely on this
                     function to cut the data transfer at proper address boundaries, and it's the
@@ -675,7 +803,6 @@ Returns:
 
 --*/
 {
-  UINT32        Index;
   SPI_INSTANCE  *SpiInstance;
   UINTN         HardwareSpiAddr;
   UINTN         SpiBiosSize;
@@ -721,35 +848,22 @@ Returns:
 
   do {
     //
-    // Trim at 256 byte boundary per operation,
+    // Trim at 256 byte boundary per write operation,
     // - PCH SPI controller requires trimming at 4KB boundary
     // - Some SPI chips require trimming at 256 byte boundary for write operation
     // - Trimming has limited performance impact as we can read / write atmost 64 byte
     //   per operation
     //
-    if (HardwareSpiAddr + DataByteCount > ((HardwareSpiAddr + BIT8) &~(BIT8 - 1))) {
-      SpiDataCount = (((UINT32) (HardwareSpiAddr) + BIT8) &~(BIT8 - 1)) - (UINT32) (HardwareSpiAddr);
-    } else {
-      SpiDataCount = DataByteCount;
-    }
-    //
-    // Calculate the number of bytes to shift in/out during the SPI data cycle.
-    // Valid settings for the number of bytes duing each data portion of the
-    // PCH SPI cycles are: 0, 1, 2, 3, 4, 5, 6, 7, 8, 16, 24, 32, 40, 48, 56, 64
-    //
-    if (SpiDataCount >= 64) {
-      SpiDataCount = 64;
-    } else if ((SpiDataCount &~0x07) != 0) {
-      SpiDataCount = SpiDataCount &~0x07;
-    }
+    SpiDataCount = SpiDataCycleCount (
+                     HardwareSpiAddr,
+                     DataByteCount,
+                     ShiftOut ? SPI_WRITE_BOUNDARY : SPI_READ_BOUNDARY
+                     );
     //
     // If shifts data out, load data into the SPI data buffer.
     //
-    if (ShiftOut) {
-      for (Index = 0; Index < SpiDataCount; Index++) {
-        MmioWrite8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index, Buffer[Index]);
-        MmioRead8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index);
-      }
+    if (ShiftOut && (SpiDataCount > 0)) {
+      SpiDataBufferWrite (PchRootComplexBar, SpiDataCount, Buffer);
     }
 
     MmioWrite32 (
@@ -801,9 +915,7 @@ Returns:
     // If shifts data in, get data from the SPI data buffer.
     //
     if (!ShiftOut) {
-      for (Index = 0; Index < SpiDataCount; Index++) {
-        Buffer[Index] = MmioRead8 (PchRootComplexBar + R_QNC_RCRB_SPID0 + Index);
-      }
+      SpiDataBufferRead (PchRootComplexBar, SpiDataCount, Buffer);
     }
 
     HardwareSpiAddr += SpiDataCount;
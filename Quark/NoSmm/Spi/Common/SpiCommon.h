@@ -16,6 +16,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define _SPI_COMMON_H_
 
 #include "Protocol/Spi.h"
+#include <Library/BaseLib.h>
 #include <Library/PciLib.h>
 #include <Library/IoLib.h>
 #include <Library/DebugLib.h>
@@ -33,6 +34,15 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define WAIT_TIME   6000000
 #define WAIT_PERIOD 10
 //
+// SPI data cycle limits
+//  Data buffer = SPID0 - SPID7, 64 bytes
+//  Write operations are trimmed at the 256 byte flash page boundary
+//  Read operations are trimmed at the 4 KB boundary required by the controller
+//
+#define SPI_DATA_BUFFER_SIZE    64
+#define SPI_WRITE_BOUNDARY      BIT8
+#define SPI_READ_BOUNDARY       BIT12
+//
 // PCH Required SPI Commands -------- COMMAND SET I ------------
 // SPI flash device must support in order to be compatible with PCH
 //
@@ -239,8 +249,8 @@ Arguments:
                     supposed to be placed at the top end of the BIOS Region (in Descriptor Mode) or
                     the flash (in Non Descriptor Mode)
   DataByteCount     Number of bytes in the data portion of the SPI cycle. This function may break the
-                    data transfer into multiple operations. This function ensures each operation does
-                    not cross 256 byte flash address boundary.
+                    data transfer into multiple operations. This function ensures each write operation
+                    does not cross 256 byte flash address boundary.
                     *NOTE: if there is some SPI chip that has a stricter address boundary requirement
                     (e.g., its write page size is < 256 byte), then the caller cannot rely on this
                     function to cut the data transfer at proper address boundaries, and it's the
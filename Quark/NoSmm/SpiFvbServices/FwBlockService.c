@@ -425,6 +425,71 @@ Returns:
   }
 }
 
+VOID
+FvbMmioReadBuffer (
+  IN  UINTN                               Address,
+  IN  UINTN                               NumBytes,
+  OUT UINT8                               *Buffer
+  )
+/*++
+
+Routine Description:
+  Copies data out of the memory mapped flash window using 32-bit reads.
+  Each uncached read of the window is a separate SPI read, so reading 32
+  bits at a time cuts the number of SPI reads by a factor of 4.  The bytes
+  before the first UINT32 aligned address and after the last one are read
+  a byte at a time.  MmioReadBuffer32 is used when Buffer is also aligned,
+  otherwise each UINT32 is stored with WriteUnaligned32.
+
+Arguments:
+  Address               - Memory mapped address of the data
+  NumBytes              - Number of bytes to read
+  Buffer                - Buffer to receive the data
+
+Returns:
+  None
+
+--*/
+{
+  UINTN AlignedBytes;
+
+  //
+  // Read the bytes before the first aligned address
+  //
+  while ((NumBytes > 0) && ((Address & (sizeof (UINT32) - 1)) != 0)) {
+    *Buffer++ = MmioRead8 (Address++);
+    NumBytes--;
+  }
+
+  //
+  // Read the aligned data
+  //
+  if ((((UINTN) Buffer) & (sizeof (UINT32) - 1)) == 0) {
+    AlignedBytes = NumBytes & ~(sizeof (UINT32) - 1);
+    if (AlignedBytes != 0) {
+      MmioReadBuffer32 (Address, AlignedBytes, (UINT32 *) Buffer);
+      Address  += AlignedBytes;
+      Buffer   += AlignedBytes;
+      NumBytes -= AlignedBytes;
+    }
+  } else {
+    while (NumBytes >= sizeof (UINT32)) {
+      WriteUnaligned32 ((UINT32 *) Buffer, MmioRead32 (Address));
+      Address  += sizeof (UINT32);
+      Buffer   += sizeof (UINT32);
+      NumBytes -= sizeof (UINT32);
+    }
+  }
+
+  //
+  // Read the remaining bytes
+  //
+  while (NumBytes > 0) {
+    *Buffer++ = MmioRead8 (Address++);
+    NumBytes--;
+  }
+}
+
 EFI_STATUS
 FvbReadBlock (
   IN UINTN                                Instance,
@@ -506,7 +571,7 @@ Returns:
     Status    = EFI_BAD_BUFFER_SIZE;
   }
 
-  MmioReadBuffer8 (LbaAddress + BlockOffset, (UINTN) *NumBytes, Buffer);
+  FvbMmioReadBuffer (LbaAddress + BlockOffset, (UINTN) *NumBytes, Buffer);
 
   return Status;
 }
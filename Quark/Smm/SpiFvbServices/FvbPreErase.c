@@ -0,0 +1,253 @@
+/** @file
+  Boot time blank check of the writable firmware volume blocks.
+
+  A fault tolerant write or a variable reclaim erases blocks before writing
+  them.  The erase adds to the latency of the SetVariable call even when the
+  blocks are already blank.  Each writable firmware volume instance keeps a
+  known-erased bitmap which FvbEraseBlock uses to skip these erases.
+
+  This service fills the known-erased bitmaps of the boot time instance of
+  the driver in the background, blank checking one block per timer tick,
+  instead of checking every block while the driver initializes.  The SMM
+  instance of the driver does not have timer services and checks its blocks
+  during initialization.
+
+  The service never erases a block on its own.  When SMM is enabled the
+  variable and fault tolerant write services run in SMM and update the
+  flash through the SMM instance of this driver, so this instance is not
+  able to follow the progress of a fault tolerant write and can not tell
+  when the spare area contents are no longer needed.
+
+Copyright (c) 2017 Intel Corporation.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "FwBlockService.h"
+
+//
+// Timer period between blank checks in 100ns units
+//
+#define FVB_PRE_ERASE_PERIOD      EFI_TIMER_PERIOD_MILLISECONDS (10)
+
+typedef struct {
+  //
+  // Next block to blank check
+  //
+  UINTN           CheckInstance;
+  EFI_LBA         CheckLba;
+
+  //
+  // Number of flash updates in progress
+  //
+  UINTN           UpdateDepth;
+
+  EFI_EVENT       TimerEvent;
+  BOOLEAN         Enabled;
+} FVB_PRE_ERASE;
+
+extern ESAL_FWB_GLOBAL  *mFvbModuleGlobal;
+
+STATIC FVB_PRE_ERASE    mFvbPreErase;
+
+/**
+  Stop the blank check.
+
+**/
+STATIC
+VOID
+FvbPreEraseStop (
+  VOID
+  )
+{
+  mFvbPreErase.Enabled = FALSE;
+  if (mFvbPreErase.TimerEvent != NULL) {
+    gBS->SetTimer (mFvbPreErase.TimerEvent, TimerCancel, 0);
+  }
+}
+
+/**
+  Blank check the next block of the writable firmware volumes.
+
+  This routine runs at TPL_CALLBACK.
+
+  @param[in]  Event             The periodic timer event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+FvbPreEraseTimer (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  EFI_FW_VOL_INSTANCE  *FwhInstance;
+  EFI_LBA              Lba;
+  UINTN                LbaAddress;
+  UINTN                LbaLength;
+  EFI_STATUS           Status;
+
+  //
+  // Don't access the flash while it is being written or erased
+  //
+  if ((!mFvbPreErase.Enabled) || (mFvbPreErase.UpdateDepth != 0)) {
+    return;
+  }
+
+  //
+  // Blank check the next block
+  //
+  while (mFvbPreErase.CheckInstance < mFvbModuleGlobal->NumFv) {
+    GetFvbInstance (mFvbPreErase.CheckInstance, mFvbModuleGlobal, &FwhInstance, FALSE);
+    if ((FwhInstance->ErasedBlocks == NULL)
+      || (mFvbPreErase.CheckLba >= FwhInstance->NumOfBlocks)) {
+      mFvbPreErase.CheckInstance += 1;
+      mFvbPreErase.CheckLba = 0;
+      continue;
+    }
+    Lba = mFvbPreErase.CheckLba++;
+    Status = FvbGetLbaAddress (
+               mFvbPreErase.CheckInstance,
+               Lba,
+               &LbaAddress,
+               NULL,
+               &LbaLength,
+               NULL,
+               mFvbModuleGlobal,
+               FALSE
+               );
+    if ((!EFI_ERROR (Status)) && FvbBlankCheck (LbaAddress, LbaLength)) {
+      FvbSetBlockErased (FwhInstance, Lba, TRUE);
+    }
+    return;
+  }
+
+  //
+  // All of the blocks are checked
+  //
+  gBS->SetTimer (mFvbPreErase.TimerEvent, TimerCancel, 0);
+}
+
+/**
+  Stop the blank check when the OS takes control of the system.
+
+  @param[in]  Event             The exit boot services event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+FvbPreEraseExitBootServices (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  FvbPreEraseStop ();
+}
+
+/**
+  Start the background blank check of the writable firmware volume blocks.
+
+  The blank check is performed one block per tick of a periodic timer event.
+  FvbInitializeErasedBlocks only allocates the known-erased bitmaps of the
+  boot time instance when this service is enabled.
+
+  @retval EFI_SUCCESS           The blank check was started
+  @retval EFI_NOT_READY         The SPI NOR flash protocol is not available
+
+**/
+EFI_STATUS
+FvbPreEraseStart (
+  VOID
+  )
+{
+  EFI_EVENT           Event;
+  EFI_STATUS          Status;
+
+  if ((mFvbModuleGlobal == NULL) || (mFvbModuleGlobal->SpiProtocol == NULL)) {
+    return EFI_NOT_READY;
+  }
+  if (mFvbPreErase.Enabled) {
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Create the timer and exit boot services events
+  //
+  Status = gBS->CreateEvent (
+                  EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                  TPL_CALLBACK,
+                  FvbPreEraseTimer,
+                  NULL,
+                  &mFvbPreErase.TimerEvent
+                  );
+  if (EFI_ERROR (Status)) {
+    mFvbPreErase.TimerEvent = NULL;
+    return Status;
+  }
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  FvbPreEraseExitBootServices,
+                  NULL,
+                  &gEfiEventExitBootServicesGuid,
+                  &Event
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Start the blank check
+  //
+  mFvbPreErase.CheckInstance = 0;
+  mFvbPreErase.CheckLba = 0;
+  mFvbPreErase.Enabled = TRUE;
+  Status = gBS->SetTimer (mFvbPreErase.TimerEvent, TimerPeriodic, FVB_PRE_ERASE_PERIOD);
+  if (EFI_ERROR (Status)) {
+    mFvbPreErase.Enabled = FALSE;
+    return Status;
+  }
+  DEBUG ((EFI_D_INFO, "FVB pre-erase: Blank checking %d firmware volumes\n",
+          mFvbModuleGlobal->NumFv));
+  return EFI_SUCCESS;
+}
+
+/**
+  Pause the blank check while the flash is written or erased.
+
+  Each call must be followed by a call to FvbPreEraseEndUpdate.
+
+**/
+VOID
+FvbPreEraseBeginUpdate (
+  VOID
+  )
+{
+  if (!mFvbPreErase.Enabled) {
+    return;
+  }
+  mFvbPreErase.UpdateDepth += 1;
+}
+
+/**
+  Resume the blank check after the flash update completes.
+
+**/
+VOID
+FvbPreEraseEndUpdate (
+  VOID
+  )
+{
+  if (mFvbPreErase.UpdateDepth != 0) {
+    mFvbPreErase.UpdateDepth -= 1;
+  }
+}
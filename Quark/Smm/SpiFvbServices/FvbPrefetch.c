@@ -0,0 +1,557 @@
+/** @file
+  Boot time firmware volume prefetch for the SPI FVB services.
+
+  The prefetch service reads a firmware volume from the SPI NOR flash into a
+  RAM cache using a periodic timer event.  One block is read per timer tick,
+  so the flash reads overlap with other boot activity such as decompression
+  and driver dispatch.  FvbReadBlock serves reads from the cache when the
+  requested range has already been fetched.
+
+  The SMM instance of this driver also writes the flash, for example for the
+  variable services.  It records the range of its updates in a structure
+  outside of SMRAM which the boot time instance checks before using the
+  cache.  The SMM instance stops writing the structure at ExitBootServices.
+
+Copyright (c) 2017 Intel Corporation.
+
+This program and the accompanying materials
+are licensed and made available under the terms and conditions of the BSD License
+which accompanies this distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "FwBlockService.h"
+
+//
+// Timer period between block reads in 100ns units
+//
+#define FVB_PREFETCH_PERIOD     EFI_TIMER_PERIOD_MILLISECONDS (1)
+
+//
+// Configuration table containing the FVB_PREFETCH_SMM_UPDATE structure
+//
+#define FVB_PREFETCH_SMM_UPDATE_GUID \
+  { \
+    0x6b1c7a53, 0x2f0e, 0x4d8a, { 0x9e, 0x31, 0x57, 0xc4, 0xb, 0x8d, 0xa2, 0x16 } \
+  }
+
+//
+// Flash updates performed by the SMM instance of the driver.  Base and End
+// describe the memory mapped range containing the updates since the boot
+// time instance last checked the structure.  Generation is incremented after
+// each update.  The boot time instance sets ConsumedGeneration to the
+// Generation value it checked, the next update then starts a new range.
+//
+typedef struct {
+  volatile UINT32 Generation;
+  volatile UINTN  Base;
+  volatile UINTN  End;
+  volatile UINT32 ConsumedGeneration;
+} FVB_PREFETCH_SMM_UPDATE;
+
+typedef struct {
+  //
+  // Memory mapped address and length of the firmware volume in the cache
+  //
+  UINTN           FvBase;
+  UINTN           FvLength;
+
+  //
+  // Flash address of the firmware volume and the number of bytes read from
+  // the flash on each timer tick
+  //
+  UINT32          FlashAddress;
+  UINT32          ChunkBytes;
+
+  //
+  // RAM cache and the number of bytes at the start of the cache containing
+  // valid data
+  //
+  UINT8           *Cache;
+  volatile UINTN  ValidBytes;
+
+  //
+  // Number of flash updates in progress, the prefetch is paused while the
+  // flash is being written or erased
+  //
+  UINTN           UpdateDepth;
+
+  //
+  // Updates performed by the SMM instance of the driver and the Generation
+  // value when the updates were last checked
+  //
+  FVB_PREFETCH_SMM_UPDATE *SmmUpdate;
+  UINT32          SmmGeneration;
+
+  EFI_EVENT       TimerEvent;
+  BOOLEAN         Enabled;
+} FVB_PREFETCH;
+
+extern ESAL_FWB_GLOBAL  *mFvbModuleGlobal;
+extern EFI_SMM_SYSTEM_TABLE2  *mSmst;
+
+EFI_GUID                mFvbPrefetchSmmUpdateGuid = FVB_PREFETCH_SMM_UPDATE_GUID;
+
+STATIC FVB_PREFETCH     mFvbPrefetch;
+
+//
+// Update structure written by the SMM instance of the driver
+//
+STATIC FVB_PREFETCH_SMM_UPDATE  *mFvbPrefetchSmmUpdate;
+
+/**
+  Stop the prefetch operation and disable the cache.
+
+**/
+STATIC
+VOID
+FvbPrefetchStop (
+  VOID
+  )
+{
+  mFvbPrefetch.Enabled = FALSE;
+  mFvbPrefetch.ValidBytes = 0;
+  if (mFvbPrefetch.TimerEvent != NULL) {
+    gBS->SetTimer (mFvbPrefetch.TimerEvent, TimerCancel, 0);
+  }
+}
+
+/**
+  Refill the cache when the SMM instance of the driver updated the flash.
+
+  The cache contents are discarded and the prefetch starts over when the
+  range of the SMM updates overlaps the firmware volume in the cache.
+
+**/
+STATIC
+VOID
+FvbPrefetchCheckSmmUpdates (
+  VOID
+  )
+{
+  UINT32                  Generation;
+  FVB_PREFETCH_SMM_UPDATE *SmmUpdate;
+  EFI_STATUS              Status;
+
+  //
+  // Locate the update structure, the SMM instance may start after the
+  // prefetch.  No SMM updates were performed before it is published.
+  //
+  SmmUpdate = mFvbPrefetch.SmmUpdate;
+  if (SmmUpdate == NULL) {
+    Status = EfiGetSystemConfigurationTable (&mFvbPrefetchSmmUpdateGuid,
+                                             (VOID **) &SmmUpdate);
+    if (EFI_ERROR (Status)) {
+      return;
+    }
+    mFvbPrefetch.SmmUpdate = SmmUpdate;
+    mFvbPrefetch.SmmGeneration = 0;
+  }
+
+  //
+  // Determine if the SMM instance updated the flash since the last check
+  //
+  Generation = SmmUpdate->Generation;
+  if (Generation == mFvbPrefetch.SmmGeneration) {
+    return;
+  }
+  MemoryFence ();
+  mFvbPrefetch.SmmGeneration = Generation;
+  if ((SmmUpdate->Base < (mFvbPrefetch.FvBase + mFvbPrefetch.FvLength))
+    && (SmmUpdate->End > mFvbPrefetch.FvBase)) {
+    DEBUG ((EFI_D_INFO, "FVB prefetch: Cache discarded by SMM update\n"));
+    mFvbPrefetch.ValidBytes = 0;
+    gBS->SetTimer (mFvbPrefetch.TimerEvent, TimerPeriodic, FVB_PREFETCH_PERIOD);
+  }
+
+  //
+  // Let the next SMM update start a new range.  An update performed since
+  // Generation was read changes Generation again and is checked next time.
+  //
+  MemoryFence ();
+  SmmUpdate->ConsumedGeneration = Generation;
+}
+
+/**
+  Read the next block of the firmware volume into the cache.
+
+  This routine runs at TPL_CALLBACK.
+
+  @param[in]  Event             The periodic timer event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+FvbPrefetchTimer (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  CONST EFI_SPI_NOR_FLASH_PROTOCOL *FlashProtocol;
+  UINTN                            LengthInBytes;
+  UINTN                            ValidBytes;
+  EFI_STATUS                       Status;
+
+  //
+  // Don't read the flash while it is being written or erased
+  //
+  if ((!mFvbPrefetch.Enabled) || (mFvbPrefetch.UpdateDepth != 0)) {
+    return;
+  }
+
+  //
+  // Start over when the SMM instance updated the firmware volume
+  //
+  FvbPrefetchCheckSmmUpdates ();
+
+  //
+  // Read the next block into the cache
+  //
+  ValidBytes = mFvbPrefetch.ValidBytes;
+  LengthInBytes = mFvbPrefetch.FvLength - ValidBytes;
+  if (LengthInBytes > mFvbPrefetch.ChunkBytes) {
+    LengthInBytes = mFvbPrefetch.ChunkBytes;
+  }
+  FlashProtocol = &mFvbModuleGlobal->SpiProtocol->FlashProtocol;
+  Status = FlashProtocol->ReadData (
+                            FlashProtocol,
+                            mFvbPrefetch.FlashAddress + (UINT32) ValidBytes,
+                            (UINT32) LengthInBytes,
+                            &mFvbPrefetch.Cache[ValidBytes]
+                            );
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - FVB prefetch read failed, Status: %r\n", Status));
+    FvbPrefetchStop ();
+    return;
+  }
+
+  //
+  // Make the data visible to FvbPrefetchRead only after it is in the cache
+  //
+  MemoryFence ();
+  mFvbPrefetch.ValidBytes = ValidBytes + LengthInBytes;
+
+  //
+  // Stop the timer when the entire firmware volume is in the cache
+  //
+  if (mFvbPrefetch.ValidBytes >= mFvbPrefetch.FvLength) {
+    gBS->SetTimer (mFvbPrefetch.TimerEvent, TimerCancel, 0);
+    DEBUG ((EFI_D_INFO, "FVB prefetch: 0x%08x bytes at 0x%08x cached\n",
+            mFvbPrefetch.FvLength, mFvbPrefetch.FvBase));
+  }
+}
+
+/**
+  Disable the cache when the OS takes control of the system.
+
+  @param[in]  Event             The exit boot services event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+FvbPrefetchExitBootServices (
+  IN EFI_EVENT        Event,
+  IN VOID             *Context
+  )
+{
+  FvbPrefetchStop ();
+}
+
+/**
+  Start prefetching a firmware volume into the RAM cache.
+
+  The layout of the firmware volume is obtained from GetFvbInfo.  The cache is
+  filled one block at a time from a periodic timer event.  Only one firmware
+  volume is cached at a time, starting a new prefetch discards the previous
+  cache contents.
+
+  @param[in]  FvBaseAddress     Memory mapped base address of the firmware
+                                volume to prefetch
+
+  @retval EFI_SUCCESS           The prefetch was started
+  @retval EFI_NOT_FOUND         The firmware volume layout is not known
+  @retval EFI_NOT_READY         The SPI NOR flash protocol is not available
+  @retval EFI_OUT_OF_RESOURCES  The cache could not be allocated
+
+**/
+EFI_STATUS
+FvbPrefetchStart (
+  IN EFI_PHYSICAL_ADDRESS   FvBaseAddress
+  )
+{
+  EFI_EVENT                   Event;
+  EFI_FIRMWARE_VOLUME_HEADER  *FvbInfo;
+  EFI_STATUS                  Status;
+
+  if ((mFvbModuleGlobal == NULL) || (mFvbModuleGlobal->SpiProtocol == NULL)) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // Get the layout of the firmware volume
+  //
+  Status = GetFvbInfo (FvBaseAddress, &FvbInfo);
+  if (EFI_ERROR (Status) || (FvbInfo->FvLength == 0)) {
+    return EFI_NOT_FOUND;
+  }
+
+  //
+  // Discard the previous cache
+  //
+  FvbPrefetchStop ();
+  if (mFvbPrefetch.Cache != NULL) {
+    FreePool (mFvbPrefetch.Cache);
+    mFvbPrefetch.Cache = NULL;
+  }
+
+  //
+  // Allocate the cache
+  //
+  mFvbPrefetch.Cache = AllocatePool ((UINTN) FvbInfo->FvLength);
+  if (mFvbPrefetch.Cache == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  mFvbPrefetch.FvBase = (UINTN) FvBaseAddress;
+  mFvbPrefetch.FvLength = (UINTN) FvbInfo->FvLength;
+  mFvbPrefetch.ChunkBytes = FvbInfo->BlockMap[0].Length;
+  mFvbPrefetch.FlashAddress = (UINT32) (FvBaseAddress
+                            - PcdGet32 (PcdFlashAreaBaseAddress)
+                            + mFvbModuleGlobal->SpiProtocol->FlashProtocol.FlashSize
+                            - FLASH_SIZE);
+
+  //
+  // Create the timer and exit boot services events
+  //
+  if (mFvbPrefetch.TimerEvent == NULL) {
+    Status = gBS->CreateEvent (
+                    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    FvbPrefetchTimer,
+                    NULL,
+                    &mFvbPrefetch.TimerEvent
+                    );
+    if (EFI_ERROR (Status)) {
+      mFvbPrefetch.TimerEvent = NULL;
+      return Status;
+    }
+    Status = gBS->CreateEventEx (
+                    EVT_NOTIFY_SIGNAL,
+                    TPL_NOTIFY,
+                    FvbPrefetchExitBootServices,
+                    NULL,
+                    &gEfiEventExitBootServicesGuid,
+                    &Event
+                    );
+    ASSERT_EFI_ERROR (Status);
+  }
+
+  //
+  // Start the prefetch
+  //
+  mFvbPrefetch.ValidBytes = 0;
+  mFvbPrefetch.Enabled = TRUE;
+  Status = gBS->SetTimer (mFvbPrefetch.TimerEvent, TimerPeriodic, FVB_PREFETCH_PERIOD);
+  if (EFI_ERROR (Status)) {
+    mFvbPrefetch.Enabled = FALSE;
+    return Status;
+  }
+  DEBUG ((EFI_D_INFO, "FVB prefetch: Reading 0x%08x bytes at 0x%08x\n",
+          mFvbPrefetch.FvLength, mFvbPrefetch.FvBase));
+  return EFI_SUCCESS;
+}
+
+/**
+  Attempt to satisfy a read from the prefetch cache.
+
+  @param[in]  Address           Memory mapped address of the data
+  @param[in]  NumBytes          Number of bytes to read
+  @param[out] Buffer            Buffer to receive the data
+
+  @retval TRUE                  The data was read from the cache
+  @retval FALSE                 The data is not in the cache
+
+**/
+BOOLEAN
+FvbPrefetchRead (
+  IN  UINTN                 Address,
+  IN  UINTN                 NumBytes,
+  OUT UINT8                 *Buffer
+  )
+{
+  UINTN Offset;
+
+  if ((!mFvbPrefetch.Enabled) || (Address < mFvbPrefetch.FvBase)) {
+    return FALSE;
+  }
+  FvbPrefetchCheckSmmUpdates ();
+  Offset = Address - mFvbPrefetch.FvBase;
+  if ((Offset > mFvbPrefetch.ValidBytes)
+    || (NumBytes > (mFvbPrefetch.ValidBytes - Offset))) {
+    return FALSE;
+  }
+  CopyMem (Buffer, &mFvbPrefetch.Cache[Offset], NumBytes);
+  return TRUE;
+}
+
+/**
+  Pause the prefetch while the flash is written or erased.
+
+  The cache is discarded when the update overlaps the firmware volume in the
+  cache.  Each call must be followed by a call to FvbPrefetchEndUpdate.
+
+  @param[in]  Address           Memory mapped address of the update
+  @param[in]  NumBytes          Number of bytes being updated
+
+**/
+VOID
+FvbPrefetchBeginUpdate (
+  IN UINTN                  Address,
+  IN UINTN                  NumBytes
+  )
+{
+  if (!mFvbPrefetch.Enabled) {
+    return;
+  }
+  mFvbPrefetch.UpdateDepth += 1;
+  if ((Address < (mFvbPrefetch.FvBase + mFvbPrefetch.FvLength))
+    && ((Address + NumBytes) > mFvbPrefetch.FvBase)) {
+    FvbPrefetchStop ();
+  }
+}
+
+/**
+  Stop recording the SMM flash updates when the OS takes control of the
+  system.
+
+  The structure is outside of SMRAM and the boot time instance no longer
+  uses it, so it is not written after ExitBootServices.
+
+  @param[in] Protocol   Points to the protocol's unique identifier.
+  @param[in] Interface  Points to the interface instance.
+  @param[in] Handle     The handle on which the interface was installed.
+
+  @retval EFI_SUCCESS   The updates are no longer recorded
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FvbPrefetchSmmExitBootServices (
+  IN CONST EFI_GUID  *Protocol,
+  IN VOID            *Interface,
+  IN EFI_HANDLE      Handle
+  )
+{
+  mFvbPrefetchSmmUpdate = NULL;
+  return EFI_SUCCESS;
+}
+
+/**
+  Publish the structure recording the flash updates performed in SMM.
+
+  This routine is called by the SMM instance of the driver from its entry
+  point while the boot services are available.  The structure must be
+  located outside of SMRAM so that the boot time instance is able to read it.
+
+  @retval EFI_SUCCESS           The structure was published
+  @retval other                 The structure could not be allocated or
+                                published
+
+**/
+EFI_STATUS
+FvbPrefetchSmmInit (
+  VOID
+  )
+{
+  VOID        *Registration;
+  EFI_STATUS  Status;
+
+  Status = gBS->AllocatePool (
+                  EfiRuntimeServicesData,
+                  sizeof (FVB_PREFETCH_SMM_UPDATE),
+                  (VOID **) &mFvbPrefetchSmmUpdate
+                  );
+  if (EFI_ERROR (Status)) {
+    mFvbPrefetchSmmUpdate = NULL;
+    return Status;
+  }
+  ZeroMem (mFvbPrefetchSmmUpdate, sizeof (FVB_PREFETCH_SMM_UPDATE));
+  Status = gBS->InstallConfigurationTable (
+                  &mFvbPrefetchSmmUpdateGuid,
+                  mFvbPrefetchSmmUpdate
+                  );
+  if (EFI_ERROR (Status)) {
+    gBS->FreePool (mFvbPrefetchSmmUpdate);
+    mFvbPrefetchSmmUpdate = NULL;
+    return Status;
+  }
+
+  //
+  // Stop writing the structure at ExitBootServices
+  //
+  Status = mSmst->SmmRegisterProtocolNotify (
+                    &gEdkiiSmmExitBootServicesProtocolGuid,
+                    FvbPrefetchSmmExitBootServices,
+                    &Registration
+                    );
+  ASSERT_EFI_ERROR (Status);
+  return Status;
+}
+
+/**
+  Record a flash write or erase performed by the SMM instance of the driver.
+
+  @param[in]  Address           Memory mapped address of the update
+  @param[in]  NumBytes          Number of bytes updated
+
+**/
+VOID
+FvbPrefetchSmmUpdate (
+  IN UINTN                  Address,
+  IN UINTN                  NumBytes
+  )
+{
+  FVB_PREFETCH_SMM_UPDATE *SmmUpdate;
+
+  SmmUpdate = mFvbPrefetchSmmUpdate;
+  if (SmmUpdate == NULL) {
+    return;
+  }
+
+  //
+  // Start a new range once the boot time instance checked the previous
+  // updates, otherwise grow the range to include this update
+  //
+  if ((SmmUpdate->Generation == SmmUpdate->ConsumedGeneration)
+    || (Address < SmmUpdate->Base)) {
+    SmmUpdate->Base = Address;
+  }
+  if ((SmmUpdate->Generation == SmmUpdate->ConsumedGeneration)
+    || ((Address + NumBytes) > SmmUpdate->End)) {
+    SmmUpdate->End = Address + NumBytes;
+  }
+  MemoryFence ();
+  SmmUpdate->Generation += 1;
+}
+
+/**
+  Resume the prefetch after the flash update completes.
+
+**/
+VOID
+FvbPrefetchEndUpdate (
+  VOID
+  )
+{
+  if (mFvbPrefetch.UpdateDepth != 0) {
+    mFvbPrefetch.UpdateDepth -= 1;
+  }
+}
@@ -26,6 +26,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 // Statements that include other header files
 
 #include <Library/IoLib.h>
+#include <Library/BaseLib.h>
 #include <Library/HobLib.h>
 #include <Library/PcdLib.h>
 #include <Library/UefiLib.h>
@@ -37,6 +38,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/UefiRuntimeServicesTableLib.h>
 #include <Library/DxeServicesTableLib.h>
+#include <Library/FlashBufferLib.h>
 #include <Library/MemoryAllocationLib.h>
 
 #include <Guid/EventGroup.h>
@@ -45,6 +47,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Guid/SystemNvDataGuid.h>
 
 #include <Protocol/SmmBase2.h>
+#include <Protocol/SmmExitBootServices.h>
 #include <Protocol/LoadedImage.h>
 #include <Protocol/PlatformSmmSpiReady.h>
 
@@ -71,6 +74,8 @@ typedef struct {
   UINTN                       FvWriteBase[2];
   UINTN                       NumOfBlocks;
   BOOLEAN                     WriteEnabled;
+  UINT8                       *ErasedBlocks;    // One bit per LBA, set when known to be erased
+  UINTN                       ErasesAvoided;
   EFI_FIRMWARE_VOLUME_HEADER  VolumeHeader;
 } EFI_FW_VOL_INSTANCE;
 
@@ -145,11 +150,81 @@ GetFvbInfo (
   OUT EFI_FIRMWARE_VOLUME_HEADER        **FvbInfo
   );
 
+BOOLEAN
+FvbBlankCheck (
+  IN UINTN                              Address,
+  IN UINTN                              NumBytes
+  );
+
+VOID
+FvbSetBlockErased (
+  IN EFI_FW_VOL_INSTANCE                *FwhInstance,
+  IN EFI_LBA                            Lba,
+  IN BOOLEAN                            Erased
+  );
+
+EFI_STATUS
+GetFvbInstance (
+  IN  UINTN                             Instance,
+  IN  ESAL_FWB_GLOBAL                   *Global,
+  OUT EFI_FW_VOL_INSTANCE               **FwhInstance,
+  IN BOOLEAN                            Virtual
+  );
+
 BOOLEAN
 SetPlatformFvbLock (
   IN UINTN                              LbaAddress
   );
 
+EFI_STATUS
+FvbPrefetchStart (
+  IN EFI_PHYSICAL_ADDRESS               FvBaseAddress
+  );
+
+BOOLEAN
+FvbPrefetchRead (
+  IN  UINTN                             Address,
+  IN  UINTN                             NumBytes,
+  OUT UINT8                             *Buffer
+  );
+
+VOID
+FvbPrefetchBeginUpdate (
+  IN UINTN                              Address,
+  IN UINTN                              NumBytes
+  );
+
+VOID
+FvbPrefetchEndUpdate (
+  VOID
+  );
+
+EFI_STATUS
+FvbPrefetchSmmInit (
+  VOID
+  );
+
+VOID
+FvbPrefetchSmmUpdate (
+  IN UINTN                              Address,
+  IN UINTN                              NumBytes
+  );
+
+EFI_STATUS
+FvbPreEraseStart (
+  VOID
+  );
+
+VOID
+FvbPreEraseBeginUpdate (
+  VOID
+  );
+
+VOID
+FvbPreEraseEndUpdate (
+  VOID
+  );
+
 EFI_STATUS
 FvbReadBlock (
   IN UINTN                              Instance,
@@ -20,9 +20,12 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Uefi.h>
 #include <IndustryStandard/Pci.h>
 #include <Intel/LegacySpiConfig.h>
+#include <Library/BaseLib.h>
+#include <Library/CacheMaintenanceLib.h>
 #include <Library/DebugLib.h>
 #include <Library/MemoryAllocationLib.h>
 #include <Library/PciLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiLib.h>
 #include <Protocol/DriverBinding.h>
 #include <Protocol/LegacySpiController.h>
@@ -33,6 +36,13 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define INTEL_VENDOR_ID         0x8086
 #define LEGACY_BRIDGE_ID        0x095e
 
+//
+// Debug output for the transaction, removed by the compiler when
+// PcdSpiDebugTransaction is FALSE
+//
+#define SPI_DEBUG(DebugTransaction)                                           \
+  (FixedPcdGetBool (PcdSpiDebugTransaction) && (DebugTransaction))
+
 //
 // BC - BIOS control
 //
@@ -50,6 +60,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define RCBA                    0xf0
 #define RCBA_BA                 0xffffc000
 #define RCBA_EN                 0x00000001
+#define RCBA_LENGTH             0x00004000
 
 //
 // SPISTS - SPI status
@@ -245,8 +256,70 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 ///
 #define SPI_HC_FLAG_PREFIX_SENT         0x00000002
 
+///
+/// SPI cycle completion
+///
+
+///
+/// Time to spin on the cycle in progress bit before waiting, most cycles
+/// complete within this time
+///
+#define SPI_HC_CYCLE_SPIN_US            64
+
+///
+/// Interval between status reads while waiting for a cycle
+///
+#define SPI_HC_CYCLE_POLL_US            16
+
+///
+/// Maximum time for a read, page program or write status cycle, a hung
+/// controller fails the transaction with EFI_TIMEOUT
+///
+#define SPI_HC_CYCLE_TIMEOUT_US         (100 * 1000)
+
+///
+/// Maximum time for the erase cycles.  The atomic cycle sequence does not
+/// complete until the SPI NOR flash clears its busy bit, which for an erase
+/// takes much longer than the other cycles.
+///
+#define SPI_HC_ERASE_4KB_TIMEOUT_US     (400 * 1000)
+#define SPI_HC_ERASE_BLOCK_TIMEOUT_US   (2 * 1000 * 1000)
+#define SPI_HC_CHIP_ERASE_TIMEOUT_US    (200 * 1000 * 1000)
+
 #define SPI_INPUT_CLOCK         MHz(20)
 
+//
+// Opcode, address and data of a SPI transaction
+//
+typedef struct _SPI_HC_COMMAND
+{
+  //
+  // Opcode sent to the SPI flash part
+  //
+  UINT8 Opcode;
+
+  //
+  // Number of address bytes: 0 or 3
+  //
+  UINT8 AddressBytes;
+
+  //
+  // Address bytes, most significant byte first
+  //
+  UINT8 AddressData[3];
+
+  //
+  // Address in the SPI flash part
+  //
+  UINT32 Address;
+
+  //
+  // Data sent following the address
+  //
+  UINT8 *Data;
+  UINTN DataBytes;
+} SPI_HC_COMMAND;
+
 #define SPI_HC_SIGNATURE        SIGNATURE_32 ('L', 's', 'p', 'i')
 
 typedef struct _SPI_HC
@@ -300,6 +373,25 @@ typedef struct _SPI_HC
   //
   UINT32 RangeRegisterCount;
 
+  //
+  // Memory mapped flash window, flash address zero is at WindowBase
+  //
+  UINT32 WindowBase;
+  UINT32 WindowBytes;
+
+  //
+  // Flush the modified flash data from the processor caches after write and
+  // erase operations
+  //
+  BOOLEAN InvalidateWindow;
+
+  //
+  // Flash range modified by the write or erase operations which are still
+  // in progress, flushed when a status read reports the flash is not busy
+  //
+  UINT32 PendingAddress;
+  UINT32 PendingBytes;
+
   EFI_LEGACY_SPI_CONTROLLER_PROTOCOL LegacySpiProtocol;
 } SPI_HC;
 
@@ -309,6 +401,52 @@ typedef struct _SPI_HC
 #define SPI_HC_CONTEXT_FROM_LEGACY_PROTOCOL(protocol)           \
     CR (protocol, SPI_HC, LegacySpiProtocol, SPI_HC_SIGNATURE)
 
+/**
+  Map the memory mapped flash window as write-protect cacheable.
+
+  This routine is called at TPL_NOTIFY.
+
+  The SPI host controller calls this routine once the flash window is known.
+  The environment specific code determines if and when the processor caching
+  policy for the window is changed.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+
+**/
+VOID
+EFIAPI
+LegacySpiCacheWindow (
+  IN SPI_HC *SpiHc
+  );
+
+/**
+  Wait for the SPI cycle to complete.
+
+  This routine is called at TPL_NOTIFY.
+
+  The SPI host controller calls this routine when the SPI cycle does not
+  complete within SPI_HC_CYCLE_SPIN_US.  The environment specific code waits
+  without spinning on the status register.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  SpiStatusRegister Address of the SPI status register
+  @param[in]  TimeoutUs         Maximum time for the cycle in microseconds
+  @param[out] SpiStatus         Receives the last value of the status register
+
+  @retval EFI_SUCCESS           The SPI cycle completed
+  @retval EFI_TIMEOUT           The SPI cycle did not complete within
+                                TimeoutUs
+
+**/
+EFI_STATUS
+EFIAPI
+LegacySpiWaitForCycle (
+  IN SPI_HC *SpiHc,
+  IN volatile UINT16 *SpiStatusRegister,
+  IN UINTN TimeoutUs,
+  OUT UINT16 *SpiStatus
+  );
+
 EFI_STATUS
 EFIAPI
 SpiHcInitialize (
@@ -19,12 +19,365 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
 #include "QuarkLegacySpi.h"
+#include <Guid/EventGroup.h>
+#include <Library/DxeServicesTableLib.h>
+#include <Library/UefiRuntimeLib.h>
 
 CONST LEGACY_SPI_DEVICE_PATH gSpiHcDevicePath = {
   LEGACY_SPI_DEVICE_PATH_NODE,
   END_LEGACY_DEVICE_PATH
 };
 
+//
+// Processor caching attributes of a GCD memory space descriptor
+//
+#define CACHE_ATTRIBUTE_MASK  (EFI_MEMORY_UC | EFI_MEMORY_WC | EFI_MEMORY_WT \
+                               | EFI_MEMORY_WB | EFI_MEMORY_UCE | EFI_MEMORY_WP)
+
+//
+// SPI host controller used at runtime
+//
+STATIC SPI_HC *mSpiHc;
+
+//
+// Memory mapped flash window caching
+//
+STATIC EFI_EVENT mCacheWindowEvent;
+STATIC UINT64 mWindowAttributes;
+STATIC BOOLEAN mWindowCached;
+
+//
+// SPI cycle timeout
+//
+STATIC EFI_EVENT mCycleTimeoutEvent;
+
+/**
+  Restore the caching attributes of the memory mapped flash window.
+
+  The operating system updates the flash with the caches enabled, restore the
+  original caching policy for the window before the operating system takes
+  control of the processor.  The cache lines of the window are no longer
+  flushed after this point since the window is not mapped at runtime.
+
+  @param[in]  Event             The exit boot services event
+  @param[in]  Context           Pointer to the SPI_HC data structure
+
+**/
+STATIC
+VOID
+EFIAPI
+LegacySpiUncacheWindow (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  SPI_HC *SpiHc;
+
+  SpiHc = (SPI_HC *)Context;
+  SpiHc->InvalidateWindow = FALSE;
+  if (mWindowCached) {
+    mWindowCached = FALSE;
+    gDS->SetMemorySpaceAttributes (
+           SpiHc->WindowBase,
+           SpiHc->WindowBytes,
+           mWindowAttributes
+           );
+    WriteBackInvalidateDataCacheRange ((VOID *)(UINTN)SpiHc->WindowBase,
+                                       SpiHc->WindowBytes);
+  }
+}
+
+/**
+  Map the memory mapped flash window as write-protect cacheable.
+
+  Reads of the flash window hit in the processor caches while writes to the
+  window are not cached.  SpiHcTransaction flushes the modified cache lines
+  after each write and erase operation.
+
+  @param[in]  Event             The cache window event
+  @param[in]  Context           Pointer to the SPI_HC data structure
+
+**/
+STATIC
+VOID
+EFIAPI
+LegacySpiCacheWindowNotify (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR Descriptor;
+  EFI_EVENT ExitBootServicesEvent;
+  SPI_HC *SpiHc;
+  EFI_STATUS Status;
+
+  SpiHc = (SPI_HC *)Context;
+  gBS->CloseEvent (Event);
+
+  //
+  // Switch the window to write-protect caching
+  //
+  Status = gDS->GetMemorySpaceDescriptor (SpiHc->WindowBase, &Descriptor);
+  if (!EFI_ERROR (Status)) {
+    Status = gDS->SetMemorySpaceAttributes (
+                    SpiHc->WindowBase,
+                    SpiHc->WindowBytes,
+                    (Descriptor.Attributes & ~CACHE_ATTRIBUTE_MASK)
+                    | EFI_MEMORY_WP
+                    );
+  }
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiHc failed to cache the flash window, Status: %r\n",
+            Status));
+    return;
+  }
+  mWindowAttributes = Descriptor.Attributes;
+  mWindowCached = TRUE;
+  DEBUG ((EFI_D_INFO, "0x%08x - 0x%08x: SPI flash window cached write-protect\n",
+          SpiHc->WindowBase, SpiHc->WindowBase + SpiHc->WindowBytes - 1));
+
+  //
+  // Restore the caching policy before the operating system starts
+  //
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  LegacySpiUncacheWindow,
+                  SpiHc,
+                  &gEfiEventExitBootServicesGuid,
+                  &ExitBootServicesEvent
+                  );
+  ASSERT_EFI_ERROR (Status);
+}
+
+/**
+  Map the memory mapped flash window as write-protect cacheable.
+
+  This routine is called at TPL_NOTIFY.
+
+  The SPI host controller calls this routine once the flash window is known.
+  The GCD services may not be called at TPL_NOTIFY so the caching policy is
+  changed by a TPL_CALLBACK event.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+
+**/
+VOID
+EFIAPI
+LegacySpiCacheWindow (
+  IN SPI_HC *SpiHc
+  )
+{
+  EFI_STATUS Status;
+
+  //
+  // Leave the caching policy alone at runtime
+  //
+  if (EfiAtRuntime ()) {
+    SpiHc->InvalidateWindow = FALSE;
+    return;
+  }
+
+  if (mCacheWindowEvent == NULL) {
+    Status = gBS->CreateEvent (
+                    EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    LegacySpiCacheWindowNotify,
+                    SpiHc,
+                    &mCacheWindowEvent
+                    );
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_ERROR, "ERROR - SpiHc failed to create cache window event, Status: %r\n",
+              Status));
+      return;
+    }
+    gBS->SignalEvent (mCacheWindowEvent);
+  }
+}
+
+/**
+  Wait for the SPI cycle to complete.
+
+  This routine is called at TPL_NOTIFY.
+
+  The status register is polled using a delay.  During boot a timer event
+  bounds the wait, so time spent in interrupt handlers counts against the
+  timeout.  Sleeping until the next timer interrupt would stretch each page
+  program to a full timer tick.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  SpiStatusRegister Address of the SPI status register
+  @param[in]  TimeoutUs         Maximum time for the cycle in microseconds
+  @param[out] SpiStatus         Receives the last value of the status register
+
+  @retval EFI_SUCCESS           The SPI cycle completed
+  @retval EFI_TIMEOUT           The SPI cycle did not complete within
+                                TimeoutUs
+
+**/
+EFI_STATUS
+EFIAPI
+LegacySpiWaitForCycle (
+  IN SPI_HC *SpiHc,
+  IN volatile UINT16 *SpiStatusRegister,
+  IN UINTN TimeoutUs,
+  OUT UINT16 *SpiStatus
+  )
+{
+  UINTN Delay;
+  EFI_STATUS Status;
+
+  //
+  // Poll the status register when the boot services are not available
+  //
+  if (EfiAtRuntime () || (mCycleTimeoutEvent == NULL)) {
+    for (Delay = 0; Delay < TimeoutUs;
+      Delay += SPI_HC_CYCLE_POLL_US) {
+      MicroSecondDelay (SPI_HC_CYCLE_POLL_US);
+      *SpiStatus = *SpiStatusRegister;
+      if ((*SpiStatus & SPISTS_CIP) == 0) {
+        return EFI_SUCCESS;
+      }
+    }
+    return EFI_TIMEOUT;
+  }
+
+  //
+  // Start the timeout, discarding any expiration left by the previous cycle
+  //
+  gBS->CheckEvent (mCycleTimeoutEvent);
+  Status = gBS->SetTimer (
+                  mCycleTimeoutEvent,
+                  TimerRelative,
+                  EFI_TIMER_PERIOD_MICROSECONDS (TimeoutUs)
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Wait for the cycle to complete
+  //
+  Status = EFI_TIMEOUT;
+  do {
+    *SpiStatus = *SpiStatusRegister;
+    if ((*SpiStatus & SPISTS_CIP) == 0) {
+      Status = EFI_SUCCESS;
+      break;
+    }
+    MicroSecondDelay (SPI_HC_CYCLE_POLL_US);
+  } while (gBS->CheckEvent (mCycleTimeoutEvent) == EFI_NOT_READY);
+
+  //
+  // The cycle may have completed while the timer expired
+  //
+  if (EFI_ERROR (Status)) {
+    *SpiStatus = *SpiStatusRegister;
+    if ((*SpiStatus & SPISTS_CIP) == 0) {
+      Status = EFI_SUCCESS;
+    }
+  }
+  gBS->SetTimer (mCycleTimeoutEvent, TimerCancel, 0);
+  return Status;
+}
+
+/**
+  Convert the SPI host controller pointers to virtual addresses.
+
+  This routine is called once by SetVirtualAddressMap.  The RCBA MMIO
+  registers, the protocol functions and the protocol GUID pointer are
+  converted.
+
+  @param[in]  Event             The virtual address change event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+LegacySpiVirtualAddressChange (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  UINTN BaseAddress;
+  EFI_LEGACY_SPI_CONTROLLER_PROTOCOL *LegacySpiProtocol;
+  EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+
+  //
+  // Convert the controller registers
+  //
+  BaseAddress = mSpiHc->BaseAddress;
+  EfiConvertPointer (0, (VOID **)&BaseAddress);
+  mSpiHc->BaseAddress = (UINT32)BaseAddress;
+
+  //
+  // Convert the SPI host controller protocol
+  //
+  SpiHcProtocol = &mSpiHc->SpiHcProtocol;
+  EfiConvertPointer (0, (VOID **)&SpiHcProtocol->ChipSelect);
+  EfiConvertPointer (0, (VOID **)&SpiHcProtocol->Clock);
+  EfiConvertPointer (0, (VOID **)&SpiHcProtocol->Transaction);
+
+  //
+  // Convert the legacy SPI controller protocol
+  //
+  LegacySpiProtocol = &mSpiHc->LegacySpiProtocol;
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->EraseBlockOpcode);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->WriteStatusPrefix);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->BiosBaseAddress);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->ClearSpiProtect);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->IsRangeProtected);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->ProtectNextRange);
+  EfiConvertPointer (0, (VOID **)&LegacySpiProtocol->LockController);
+
+  EfiConvertPointer (0, (VOID **)&mSpiHc->SpiHcGuid);
+  EfiConvertPointer (0, (VOID **)&mSpiHc);
+}
+
+/**
+  Make the SPI host controller registers available at runtime.
+
+  Mark the RCBA MMIO range as a runtime range so that it is mapped by the
+  operating system's virtual address map.  The range may have already been
+  added to the GCD by the platform.
+
+  @param[in]  BaseAddress       Physical address of the root complex registers
+
+  @retval EFI_SUCCESS           The registers are available at runtime
+  @retval other                 The GCD update failed
+
+**/
+STATIC
+EFI_STATUS
+LegacySpiRuntimeRegisters (
+  IN UINT32 BaseAddress
+  )
+{
+  EFI_GCD_MEMORY_SPACE_DESCRIPTOR Descriptor;
+  EFI_STATUS Status;
+
+  Status = gDS->GetMemorySpaceDescriptor (BaseAddress, &Descriptor);
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
+  if (Descriptor.GcdMemoryType == EfiGcdMemoryTypeNonExistent) {
+    Status = gDS->AddMemorySpace (
+                    EfiGcdMemoryTypeMemoryMappedIo,
+                    BaseAddress,
+                    RCBA_LENGTH,
+                    EFI_MEMORY_RUNTIME | EFI_MEMORY_UC
+                    );
+    if (EFI_ERROR (Status)) {
+      return Status;
+    }
+    Descriptor.Attributes = EFI_MEMORY_UC;
+  }
+  return gDS->SetMemorySpaceAttributes (
+                BaseAddress,
+                RCBA_LENGTH,
+                Descriptor.Attributes | EFI_MEMORY_RUNTIME
+                );
+}
+
 /**
   The entry point for the legacy SPI controller driver.
 
@@ -42,6 +395,7 @@ LegacySpiEntryPoint (
   IN EFI_SYSTEM_TABLE     *SystemTable
   )
 {
+  EFI_EVENT Event;
   SPI_HC *SpiHc;
   EFI_STATUS Status;
 
@@ -50,6 +404,15 @@ LegacySpiEntryPoint (
   //
   Status = SpiHcInitialize (&SpiHc, &gEfiSpiHcProtocolGuid);
   if (!EFI_ERROR(Status)) {
+    //
+    // Bound the wait for the SPI cycles during boot, the status register is
+    // polled when the event is not available
+    //
+    if (EFI_ERROR (gBS->CreateEvent (EVT_TIMER, TPL_NOTIFY, NULL, NULL,
+                                     &mCycleTimeoutEvent))) {
+      mCycleTimeoutEvent = NULL;
+    }
+
     //
     // Install the SPI host controller protocols
     //
@@ -65,6 +428,29 @@ LegacySpiEntryPoint (
                      );
     if (EFI_ERROR (Status)) {
       DEBUG ((EFI_D_ERROR, "ERROR - SpiHc failed to install SPI HC protocol!\n"));
+    } else {
+      //
+      // Support flash updates from the operating system
+      //
+      mSpiHc = SpiHc;
+      Status = LegacySpiRuntimeRegisters (SpiHc->BaseAddress);
+      if (EFI_ERROR (Status)) {
+        //
+        // The controller is still usable during boot
+        //
+        DEBUG ((EFI_D_ERROR, "ERROR - SpiHc registers not available at runtime, Status: %r\n",
+                Status));
+        Status = EFI_SUCCESS;
+      } else {
+        Status = gBS->CreateEventEx (
+                        EVT_NOTIFY_SIGNAL,
+                        TPL_NOTIFY,
+                        LegacySpiVirtualAddressChange,
+                        NULL,
+                        &gEfiEventVirtualAddressChangeGuid,
+                        &Event
+                        );
+      }
     }
   }
   ASSERT_EFI_ERROR (Status);
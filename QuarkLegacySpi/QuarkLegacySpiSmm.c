@@ -21,6 +21,67 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include "QuarkLegacySpi.h"
 #include <Library/SmmServicesTableLib.h>
 
+/**
+  Map the memory mapped flash window as write-protect cacheable.
+
+  This routine is called at TPL_NOTIFY.
+
+  The caching policy of the window is owned by the DXE driver.  SMM only
+  flushes the modified cache lines after the write and erase operations.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+
+**/
+VOID
+EFIAPI
+LegacySpiCacheWindow (
+  IN SPI_HC *SpiHc
+  )
+{
+}
+
+/**
+  Wait for the SPI cycle to complete.
+
+  This routine is called at TPL_NOTIFY.
+
+  The SPI host controller is only used from within SMM, so the cycle done
+  SMI (SPICTL_SMIEN) is not used: it remains pending until the processor
+  leaves SMM.  Instead the cycle done status is polled using a delay between
+  the reads of the status register.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  SpiStatusRegister Address of the SPI status register
+  @param[in]  TimeoutUs         Maximum time for the cycle in microseconds
+  @param[out] SpiStatus         Receives the last value of the status register
+
+  @retval EFI_SUCCESS           The SPI cycle completed
+  @retval EFI_TIMEOUT           The SPI cycle did not complete within
+                                TimeoutUs
+
+**/
+EFI_STATUS
+EFIAPI
+LegacySpiWaitForCycle (
+  IN SPI_HC *SpiHc,
+  IN volatile UINT16 *SpiStatusRegister,
+  IN UINTN TimeoutUs,
+  OUT UINT16 *SpiStatus
+  )
+{
+  UINTN Delay;
+
+  for (Delay = 0; Delay < TimeoutUs;
+    Delay += SPI_HC_CYCLE_POLL_US) {
+    MicroSecondDelay (SPI_HC_CYCLE_POLL_US);
+    *SpiStatus = *SpiStatusRegister;
+    if ((*SpiStatus & (SPISTS_CD | SPISTS_CIP)) == SPISTS_CD) {
+      return EFI_SUCCESS;
+    }
+  }
+  return EFI_TIMEOUT;
+}
+
 /**
   The entry point for the legacy SPI controller driver.
 
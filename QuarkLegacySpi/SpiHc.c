@@ -72,6 +72,16 @@ SpiHcChipSelect (
   LegacySpiConfig = SpiPeripheral->ChipSelectParameter;
   if (PinValue == 0) {
     SpiHc->ChipSelect = LegacySpiConfig->ChipSelect & SPIADDR_CSC;
+
+    //
+    // Cache the memory mapped flash window once its size is known
+    //
+    if ((SpiHc->WindowBytes == 0) && (LegacySpiConfig->MemoryMappedBytes != 0)) {
+      SpiHc->WindowBytes = LegacySpiConfig->MemoryMappedBytes;
+      SpiHc->WindowBase = (UINT32)(BASE_4GB - SpiHc->WindowBytes);
+      SpiHc->InvalidateWindow = TRUE;
+      LegacySpiCacheWindow (SpiHc);
+    }
   } else {
     SpiHc->ChipSelect = SPIADDR_CSC;
   }
@@ -266,6 +276,231 @@ SpiHcReadOpcode (
   return *Controller.Reg;
 }
 
+/**
+  Flush a modified range of the flash from the processor caches.
+
+  This routine is called at TPL_NOTIFY.
+
+  Only the cache lines of the memory mapped window which hold the modified
+  range of the flash are flushed.  This avoids writing back and invalidating
+  the entire cache with WBINVD after each write or erase operation.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  FlashAddress      Address in the flash of the modified data
+  @param[in]  LengthInBytes     Number of bytes modified
+
+**/
+STATIC
+VOID
+SpiHcInvalidateWindow (
+  IN SPI_HC *SpiHc,
+  IN UINT32 FlashAddress,
+  IN UINT32 LengthInBytes
+  )
+{
+  if ((!SpiHc->InvalidateWindow) || (LengthInBytes == 0)
+    || (FlashAddress >= SpiHc->WindowBytes)) {
+    return;
+  }
+  if (LengthInBytes > (SpiHc->WindowBytes - FlashAddress)) {
+    LengthInBytes = SpiHc->WindowBytes - FlashAddress;
+  }
+  InvalidateDataCacheRange ((VOID *)(UINTN)(SpiHc->WindowBase + FlashAddress),
+                            LengthInBytes);
+}
+
+/**
+  Record a flash range modified by a write or erase operation.
+
+  This routine is called at TPL_NOTIFY.
+
+  The flash part continues to program or erase the range after the command
+  cycle completes.  The processor may cache the window during this time, so
+  the range is flushed after a status read reports the flash is not busy.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  FlashAddress      Address in the flash of the modified data
+  @param[in]  LengthInBytes     Number of bytes modified
+
+**/
+STATIC
+VOID
+SpiHcPendInvalidate (
+  IN SPI_HC *SpiHc,
+  IN UINT32 FlashAddress,
+  IN UINT32 LengthInBytes
+  )
+{
+  UINT32 EndAddress;
+
+  if ((!SpiHc->InvalidateWindow) || (LengthInBytes == 0)) {
+    return;
+  }
+  if (SpiHc->PendingBytes == 0) {
+    SpiHc->PendingAddress = FlashAddress;
+    SpiHc->PendingBytes = LengthInBytes;
+    return;
+  }
+
+  //
+  // Extend the pending range to include the modified data
+  //
+  EndAddress = SpiHc->PendingAddress + SpiHc->PendingBytes;
+  if (EndAddress < FlashAddress + LengthInBytes) {
+    EndAddress = FlashAddress + LengthInBytes;
+  }
+  if (SpiHc->PendingAddress > FlashAddress) {
+    SpiHc->PendingAddress = FlashAddress;
+  }
+  SpiHc->PendingBytes = EndAddress - SpiHc->PendingAddress;
+}
+
+/**
+  Wait for the SPI cycle to complete.
+
+  This routine is called at TPL_NOTIFY.
+
+  Spin on the cycle in progress bit for the short cycles and then let the
+  environment specific code wait for the longer cycles.  The cycle done and
+  blocked access bits are cleared by the caller.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  DebugTransaction  Display the status register value
+  @param[in]  TimeoutUs         Maximum time for the cycle in microseconds
+  @param[out] SpiStatus         Receives the last value of the status register
+
+  @retval EFI_SUCCESS           The SPI cycle completed
+  @retval EFI_TIMEOUT           The SPI cycle did not complete within
+                                TimeoutUs
+
+**/
+STATIC
+EFI_STATUS
+SpiHcWaitForCycle (
+  IN SPI_HC *SpiHc,
+  IN BOOLEAN DebugTransaction,
+  IN UINTN TimeoutUs,
+  OUT UINT16 *SpiStatus
+  )
+{
+  UINTN Delay;
+  volatile UINT16 *SpiStatusRegister;
+  EFI_STATUS Status;
+
+  SpiStatusRegister = (volatile UINT16 *)(UINTN)(SpiHc->BaseAddress + SPISTS);
+  Status = EFI_SUCCESS;
+  Delay = 0;
+  while (((*SpiStatus = *SpiStatusRegister) & SPISTS_CIP) != 0) {
+    if (Delay >= SPI_HC_CYCLE_SPIN_US) {
+      Status = LegacySpiWaitForCycle (SpiHc, SpiStatusRegister, TimeoutUs,
+                                      SpiStatus);
+      break;
+    }
+    MicroSecondDelay (1);
+    Delay += 1;
+  }
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "0x%08x --> 0x%04x\n", SpiStatusRegister, *SpiStatus));
+  }
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiHc cycle did not complete, Status: %r\n",
+            Status));
+  }
+  return Status;
+}
+
+/**
+  Locate the opcode, address and data of a SPI transaction.
+
+  This routine is called at TPL_NOTIFY.
+
+  The phases are used directly when the SPI bus layer provides them.
+  Otherwise the opcode is the first byte of the write buffer.  A read
+  transaction includes an address when the write buffer holds at least four
+  bytes.  A write transaction includes an address for the page program and
+  erase opcodes, and for other opcodes, except write status, when the write
+  data does not fit in the data registers.
+
+  @param[in]  SpiHc             Pointer to the SPI_HC data structure.
+  @param[in]  BusTransaction    Pointer to a EFI_SPI_BUS_TRANSACTION containing
+                                the description of the SPI transaction
+  @param[in]  Write             TRUE when decoding a write transaction
+  @param[out] Command           Pointer to the SPI_HC_COMMAND structure to
+                                receive the opcode, address and data
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The command was decoded successfully
+  @retval EFI_UNSUPPORTED       The phases require dummy cycles, a 4-byte
+                                address or a multi-bit bus
+
+**/
+STATIC
+EFI_STATUS
+SpiHcDecodeCommand (
+  IN SPI_HC *SpiHc,
+  IN CONST EFI_SPI_BUS_TRANSACTION *BusTransaction,
+  IN BOOLEAN Write,
+  OUT SPI_HC_COMMAND *Command
+  )
+{
+  UINT8 Opcode;
+  CONST EFI_SPI_TRANSACTION_PHASES *Phases;
+  UINT8 *WriteBuffer;
+  UINTN WriteBytes;
+
+  Phases = BusTransaction->Phases;
+  if (Phases != NULL) {
+    //
+    // The hardware sequencer only supports 1-bit opcode, 3-byte address and
+    // data phases
+    //
+    if ((Phases->DummyCycles != 0) || (Phases->AddressBytes == 4)
+      || (Phases->OpcodeBusWidth != 1) || (Phases->DataBusWidth != 1)
+      || ((Phases->AddressBytes != 0) && (Phases->AddressBusWidth != 1))) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+        DEBUG ((EFI_D_ERROR, "ERROR - SpiHc does not support the phases!\n"));
+      }
+      return EFI_UNSUPPORTED;
+    }
+    Command->Opcode = Phases->Opcode;
+    Command->AddressBytes = Phases->AddressBytes;
+    Command->Address = (Phases->AddressBytes != 0)
+                     ? (Phases->Address & SPIADDR_CA) : 0;
+    Command->Data = BusTransaction->WriteBuffer;
+    Command->DataBytes = BusTransaction->WriteBytes;
+  } else {
+    //
+    // Parse the opcode and address from the write buffer
+    //
+    WriteBuffer = BusTransaction->WriteBuffer;
+    WriteBytes = BusTransaction->WriteBytes;
+    Opcode = WriteBuffer[0];
+    Command->Opcode = Opcode;
+    Command->AddressBytes = 0;
+    if (WriteBytes >= 4) {
+      if ((!Write)
+        || (Opcode == OPCODE_WRITE_DATA)
+        || (Opcode == OPCODE_ERASE_4KB)
+        || (Opcode == SpiHcReadOpcode (SpiHc, OPCODE_ERASE_BLOCK_INDEX))
+        || ((Opcode != OPCODE_WRITE_STATUS) && ((WriteBytes - 1) > 64))) {
+        Command->AddressBytes = 3;
+      }
+    }
+    Command->Address = 0;
+    if (Command->AddressBytes != 0) {
+      Command->Address = (WriteBuffer[1] << 16) | (WriteBuffer[2] << 8)
+                       | WriteBuffer[3];
+    }
+    Command->Data = &WriteBuffer[1 + Command->AddressBytes];
+    Command->DataBytes = WriteBytes - 1 - Command->AddressBytes;
+  }
+  Command->AddressData[0] = (UINT8)(Command->Address >> 16);
+  Command->AddressData[1] = (UINT8)(Command->Address >> 8);
+  Command->AddressData[2] = (UINT8)Command->Address;
+  return EFI_SUCCESS;
+}
+
 /**
   Perform the SPI transaction on the SPI peripheral using the SPI host
   controller.
@@ -289,6 +524,7 @@ SpiHcReadOpcode (
   @retval EFI_BAD_BUFFER_SIZE   The BusTransaction->ReadBytes value is invalid
   @retval EFI_UNSUPPORTED       The BusTransaction->TransactionType is
                                 unsupported
+  @retval EFI_TIMEOUT           The SPI cycle did not complete
 **/
 EFI_STATUS
 EFIAPI
@@ -301,6 +537,7 @@ SpiHcTransaction (
   UINT32 BaseAddress;
   UINT32 BiosControl;
   UINT32 BiosControlSaved;
+  SPI_HC_COMMAND Command;
   UINT16 Control;
   union {
     volatile UINT8 *Reg8;
@@ -313,6 +550,8 @@ SpiHcTransaction (
   UINT32 FlashAddress;
   UINT32 FrameSize;
   UINTN Index;
+  UINT32 ModifiedAddress;
+  UINT32 ModifiedBytes;
   UINT8 Opcode;
   UINT8 *ReadBuffer;
   UINTN ReadBytes;
@@ -320,6 +559,7 @@ SpiHcTransaction (
   SPI_HC *SpiHc;
   UINT16 SpiStatus;
   EFI_STATUS Status;
+  UINTN TimeoutUs;
   UINT8 *WriteBuffer;
   UINTN WriteBytes;
 
@@ -328,6 +568,7 @@ SpiHcTransaction (
   //
   SpiHc = SPI_HC_CONTEXT_FROM_PROTOCOL(This);
   BaseAddress = SpiHc->BaseAddress;
+  TimeoutUs = SPI_HC_CYCLE_TIMEOUT_US;
 
   //
   // Verify the transaction type independent input parameters
@@ -341,6 +582,8 @@ SpiHcTransaction (
   ReadBytes = BusTransaction->ReadBytes;
   ReadBuffer = BusTransaction->ReadBuffer;
   FlashAddress = 0;
+  ModifiedAddress = 0;
+  ModifiedBytes = 0;
   Status = EFI_SUCCESS;
 
   //
@@ -353,15 +596,23 @@ SpiHcTransaction (
     // ReadBytes must equal WriteBytes and both ReadBuffer and WriteBuffer
     // must be provided.
     //
-  case SPI_TRANSACTION_READ_ONLY:
-    //
-    // Data flowing from the SPI peripheral to the host.  WriteBytes must be
-    // zero.  ReadBytes must be non-zero and ReadBuffer must be provided.
-    //
   default:
     Status = EFI_UNSUPPORTED;
     break;
 
+  case SPI_TRANSACTION_READ_ONLY:
+    //
+    // Data flowing from the SPI peripheral to the host.  Only supported when
+    // the phases describe the opcode and address to send first.
+    //
+    if (BusTransaction->Phases == NULL) {
+      Status = EFI_UNSUPPORTED;
+      break;
+    }
+    //
+    // Fall through
+    //
+
   case SPI_TRANSACTION_WRITE_THEN_READ:
     //
     // Data first flowing from the host to the SPI peripheral and then data
@@ -369,47 +620,53 @@ SpiHcTransaction (
     // get used for SPI flash devices when control data (opcode, address) must
     // be passed to the SPI peripheral to specify the data to be read.
     //
-    ASSERT (WriteBytes != 0);
-    ASSERT (WriteBuffer != NULL);
+    ASSERT ((BusTransaction->Phases != NULL) || (WriteBytes != 0));
+    ASSERT ((WriteBytes == 0) || (WriteBuffer != NULL));
     ASSERT (ReadBytes != 0);
     ASSERT (ReadBytes <= 64);
     ASSERT (ReadBuffer != NULL);
+    Status = SpiHcDecodeCommand (SpiHc, BusTransaction, FALSE, &Command);
+    if (EFI_ERROR (Status)) {
+      break;
+    }
 
     //
     // Assume a read operation
     //
     SpiHc->Flags &= ~SPI_HC_FLAG_PREFIX_SENT;
-    Opcode = *WriteBuffer;
+    Opcode = Command.Opcode;
     if (Opcode == OPCODE_READ_DATA) {
       ///
       /// Read data from the SPI NOR flash part
       /// One command byte and 3 address bytes to send followed by one or more
       /// bytes of data to receive
       ///
-      ASSERT (WriteBytes == 4);
+      ASSERT (Command.AddressBytes == 3);
+      ASSERT (Command.DataBytes == 0);
       Index = OPCODE_READ_DATA_INDEX;
-      FlashAddress = (WriteBuffer[1] << 16) | (WriteBuffer[2] << 8)
-                   | WriteBuffer[3] | SpiHc->ChipSelect;
+      FlashAddress = Command.Address | SpiHc->ChipSelect;
     } else if (Opcode == OPCODE_READ_STATUS) {
       ///
       /// Read status register
       /// One command byte followed by one or two bytes to receive
       ///
-      ASSERT (WriteBytes == 1);
+      ASSERT (Command.AddressBytes == 0);
+      ASSERT (Command.DataBytes == 0);
       Index = OPCODE_READ_STATUS_INDEX;
     } else if (Opcode == OPCODE_READ_ID) {
       ///
       /// Read the three bytes of manufacture and device ID
       /// One command byte to send followed by 3 bytes of data to receive
       ///
-      ASSERT (WriteBytes == 1);
+      ASSERT (Command.AddressBytes == 0);
+      ASSERT (Command.DataBytes == 0);
       Index = OPCODE_READ_ID_INDEX;
     } else {
       //
       // Unknown opcode, map it to slot 0 if the controller is unlocked
       //
       if (SpiHc->ControllerLocked) {
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR,
                   "ERROR - SpiHc controller is locked!\n"));
         }
@@ -417,12 +674,12 @@ SpiHcTransaction (
         break;
       }
       Type = OPTYPE_READ_NO_ADDR;
-      if (WriteBytes == 4) {
-        FlashAddress = (WriteBuffer[1] << 16) | (WriteBuffer[2] << 8)
-                     | WriteBuffer[3] | SpiHc->ChipSelect;
+      if (Command.AddressBytes != 0) {
+        FlashAddress = Command.Address | SpiHc->ChipSelect;
         Type = OPTYPE_READ_ADDR;
-      } else if (WriteBytes != 1) {
-        if (BusTransaction->DebugTransaction) {
+      }
+      if (Command.DataBytes != 0) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR,
                   "ERROR - SpiHc could not properly map transaction!\n"));
         }
@@ -436,7 +693,7 @@ SpiHcTransaction (
     //
     // Initiate the read operation
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiHc: Starting the write-then-read SPI transaction\n"));
       DEBUG ((EFI_D_ERROR, "SpiHc: Sending data from 0x%08x, 0x%08x bytes\n",
@@ -445,7 +702,7 @@ SpiHcTransaction (
               ReadBuffer, ReadBytes));
     }
     Controller.U32 = BaseAddress + SPIADDR;
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%08x\n", Controller.U32,
               FlashAddress));
     }
@@ -454,7 +711,7 @@ SpiHcTransaction (
     Controller.U32 = BaseAddress + SPICTL;
     Control = (UINT16)(SPICTL_DC | SPICTL_ACS | SPICTL_AR | (Index << SPICTL_COPTR_SHIFT)
             | ((ReadBytes - 1) << SPICTL_DBCNT_SHIFT) | SPICTL_CG);
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%04x\n", Controller.U32, Control));
     }
     *Controller.Reg16 = Control;
@@ -464,20 +721,16 @@ SpiHcTransaction (
     // Wait for the operation to complete
     //
     Controller.U32 = BaseAddress + SPISTS;
-    do {
-      SpiStatus = *Controller.Reg16;
-      if (BusTransaction->DebugTransaction) {
-        DEBUG ((EFI_D_ERROR, "0x%08x --> 0x%04x\n", Controller.U32, SpiStatus));
-      }
-    } while ((SpiStatus & SPISTS_CIP) != 0);
-    if ((SpiStatus & SPISTS_BA) != 0) {
-      if (BusTransaction->DebugTransaction) {
+    Status = SpiHcWaitForCycle (SpiHc, BusTransaction->DebugTransaction,
+                                TimeoutUs, &SpiStatus);
+    if ((!EFI_ERROR (Status)) && ((SpiStatus & SPISTS_BA) != 0)) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR,
                 "ERROR - SpiHc blocked access, transaction failed!\n"));
       }
       Status = EFI_ACCESS_DENIED;
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%04x\n", Controller.U32,
               SPISTS_BA | SPISTS_CD));
     }
@@ -494,7 +747,7 @@ SpiHcTransaction (
     Controller.U32 = BaseAddress + SPID0_1;
     while (ReadBytes >= 4) {
       Data32 = *Controller.Reg32;
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "0x%08x --> 0x%08x\n", Controller.U32, Data32));
       }
       *(UINT32 *)ReadBuffer = Data32;
@@ -504,12 +757,23 @@ SpiHcTransaction (
     }
     while (ReadBytes--) {
       Data = *Controller.Reg8;
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "0x%08x --> 0x%02x\n", Controller.U32, Data));
       }
       *ReadBuffer++ = Data;
       Controller.U32 += 1;
     }
+
+    //
+    // Discard the stale flash data from the processor caches once the write
+    // or erase operation completes
+    //
+    if ((Opcode == OPCODE_READ_STATUS) && (SpiHc->PendingBytes != 0)
+      && ((BusTransaction->ReadBuffer[0] & SPI_STATUS1_BUSY) == 0)) {
+      SpiHcInvalidateWindow (SpiHc, SpiHc->PendingAddress,
+                             SpiHc->PendingBytes);
+      SpiHc->PendingBytes = 0;
+    }
     break;
 
   case SPI_TRANSACTION_WRITE_ONLY:
@@ -517,9 +781,13 @@ SpiHcTransaction (
     // Data flowing from the host to the SPI peripheral.  ReadBytes must be
     // zero.  WriteBytes must be non-zero and WriteBuffer must be provided.
     //
-    ASSERT (WriteBytes != 0);
-    ASSERT (WriteBuffer != NULL);
+    ASSERT ((BusTransaction->Phases != NULL) || (WriteBytes != 0));
+    ASSERT ((WriteBytes == 0) || (WriteBuffer != NULL));
     ASSERT (ReadBytes == 0);
+    Status = SpiHcDecodeCommand (SpiHc, BusTransaction, TRUE, &Command);
+    if (EFI_ERROR (Status)) {
+      break;
+    }
 
     //
     // This is a hardware flash controller.  As such, write operations must
@@ -527,7 +795,7 @@ SpiHcTransaction (
     // Consume single byte transactions which match one of the prefix opcodes.
     // Flag which opcode should be used on the next SPI transaction.
     //
-    Opcode = *WriteBuffer;
+    Opcode = Command.Opcode;
     if (Opcode == SpiHcReadPrefix (SpiHc, 0)) {
       SpiHc->Flags = SPI_HC_FLAG_PREFIX_SENT;
       break;
@@ -551,63 +819,80 @@ SpiHcTransaction (
       /// One prefix byte, one command byte and 3 address bytes to send
       /// followed by up to 256 bytes of data
       ///
-      ASSERT (WriteBytes > 4);
-      ASSERT (WriteBytes <= (4 + 64));
+      ASSERT (Command.AddressBytes == 3);
+      ASSERT (Command.DataBytes > 0);
+      ASSERT (Command.DataBytes <= 64);
       Index = OPCODE_WRITE_DATA_INDEX;
-      FlashAddress = (WriteBuffer[1] << 16) | (WriteBuffer[2] << 8)
-                   | WriteBuffer[3] | SpiHc->ChipSelect;
-      WriteBuffer += 4;
-      WriteBytes -= 4;
+      FlashAddress = Command.Address | SpiHc->ChipSelect;
+      WriteBuffer = Command.Data;
+      WriteBytes = Command.DataBytes;
+      ModifiedAddress = Command.Address;
+      ModifiedBytes = (UINT32)WriteBytes;
     } else if (Opcode == OPCODE_ERASE_4KB) {
       ///
       /// Erase 4 KBytes
-      /// One prefix byte, one command byte and 3 address bytes to send
+      /// One prefix byte, one command byte and 3 address bytes to send, the
+      /// address is sent as data
       ///
-      ASSERT (WriteBytes == 4);
+      ASSERT (Command.AddressBytes == 3);
+      ASSERT (Command.DataBytes == 0);
       Index = OPCODE_ERASE_4KB_INDEX;
-      WriteBuffer += 1;
-      WriteBytes -= 1;
+      TimeoutUs = SPI_HC_ERASE_4KB_TIMEOUT_US;
+      ModifiedAddress = Command.Address & ~(SIZE_4KB - 1);
+      ModifiedBytes = SIZE_4KB;
+      WriteBuffer = Command.AddressData;
+      WriteBytes = sizeof (Command.AddressData);
     } else if (Opcode == SpiHcReadOpcode (SpiHc, OPCODE_ERASE_BLOCK_INDEX)) {
       ///
       /// Erase block
-      /// One prefix byte, one command byte and 3 address bytes to send
+      /// One prefix byte, one command byte and 3 address bytes to send, the
+      /// address is sent as data
       ///
-      ASSERT (WriteBytes == 4);
+      ASSERT (Command.AddressBytes == 3);
+      ASSERT (Command.DataBytes == 0);
       Index = OPCODE_ERASE_BLOCK_INDEX;
-      WriteBuffer += 1;
-      WriteBytes -= 1;
+      TimeoutUs = SPI_HC_ERASE_BLOCK_TIMEOUT_US;
+      ModifiedBytes = (Opcode == OPCODE_ERASE_64KB) ? SIZE_64KB : SIZE_32KB;
+      ModifiedAddress = Command.Address & ~(ModifiedBytes - 1);
+      WriteBuffer = Command.AddressData;
+      WriteBytes = sizeof (Command.AddressData);
     } else if (Opcode == OPCODE_WRITE_STATUS) {
       ///
       /// Write status
       /// One prefix byte, one command byte and one or two bytes of data to send
       ///
-      ASSERT (WriteBytes > 1);
-      ASSERT (WriteBytes <= (1 + 64));
+      ASSERT (Command.AddressBytes == 0);
+      ASSERT (Command.DataBytes > 0);
+      ASSERT (Command.DataBytes <= 64);
       Index = OPCODE_WRITE_STATUS_INDEX;
-      WriteBuffer += 1;
-      WriteBytes -= 1;
+      WriteBuffer = Command.Data;
+      WriteBytes = Command.DataBytes;
     } else {
       //
       // Unknown opcode, map it to slot 0 if the controller is unlocked
       //
       if (SpiHc->ControllerLocked) {
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR,
                   "ERROR - SpiHc controller is locked!\n"));
         }
         Status = EFI_ACCESS_DENIED;
         break;
       }
-      WriteBuffer += 1;
-      WriteBytes -= 1;
+      if (Opcode == SPI_NOR_CHIP_ERASE) {
+        ModifiedBytes = SpiHc->WindowBytes;
+        TimeoutUs = SPI_HC_CHIP_ERASE_TIMEOUT_US;
+      } else if ((Opcode == SPI_NOR_ERASE_32KB)
+        || (Opcode == SPI_NOR_ERASE_64KB)) {
+        TimeoutUs = SPI_HC_ERASE_BLOCK_TIMEOUT_US;
+      }
       Type = OPTYPE_WRITE_NO_ADDR;
-      if (WriteBytes > 64) {
-        FlashAddress = (WriteBuffer[0] << 16) | (WriteBuffer[1] << 8)
-                     | WriteBuffer[2] | SpiHc->ChipSelect;
-        WriteBuffer += 3;
-        WriteBytes -= 3;
+      if (Command.AddressBytes != 0) {
+        FlashAddress = Command.Address | SpiHc->ChipSelect;
         Type = OPTYPE_WRITE_ADDR;
       }
+      WriteBuffer = Command.Data;
+      WriteBytes = Command.DataBytes;
       Index = 0;
       SpiHcOpcode (SpiHc, Index, Type, Opcode);
     }
@@ -615,7 +900,7 @@ SpiHcTransaction (
     //
     // Initiate the write operation
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiHc: Starting the write-only SPI transaction\n"));
       DEBUG ((EFI_D_ERROR, "SpiHc: Sending data from 0x%08x, 0x%08x bytes\n",
               WriteBuffer, WriteBytes));
@@ -628,7 +913,7 @@ SpiHcTransaction (
     Address = PCI_LIB_ADDRESS (0, 31, 0, BC);
     BiosControlSaved = PciRead32 (Address);
     BiosControl = (BiosControlSaved & ~BC_PFE) | BC_CD | BC_WPD;
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "BIOS Control --> 0x%08x\n", BiosControlSaved));
       DEBUG ((EFI_D_ERROR, "BIOS Control <-- 0x%08x\n", BiosControl));
     }
@@ -638,15 +923,18 @@ SpiHcTransaction (
     // Setup the hardware flash controller for the transfer
     //
     Controller.U32 = BaseAddress + SPIADDR;
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%08x\n", Controller.U32,
               FlashAddress));
     }
     *Controller.Reg32 = FlashAddress;
     *Controller.Reg32;
-    Control = (UINT16)(SPICTL_DC | SPICTL_ACS | SPICTL_AR | ((UINT16)Index << SPICTL_COPTR_SHIFT)
+    Control = (UINT16)(SPICTL_ACS | SPICTL_AR | ((UINT16)Index << SPICTL_COPTR_SHIFT)
             | ((SpiHc->Flags & SPI_HC_FLAG_USE_PREFIX_1) ? SPICTL_SOPTR : 0)
-            | ((WriteBytes - 1) << SPICTL_DBCNT_SHIFT) | SPICTL_CG);
+            | SPICTL_CG);
+    if (WriteBytes != 0) {
+      Control |= (UINT16)(SPICTL_DC | ((WriteBytes - 1) << SPICTL_DBCNT_SHIFT));
+    }
 
     //
     // Move the write data into the hardware flash controller
@@ -655,7 +943,7 @@ SpiHcTransaction (
     Controller.U32 = BaseAddress + SPID0_1;
     while (WriteBytes >= 4) {
       Data32 = *(UINT32 *)WriteBuffer;
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%08x\n", Controller.U32, Data32));
       }
       *Controller.Reg32 = Data32;
@@ -666,7 +954,7 @@ SpiHcTransaction (
     }
     while (WriteBytes--) {
       Data = *WriteBuffer++;
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%02x\n", Controller.U32, Data));
       }
       *Controller.Reg8 = Data;
@@ -678,7 +966,7 @@ SpiHcTransaction (
     // Start the write operation
     //
     Controller.U32 = BaseAddress + SPICTL;
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%04x\n", Controller.U32, Control));
     }
     *Controller.Reg16 = Control;
@@ -688,30 +976,32 @@ SpiHcTransaction (
     // Wait for the operation to complete
     //
     Controller.U32 = BaseAddress + SPISTS;
-    do {
-      SpiStatus = *Controller.Reg16;
-      if (BusTransaction->DebugTransaction) {
-        DEBUG ((EFI_D_ERROR, "0x%08x --> 0x%04x\n", Controller.U32, SpiStatus));
-      }
-    } while ((SpiStatus & SPISTS_CIP) != 0);
-    if ((SpiStatus & SPISTS_BA) != 0) {
-      if (BusTransaction->DebugTransaction) {
+    Status = SpiHcWaitForCycle (SpiHc, BusTransaction->DebugTransaction,
+                                TimeoutUs, &SpiStatus);
+    if ((!EFI_ERROR (Status)) && ((SpiStatus & SPISTS_BA) != 0)) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR,
                 "ERROR - SpiHc blocked access, transaction failed!\n"));
       }
       Status = EFI_ACCESS_DENIED;
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "0x%08x <-- 0x%04x\n", Controller.U32,
               SPISTS_BA | SPISTS_CD));
     }
     *Controller.Reg16 = SPISTS_BA | SPISTS_CD;
     *Controller.Reg16;
 
+    //
+    // Discard the stale flash data from the processor caches after the flash
+    // part completes the operation
+    //
+    SpiHcPendInvalidate (SpiHc, ModifiedAddress, ModifiedBytes);
+
     //
     // Restore the BIOS control
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "BIOS Control <-- 0x%08x\n", BiosControlSaved));
     }
     PciWrite32 (Address, BiosControlSaved);
@@ -1248,7 +1538,7 @@ SpiHcInitialize (
   //
   // Allocate the SPI host controller data structure
   //
-  SpiHc = AllocateZeroPool (sizeof (SPI_HC));
+  SpiHc = AllocateRuntimeZeroPool (sizeof (SPI_HC));
   *SpiHcPtr = SpiHc;
   if (SpiHc == NULL) {
     DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI_HC!\n"));
@@ -1279,6 +1569,13 @@ SpiHcInitialize (
   SpiHc->BaseAddress &= RCBA_BA;
   DEBUG ((EFI_D_INFO, "0x%08x: SPI HC Base Address\n", SpiHc->BaseAddress));
 
+  //
+  // Enable prefetching and caching of the memory mapped flash reads.  Both
+  // are disabled by SpiHcTransaction around the write and erase operations.
+  //
+  Address = PCI_LIB_ADDRESS (0, 31, 0, BC);
+  PciWrite32 (Address, (PciRead32 (Address) | BC_PFE) & ~BC_CD);
+
   //
   // Initialize the prefix table
   //
@@ -1324,7 +1621,8 @@ SpiHcInitialize (
   //
   SpiHc->Signature = SPI_HC_SIGNATURE;
   SpiHc->SpiHcProtocol.Attributes = HC_SUPPORTS_WRITE_ONLY_OPERATIONS
-                                  | HC_SUPPORTS_WRITE_THEN_READ_OPERATIONS;
+                                  | HC_SUPPORTS_WRITE_THEN_READ_OPERATIONS
+                                  | HC_SUPPORTS_TRANSACTION_PHASES;
   SpiHc->SpiHcProtocol.FrameSizeSupportMask = SUPPORT_FRAME_SIZE_BITS (8);
   SpiHc->SpiHcProtocol.MaximumTransferBytes = 64;
 
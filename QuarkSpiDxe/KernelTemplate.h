@@ -1,6 +1,20 @@
 /** @file
 
-  This module implements the 16-bit transfer routines.
+  This module is the template for the SPI transfer routines.
+
+  Kernels.c includes this file once for each FIFO access width.  Before each
+  include the following macros must be defined:
+
+    SPI_FRAME_TYPE    - Data type of a single frame in the data buffers
+    SPI_FRAME_BITS    - Number of bits in SPI_FRAME_TYPE, used in the names
+    SPI_FRAME_SHIFT   - Shift value that converts a byte count to frames
+    SPI_FRAME_SWAP    - Conversion between the buffer and FIFO frame layout
+
+  Each transaction type gets its own kernel.  The kernels are specialized for
+  the data flowing in each direction: transmit data comes either from the
+  write buffer or is a constant zero, and receive data is either placed into
+  the read buffer or discarded.  As a result, the inner loops contain no
+  tests for data that is never used.
 
 Copyright (c) 2016, Intel Corporation. All rights reserved.<BR>
 This program and the accompanying materials are licensed and made available
@@ -18,7 +32,10 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 **/
 
-#include "QuarkSpiDxe.h"
+#if !defined (SPI_FRAME_TYPE) || !defined (SPI_FRAME_BITS) \
+  || !defined (SPI_FRAME_SHIFT) || !defined (SPI_FRAME_SWAP)
+#error "Define the SPI_FRAME_* macros before including KernelTemplate.h"
+#endif
 
 /**
   Perform a full-duplex SPI transaction with the SPI peripheral using the SPI
@@ -28,34 +45,39 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
   @param[in]  BaseAddress       Address of the SPI host controller registers
   @param[in]  WriteBytes        Number of bytes to send to the SPI peripheral
-  @param[in]  WriteBuffer       Pointer to the data to send to the SPI
+  @param[in]  WriteData         Pointer to the data to send to the SPI
                                 peripheral
   @param[in]  ReadBytes         Number of bytes to receive from the SPI
                                 peripheral
-  @param[in]  ReadBuffer        Pointer to the receive data buffer
+  @param[in]  ReadData          Pointer to the receive data buffer
 **/
 VOID
 EFIAPI
-SpiHc16BitFullDuplexTransaction (
+SPI_HC_KERNEL (SPI_FRAME_BITS, FullDuplex) (
   IN UINT32 BaseAddress,
   IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
+  IN VOID *WriteData,
   IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
+  IN VOID *ReadData
   )
 {
   union {
     volatile UINT32 *Reg;
     UINT32 U32;
   } Controller;
+  SPI_FRAME_TYPE *ReadBuffer;
   UINT32 Sssr;
+  SPI_FRAME_TYPE *WriteBuffer;
+
+  WriteBuffer = WriteData;
+  ReadBuffer = ReadData;
+  WriteBytes >>= SPI_FRAME_SHIFT;
+  ReadBytes >>= SPI_FRAME_SHIFT;
 
   //
   // Start the SPI transaction
   // Send the data to the SPI peripheral
   //
-  WriteBytes /= 2;
-  ReadBytes /= 2;
   while (WriteBytes) {
     //
     // Determine if space is available in the FIFO
@@ -64,24 +86,24 @@ SpiHc16BitFullDuplexTransaction (
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_TNF) != 0) {
       //
-      // Send the next data byte to the SPI peripheral
+      // Send the next data frame to the SPI peripheral
       //
       WriteBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *Controller.Reg = *WriteBuffer++;
+      *Controller.Reg = SPI_FRAME_SWAP (*WriteBuffer++);
     }
 
     //
     // Save any receive data
-    // Determine if a receive byte is in the FIFO
+    // Determine if a receive frame is in the FIFO
     //
     if ((Sssr & SSSR_RNE) != 0) {
       //
-      // Place the receive data byte into the buffer
+      // Place the receive data frame into the buffer
       //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *ReadBuffer++ = (UINT16)*Controller.Reg;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
     }
   }
 
@@ -89,19 +111,12 @@ SpiHc16BitFullDuplexTransaction (
   //  Finish receiving the data
   //
   while (ReadBytes) {
-    //
-    // Save any receive data
-    // Determine if a receive byte is in the FIFO
-    //
     Controller.U32 = BaseAddress + SSSR;
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Place the receive data byte into the buffer
-      //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *ReadBuffer++ = (UINT16)*Controller.Reg;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
     }
   }
 }
@@ -112,22 +127,24 @@ SpiHc16BitFullDuplexTransaction (
 
   This routine is called at TPL_NOTIFY.
 
+  The receive data is discarded.
+
   @param[in]  BaseAddress       Address of the SPI host controller registers
   @param[in]  WriteBytes        Number of bytes to send to the SPI peripheral
-  @param[in]  WriteBuffer       Pointer to the data to send to the SPI
+  @param[in]  WriteData         Pointer to the data to send to the SPI
                                 peripheral
   @param[in]  ReadBytes         Number of bytes to receive from the SPI
-                                peripheral
-  @param[in]  ReadBuffer        Pointer to the receive data buffer
+                                peripheral, must equal WriteBytes
+  @param[in]  ReadData          Not used
 **/
 VOID
 EFIAPI
-SpiHc16BitWriteOnlyTransaction (
+SPI_HC_KERNEL (SPI_FRAME_BITS, WriteOnly) (
   IN UINT32 BaseAddress,
   IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
+  IN VOID *WriteData,
   IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
+  IN VOID *ReadData
   )
 {
   union {
@@ -135,13 +152,16 @@ SpiHc16BitWriteOnlyTransaction (
     UINT32 U32;
   } Controller;
   UINT32 Sssr;
+  SPI_FRAME_TYPE *WriteBuffer;
+
+  WriteBuffer = WriteData;
+  WriteBytes >>= SPI_FRAME_SHIFT;
+  ReadBytes >>= SPI_FRAME_SHIFT;
 
   //
   // Start the SPI transaction
   // Send the data to the SPI peripheral
   //
-  WriteBytes /= 2;
-  ReadBytes /= 2;
   while (WriteBytes) {
     //
     // Determine if space is available in the FIFO
@@ -150,21 +170,17 @@ SpiHc16BitWriteOnlyTransaction (
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_TNF) != 0) {
       //
-      // Send the next data byte to the SPI peripheral
+      // Send the next data frame to the SPI peripheral
       //
       WriteBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *Controller.Reg = *WriteBuffer++;
+      *Controller.Reg = SPI_FRAME_SWAP (*WriteBuffer++);
     }
 
     //
-    // Discard receive data
-    // Determine if a receive byte is in the FIFO
+    // Discard the receive data frame
     //
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Discard the receive data byte
-      //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
       *Controller.Reg;
@@ -172,22 +188,92 @@ SpiHc16BitWriteOnlyTransaction (
   }
 
   //
-  //  Finish discarding the receiving the data
+  //  Finish discarding the receive data
   //
   while (ReadBytes) {
+    Controller.U32 = BaseAddress + SSSR;
+    Sssr = *Controller.Reg;
+    if ((Sssr & SSSR_RNE) != 0) {
+      ReadBytes -= 1;
+      Controller.U32 = BaseAddress + SSDR;
+      *Controller.Reg;
+    }
+  }
+}
+
+/**
+  Perform a read-only SPI transaction with the SPI peripheral using the SPI
+  host controller.
+
+  This routine is called at TPL_NOTIFY.
+
+  Zeros are sent to the SPI peripheral to clock in the receive data.
+
+  @param[in]  BaseAddress       Address of the SPI host controller registers
+  @param[in]  WriteBytes        Not used
+  @param[in]  WriteData         Not used
+  @param[in]  ReadBytes         Number of bytes to receive from the SPI
+                                peripheral
+  @param[in]  ReadData          Pointer to the receive data buffer
+**/
+VOID
+EFIAPI
+SPI_HC_KERNEL (SPI_FRAME_BITS, ReadOnly) (
+  IN UINT32 BaseAddress,
+  IN UINTN WriteBytes,
+  IN VOID *WriteData,
+  IN UINTN ReadBytes,
+  IN VOID *ReadData
+  )
+{
+  union {
+    volatile UINT32 *Reg;
+    UINT32 U32;
+  } Controller;
+  SPI_FRAME_TYPE *ReadBuffer;
+  UINT32 Sssr;
+  UINTN ZeroBytes;
+
+  ReadBuffer = ReadData;
+  ReadBytes >>= SPI_FRAME_SHIFT;
+  ZeroBytes = ReadBytes;
+
+  //
+  // Start the SPI transaction
+  // Send zeros to the SPI peripheral
+  //
+  while (ZeroBytes) {
     //
-    // Save any receive data
-    // Determine if a receive byte is in the FIFO
+    // Determine if space is available in the FIFO
     //
     Controller.U32 = BaseAddress + SSSR;
     Sssr = *Controller.Reg;
+    if ((Sssr & SSSR_TNF) != 0) {
+      ZeroBytes -= 1;
+      Controller.U32 = BaseAddress + SSDR;
+      *Controller.Reg = 0;
+    }
+
+    //
+    // Place the receive data frame into the buffer
+    //
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Place the receive data byte into the buffer
-      //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *Controller.Reg;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
+    }
+  }
+
+  //
+  //  Finish receiving the data
+  //
+  while (ReadBytes) {
+    Controller.U32 = BaseAddress + SSSR;
+    Sssr = *Controller.Reg;
+    if ((Sssr & SSSR_RNE) != 0) {
+      ReadBytes -= 1;
+      Controller.U32 = BaseAddress + SSDR;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
     }
   }
 }
@@ -198,22 +284,25 @@ SpiHc16BitWriteOnlyTransaction (
 
   This routine is called at TPL_NOTIFY.
 
+  The data received while sending the write buffer is discarded.  Zeros are
+  sent to the SPI peripheral to clock in the read data.
+
   @param[in]  BaseAddress       Address of the SPI host controller registers
   @param[in]  WriteBytes        Number of bytes to send to the SPI peripheral
-  @param[in]  WriteBuffer       Pointer to the data to send to the SPI
+  @param[in]  WriteData         Pointer to the data to send to the SPI
                                 peripheral
   @param[in]  ReadBytes         Number of bytes to receive from the SPI
                                 peripheral
-  @param[in]  ReadBuffer        Pointer to the receive data buffer
+  @param[in]  ReadData          Pointer to the receive data buffer
 **/
 VOID
 EFIAPI
-SpiHc16BitWriteThenReadTransaction (
+SPI_HC_KERNEL (SPI_FRAME_BITS, WriteThenRead) (
   IN UINT32 BaseAddress,
   IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
+  IN VOID *WriteData,
   IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
+  IN VOID *ReadData
   )
 {
   union {
@@ -221,15 +310,20 @@ SpiHc16BitWriteThenReadTransaction (
     UINT32 U32;
   } Controller;
   UINTN DiscardBytes;
+  SPI_FRAME_TYPE *ReadBuffer;
   UINT32 Sssr;
+  SPI_FRAME_TYPE *WriteBuffer;
   UINTN ZeroBytes;
 
+  WriteBuffer = WriteData;
+  ReadBuffer = ReadData;
+  WriteBytes >>= SPI_FRAME_SHIFT;
+  ReadBytes >>= SPI_FRAME_SHIFT;
+
   //
   // Start the SPI transaction
   // Send the data to the SPI peripheral
   //
-  WriteBytes /= 2;
-  ReadBytes /= 2;
   DiscardBytes = WriteBytes;
   ZeroBytes = ReadBytes;
   while (WriteBytes) {
@@ -240,21 +334,17 @@ SpiHc16BitWriteThenReadTransaction (
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_TNF) != 0) {
       //
-      // Send the next data byte to the SPI peripheral
+      // Send the next data frame to the SPI peripheral
       //
       WriteBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *Controller.Reg = *WriteBuffer++;
+      *Controller.Reg = SPI_FRAME_SWAP (*WriteBuffer++);
     }
 
     //
     // Discard the initial receive data
-    // Determine if a receive byte is in the FIFO
     //
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Discard this receive data byte
-      //
       DiscardBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
       *Controller.Reg;
@@ -262,30 +352,17 @@ SpiHc16BitWriteThenReadTransaction (
   }
 
   //
-  // Finish discarding the receive bytes
+  // Finish discarding the receive frames while starting to send the zeros
   //
   while (DiscardBytes) {
-    //
-    // Determine if space is available in the FIFO
-    //
     Controller.U32 = BaseAddress + SSSR;
     Sssr = *Controller.Reg;
     if (ZeroBytes && ((Sssr & SSSR_TNF) != 0)) {
-      //
-      // Send zeros to the SPI peripheral
-      //
       ZeroBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
       *Controller.Reg = 0;
     }
-
-    //
-    // Determine if a receive byte is in the FIFO
-    //
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Discard this receive data byte
-      //
       DiscardBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
       *Controller.Reg;
@@ -293,33 +370,20 @@ SpiHc16BitWriteThenReadTransaction (
   }
 
   //
-  // Start receiving the data
+  // Send the remaining zeros and start receiving the data
   //
   while (ZeroBytes) {
-    //
-    // Determine if space is available in the FIFO
-    //
     Controller.U32 = BaseAddress + SSSR;
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_TNF) != 0) {
-      //
-      // Send zeros to the SPI peripheral
-      //
       ZeroBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
       *Controller.Reg = 0;
     }
-
-    //
-    // Determine if a receive byte is in the FIFO
-    //
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Place the receive data into the receive buffer
-      //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *ReadBuffer++ = (UINT16)*Controller.Reg;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
     }
   }
 
@@ -327,19 +391,12 @@ SpiHc16BitWriteThenReadTransaction (
   //  Finish receiving the data
   //
   while (ReadBytes) {
-    //
-    // Save any receive data
-    // Determine if a receive byte is in the FIFO
-    //
     Controller.U32 = BaseAddress + SSSR;
     Sssr = *Controller.Reg;
     if ((Sssr & SSSR_RNE) != 0) {
-      //
-      // Place the receive data byte into the buffer
-      //
       ReadBytes -= 1;
       Controller.U32 = BaseAddress + SSDR;
-      *ReadBuffer++ = (UINT16)*Controller.Reg;
+      *ReadBuffer++ = (SPI_FRAME_TYPE)SPI_FRAME_SWAP (*Controller.Reg);
     }
   }
 }
@@ -0,0 +1,124 @@
+/** @file
+
+  This module generates the 8, 16 and 32-bit transfer routines.
+
+Copyright (c) 2016, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "QuarkSpiDxe.h"
+
+//
+// Frame sizes 1 - 8 bits
+//
+#define SPI_FRAME_TYPE          UINT8
+#define SPI_FRAME_BITS          8
+#define SPI_FRAME_SHIFT         0
+#define SPI_FRAME_SWAP(Frame)   (Frame)
+#include "KernelTemplate.h"
+#undef SPI_FRAME_TYPE
+#undef SPI_FRAME_BITS
+#undef SPI_FRAME_SHIFT
+#undef SPI_FRAME_SWAP
+
+//
+// Frame sizes 9 - 16 bits
+//
+#define SPI_FRAME_TYPE          UINT16
+#define SPI_FRAME_BITS          16
+#define SPI_FRAME_SHIFT         1
+#define SPI_FRAME_SWAP(Frame)   (Frame)
+#include "KernelTemplate.h"
+#undef SPI_FRAME_TYPE
+#undef SPI_FRAME_BITS
+#undef SPI_FRAME_SHIFT
+#undef SPI_FRAME_SWAP
+
+//
+// Frame sizes 17 - 32 bits
+//
+#define SPI_FRAME_TYPE          UINT32
+#define SPI_FRAME_BITS          32
+#define SPI_FRAME_SHIFT         2
+#define SPI_FRAME_SWAP(Frame)   (Frame)
+#include "KernelTemplate.h"
+#undef SPI_FRAME_TYPE
+#undef SPI_FRAME_BITS
+#undef SPI_FRAME_SHIFT
+#undef SPI_FRAME_SWAP
+
+//
+// Byte streams packed into 32-bit frames
+//
+// The SPI controller shifts the most significant bit of the frame out first.
+// Swap the bytes so that the first byte in the buffer is sent first and the
+// first byte received is placed first in the buffer.  The byte streams are
+// not aligned, IA32 and X64 support unaligned 32-bit accesses.
+//
+#define SPI_FRAME_TYPE          UINT32
+#define SPI_FRAME_BITS          Packed32
+#define SPI_FRAME_SHIFT         2
+#define SPI_FRAME_SWAP(Frame)   SwapBytes32 (Frame)
+#include "KernelTemplate.h"
+#undef SPI_FRAME_TYPE
+#undef SPI_FRAME_BITS
+#undef SPI_FRAME_SHIFT
+#undef SPI_FRAME_SWAP
+
+//
+// Kernel table indexed by [SPI_TRANSACTION_TYPE][frame width]
+//
+CONST SPI_TRANSACTION mSpiHcKernels[SPI_HC_TRANSACTION_TYPES][SPI_HC_FRAME_WIDTHS] = {
+  //
+  // SPI_TRANSACTION_FULL_DUPLEX
+  //
+  {
+    SpiHc8BitFullDuplexTransaction,
+    SpiHc16BitFullDuplexTransaction,
+    SpiHc32BitFullDuplexTransaction
+  },
+
+  //
+  // SPI_TRANSACTION_WRITE_ONLY
+  //
+  {
+    SpiHc8BitWriteOnlyTransaction,
+    SpiHc16BitWriteOnlyTransaction,
+    SpiHc32BitWriteOnlyTransaction
+  },
+
+  //
+  // SPI_TRANSACTION_READ_ONLY
+  //
+  {
+    SpiHc8BitReadOnlyTransaction,
+    SpiHc16BitReadOnlyTransaction,
+    SpiHc32BitReadOnlyTransaction
+  },
+
+  //
+  // SPI_TRANSACTION_WRITE_THEN_READ
+  //
+  {
+    SpiHc8BitWriteThenReadTransaction,
+    SpiHc16BitWriteThenReadTransaction,
+    SpiHc32BitWriteThenReadTransaction
+  }
+};
+
+//
+// Packed kernel table indexed by [SPI_TRANSACTION_TYPE]
+//
+CONST SPI_TRANSACTION mSpiHcPackedKernels[SPI_HC_TRANSACTION_TYPES] = {
+  SpiHcPacked32BitFullDuplexTransaction,
+  SpiHcPacked32BitWriteOnlyTransaction,
+  SpiHcPacked32BitReadOnlyTransaction,
+  SpiHcPacked32BitWriteThenReadTransaction
+};
@@ -18,8 +18,10 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include <Uefi.h>
 #include <IndustryStandard/Pci.h>
+#include <Library/BaseLib.h>
 #include <Library/DebugLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiLib.h>
 #include <Protocol/DriverBinding.h>
 #include <Protocol/PciIo.h>
@@ -29,6 +31,13 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define   INTEL_VENDOR_ID          0x8086
 #define   QUARK_SPI_DEVICE_ID      0x0935
 
+//
+// Debug output for the transaction, removed by the compiler when
+// PcdSpiDebugTransaction is FALSE
+//
+#define SPI_DEBUG(DebugTransaction)                                           \
+  (FixedPcdGetBool (PcdSpiDebugTransaction) && (DebugTransaction))
+
 //
 // SSCR0 - SPI Control Register 0
 //         Datasheet 20.5.1
@@ -175,94 +184,55 @@ SpiHcStartup (
   IN EFI_HANDLE ControllerHandle
   );
 
-VOID
-EFIAPI
-SpiHc8BitFullDuplexTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT8* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT8* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc8BitWriteOnlyTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT8* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT8* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc8BitWriteThenReadTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT8* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT8* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc16BitFullDuplexTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc16BitWriteOnlyTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc16BitWriteThenReadTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT16* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT16* ReadBuffer
-  );
-
-VOID
-EFIAPI
-SpiHc32BitFullDuplexTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT32* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT32* ReadBuffer
-  );
+//
+// Transfer routines generated by Kernels.c
+//
+#define SPI_HC_FRAME_WIDTHS       3   // 8, 16 and 32-bit FIFO accesses
+#define SPI_HC_TRANSACTION_TYPES  (SPI_TRANSACTION_WRITE_THEN_READ + 1)
 
-VOID
-EFIAPI
-SpiHc32BitWriteOnlyTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT32* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT32* ReadBuffer
-  );
+//
+// Byte streams of at least this length are packed into 32-bit frames
+//
+#define SPI_HC_PACKED_THRESHOLD   16
 
-VOID
-EFIAPI
-SpiHc32BitWriteThenReadTransaction (
-  IN UINT32 BaseAddress,
-  IN UINTN WriteBytes,
-  IN UINT32* WriteBuffer,
-  IN UINTN ReadBytes,
-  IN UINT32* ReadBuffer
-  );
+//
+// Opcode, 4-byte address and the maximum number of dummy bytes
+//
+#define SPI_HC_COMMAND_BYTES      (1 + 4 + (MAX_UINT8 / 8))
+
+#define SPI_HC_KERNEL(Bits, Type)       SPI_HC_KERNEL_NAME (Bits, Type)
+#define SPI_HC_KERNEL_NAME(Bits, Type)  SpiHc##Bits##Bit##Type##Transaction
+
+#define SPI_HC_KERNEL_PROTOTYPE(Bits, Type) \
+  VOID                                      \
+  EFIAPI                                    \
+  SPI_HC_KERNEL (Bits, Type) (              \
+    IN UINT32 BaseAddress,                  \
+    IN UINTN WriteBytes,                    \
+    IN VOID *WriteData,                     \
+    IN UINTN ReadBytes,                     \
+    IN VOID *ReadData                       \
+    )
+
+SPI_HC_KERNEL_PROTOTYPE (8, FullDuplex);
+SPI_HC_KERNEL_PROTOTYPE (8, WriteOnly);
+SPI_HC_KERNEL_PROTOTYPE (8, ReadOnly);
+SPI_HC_KERNEL_PROTOTYPE (8, WriteThenRead);
+SPI_HC_KERNEL_PROTOTYPE (16, FullDuplex);
+SPI_HC_KERNEL_PROTOTYPE (16, WriteOnly);
+SPI_HC_KERNEL_PROTOTYPE (16, ReadOnly);
+SPI_HC_KERNEL_PROTOTYPE (16, WriteThenRead);
+SPI_HC_KERNEL_PROTOTYPE (32, FullDuplex);
+SPI_HC_KERNEL_PROTOTYPE (32, WriteOnly);
+SPI_HC_KERNEL_PROTOTYPE (32, ReadOnly);
+SPI_HC_KERNEL_PROTOTYPE (32, WriteThenRead);
+SPI_HC_KERNEL_PROTOTYPE (Packed32, FullDuplex);
+SPI_HC_KERNEL_PROTOTYPE (Packed32, WriteOnly);
+SPI_HC_KERNEL_PROTOTYPE (Packed32, ReadOnly);
+SPI_HC_KERNEL_PROTOTYPE (Packed32, WriteThenRead);
+
+extern CONST SPI_TRANSACTION
+               mSpiHcKernels[SPI_HC_TRANSACTION_TYPES][SPI_HC_FRAME_WIDTHS];
+extern CONST SPI_TRANSACTION mSpiHcPackedKernels[SPI_HC_TRANSACTION_TYPES];
 
 #endif	// __QUARK_SPI_DXE_H__
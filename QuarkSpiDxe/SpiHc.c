@@ -147,6 +147,172 @@ SpiHcClock (
   return EFI_SUCCESS;
 }
 
+/**
+  Enable the SPI controller using the specified frame size.
+
+  This routine is called at TPL_NOTIFY.
+
+  The data size select field may only be changed while the SPI controller is
+  disabled.  The transfer routines wait for the last receive frame, so the
+  shift register is idle when this routine is called.  The chip select is
+  not driven by the SPI controller and remains asserted.
+
+  @param[in]  SpiHc             Pointer to a SPI_HC data structure.
+  @param[in]  FrameSize         Number of bits in each frame
+
+**/
+STATIC
+VOID
+SpiHcSetFrameSize (
+  IN SPI_HC *SpiHc,
+  IN UINT32 FrameSize
+  )
+{
+  union {
+    volatile UINT32 *Reg;
+    UINT32 U32;
+  } Controller;
+
+  Controller.U32 = SpiHc->BaseAddress + SSCR0;
+  *Controller.Reg = 0;
+  MemoryFence ();
+  *Controller.Reg = SpiHc->Sscr0 | SSCR0_SSE | (FrameSize - 1);
+  MemoryFence ();
+}
+
+/**
+  Perform a byte-stream SPI transaction using 32-bit frames.
+
+  This routine is called at TPL_NOTIFY with the SPI controller enabled for
+  8-bit frames.
+
+  Each 32-bit frame carries four bytes of the stream, reducing the number of
+  SSSR and SSDR accesses by a factor of four.  The bytes are swapped so that
+  the same bit sequence appears on the SPI bus as when using 8-bit frames.
+  The write phase (opcode, address and dummy bytes) of a write-then-read
+  transaction is sent using 8-bit frames unless it is a multiple of four
+  bytes.  The remaining bytes of the stream which do not fill a 32-bit frame
+  are transferred using 8-bit frames.
+
+  @param[in]  SpiHc             Pointer to a SPI_HC data structure.
+  @param[in]  TransactionType   Type of SPI transaction
+  @param[in]  WriteBytes        Number of bytes to send to the SPI peripheral
+  @param[in]  WriteBuffer       Pointer to the data to send to the SPI
+                                peripheral
+  @param[in]  ReadBytes         Number of bytes to receive from the SPI
+                                peripheral
+  @param[in]  ReadBuffer        Pointer to the receive data buffer
+
+**/
+STATIC
+VOID
+SpiHcPackedTransaction (
+  IN SPI_HC *SpiHc,
+  IN SPI_TRANSACTION_TYPE TransactionType,
+  IN UINTN WriteBytes,
+  IN UINT8 *WriteBuffer,
+  IN UINTN ReadBytes,
+  IN UINT8 *ReadBuffer
+  )
+{
+  UINT32 BaseAddress;
+  UINTN PackedReadBytes;
+  UINTN PackedWriteBytes;
+
+  BaseAddress = SpiHc->BaseAddress;
+
+  //
+  // Send the unaligned write phase using 8-bit frames
+  //
+  if ((TransactionType == SPI_TRANSACTION_WRITE_THEN_READ)
+    && ((WriteBytes & 3) != 0)) {
+    mSpiHcKernels[SPI_TRANSACTION_WRITE_ONLY][0] (BaseAddress,
+                                                  WriteBytes,
+                                                  WriteBuffer,
+                                                  WriteBytes,
+                                                  NULL);
+    TransactionType = SPI_TRANSACTION_READ_ONLY;
+    WriteBytes = 0;
+  }
+
+  //
+  // Transfer the bulk of the byte stream using 32-bit frames
+  //
+  PackedWriteBytes = WriteBytes & ~((UINTN)3);
+  PackedReadBytes = ReadBytes & ~((UINTN)3);
+  SpiHcSetFrameSize (SpiHc, 32);
+  mSpiHcPackedKernels[TransactionType] (BaseAddress,
+                                        PackedWriteBytes,
+                                        WriteBuffer,
+                                        PackedReadBytes,
+                                        ReadBuffer);
+  SpiHcSetFrameSize (SpiHc, 8);
+
+  //
+  // Transfer the remaining bytes using 8-bit frames
+  //
+  if (TransactionType == SPI_TRANSACTION_WRITE_THEN_READ) {
+    TransactionType = SPI_TRANSACTION_READ_ONLY;
+  }
+  WriteBytes -= PackedWriteBytes;
+  ReadBytes -= PackedReadBytes;
+  if ((WriteBytes != 0) || (ReadBytes != 0)) {
+    mSpiHcKernels[TransactionType][0] (
+                    BaseAddress,
+                    WriteBytes,
+                    (WriteBuffer != NULL) ? &WriteBuffer[PackedWriteBytes] : NULL,
+                    ReadBytes,
+                    (ReadBuffer != NULL) ? &ReadBuffer[PackedReadBytes] : NULL);
+  }
+}
+
+/**
+  Send the opcode, address and dummy phases of a SPI transaction.
+
+  This routine is called at TPL_NOTIFY with the SPI controller enabled for
+  8-bit frames.
+
+  The phases are sent from a local buffer, the transaction buffers only
+  contain the data phase.  The dummy cycles are sent as zero bytes.
+
+  @param[in]  SpiHc             Pointer to a SPI_HC data structure.
+  @param[in]  Phases            Pointer to the EFI_SPI_TRANSACTION_PHASES
+                                structure describing the command
+
+**/
+STATIC
+VOID
+SpiHcSendPhases (
+  IN SPI_HC *SpiHc,
+  IN CONST EFI_SPI_TRANSACTION_PHASES *Phases
+  )
+{
+  UINT8 Command[SPI_HC_COMMAND_BYTES];
+  UINTN Index;
+  UINTN Length;
+
+  //
+  // Build the command: opcode, address (MSB first) and dummy bytes
+  //
+  Length = 0;
+  Command[Length++] = Phases->Opcode;
+  for (Index = Phases->AddressBytes; Index > 0; Index--) {
+    Command[Length++] = (UINT8)(Phases->Address >> ((Index - 1) * 8));
+  }
+  for (Index = Phases->DummyCycles / 8; Index > 0; Index--) {
+    Command[Length++] = 0;
+  }
+
+  //
+  // Send the command
+  //
+  mSpiHcKernels[SPI_TRANSACTION_WRITE_ONLY][0] (SpiHc->BaseAddress,
+                                                Length,
+                                                Command,
+                                                Length,
+                                                NULL);
+}
+
 /**
   Perform the SPI transaction on the SPI peripheral using the SPI host
   controller.
@@ -169,6 +335,8 @@ SpiHcClock (
   @retval EFI_BAD_BUFFER_SIZE   The BusTransaction->ReadBytes value is invalid
   @retval EFI_UNSUPPORTED       The BusTransaction->TransactionType is
                                 unsupported
+  @retval EFI_UNSUPPORTED       The BusTransaction->Phases require a multi-bit
+                                bus or a partial dummy byte
 **/
 EFI_STATUS
 EFIAPI
@@ -183,10 +351,12 @@ SpiHcTransaction (
     UINT32 U32;
   } Controller;
   UINT32 FrameSize;
+  CONST EFI_SPI_TRANSACTION_PHASES *Phases;
   UINT8 *ReadBuffer;
   UINTN ReadBytes;
   SPI_HC *SpiHc;
   SPI_TRANSACTION SpiTransaction;
+  UINT64 StartTime;
   EFI_STATUS Status;
   UINT8 *WriteBuffer;
   UINTN WriteBytes;
@@ -209,19 +379,52 @@ SpiHcTransaction (
   ReadBytes = BusTransaction->ReadBytes;
   ReadBuffer = BusTransaction->ReadBuffer;
   SpiTransaction = NULL;
+  StartTime = 0;
   Status = EFI_SUCCESS;
 
+  //
+  // The SPI controller only sends the phases on a 1-bit bus.  The command
+  // buffer holds at most a 4-byte address.
+  //
+  Phases = BusTransaction->Phases;
+  if (Phases != NULL) {
+    ASSERT (FrameSize == 8);
+    if ((Phases->OpcodeBusWidth != 1) || (Phases->DataBusWidth != 1)
+      || (Phases->AddressBytes > 4)
+      || ((Phases->AddressBytes != 0) && (Phases->AddressBusWidth != 1))
+      || ((Phases->DummyCycles & 7) != 0)) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+        DEBUG ((EFI_D_ERROR, "ERROR - SpiHc does not support the phases!\n"));
+      }
+      return EFI_UNSUPPORTED;
+    }
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiHc: Opcode 0x%02x, %d address bytes: 0x%08x\n",
+              Phases->Opcode, Phases->AddressBytes, Phases->Address));
+    }
+  }
+
   //
   // Verify the input parameters based upon the transaction type
   //
   switch (BusTransaction->TransactionType) {
   default:
+    Status = EFI_UNSUPPORTED;
+    break;
+
   case SPI_TRANSACTION_READ_ONLY:
     //
     // Data flowing from the SPI peripheral to the host.  WriteBytes must be
     // zero.  ReadBytes must be non-zero and ReadBuffer must be provided.
     //
-    Status = EFI_UNSUPPORTED;
+    ASSERT (WriteBytes == 0);
+    ASSERT (ReadBytes != 0);
+    ASSERT (ReadBuffer != NULL);
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiHc: Starting the read-only SPI transaction\n"));
+      DEBUG ((EFI_D_ERROR, "SpiHc: Receiving data into 0x%08x, 0x%08x bytes\n",
+              ReadBuffer, ReadBytes));
+    }
     break;
 
   case SPI_TRANSACTION_WRITE_THEN_READ:
@@ -235,14 +438,7 @@ SpiHcTransaction (
     ASSERT (WriteBuffer != NULL);
     ASSERT (ReadBytes != 0);
     ASSERT (ReadBuffer != NULL);
-    if (BusTransaction->FrameSize <= 8) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc8BitWriteThenReadTransaction;
-    } else if (BusTransaction->FrameSize <= 16) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc16BitWriteThenReadTransaction;
-    } else {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc32BitWriteThenReadTransaction;
-    }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiHc: Starting the write-then-read SPI transaction\n"));
       DEBUG ((EFI_D_ERROR, "SpiHc: Sending data from 0x%08x, 0x%08x bytes\n",
@@ -255,20 +451,14 @@ SpiHcTransaction (
   case SPI_TRANSACTION_WRITE_ONLY:
     //
     // Data flowing from the host to the SPI peripheral.  ReadBytes must be
-    // zero.  WriteBytes must be non-zero and WriteBuffer must be provided.
+    // zero.  WriteBytes must be non-zero and WriteBuffer must be provided,
+    // except when the phases describe a command without data.
     //
-    ASSERT (WriteBytes != 0);
-    ASSERT (WriteBuffer != NULL);
+    ASSERT ((Phases != NULL) || (WriteBytes != 0));
+    ASSERT ((WriteBytes == 0) || (WriteBuffer != NULL));
     ASSERT (ReadBytes == 0);
     ReadBytes = WriteBytes;
-    if (BusTransaction->FrameSize <= 8) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc8BitWriteOnlyTransaction;
-    } else if (BusTransaction->FrameSize <= 16) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc16BitWriteOnlyTransaction;
-    } else {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc32BitWriteOnlyTransaction;
-    }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiHc: Starting the write-only SPI transaction\n"));
       DEBUG ((EFI_D_ERROR, "SpiHc: Sending data from 0x%08x, 0x%08x bytes\n",
               WriteBuffer, WriteBytes));
@@ -285,14 +475,7 @@ SpiHcTransaction (
     ASSERT (WriteBuffer != NULL);
     ASSERT (ReadBytes != 0);
     ASSERT (ReadBuffer != NULL);
-    if (BusTransaction->FrameSize <= 8) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc8BitFullDuplexTransaction;
-    } else if (BusTransaction->FrameSize <= 16) {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc16BitFullDuplexTransaction;
-    } else {
-      SpiTransaction = (SPI_TRANSACTION)SpiHc32BitFullDuplexTransaction;
-    }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiHc: Starting the full-duplex SPI transaction\n"));
       DEBUG ((EFI_D_ERROR, "SpiHc: Sending data from 0x%08x, 0x%08x bytes\n",
@@ -304,6 +487,13 @@ SpiHcTransaction (
   }
 
   if (!EFI_ERROR(Status)) {
+    //
+    // Select the transfer routine for the transaction type and frame size
+    //
+    SpiTransaction = mSpiHcKernels[BusTransaction->TransactionType]
+                                  [(FrameSize <= 8) ? 0
+                                  : ((FrameSize <= 16) ? 1 : 2)];
+
     //
     // Set-up the clock and enable the SPI controller
     //
@@ -321,11 +511,30 @@ SpiHcTransaction (
     //
     // Start the SPI transaction
     //
-    SpiTransaction (BaseAddress,
-                    WriteBytes,
-                    WriteBuffer,
-                    ReadBytes,
-                    ReadBuffer);
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      StartTime = GetPerformanceCounter ();
+    }
+    if (Phases != NULL) {
+      SpiHcSendPhases (SpiHc, Phases);
+    }
+    if ((FrameSize == 8) && (ReadBytes >= SPI_HC_PACKED_THRESHOLD)) {
+      SpiHcPackedTransaction (SpiHc,
+                              BusTransaction->TransactionType,
+                              WriteBytes,
+                              WriteBuffer,
+                              ReadBytes,
+                              ReadBuffer);
+    } else if (ReadBytes != 0) {
+      SpiTransaction (BaseAddress,
+                      WriteBytes,
+                      WriteBuffer,
+                      ReadBytes,
+                      ReadBuffer);
+    }
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiHc: Transfer routine took %Ld nS\n",
+              GetTimeInNanoSecond (GetPerformanceCounter () - StartTime)));
+    }
 
     //
     // Disable the SPI controller
@@ -569,9 +778,12 @@ SpiHcStartup (
   SpiHc->SpiHcProtocol.Clock = SpiHcClock;
   SpiHc->SpiHcProtocol.Transaction = SpiHcTransaction;
   SpiHc->SpiHcProtocol.Attributes = HC_SUPPORTS_WRITE_ONLY_OPERATIONS
+                                  | HC_SUPPORTS_READ_ONLY_OPERATIONS
                                   | HC_SUPPORTS_WRITE_THEN_READ_OPERATIONS
                                   | HC_TRANSFER_SIZE_INCLUDES_OPCODE
-                                  | HC_TRANSFER_SIZE_INCLUDES_ADDRESS;
+                                  | HC_TRANSFER_SIZE_INCLUDES_ADDRESS
+                                  | HC_SUPPORTS_CHIP_SELECT_HOLD
+                                  | HC_SUPPORTS_TRANSACTION_PHASES;
   SpiHc->SpiHcProtocol.FrameSizeSupportMask =
            (UINT32)( SUPPORT_FRAME_SIZE_BITS (4)
                    | SUPPORT_FRAME_SIZE_BITS (5)
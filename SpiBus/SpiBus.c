@@ -15,10 +15,60 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include "SpiBus.h"
 
+//
+// List of SPI buses managed by this driver
+//
+SPI_BUS *gSpiBusList;
+
+/**
+  Hand a transaction or transaction phase to the SPI host controller.
+
+  This routine must be called at TPL_NOTIFY.
+
+  The phase is recorded in the trace ring when PcdSpiTransactionTrace is TRUE.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+  @param[in]  BusTransaction    Pointer to a EFI_SPI_BUS_TRANSACTION containing
+                                the description of the SPI transaction
+
+  @return  The status returned by the SPI host controller
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiBusHcTransaction (
+  IN SPI_BUS *SpiBus,
+  IN EFI_SPI_BUS_TRANSACTION *BusTransaction
+  )
+{
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  EFI_STATUS Status;
+
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceRecord (SPI_TRACE_PHASE_START,
+                    SpiBus->IoTransaction.SpiIo->PartIndex,
+                    BusTransaction, 0, EFI_SUCCESS);
+  }
+  Status = SpiHcProtocol->Transaction (SpiHcProtocol, BusTransaction);
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceRecord (SPI_TRACE_PHASE_END,
+                    SpiBus->IoTransaction.SpiIo->PartIndex,
+                    BusTransaction, 0, Status);
+  }
+  return Status;
+}
+
 /**
   Enumerate the SPI devices on the bus and create an EFI_SPI_IO_PROTOCOL
   instance for each one.
 
+  When PcdSpiLazyEnumeration is TRUE, only a stub is published for each SPI
+  peripheral.  The EFI_SPI_IO_PROTOCOL instance is created when the SPI
+  peripheral driver connects the stub.  The SPI peripherals are enumerated
+  immediately when the environment does not support the stubs.
+
   @param[in]  SpiBus            A pointer to the SPI_BUS instance.
 
   @return  This routine returns one of the following status values:
@@ -68,9 +118,16 @@ SpiBusEnumerateSpiDevices (
     }
 
     //
-    // Create an EFI_SPI_IO_PROTOCOL instance for this SPI peripheral
+    // Create an EFI_SPI_IO_PROTOCOL instance for this SPI peripheral, or
+    // defer the creation until a SPI peripheral driver needs it
     //
-    Status = SpiIoStartup (SpiBus, SpiPeripheral);
+    Status = EFI_UNSUPPORTED;
+    if (FeaturePcdGet (PcdSpiLazyEnumeration)) {
+      Status = SpiIoPublishStub (SpiBus, SpiPeripheral);
+    }
+    if (Status == EFI_UNSUPPORTED) {
+      Status = SpiIoStartup (SpiBus, SpiPeripheral, NULL);
+    }
     if (EFI_ERROR(Status)) {
       break;
     }
@@ -135,7 +192,7 @@ SpiBusReleaseBuffers (
     //
     // Convert the data from big-endian to little-endian
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Converting 0x%08x bytes of 8-bit frames at 0x%08x\n",
               ReceiveBytes,
@@ -161,7 +218,7 @@ SpiBusReleaseBuffers (
     //
     // Convert the data from big-endian to little-endian
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Converting 0x%08x bytes of 8-bit frames at 0x%08x\n",
               ReceiveBytes,
@@ -189,7 +246,7 @@ SpiBusReleaseBuffers (
     //
     // Convert the data from big-endian to little-endian
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Converting 0x%08x bytes of 8-bit frames at 0x%08x\n",
               ReceiveBytes,
@@ -216,7 +273,7 @@ SpiBusReleaseBuffers (
     //
     // Copy the read data into the original buffer
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
       "SpiBus: Copying 0x%08x bytes of received data from 0x%08x into 0x%08x\n",
               ReadBytes,
@@ -229,18 +286,25 @@ SpiBusReleaseBuffers (
     break;
   }
 
+  //
+  // The buffers of a prepared transaction are released by ReleasePrepared
+  //
+  if (IoTransaction->Prepared != NULL) {
+    return;
+  }
+
   //
   // Release the allocated buffers
   //
   if ((IoTransaction->SetupFlags & SETUP_FLAG_DISCARD_WRITE_BUFFER) != 0) {
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Freeing WriteBuffer at 0x%08x\n",
               BusTransaction->WriteBuffer));
     }
     FreePool (BusTransaction->WriteBuffer);
   }
   if ((IoTransaction->SetupFlags & SETUP_FLAG_DISCARD_READ_BUFFER) != 0) {
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Freeing ReadBuffer at 0x%08x\n",
               BusTransaction->ReadBuffer));
     }
@@ -248,6 +312,668 @@ SpiBusReleaseBuffers (
   }
 }
 
+/**
+  Perform one phase of an emulated SPI transaction using full-duplex transfers.
+
+  This routine must be called at TPL_NOTIFY with the chip select asserted.
+
+  The SPI bus layer emulates the write-only, read-only and write-then-read
+  transactions for SPI host controllers which do not support them.  Each phase
+  either sends data while discarding the receive data, or receives data while
+  sending zeros.  The side of the transfer which the SPI peripheral layer did
+  not provide uses one of the scratch buffers in the SPI_BUS structure, so the
+  phase is broken into SPI_BUS_SCRATCH_BYTES sized full-duplex transfers.  The
+  chip select remains asserted across all of these transfers, so this routine
+  is only used when the SPI host controller supports the chip select hold.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+  @param[in]  WriteBuffer       Buffer containing the data to send or NULL to
+                                send zeros
+  @param[in]  ReadBuffer        Buffer to receive the data or NULL to discard
+                                the receive data
+  @param[in]  Bytes             Number of bytes to transfer
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction phase completed successfully
+  @retval other                 The SPI host controller transaction failed
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiBusFullDuplexPhase (
+  IN SPI_BUS *SpiBus,
+  IN UINT8 *WriteBuffer OPTIONAL,
+  IN UINT8 *ReadBuffer OPTIONAL,
+  IN UINT32 Bytes
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  UINT32 FrameBytes;
+  UINT32 LengthInBytes;
+  EFI_SPI_BUS_TRANSACTION PhaseTransaction;
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  EFI_STATUS Status;
+
+  //
+  // Locate the data structures
+  //
+  BusTransaction = &SpiBus->IoTransaction.BusTransaction;
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+  ASSERT ((WriteBuffer == NULL) || (ReadBuffer == NULL));
+  ASSERT ((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) != 0);
+
+  //
+  // Build the full-duplex transaction for the host controller.  The opcode
+  // and address were already sent, so the phases are not described again.
+  //
+  CopyMem (&PhaseTransaction, BusTransaction, sizeof (PhaseTransaction));
+  PhaseTransaction.TransactionType = SPI_TRANSACTION_FULL_DUPLEX;
+  PhaseTransaction.Phases = NULL;
+
+  //
+  // Determine the number of buffer bytes used by each frame
+  //
+  FrameBytes = 1;
+  if (BusTransaction->FrameSize > 16) {
+    FrameBytes = 4;
+  } else if (BusTransaction->FrameSize > 8) {
+    FrameBytes = 2;
+  }
+  Status = EFI_SUCCESS;
+  while (Bytes > 0) {
+    LengthInBytes = Bytes;
+    if (LengthInBytes > SPI_BUS_SCRATCH_BYTES) {
+      LengthInBytes = SPI_BUS_SCRATCH_BYTES;
+    }
+    if (LengthInBytes > SpiHcProtocol->MaximumTransferBytes) {
+      //
+      // Keep the transfer a whole number of frames
+      //
+      LengthInBytes = SpiHcProtocol->MaximumTransferBytes;
+      if (LengthInBytes >= FrameBytes) {
+        LengthInBytes -= LengthInBytes % FrameBytes;
+      }
+    }
+    PhaseTransaction.WriteBytes = LengthInBytes;
+    PhaseTransaction.ReadBytes = LengthInBytes;
+    PhaseTransaction.WriteBuffer = (WriteBuffer != NULL) ? WriteBuffer
+                                 : (UINT8 *)SpiBus->ZeroBuffer;
+    PhaseTransaction.ReadBuffer = (ReadBuffer != NULL) ? ReadBuffer
+                                : (UINT8 *)SpiBus->DiscardBuffer;
+
+    //
+    // Transfer this portion of the data
+    //
+    Status = SpiBusHcTransaction (SpiBus, &PhaseTransaction);
+    if (EFI_ERROR(Status)) {
+      break;
+    }
+
+    //
+    // Account for the data transferred
+    //
+    if (WriteBuffer != NULL) {
+      WriteBuffer += LengthInBytes;
+    }
+    if (ReadBuffer != NULL) {
+      ReadBuffer += LengthInBytes;
+    }
+    Bytes -= LengthInBytes;
+  }
+  return Status;
+}
+
+/**
+  Perform an emulated SPI transaction using full-duplex transfers.
+
+  This routine must be called at TPL_NOTIFY with the chip select asserted.
+
+  The write phase sends the SPI peripheral layer's write data and discards the
+  receive data.  The read phase then sends zeros and places the receive data
+  directly into the SPI peripheral layer's read buffer.  Since the chip select
+  is held asserted between the phases, the SPI peripheral sees a single
+  write-then-read transaction.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval other                 The SPI host controller transaction failed
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiBusEmulatedTransaction (
+  IN SPI_BUS *SpiBus
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  SPI_IO_TRANSACTION *IoTransaction;
+  EFI_STATUS Status;
+
+  //
+  // Locate the data structures
+  //
+  IoTransaction = &SpiBus->IoTransaction;
+  BusTransaction = &IoTransaction->BusTransaction;
+
+  //
+  // Send the write data, discarding the receive data
+  //
+  Status = EFI_SUCCESS;
+  if ((IoTransaction->SetupFlags & SETUP_FLAG_DISCARD_WRITE_PHASE_DATA) != 0) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR,
+              "SpiBus: Write phase, sending 0x%08x bytes from 0x%08x\n",
+              BusTransaction->WriteBytes,
+              BusTransaction->WriteBuffer));
+    }
+    Status = SpiBusFullDuplexPhase (SpiBus,
+                                    BusTransaction->WriteBuffer,
+                                    NULL,
+                                    BusTransaction->WriteBytes);
+  }
+
+  //
+  // Send zeros, placing the receive data into the read buffer
+  //
+  if ((!EFI_ERROR(Status))
+    && ((IoTransaction->SetupFlags & SETUP_FLAG_ZERO_READ_PHASE_DATA) != 0)) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR,
+              "SpiBus: Read phase, receiving 0x%08x bytes into 0x%08x\n",
+              BusTransaction->ReadBytes,
+              BusTransaction->ReadBuffer));
+    }
+    Status = SpiBusFullDuplexPhase (SpiBus,
+                                    NULL,
+                                    BusTransaction->ReadBuffer,
+                                    BusTransaction->ReadBytes);
+  }
+  return Status;
+}
+
+/**
+  Determine if a SPI transaction must be streamed.
+
+  A transaction is streamed when it exceeds the SPI host controller's maximum
+  transfer size and the SPI host controller allows the chip select to remain
+  asserted across multiple transactions.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+
+  @retval TRUE                  The transaction must be streamed
+  @retval FALSE                 The SPI host controller is able to perform the
+                                transaction in a single operation
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+SpiBusStreamRequired (
+  IN SPI_BUS *SpiBus
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  UINT64 TransferBytes;
+
+  //
+  // Locate the data structures
+  //
+  BusTransaction = &SpiBus->IoTransaction.BusTransaction;
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+  if (((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) == 0)
+    || (BusTransaction->Phases != NULL)) {
+    return FALSE;
+  }
+
+  //
+  // Determine the number of bytes the SPI host controller must transfer
+  //
+  if (BusTransaction->TransactionType == SPI_TRANSACTION_FULL_DUPLEX) {
+    TransferBytes = BusTransaction->WriteBytes;
+  } else {
+    TransferBytes = (UINT64)BusTransaction->WriteBytes
+                  + BusTransaction->ReadBytes;
+  }
+  return (BOOLEAN)(TransferBytes > SpiHcProtocol->MaximumTransferBytes);
+}
+
+/**
+  Perform a SPI transaction larger than the SPI host controller's maximum
+  transfer size.
+
+  This routine must be called at TPL_NOTIFY with the chip select asserted.
+
+  The transaction is broken into pieces which fit within the SPI host
+  controller's maximum transfer size.  The chip select remains asserted across
+  all of the pieces, so the SPI peripheral sees a single transaction.  For a
+  write-then-read transaction, the first piece contains the write data, such
+  as an opcode and address, along with the start of the read data.  The
+  remaining read data is received using read-only pieces, or full-duplex
+  pieces when the SPI host controller does not support read-only transactions.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval other                 The SPI host controller transaction failed
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiBusStreamTransaction (
+  IN SPI_BUS *SpiBus
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  UINT32 LengthInBytes;
+  UINT32 MaximumBytes;
+  EFI_SPI_BUS_TRANSACTION PieceTransaction;
+  UINT8 *ReadBuffer;
+  UINT32 ReadBytes;
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  EFI_STATUS Status;
+  UINT8 *WriteBuffer;
+  UINT32 WriteBytes;
+
+  //
+  // Locate the data structures
+  //
+  BusTransaction = &SpiBus->IoTransaction.BusTransaction;
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+
+  //
+  // Keep each piece a multiple of the largest frame size
+  //
+  MaximumBytes = SpiHcProtocol->MaximumTransferBytes;
+  if (MaximumBytes >= sizeof (UINT32)) {
+    MaximumBytes &= ~(UINT32)(sizeof (UINT32) - 1);
+  }
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR,
+            "SpiBus: Streaming transaction in 0x%08x byte pieces\n",
+            MaximumBytes));
+  }
+
+  CopyMem (&PieceTransaction, BusTransaction, sizeof (PieceTransaction));
+  WriteBuffer = BusTransaction->WriteBuffer;
+  WriteBytes = BusTransaction->WriteBytes;
+  ReadBuffer = BusTransaction->ReadBuffer;
+  ReadBytes = BusTransaction->ReadBytes;
+  Status = EFI_SUCCESS;
+  switch (BusTransaction->TransactionType) {
+  default:
+    return EFI_INVALID_PARAMETER;
+
+  case SPI_TRANSACTION_FULL_DUPLEX:
+    while (WriteBytes > 0) {
+      LengthInBytes = MIN (WriteBytes, MaximumBytes);
+      PieceTransaction.WriteBuffer = WriteBuffer;
+      PieceTransaction.WriteBytes = LengthInBytes;
+      PieceTransaction.ReadBuffer = ReadBuffer;
+      PieceTransaction.ReadBytes = LengthInBytes;
+      Status = SpiBusHcTransaction (SpiBus, &PieceTransaction);
+      if (EFI_ERROR(Status)) {
+        break;
+      }
+      WriteBuffer += LengthInBytes;
+      ReadBuffer += LengthInBytes;
+      WriteBytes -= LengthInBytes;
+    }
+    return Status;
+
+  case SPI_TRANSACTION_WRITE_ONLY:
+    while (WriteBytes > 0) {
+      LengthInBytes = MIN (WriteBytes, MaximumBytes);
+      PieceTransaction.WriteBuffer = WriteBuffer;
+      PieceTransaction.WriteBytes = LengthInBytes;
+      Status = SpiBusHcTransaction (SpiBus, &PieceTransaction);
+      if (EFI_ERROR(Status)) {
+        break;
+      }
+      WriteBuffer += LengthInBytes;
+      WriteBytes -= LengthInBytes;
+    }
+    return Status;
+
+  case SPI_TRANSACTION_WRITE_THEN_READ:
+    //
+    // Send the header along with the start of the read data
+    //
+    if (WriteBytes < MaximumBytes) {
+      LengthInBytes = MIN (ReadBytes, MaximumBytes - WriteBytes);
+      PieceTransaction.ReadBytes = LengthInBytes;
+      Status = SpiBusHcTransaction (SpiBus, &PieceTransaction);
+      if (EFI_ERROR(Status)) {
+        return Status;
+      }
+      ReadBuffer += LengthInBytes;
+      ReadBytes -= LengthInBytes;
+    } else if ((SpiHcProtocol->Attributes
+               & HC_SUPPORTS_WRITE_ONLY_OPERATIONS) == 0) {
+      Status = SpiBusFullDuplexPhase (SpiBus, WriteBuffer, NULL, WriteBytes);
+      if (EFI_ERROR(Status)) {
+        return Status;
+      }
+    } else {
+      PieceTransaction.TransactionType = SPI_TRANSACTION_WRITE_ONLY;
+      PieceTransaction.ReadBuffer = NULL;
+      PieceTransaction.ReadBytes = 0;
+      while (WriteBytes > 0) {
+        LengthInBytes = MIN (WriteBytes, MaximumBytes);
+        PieceTransaction.WriteBuffer = WriteBuffer;
+        PieceTransaction.WriteBytes = LengthInBytes;
+        Status = SpiBusHcTransaction (SpiBus, &PieceTransaction);
+        if (EFI_ERROR(Status)) {
+          return Status;
+        }
+        WriteBuffer += LengthInBytes;
+        WriteBytes -= LengthInBytes;
+      }
+    }
+
+    //
+    // Receive the remaining data
+    //
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_READ_ONLY_OPERATIONS) == 0) {
+      return SpiBusFullDuplexPhase (SpiBus, NULL, ReadBuffer, ReadBytes);
+    }
+    PieceTransaction.TransactionType = SPI_TRANSACTION_READ_ONLY;
+    PieceTransaction.WriteBuffer = NULL;
+    PieceTransaction.WriteBytes = 0;
+    //
+    // Fall through
+    //
+
+  case SPI_TRANSACTION_READ_ONLY:
+    while (ReadBytes > 0) {
+      LengthInBytes = MIN (ReadBytes, MaximumBytes);
+      PieceTransaction.ReadBuffer = ReadBuffer;
+      PieceTransaction.ReadBytes = LengthInBytes;
+      Status = SpiBusHcTransaction (SpiBus, &PieceTransaction);
+      if (EFI_ERROR(Status)) {
+        break;
+      }
+      ReadBuffer += LengthInBytes;
+      ReadBytes -= LengthInBytes;
+    }
+    return Status;
+  }
+}
+
+/**
+  Perform a segmented write using the SPI host controller.
+
+  This routine must be called at TPL_NOTIFY with the chip select asserted.
+
+  Each segment is sent directly from the SPI peripheral layer's buffer as a
+  write-only transfer.  The chip select remains asserted across all of the
+  segments, so the SPI peripheral sees a single write-only transaction.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval other                 The SPI host controller transaction failed
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiBusSegmentTransaction (
+  IN SPI_BUS *SpiBus
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  UINT32 Index;
+  SPI_IO_TRANSACTION *IoTransaction;
+  CONST EFI_SPI_IO_WRITE_SEGMENT *Segment;
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  EFI_STATUS Status;
+
+  //
+  // Locate the data structures
+  //
+  IoTransaction = &SpiBus->IoTransaction;
+  BusTransaction = &IoTransaction->BusTransaction;
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+
+  //
+  // Send each of the segments
+  //
+  Status = EFI_SUCCESS;
+  for (Index = 0; Index < IoTransaction->SegmentCount; Index++) {
+    Segment = &IoTransaction->Segments[Index];
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR,
+              "SpiBus: Segment %d, sending 0x%08x bytes from 0x%08x\n",
+              Index,
+              Segment->WriteBytes,
+              Segment->WriteBuffer));
+    }
+    BusTransaction->WriteBuffer = Segment->WriteBuffer;
+    BusTransaction->WriteBytes = Segment->WriteBytes;
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_WRITE_ONLY_OPERATIONS) == 0) {
+      Status = SpiBusFullDuplexPhase (SpiBus,
+                                      Segment->WriteBuffer,
+                                      NULL,
+                                      Segment->WriteBytes);
+    } else if (SpiBusStreamRequired (SpiBus)) {
+      Status = SpiBusStreamTransaction (SpiBus);
+    } else {
+      Status = SpiBusHcTransaction (SpiBus, BusTransaction);
+    }
+    if (EFI_ERROR(Status)) {
+      break;
+    }
+  }
+  return Status;
+}
+
+/**
+  Determine the SCLK frequency to request for a SPI transaction.
+
+  The frequency is the lowest of the SPI part's maximum frequency, the SPI
+  peripheral's maximum frequency and the transaction specific frequency.
+  The training only verifies reads, so the frequency selected by the SCLK
+  training replaces the part's maximum frequency only for the read
+  transactions of the original SPI peripheral.  The program and erase
+  commands always use the datasheet frequency.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+  @param[in]  SpiPeripheral     Pointer to the EFI_SPI_PERIPHERAL structure.
+  @param[in]  TransactionType   Transaction type requested by the SPI
+                                peripheral layer
+  @param[in]  ClockHz           Transaction specific frequency or zero (0) to
+                                use the maximum frequency
+
+  @return  The SCLK frequency in Hertz
+
+**/
+UINT32
+EFIAPI
+SpiBusClockFrequency (
+  IN SPI_IO *SpiIo,
+  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral,
+  IN EFI_SPI_TRANSACTION_TYPE TransactionType,
+  IN UINTN ClockHz
+  )
+{
+  UINT32 ClockFrequency;
+
+  //
+  // Get the maximum frequency that the chip supports, reads may use the
+  // trained frequency
+  //
+  ClockFrequency = SpiPeripheral->SpiPart->MaxClockHz;
+  if ((SpiIo->TrainedClockHz != 0)
+    && (SpiPeripheral == SpiIo->SpiIoProtocol.OriginalSpiPeripheral)
+    && ((TransactionType == SPI_TRANSACTION_READ_ONLY)
+      || (TransactionType == SPI_TRANSACTION_WRITE_THEN_READ))) {
+    ClockFrequency = SpiIo->TrainedClockHz;
+  }
+
+  //
+  // Limit the frequency to the maximum supported by the board
+  //
+  if ((SpiPeripheral->MaxClockHz != 0)
+    && (ClockFrequency > SpiPeripheral->MaxClockHz)) {
+    ClockFrequency = SpiPeripheral->MaxClockHz;
+  }
+
+  //
+  // Reduce this frequency on an operation specific basis
+  //
+  if ((ClockHz != 0 ) && (ClockHz < ClockFrequency)) {
+    ClockFrequency = (UINT32)ClockHz;
+  }
+  return ClockFrequency;
+}
+
+/**
+  Allocate a buffer for the frame conversion.
+
+  This routine must be called at TPL_NOTIFY.
+
+  A prepared transaction uses the buffer allocated when the transaction was
+  prepared.  Memory allocation is not available after ExitBootServices.
+
+  @param[in]  IoTransaction     Pointer to an IO_TRANSACTION structure.
+  @param[in]  BufferLength      Number of bytes to allocate
+
+  @return  The address of the buffer or NULL if not available
+
+**/
+STATIC
+UINT8 *
+EFIAPI
+SpiBusAllocateBuffer (
+  IN SPI_IO_TRANSACTION *IoTransaction,
+  IN UINT32 BufferLength
+  )
+{
+  SPI_PREPARED_TRANSACTION *Prepared;
+
+  Prepared = IoTransaction->Prepared;
+  if (Prepared != NULL) {
+    ASSERT (BufferLength <= Prepared->BufferBytes);
+    return Prepared->Buffer;
+  }
+  if (SpiAtRuntime ()) {
+    return NULL;
+  }
+  return AllocateRuntimePool (BufferLength);
+}
+
+/**
+  Perform the set up for a prepared SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  Determine the clock frequency and how the SPI bus layer performs the
+  transaction on this SPI host controller.  When the frame size must be
+  converted, allocate the buffer used by SpiBusSetupBuffers for the
+  conversion.  Otherwise save the emulation flags so that ExecutePrepared
+  is able to skip SpiBusSetupBuffers.
+
+  @param[in]  SpiBus            Pointer to a SPI_BUS structure.
+  @param[in]  Prepared          Pointer to a SPI_PREPARED_TRANSACTION structure
+                                containing the validated BusTransaction and the
+                                requested ClockHz value
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The transaction is ready for ExecutePrepared
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for the conversion buffer
+
+**/
+EFI_STATUS
+EFIAPI
+SpiBusPrepareTransaction (
+  IN SPI_BUS *SpiBus,
+  IN SPI_PREPARED_TRANSACTION *Prepared
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+
+  BusTransaction = &Prepared->BusTransaction;
+  SpiHcProtocol = SpiBus->SpiHcProtocol;
+
+  //
+  // Cache the clock frequency
+  //
+  Prepared->RequestedClockHz = Prepared->ClockHz;
+  Prepared->ClockHz = SpiBusClockFrequency (Prepared->SpiIo,
+                                            Prepared->SpiPeripheral,
+                                            BusTransaction->TransactionType,
+                                            Prepared->RequestedClockHz);
+
+  //
+  // Determine if the transaction must be emulated with full-duplex transfers
+  //
+  switch (BusTransaction->TransactionType) {
+  default:
+    break;
+
+  case SPI_TRANSACTION_WRITE_ONLY:
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_WRITE_ONLY_OPERATIONS) == 0) {
+      Prepared->SetupFlags = SETUP_FLAG_DISCARD_WRITE_PHASE_DATA;
+    }
+    break;
+
+  case SPI_TRANSACTION_READ_ONLY:
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_READ_ONLY_OPERATIONS) == 0) {
+      Prepared->SetupFlags = SETUP_FLAG_ZERO_READ_PHASE_DATA;
+    }
+    break;
+
+  case SPI_TRANSACTION_WRITE_THEN_READ:
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_WRITE_THEN_READ_OPERATIONS)
+         == 0) {
+      Prepared->SetupFlags = SETUP_FLAG_DISCARD_WRITE_PHASE_DATA
+                           | SETUP_FLAG_ZERO_READ_PHASE_DATA;
+    }
+    break;
+  }
+
+  //
+  // Frame conversions and emulation without the chip select hold are
+  // performed by SpiBusSetupBuffers on each call.  Allocate a buffer large
+  // enough for any of the conversions.
+  //
+  if (((BusTransaction->FrameSize != 8)
+      && ((SpiHcProtocol->FrameSizeSupportMask
+           & (1 << (BusTransaction->FrameSize - 1))) == 0))
+    || ((Prepared->SetupFlags != 0)
+      && ((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) == 0))) {
+    Prepared->SetupFlags = 0;
+    Prepared->ConvertFrames = TRUE;
+    Prepared->BufferBytes = ((BusTransaction->WriteBytes
+                              + BusTransaction->ReadBytes) * 2) + 8;
+    Prepared->Buffer = AllocateRuntimePool (Prepared->BufferBytes);
+    if (Prepared->Buffer == NULL) {
+      DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate conversion buffer!\n"));
+      return EFI_OUT_OF_RESOURCES;
+    }
+    return EFI_SUCCESS;
+  }
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "SpiBus: Prepared SCLK: %d Hz, SetupFlags: 0x%08x\n",
+            Prepared->ClockHz, Prepared->SetupFlags));
+  }
+  return EFI_SUCCESS;
+}
+
 /**
   Start the SPI transaction on the SPI host controller.
 
@@ -321,7 +1047,7 @@ SpiBusTransaction (
   //  5.  Stop the clock
   //
 
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR, "SpiBus: IoTransaction 0x%08x starting\n",
             IoTransaction));
   }
@@ -331,29 +1057,30 @@ SpiBusTransaction (
   //--------------------------------------------------
 
   //
-  // Get the maximum frequency that the chip supports
-  //
-  ClockFrequency = SpiPart->MaxClockHz;
-  if ((SpiPeripheral->MaxClockHz != 0)
-    && (ClockFrequency > SpiPeripheral->MaxClockHz)) {
-    ClockFrequency = SpiPeripheral->MaxClockHz;
-  }
-
-  //
-  // Reduce this frequency on an operation specific basis
+  // Determine the clock frequency, a prepared transaction has already done
+  // this computation
   //
-  if ((IoTransaction->ClockHz != 0 )
-    && (IoTransaction->ClockHz < ClockFrequency)) {
-    ClockFrequency = IoTransaction->ClockHz;
+  if (IoTransaction->Prepared != NULL) {
+    ClockFrequency = IoTransaction->Prepared->ClockHz;
+  } else {
+    ClockFrequency = SpiBusClockFrequency (IoTransaction->SpiIo,
+                                           SpiPeripheral,
+                                           IoTransaction->TransactionType,
+                                           IoTransaction->ClockHz);
   }
 
   //
   // Display the clock set up if requested
   //
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR, "SpiBus: Requested SCLK Frequency: %d.%03d MHz\n",
            ClockFrequency / 1000000, (ClockFrequency % 1000000) / 1000));
   }
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceRecord (SPI_TRACE_TRANSACTION_START,
+                    IoTransaction->SpiIo->PartIndex,
+                    BusTransaction, ClockFrequency, EFI_SUCCESS);
+  }
 
   //
   // Select the proper clock frequency, polarity and phase
@@ -374,7 +1101,7 @@ SpiBusTransaction (
   //
   // Display the clock set up if requested
   //
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR, "SpiBus: SCLK Frequency: %d.%06d MHz\n",
            ClockFrequency / 1000000, ClockFrequency % 1000000));
     DEBUG ((EFI_D_ERROR, "SpiBus: SCLK Polarity: %d\n",
@@ -401,7 +1128,7 @@ SpiBusTransaction (
   // Determine the proper pin value to assert chip select
   //
   PinValue = SpiPart->ChipSelectPolarity;
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR, "SpiBus: Assert chip select: %d\n", PinValue));
   }
 
@@ -418,7 +1145,7 @@ SpiBusTransaction (
   // Verify that the chip was properly selected
   //
   if (EFI_ERROR(Status)) {
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "ERROR - Chip select failure, Status: %r\n", Status));
     }
@@ -433,14 +1160,21 @@ SpiBusTransaction (
   //
   // Use the SPI host controller to perform the transaction
   //
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR,
             "SpiBus: SPI transaction handed to host controller\n"));
   }
-  Status = SpiHcProtocol->Transaction (
-                SpiHcProtocol,
-                BusTransaction
-                );
+  if (IoTransaction->Segments != NULL) {
+    Status = SpiBusSegmentTransaction (SpiBus);
+  } else if ((IoTransaction->SetupFlags
+              & (SETUP_FLAG_DISCARD_WRITE_PHASE_DATA
+                 | SETUP_FLAG_ZERO_READ_PHASE_DATA)) != 0) {
+    Status = SpiBusEmulatedTransaction (SpiBus);
+  } else if (SpiBusStreamRequired (SpiBus)) {
+    Status = SpiBusStreamTransaction (SpiBus);
+  } else {
+    Status = SpiBusHcTransaction (SpiBus, BusTransaction);
+  }
   if (EFI_ERROR(Status)) {
     DEBUG ((EFI_D_ERROR, "ERROR - SpiBus failed the SPI transaction!\n"));
   }
@@ -472,10 +1206,15 @@ TransactionFailure:
     } else {
       SpiHcProtocol->ChipSelect (SpiHcProtocol, SpiPeripheral, PinValue);
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Deasserted chip select: %d\n", PinValue));
     }
   }
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceRecord (SPI_TRACE_TRANSACTION_END,
+                    IoTransaction->SpiIo->PartIndex,
+                    BusTransaction, ClockFrequency, Status);
+  }
 
   //--------------------------------------------------
   //  5.  Stop the clock
@@ -500,7 +1239,7 @@ TransactionFailure:
               "ERROR - SpiBus failed to turn off the clock, Status: %r\n",
               TempStatus));
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: SCLK stopped\n"));
     }
   }
@@ -574,14 +1313,14 @@ ConvertTransmitFrames (
   //
   if (((SpiHcProtocol->FrameSizeSupportMask & (1 << (FrameSize - 1))) != 0)
        || (FrameSize == 8)) {
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: %d-bits/frame supported by SPI host controller\n",
               BusTransaction->FrameSize));
     }
     return EFI_SUCCESS;
   }
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR,
             "SpiBus: %d-bits/frame not supported by SPI host controller\n",
             BusTransaction->FrameSize));
@@ -592,6 +1331,17 @@ ConvertTransmitFrames (
   //
   PreviousBuffer.U8 = BusTransaction->WriteBuffer;
   if (AllocateBuffers) {
+    //
+    // Memory allocation is not available after ExitBootServices
+    //
+    if ((IoTransaction->Prepared == NULL) && SpiAtRuntime ()) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
+        DEBUG ((EFI_D_ERROR,
+                "ERROR - Frame size conversion not supported at runtime!\n"));
+      }
+      return EFI_UNSUPPORTED;
+    }
+
     if (BusTransaction->WriteBuffer != NULL) {
       if (BusTransaction->ReadBuffer != NULL) {
         //
@@ -606,10 +1356,11 @@ ConvertTransmitFrames (
         // Allocate the write and read buffers
         //
         AlignmentMask = 8 - 1;
-        BusTransaction->WriteBuffer = AllocateRuntimePool (BufferLength
+        BusTransaction->WriteBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                    BufferLength
                                                     + AlignmentMask);
         if (BusTransaction->WriteBuffer == NULL) {
-          if (BusTransaction->DebugTransaction) {
+          if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
             DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate WriteBuffer!\n"));
           }
           return EFI_OUT_OF_RESOURCES;
@@ -620,11 +1371,11 @@ ConvertTransmitFrames (
         //
         BusTransaction->ReadBuffer = BusTransaction->WriteBuffer
                         + ((BufferLength + AlignmentMask) & (~AlignmentMask));
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR, "SpiBus: Allocated WriteBuffer at 0x%08x\n",
                   BusTransaction->WriteBuffer));
         }
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR, "SpiBus: Using ReadBuffer at 0x%08x\n",
                   BusTransaction->ReadBuffer));
         }
@@ -638,14 +1389,15 @@ ConvertTransmitFrames (
         // Allocate the write buffer
         //
         BufferLength = BusTransaction->WriteBytes;
-        BusTransaction->WriteBuffer = AllocateRuntimePool (BufferLength);
+        BusTransaction->WriteBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                            BufferLength);
         if (BusTransaction->WriteBuffer == NULL) {
-          if (BusTransaction->DebugTransaction) {
+          if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
             DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate WriteBuffer!\n"));
           }
           return EFI_OUT_OF_RESOURCES;
         }
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR, "SpiBus: Allocated WriteBuffer at 0x%08x\n",
                   BusTransaction->WriteBuffer));
         }
@@ -667,14 +1419,15 @@ ConvertTransmitFrames (
       // Allocate the read buffer
       //
       BufferLength = BusTransaction->ReadBytes;
-      BusTransaction->ReadBuffer = AllocateRuntimePool (BusTransaction->WriteBytes);
+      BusTransaction->ReadBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                  BusTransaction->WriteBytes);
       if (BusTransaction->ReadBuffer == NULL) {
-        if (BusTransaction->DebugTransaction) {
+        if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
           DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate ReadBuffer!\n"));
         }
         return EFI_OUT_OF_RESOURCES;
       }
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "SpiBus: Allocated ReadBuffer at 0x%08x\n",
                 BusTransaction->ReadBuffer));
       }
@@ -689,7 +1442,7 @@ ConvertTransmitFrames (
   //
   // Perform the frame conversion
   //
-  if (BusTransaction->DebugTransaction) {
+  if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
     DEBUG ((EFI_D_ERROR,
             "SpiBus: Converting from %d-bits/frame to 8-bits/frame\n",
             FrameSize));
@@ -774,10 +1527,19 @@ ConvertTransmitFrames (
 
   Not all SPI controllers support all modes of operations.  When they don't
   the SPI bus layer converts the transaction from the requested type into
-  a full-duplex transfer which must be supported on all SPI controllers.  This
-  is done by allocating additional buffers and copying data into and out of
-  these buffers.  These buffers are then released upon the completion of the
-  SPI transaction.
+  full-duplex transfers which must be supported on all SPI controllers.  When
+  the SPI host controller holds the chip select asserted between transactions,
+  the write data is sent while discarding the receive data and the read data
+  is received directly into the caller's buffer while sending zeros.  The
+  SpiBusTransaction routine performs these phases using the scratch buffers in
+  the SPI_BUS structure, so no buffers are allocated.
+
+  Otherwise the transaction is converted into a single full-duplex transfer
+  by allocating additional buffers and copying data into and out of these
+  buffers.  A write-then-read transaction which also requires a frame size
+  conversion is always handled this way, using a single buffer to hold both
+  the converted transmit data and the receive data.  These buffers are
+  released upon the completion of the SPI transaction.
 
   @param[in]  SpiBus            Pointer to a SPI_BUS structure.
 
@@ -821,6 +1583,14 @@ SpiBusSetupBuffers (
   //
   IoTransaction->WriteBytes = BusTransaction->WriteBytes;
 
+  //
+  // The SPI host controller performs the phases of a phase transaction
+  // directly from the SPI peripheral layer's buffers
+  //
+  if (BusTransaction->Phases != NULL) {
+    return EFI_SUCCESS;
+  }
+
   //
   // Determine if the SPI host controller supports the operation type
   //
@@ -840,7 +1610,7 @@ SpiBusSetupBuffers (
     if ((SpiHcProtocol->Attributes & HC_SUPPORTS_WRITE_ONLY_OPERATIONS) != 0) {
       return ConvertTransmitFrames (IoTransaction, TRUE);
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Transaction not supported by SPI host controller\n"));
       DEBUG ((EFI_D_ERROR,
@@ -848,19 +1618,28 @@ SpiBusSetupBuffers (
     }
 
     //
-    // Convert this to a full-duplex operation by allocating a read-buffer
-    // of the same length.  The data read into the read buffer will be discarded
-    // at the end of the SPI transaction.  The original ReadBytes value is
-    // already in the IoTransaction.
+    // Convert this to a full-duplex operation which discards the receive data.
+    // The original ReadBytes value is already in the IoTransaction.
+    //
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) != 0) {
+      IoTransaction->SetupFlags |= SETUP_FLAG_DISCARD_WRITE_PHASE_DATA;
+      break;
+    }
+
+    //
+    // The chip select may not be held between transfers, allocate a
+    // read-buffer of the same length.  The data read into the read buffer
+    // will be discarded at the end of the SPI transaction.
     //
-    BusTransaction->ReadBuffer = AllocateRuntimePool (BusTransaction->WriteBytes);
+    BusTransaction->ReadBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                 BusTransaction->WriteBytes);
     if (BusTransaction->ReadBuffer == NULL) {
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate ReadBuffer!\n"));
       }
       return EFI_OUT_OF_RESOURCES;
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Allocated ReadBuffer at 0x%08x\n",
               BusTransaction->ReadBuffer));
     }
@@ -881,7 +1660,7 @@ SpiBusSetupBuffers (
     if ((SpiHcProtocol->Attributes & HC_SUPPORTS_READ_ONLY_OPERATIONS) != 0) {
       return ConvertTransmitFrames (IoTransaction, TRUE);
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Transaction not supported by SPI host controller\n"));
       DEBUG ((EFI_D_ERROR,
@@ -889,21 +1668,32 @@ SpiBusSetupBuffers (
     }
 
     //
-    // Convert this to a full-duplex operation by allocating a write-buffer
-    // of the same length.  The write data will be all zeros and the buffer
-    // will be discarded at the end of the SPI transaction.
+    // Convert this to a full-duplex operation which sends zeros while
+    // receiving the data directly into the caller's buffer.
     //
-    BusTransaction->WriteBuffer = AllocateRuntimeZeroPool (BusTransaction->ReadBytes);
+    if ((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) != 0) {
+      IoTransaction->SetupFlags |= SETUP_FLAG_ZERO_READ_PHASE_DATA;
+      break;
+    }
+
+    //
+    // The chip select may not be held between transfers, allocate a
+    // write-buffer of the same length.  The write data will be all zeros and
+    // the buffer will be discarded at the end of the SPI transaction.
+    //
+    BusTransaction->WriteBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                  BusTransaction->ReadBytes);
     if (BusTransaction->WriteBuffer == NULL) {
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate WriteBuffer!\n"));
       }
       return EFI_OUT_OF_RESOURCES;
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Allocated WriteBuffer at 0x%08x\n",
               BusTransaction->WriteBuffer));
     }
+    ZeroMem (BusTransaction->WriteBuffer, BusTransaction->ReadBytes);
 
     //
     // Finish converting this to a full-duplex transaction
@@ -924,13 +1714,27 @@ SpiBusSetupBuffers (
          != 0) {
       return ConvertTransmitFrames (IoTransaction, TRUE);
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Transaction not supported by SPI host controller\n"));
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Converting request to full-duplex SPI transaction\n"));
     }
 
+    //
+    // Without a frame size conversion, split the transaction into a write
+    // phase and a read phase.  The chip select is held asserted across both
+    // phases and the read data is placed directly into the caller's buffer.
+    //
+    if (((SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD) != 0)
+      && ((BusTransaction->FrameSize == 8)
+        || ((SpiHcProtocol->FrameSizeSupportMask
+             & (1 << (BusTransaction->FrameSize - 1))) != 0))) {
+      IoTransaction->SetupFlags |= SETUP_FLAG_DISCARD_WRITE_PHASE_DATA
+                                 | SETUP_FLAG_ZERO_READ_PHASE_DATA;
+      break;
+    }
+
     //
     // Save the caller's buffers and lengths
     //
@@ -945,15 +1749,16 @@ SpiBusSetupBuffers (
     //
     BufferLength = IoTransaction->WriteBytes + IoTransaction->ReadBytes;
     AlignmentMask = 8 - 1;
-    BusTransaction->WriteBuffer = AllocateRuntimePool ((BufferLength * 2)
-                                                    + AlignmentMask);
+    BusTransaction->WriteBuffer = SpiBusAllocateBuffer (IoTransaction,
+                                                        (BufferLength * 2)
+                                                        + AlignmentMask);
     if (BusTransaction->WriteBuffer == NULL) {
-      if (BusTransaction->DebugTransaction) {
+      if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
         DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate WriteBuffer!\n"));
       }
       return EFI_OUT_OF_RESOURCES;
     }
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Allocated WriteBuffer at 0x%08x\n",
               BusTransaction->WriteBuffer));
     }
@@ -961,7 +1766,7 @@ SpiBusSetupBuffers (
     //
     // Copy the write data into the new buffer
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
          "SpiBus: Copying 0x%08x bytes of write data from 0x%08x into 0x%08x\n",
          IoTransaction->WriteBytes,
@@ -975,7 +1780,7 @@ SpiBusSetupBuffers (
     //
     // Zero the additional bytes in the write buffer
     //
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR,
               "SpiBus: Zeroing 0x%08x bytes of write data at 0x%08x\n",
               IoTransaction->ReadBytes,
@@ -991,7 +1796,7 @@ SpiBusSetupBuffers (
                                | SETUP_FLAG_COPY_READ_DATA;
     BusTransaction->ReadBuffer = BusTransaction->WriteBuffer
                     + ((BufferLength + AlignmentMask) & (~AlignmentMask));
-    if (BusTransaction->DebugTransaction) {
+    if (SPI_DEBUG (BusTransaction->DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiBus: Using ReadBuffer at 0x%08x\n",
               BusTransaction->ReadBuffer));
     }
@@ -1024,6 +1829,7 @@ SpiBusShutdown (
   IN SPI_BUS *SpiBus
   )
 {
+  SPI_BUS **Previous;
   SPI_BUS *SpiBusLayerTag;
   EFI_STATUS Status;
 
@@ -1031,6 +1837,18 @@ SpiBusShutdown (
   // Determine if the job is already done
   //
   if (SpiBus != NULL) {
+    //
+    // Remove the SPI bus from the list
+    //
+    Previous = &gSpiBusList;
+    while (*Previous != NULL) {
+      if (*Previous == SpiBus) {
+        *Previous = SpiBus->NextSpiBus;
+        break;
+      }
+      Previous = &(*Previous)->NextSpiBus;
+    }
+
     //
     // Release the SPI HC protocol
     //
@@ -1104,12 +1922,19 @@ SpiBusStartup (
   SPI_BUS *SpiBus;
   EFI_STATUS Status;
 
+  //
+  // Record the time spent starting the SPI bus and enumerating the SPI
+  // peripherals
+  //
+  PERF_START (ControllerHandle, "SpiBusStartup", NULL, 0);
+
   //
   // Allocate the SPI host controller data structure
   //
   SpiBus = AllocateRuntimeZeroPool (sizeof (SPI_BUS));
   if (SpiBus == NULL) {
     DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI_BUS!\n"));
+    PERF_END (ControllerHandle, "SpiBusStartup", NULL, 0);
     return EFI_OUT_OF_RESOURCES;
   }
 
@@ -1205,10 +2030,17 @@ SpiBusStartup (
     goto Failure;
   }
 
+  //
+  // Add the SPI bus to the list
+  //
+  SpiBus->NextSpiBus = gSpiBusList;
+  gSpiBusList = SpiBus;
+
   //
   // Enumerate the SPI devices
   //
   SpiBusEnumerateSpiDevices (SpiBus);
+  PERF_END (ControllerHandle, "SpiBusStartup", NULL, 0);
   return EFI_SUCCESS;
 
 Failure:
@@ -1216,5 +2048,6 @@ Failure:
   // Release the SPI host controller resources
   //
   SpiBusShutdown (SpiBus);
+  PERF_END (ControllerHandle, "SpiBusStartup", NULL, 0);
   return Status;
 }
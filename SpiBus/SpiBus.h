@@ -17,10 +17,13 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #define __SPI_BUS_H__
 
 #include <Uefi.h>
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/DevicePathLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/PerformanceLib.h>
+#include <Library/TimerLib.h>
 #include <Library/UefiLib.h>
 #include <Protocol/DevicePath.h>
 #include <Protocol/DevicePathToText.h>
@@ -28,9 +31,74 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Protocol/SpiConfiguration.h>
 #include <Protocol/SpiHc.h>
 #include <Protocol/SpiIo.h>
+#include <Protocol/SpiNorFlash.h>
+#include <Protocol/SpiPeripheralStub.h>
+#include <Protocol/SpiTrace.h>
 #include <Library/UefiBootServicesTableLib.h>
 
 typedef struct _SPI_IO SPI_IO;
+typedef struct _SPI_PREPARED_TRANSACTION SPI_PREPARED_TRANSACTION;
+
+//
+// Display the transaction details only when the debug paths are built into
+// the driver.  A FALSE PcdSpiDebugTransaction value allows the compiler to
+// remove the debug code from the transaction path.
+//
+#define SPI_DEBUG(DebugTransaction)                                           \
+  (FixedPcdGetBool (PcdSpiDebugTransaction) && (DebugTransaction))
+
+//
+// Size of the scratch buffers used to emulate the write-only, read-only and
+// write-then-read transactions with full-duplex transfers.  The emulated
+// transfers are broken into pieces of this size while the chip select remains
+// asserted.
+//
+#define SPI_BUS_SCRATCH_BYTES   256
+
+//
+// Largest command built from the phases of a phase transaction: opcode, four
+// address bytes and 255 dummy cycles on a 4-bit bus
+//
+#define SPI_BUS_COMMAND_BYTES   (1 + 4 + ((MAX_UINT8 * 4) / 8))
+
+//
+// Number of records in the transaction trace ring, a power of two
+//
+#define SPI_TRACE_RECORDS       1024
+
+//
+// Transaction trace ring
+//
+typedef struct _SPI_TRACE_RING {
+  EFI_SPI_TRACE_HEADER Header;
+  EFI_SPI_TRACE_RECORD Records[SPI_TRACE_RECORDS];
+} SPI_TRACE_RING;
+
+//
+// SCLK training
+//
+#define SPI_TRAINING_PATTERN_BYTES  3   // Manufacture and device ID
+#define SPI_TRAINING_READS          32  // Pattern reads verified per step
+#define SPI_TRAINING_STEP_SHIFT     3   // Frequency step of 1/8 (12.5%)
+#define SPI_TRAINING_MAX_RATIO      2   // Limit, multiple of datasheet SCLK
+#define SPI_TRAINING_NAME_LENGTH    16  // Variable name characters
+
+//
+// Non-volatile SCLK training results for a SPI peripheral
+//
+typedef struct _SPI_CLOCK_TRAINING_DATA {
+  //
+  // Pattern read at the datasheet frequency, identifies the SPI part
+  //
+  UINT8 Pattern[SPI_TRAINING_PATTERN_BYTES];
+  UINT8 Reserved;
+
+  //
+  // Datasheet frequency and the selected frequency
+  //
+  UINT32 BaselineClockHz;
+  UINT32 TrainedClockHz;
+} SPI_CLOCK_TRAINING_DATA;
 
 typedef struct _SPI_IO_TRANSACTION
 {
@@ -44,11 +112,28 @@ typedef struct _SPI_IO_TRANSACTION
   //
   SPI_IO *SpiIo;
 
+  //
+  // Prepared transaction being executed, NULL otherwise
+  //
+  SPI_PREPARED_TRANSACTION *Prepared;
+
+  //
+  // Segments of a segmented write, NULL otherwise
+  //
+  CONST EFI_SPI_IO_WRITE_SEGMENT *Segments;
+  UINT32 SegmentCount;
+
   //
   // Maximum clock frequency for this transaction
   //
   UINTN ClockHz OPTIONAL;
 
+  //
+  // Transaction type requested by the SPI peripheral layer, the emulation
+  // may convert the bus transaction into a full-duplex transaction
+  //
+  EFI_SPI_TRANSACTION_TYPE TransactionType;
+
   //
   // Setup flags in the event of a setup error
   //
@@ -72,6 +157,16 @@ typedef struct _SPI_IO_TRANSACTION
 
 typedef struct _SPI_BUS
 {
+  //
+  // Next SPI bus in the list of SPI buses managed by this driver
+  //
+  struct _SPI_BUS *NextSpiBus;
+
+  //
+  // List of SPI_IO structures for the peripherals on this bus
+  //
+  SPI_IO *SpiIoList;
+
   EFI_HANDLE ControllerHandle;
   EFI_DEVICE_PATH_PROTOCOL *DevicePath;
   CONST EFI_SPI_BUS *BusConfig;
@@ -91,6 +186,18 @@ typedef struct _SPI_BUS
   // Legacy SPI host controller protocol
   //
   CONST EFI_LEGACY_SPI_CONTROLLER_PROTOCOL *LegacySpiProtocol;
+
+  //
+  // Transmit data for the read phase of an emulated transaction.  This buffer
+  // is zeroed when the SPI_BUS structure is allocated and is never written.
+  //
+  UINT32 ZeroBuffer[SPI_BUS_SCRATCH_BYTES / sizeof (UINT32)];
+
+  //
+  // Receive data for the write phase of an emulated transaction.  The data
+  // placed into this buffer is discarded.
+  //
+  UINT32 DiscardBuffer[SPI_BUS_SCRATCH_BYTES / sizeof (UINT32)];
 } SPI_BUS;
 
 #define SPI_IO_SIGNATURE        SIGNATURE_32 ('S', 'P', 'I', 'O')
@@ -102,14 +209,125 @@ typedef struct _SPI_IO
   //
   UINT32 Signature;
   SPI_BUS *SpiBus;
+
+  //
+  // Next SPI_IO structure on this SPI bus
+  //
+  SPI_IO *NextSpiIo;
+
+  //
+  // Transactions prepared by the SPI peripheral driver
+  //
+  SPI_PREPARED_TRANSACTION *PreparedList;
+
   EFI_HANDLE Handle;
   EFI_DEVICE_PATH_PROTOCOL *DevicePath;
   EFI_SPI_IO_PROTOCOL SpiIoProtocol;
+
+  //
+  // Enumeration index of this SPI peripheral, names the training variable
+  //
+  UINT32 PartIndex;
+
+  //
+  // SCLK frequency selected by training for the reads of the original SPI
+  // peripheral, zero (0) uses the datasheet frequencies
+  //
+  UINT32 TrainedClockHz;
+
+  //
+  // SCLK training is waiting for the variable services
+  //
+  BOOLEAN TrainClock;
 } SPI_IO;
 
 #define SPI_IO_CONTEXT_FROM_PROTOCOL(protocol)         \
     CR (protocol, SPI_IO, SpiIoProtocol, SPI_IO_SIGNATURE)
 
+#define SPI_IO_STUB_SIGNATURE   SIGNATURE_32 ('S', 'P', 'I', 'S')
+
+typedef struct _SPI_IO_STUB
+{
+  //
+  // Structure identification
+  //
+  UINT32 Signature;
+  SPI_BUS *SpiBus;
+
+  //
+  // Child handle for the SPI peripheral
+  //
+  EFI_HANDLE Handle;
+  EFI_SPI_PERIPHERAL_STUB_PROTOCOL StubProtocol;
+
+  //
+  // Enumeration index reserved for this SPI peripheral
+  //
+  UINT32 PartIndex;
+
+  //
+  // SPI_IO structure created by Connect, NULL until then
+  //
+  SPI_IO *SpiIo;
+} SPI_IO_STUB;
+
+#define SPI_IO_STUB_FROM_PROTOCOL(protocol)            \
+    CR (protocol, SPI_IO_STUB, StubProtocol, SPI_IO_STUB_SIGNATURE)
+
+#define SPI_PREPARED_SIGNATURE  SIGNATURE_32 ('S', 'P', 'I', 'P')
+
+typedef struct _SPI_PREPARED_TRANSACTION
+{
+  //
+  // Structure identification
+  //
+  UINT32 Signature;
+  SPI_IO *SpiIo;
+
+  //
+  // Next prepared transaction for this SPI_IO structure
+  //
+  SPI_PREPARED_TRANSACTION *NextPrepared;
+
+  //
+  // SPI peripheral used to validate the transaction
+  //
+  CONST EFI_SPI_PERIPHERAL *SpiPeripheral;
+
+  //
+  // Validated transaction parameters, the buffer addresses are supplied by
+  // each call to ExecutePrepared
+  //
+  EFI_SPI_BUS_TRANSACTION BusTransaction;
+
+  //
+  // Requested SCLK frequency after applying the part and peripheral limits
+  //
+  UINT32 ClockHz;
+
+  //
+  // SCLK frequency requested by the SPI peripheral driver
+  //
+  UINT32 RequestedClockHz;
+
+  //
+  // Transaction emulation flags when the frames are not converted
+  //
+  UINT32 SetupFlags;
+
+  //
+  // TRUE when SpiBusSetupBuffers must convert the frames to 8-bits/frame or
+  // convert the transaction into a single full-duplex transfer
+  //
+  BOOLEAN ConvertFrames;
+
+  //
+  // Buffer for the frame conversion, NULL when not needed
+  //
+  UINT8 *Buffer;
+  UINT32 BufferBytes;
+} SPI_PREPARED_TRANSACTION;
+
 #define SPI_IO_TRANSACTION_SIGNATURE    SIGNATURE_32 ('S', 'P', 'I', 'T')
 
 #define IO_TRANSACTION_FROM_ENTRY(a)    \
@@ -123,6 +341,8 @@ typedef struct _SPI_IO
 #define SETUP_FLAG_CONVERT_FRAME_BITS_8_TO_16   0x00000020
 #define SETUP_FLAG_CONVERT_FRAME_BITS_8_TO_24   0x00000040
 #define SETUP_FLAG_CONVERT_FRAME_BITS_8_TO_32   0x00000080
+#define SETUP_FLAG_DISCARD_WRITE_PHASE_DATA     0x00000100
+#define SETUP_FLAG_ZERO_READ_PHASE_DATA         0x00000200
 
 typedef struct _SPI_DEVICE_PATH
 {
@@ -159,6 +379,22 @@ SpiBusSetupBuffers (
   IN SPI_BUS *SpiBus
   );
 
+UINT32
+EFIAPI
+SpiBusClockFrequency (
+  IN SPI_IO *SpiIo,
+  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral,
+  IN EFI_SPI_TRANSACTION_TYPE TransactionType,
+  IN UINTN ClockHz
+  );
+
+EFI_STATUS
+EFIAPI
+SpiBusPrepareTransaction (
+  IN SPI_BUS *SpiBus,
+  IN SPI_PREPARED_TRANSACTION *Prepared
+  );
+
 EFI_STATUS
 EFIAPI
 SpiBusTransaction (
@@ -174,6 +410,14 @@ SpiIoShutdown (
 EFI_STATUS
 EFIAPI
 SpiIoStartup (
+  IN SPI_BUS *SpiBus,
+  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral,
+  IN SPI_IO_STUB *Stub OPTIONAL
+  );
+
+EFI_STATUS
+EFIAPI
+SpiIoPublishStub (
   IN SPI_BUS *SpiBus,
   IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral
   );
@@ -200,6 +444,13 @@ SpiInstallIoProtocol (
   IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral
   );
 
+EFI_STATUS
+EFIAPI
+SpiInstallStubProtocol (
+  IN EFI_HANDLE *Handle,
+  IN EFI_SPI_PERIPHERAL_STUB_PROTOCOL *StubProtocol
+  );
+
 EFI_STATUS
 EFIAPI
 SpiBusStartup (
@@ -254,9 +505,70 @@ SpiRestoreTpl(
   IN EFI_TPL      OldTpl
   );
 
+BOOLEAN
+EFIAPI
+SpiAtRuntime(
+  VOID
+  );
+
+EFI_STATUS
+EFIAPI
+SpiGetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN OUT UINTN *DataSize,
+  OUT VOID *Data
+  );
+
+EFI_STATUS
+EFIAPI
+SpiSetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN UINTN DataSize,
+  IN VOID *Data
+  );
+
+VOID
+EFIAPI
+SpiScheduleClockTraining (
+  IN SPI_IO *SpiIo
+  );
+
+VOID
+EFIAPI
+SpiIoTrainClock (
+  IN SPI_IO *SpiIo
+  );
+
+EFI_STATUS
+EFIAPI
+SpiInstallTraceProtocol (
+  IN EFI_SPI_TRACE_PROTOCOL *TraceProtocol
+  );
+
+VOID
+EFIAPI
+SpiTraceInitialize (
+  VOID
+  );
+
+VOID
+EFIAPI
+SpiTraceRecord (
+  IN UINT8 Event,
+  IN UINT32 PartIndex,
+  IN CONST EFI_SPI_BUS_TRANSACTION *BusTransaction,
+  IN UINT32 ClockHz,
+  IN EFI_STATUS Status
+  );
+
 /* Define the externals to enable support of SMM */
 extern EFI_GUID *gLegacySpiControllerProtocolGuid;
 extern EFI_GUID *gSpiHcProtocolGuid;
 extern EFI_GUID gSpiBusLayerGuid;
+extern EFI_GUID *gSpiNorFlashDriverGuid;
+extern SPI_BUS *gSpiBusList;
+extern SPI_TRACE_RING *gSpiTraceRing;
 
 #endif	// __SPI_BUS_H__
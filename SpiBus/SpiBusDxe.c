@@ -14,6 +14,10 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
 #include "SpiBus.h"
+#include <Guid/EventGroup.h>
+#include <Library/UefiRuntimeLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Protocol/VariableWrite.h>
 
 EFI_SPI_CONFIGURATION_PROTOCOL *gSpiConfigurationProtocol;
 VOID *gSpiConfigurationProtocolRegistration;
@@ -23,6 +27,13 @@ EFI_GUID *gSpiConfigurationProtocolGuid = &gEfiSpiConfigurationProtocolGuid;
 EFI_GUID *gSpiHcProtocolGuid = &gEfiSpiHcProtocolGuid;
 EFI_GUID gSpiBusLayerGuid =
 {0x94edabab, 0x63e5, 0x4c63, {0x9b, 0xfa, 0x42, 0x85, 0x1d, 0xb7, 0x97, 0x1b}};
+EFI_GUID *gSpiNorFlashDriverGuid = &gEfiSpiNorFlashDriverGuid;
+
+//
+// SCLK training waiting for the variable services
+//
+STATIC EFI_EVENT mVariableWriteEvent;
+STATIC VOID *mVariableWriteRegistration;
 
 /**
   Raises a task's priority level and returns its previous level.
@@ -38,6 +49,13 @@ SpiRaiseTpl(
   IN EFI_TPL      NewTpl
   )
 {
+  //
+  // The boot services are not available at runtime, the caller is
+  // responsible for serializing the runtime calls
+  //
+  if (EfiAtRuntime ()) {
+    return TPL_NOTIFY;
+  }
   return gBS->RaiseTPL(NewTpl);
 }
 
@@ -53,7 +71,262 @@ SpiRestoreTpl(
   IN EFI_TPL      OldTpl
   )
 {
-  gBS->RestoreTPL(OldTpl);
+  if (!EfiAtRuntime ()) {
+    gBS->RestoreTPL(OldTpl);
+  }
+}
+
+/**
+  Determine if the system is running after ExitBootServices.
+
+  @retval TRUE                The boot services are no longer available
+  @retval FALSE               The boot services are available
+
+**/
+BOOLEAN
+EFIAPI
+SpiAtRuntime(
+  VOID
+  )
+{
+  return EfiAtRuntime ();
+}
+
+/**
+  Get the SCLK training results from a non-volatile variable.
+
+  @param[in]  VariableName      Name of the variable
+  @param[in]  VendorGuid        Vendor GUID of the variable
+  @param[in, out] DataSize      On input the size of the buffer, on output
+                                the size of the variable data
+  @param[out] Data              Buffer to receive the variable data
+
+  @retval EFI_SUCCESS           The variable was read successfully
+  @retval other                 The variable is not available
+
+**/
+EFI_STATUS
+EFIAPI
+SpiGetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN OUT UINTN *DataSize,
+  OUT VOID *Data
+  )
+{
+  return gRT->GetVariable (VariableName, VendorGuid, NULL, DataSize, Data);
+}
+
+/**
+  Save the SCLK training results in a non-volatile variable.
+
+  @param[in]  VariableName      Name of the variable
+  @param[in]  VendorGuid        Vendor GUID of the variable
+  @param[in]  DataSize          Size of the variable data in bytes
+  @param[in]  Data              Variable data
+
+  @retval EFI_SUCCESS           The variable was written successfully
+  @retval other                 The variable was not written
+
+**/
+EFI_STATUS
+EFIAPI
+SpiSetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN UINTN DataSize,
+  IN VOID *Data
+  )
+{
+  return gRT->SetVariable (
+                VariableName,
+                VendorGuid,
+                EFI_VARIABLE_NON_VOLATILE | EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                DataSize,
+                Data
+                );
+}
+
+/**
+  The variable services are available.
+
+  This routine is called at TPL_CALLBACK.
+
+  Train the SCLK frequency for the SPI peripherals which were enumerated
+  before the variable services were available, such as the SPI flash
+  containing the variable store.
+
+  @param[in]  Event             Event whose notification function is being
+                                invoked.
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+SpiBusVariableWriteAvailable (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  VOID *Interface;
+  SPI_BUS *SpiBus;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol (&gEfiVariableWriteArchProtocolGuid, NULL,
+                                &Interface);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+  gBS->CloseEvent (Event);
+  mVariableWriteEvent = NULL;
+
+  //
+  // Train the waiting SPI peripherals
+  //
+  SpiBus = gSpiBusList;
+  while (SpiBus != NULL) {
+    SpiIo = SpiBus->SpiIoList;
+    while (SpiIo != NULL) {
+      if (SpiIo->TrainClock) {
+        SpiIo->TrainClock = FALSE;
+        SpiIoTrainClock (SpiIo);
+      }
+      SpiIo = SpiIo->NextSpiIo;
+    }
+    SpiBus = SpiBus->NextSpiBus;
+  }
+}
+
+/**
+  Train the SCLK frequency for a SPI peripheral.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  The training results are saved in a non-volatile variable.  Delay the
+  training until the variable services are available.  Until then the SPI
+  peripheral uses the datasheet frequencies.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+
+**/
+VOID
+EFIAPI
+SpiScheduleClockTraining (
+  IN SPI_IO *SpiIo
+  )
+{
+  VOID *Interface;
+  EFI_STATUS Status;
+
+  Status = gBS->LocateProtocol (&gEfiVariableWriteArchProtocolGuid, NULL,
+                                &Interface);
+  if (!EFI_ERROR (Status)) {
+    SpiIoTrainClock (SpiIo);
+    return;
+  }
+  SpiIo->TrainClock = TRUE;
+  if (mVariableWriteEvent == NULL) {
+    mVariableWriteEvent = EfiCreateProtocolNotifyEvent (
+                            &gEfiVariableWriteArchProtocolGuid,
+                            TPL_CALLBACK,
+                            SpiBusVariableWriteAvailable,
+                            NULL,
+                            &mVariableWriteRegistration
+                            );
+  }
+}
+
+/**
+  Convert the SPI bus layer pointers to virtual addresses.
+
+  This routine is called once by SetVirtualAddressMap.  All of the pointers
+  used by the transaction path are converted.  The SPI_IO and SPI_BUS list
+  links are converted last since they are used to walk the lists.  A SPI bus
+  whose host controller is not runtime capable loses its SPI host controller
+  protocol and fails all further transactions.
+
+  @param[in]  Event             The virtual address change event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+SpiBusVirtualAddressChange (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  SPI_PREPARED_TRANSACTION *NextPrepared;
+  SPI_BUS *NextSpiBus;
+  SPI_IO *NextSpiIo;
+  SPI_PREPARED_TRANSACTION *Prepared;
+  SPI_BUS *SpiBus;
+  SPI_IO *SpiIo;
+
+  SpiBus = gSpiBusList;
+  while (SpiBus != NULL) {
+    //
+    // Convert the SPI_IO structures on this bus
+    //
+    SpiIo = SpiBus->SpiIoList;
+    while (SpiIo != NULL) {
+      //
+      // Convert the prepared transactions
+      //
+      Prepared = SpiIo->PreparedList;
+      while (Prepared != NULL) {
+        NextPrepared = Prepared->NextPrepared;
+        EfiConvertPointer (0, (VOID **)&Prepared->SpiIo);
+        EfiConvertPointer (0, (VOID **)&Prepared->SpiPeripheral);
+        EfiConvertPointer (0,
+                        (VOID **)&Prepared->BusTransaction.SpiPeripheral);
+        EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Prepared->Buffer);
+        EfiConvertPointer (EFI_OPTIONAL_PTR,
+                        (VOID **)&Prepared->NextPrepared);
+        Prepared = NextPrepared;
+      }
+      EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&SpiIo->PreparedList);
+
+      NextSpiIo = SpiIo->NextSpiIo;
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.SpiPeripheral);
+      EfiConvertPointer (0,
+                      (VOID **)&SpiIo->SpiIoProtocol.OriginalSpiPeripheral);
+      EfiConvertPointer (EFI_OPTIONAL_PTR,
+                      (VOID **)&SpiIo->SpiIoProtocol.LegacySpiProtocol);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.Transaction);
+      EfiConvertPointer (0,
+                      (VOID **)&SpiIo->SpiIoProtocol.UpdateSpiPeripheral);
+      EfiConvertPointer (0,
+                      (VOID **)&SpiIo->SpiIoProtocol.PrepareTransaction);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.ExecutePrepared);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.ReleasePrepared);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.WriteSegments);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiIoProtocol.PhaseTransaction);
+      EfiConvertPointer (0, (VOID **)&SpiIo->SpiBus);
+      EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&SpiIo->NextSpiIo);
+      SpiIo = NextSpiIo;
+    }
+
+    //
+    // Disable the SPI bus when the host controller is not available
+    //
+    NextSpiBus = SpiBus->NextSpiBus;
+    if (EFI_ERROR (EfiConvertPointer (0, (VOID **)&SpiBus->SpiHcProtocol))) {
+      SpiBus->SpiHcProtocol = NULL;
+    }
+    EfiConvertPointer (0, (VOID **)&SpiBus->BusConfig);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&SpiBus->LegacySpiProtocol);
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                    (VOID **)&SpiBus->IoTransaction.SpiIo);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&SpiBus->SpiIoList);
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&SpiBus->NextSpiBus);
+    SpiBus = NextSpiBus;
+  }
+  EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&gSpiBusList);
+  EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&gSpiTraceRing);
 }
 
 /**
@@ -163,6 +436,68 @@ SpiInstallIoProtocol (
   return Status;
 }
 
+/**
+  Install the SPI peripheral stub protocol for a SPI part.
+
+  @param[in]  Handle            Pointer to the handle on which to install
+                                the protocol.
+  @param[in]  StubProtocol      A pointer to the stub protocol structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The stub protocol was installed successfully
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+**/
+EFI_STATUS
+EFIAPI
+SpiInstallStubProtocol (
+  IN EFI_HANDLE *Handle,
+  IN EFI_SPI_PERIPHERAL_STUB_PROTOCOL *StubProtocol
+  )
+{
+  EFI_STATUS Status;
+
+  //
+  // Create a child handle for the SPI peripheral
+  //
+  Status = gBS->InstallProtocolInterface (
+                   Handle,
+                   &gEfiSpiPeripheralStubProtocolGuid,
+                   EFI_NATIVE_INTERFACE,
+                   StubProtocol
+                   );
+  return Status;
+}
+
+/**
+  Install the SPI trace protocol.
+
+  @param[in]  TraceProtocol     A pointer to the trace protocol structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The trace protocol was installed successfully
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+**/
+EFI_STATUS
+EFIAPI
+SpiInstallTraceProtocol (
+  IN EFI_SPI_TRACE_PROTOCOL *TraceProtocol
+  )
+{
+  EFI_HANDLE Handle;
+
+  Handle = NULL;
+  return gBS->InstallProtocolInterface (
+                &Handle,
+                &gEfiSpiTraceProtocolGuid,
+                EFI_NATIVE_INTERFACE,
+                TraceProtocol
+                );
+}
+
 /**
   Connects one or more drivers to a controller.
 
@@ -556,6 +891,27 @@ SpiBusEntryPoint (
   )
 {
   EFI_EVENT Event;
+  EFI_STATUS Status;
+
+  //
+  // Convert the pointers when the OS switches to virtual addressing
+  //
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  SpiBusVirtualAddressChange,
+                  NULL,
+                  &gEfiEventVirtualAddressChangeGuid,
+                  &Event
+                  );
+  ASSERT_EFI_ERROR (Status);
+
+  //
+  // Record the SPI transactions
+  //
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceInitialize ();
+  }
 
   //
   // Wait until the board layer's SPI configuration database is available
@@ -24,6 +24,7 @@ EFI_GUID *gSpiConfigurationProtocolGuid = &gEfiSpiSmmConfigurationProtocolGuid;
 EFI_GUID *gSpiHcProtocolGuid = &gEfiSpiSmmHcProtocolGuid;
 EFI_GUID gSpiBusLayerGuid =
 {0xf31bb793, 0x2888, 0x433a, {0x83, 0x02, 0x17, 0x29, 0xb8, 0xa0, 0xef, 0x72}};
+EFI_GUID *gSpiNorFlashDriverGuid = &gEfiSpiSmmNorFlashDriverGuid;
 
 /**
   Raises a task's priority level and returns its previous level.
@@ -56,6 +57,88 @@ SpiRestoreTpl(
 {
 }
 
+/**
+  Determine if the system is running after ExitBootServices.
+
+  @retval FALSE               SMM code always has its own services
+
+**/
+BOOLEAN
+EFIAPI
+SpiAtRuntime(
+  VOID
+  )
+{
+  return FALSE;
+}
+
+/**
+  Get the SCLK training results from a non-volatile variable.
+
+  The SMM variable services depend upon the SPI flash, so the SCLK training
+  results are not saved in SMM.
+
+  @param[in]  VariableName      Name of the variable
+  @param[in]  VendorGuid        Vendor GUID of the variable
+  @param[in, out] DataSize      On input the size of the buffer, on output
+                                the size of the variable data
+  @param[out] Data              Buffer to receive the variable data
+
+  @retval EFI_UNSUPPORTED       Variables are not available
+
+**/
+EFI_STATUS
+EFIAPI
+SpiGetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN OUT UINTN *DataSize,
+  OUT VOID *Data
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Save the SCLK training results in a non-volatile variable.
+
+  @param[in]  VariableName      Name of the variable
+  @param[in]  VendorGuid        Vendor GUID of the variable
+  @param[in]  DataSize          Size of the variable data in bytes
+  @param[in]  Data              Variable data
+
+  @retval EFI_UNSUPPORTED       Variables are not available
+
+**/
+EFI_STATUS
+EFIAPI
+SpiSetVariable (
+  IN CHAR16 *VariableName,
+  IN EFI_GUID *VendorGuid,
+  IN UINTN DataSize,
+  IN VOID *Data
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Train the SCLK frequency for a SPI peripheral.
+
+  The training runs on each boot in SMM since the results are not saved.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+
+**/
+VOID
+EFIAPI
+SpiScheduleClockTraining (
+  IN SPI_IO *SpiIo
+  )
+{
+  SpiIoTrainClock (SpiIo);
+}
+
 /**
   Install the SPI bus layer protocol for the driver.
 
@@ -156,6 +239,56 @@ SpiInstallIoProtocol (
   return Status;
 }
 
+/**
+  Install the SPI peripheral stub protocol for a SPI part.
+
+  The SMM SPI peripheral drivers locate the SPI IO protocol directly, the
+  SPI peripherals are always enumerated during the SPI bus startup.
+
+  @param[in]  Handle            Pointer to the handle on which to install
+                                the protocol.
+  @param[in]  StubProtocol      A pointer to the stub protocol structure.
+
+  @retval EFI_UNSUPPORTED       The stubs are not supported in SMM
+**/
+EFI_STATUS
+EFIAPI
+SpiInstallStubProtocol (
+  IN EFI_HANDLE *Handle,
+  IN EFI_SPI_PERIPHERAL_STUB_PROTOCOL *StubProtocol
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Install the SPI trace protocol.
+
+  @param[in]  TraceProtocol     A pointer to the trace protocol structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The trace protocol was installed successfully
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+**/
+EFI_STATUS
+EFIAPI
+SpiInstallTraceProtocol (
+  IN EFI_SPI_TRACE_PROTOCOL *TraceProtocol
+  )
+{
+  EFI_HANDLE Handle;
+
+  Handle = NULL;
+  return gSmst->SmmInstallProtocolInterface (
+                  &Handle,
+                  &gEfiSpiSmmTraceProtocolGuid,
+                  EFI_NATIVE_INTERFACE,
+                  TraceProtocol
+                  );
+}
+
 /**
   Display the device path for the host controller.
 
@@ -474,6 +607,13 @@ SpiBusEntryPoint (
 {
   EFI_STATUS Status;
 
+  //
+  // Record the SPI transactions
+  //
+  if (FeaturePcdGet (PcdSpiTransactionTrace)) {
+    SpiTraceInitialize ();
+  }
+
   //
   // Wait until the board layer's SPI configuration database is available
   //
@@ -0,0 +1,242 @@
+/** @file
+
+  This module implements the SCLK training for the SPI peripherals.
+
+  The SPI part and SPI peripheral maximum frequencies are conservative
+  datasheet values.  SPI NOR flash parts return a known pattern, the
+  manufacture and device ID, which allows the SPI bus layer to step the SCLK
+  frequency up and verify the received data at each step.  The fastest
+  frequency with margin is used for the transactions and is saved in a
+  non-volatile variable so that later boots only verify the saved frequency.
+
+Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "SpiBus.h"
+#include <Library/PrintLib.h>
+
+//
+// Vendor GUID for the SCLK training variables
+//
+STATIC EFI_GUID mSpiClockTrainingGuid =
+{0x5c9c1436, 0x6b6d, 0x4ff4, {0x9f, 0x70, 0x47, 0x18, 0x70, 0x1e, 0xdd, 0x01}};
+
+/**
+  Read the training pattern from the SPI peripheral.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+  @param[out] Pattern           Buffer to receive SPI_TRAINING_PATTERN_BYTES
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The pattern was read successfully
+  @retval other                 The SPI transaction failed
+
+**/
+STATIC
+EFI_STATUS
+SpiTrainingReadPattern (
+  IN SPI_IO *SpiIo,
+  OUT UINT8 *Pattern
+  )
+{
+  UINT8 Opcode;
+
+  Opcode = SPI_NOR_READ_MANUFACTURE_ID;
+  return SpiIo->SpiIoProtocol.Transaction (
+                                &SpiIo->SpiIoProtocol,
+                                SPI_TRANSACTION_WRITE_THEN_READ,
+                                FALSE,
+                                0,
+                                1,
+                                8,
+                                sizeof (Opcode),
+                                &Opcode,
+                                SPI_TRAINING_PATTERN_BYTES,
+                                Pattern
+                                );
+}
+
+/**
+  Verify the training pattern at a SCLK frequency.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+  @param[in]  ClockHz           SCLK frequency to verify
+  @param[in]  Pattern           Pattern read at the datasheet frequency
+
+  @retval TRUE                  All of the reads returned the pattern
+  @retval FALSE                 A transaction failed or returned other data
+
+**/
+STATIC
+BOOLEAN
+SpiTrainingVerify (
+  IN SPI_IO *SpiIo,
+  IN UINT32 ClockHz,
+  IN CONST UINT8 *Pattern
+  )
+{
+  UINT8 Data[SPI_TRAINING_PATTERN_BYTES];
+  UINTN Index;
+  EFI_STATUS Status;
+
+  SpiIo->TrainedClockHz = ClockHz;
+  for (Index = 0; Index < SPI_TRAINING_READS; Index++) {
+    SetMem (Data, sizeof (Data), (UINT8)~Pattern[0]);
+    Status = SpiTrainingReadPattern (SpiIo, Data);
+    if (EFI_ERROR (Status)
+      || (CompareMem (Data, Pattern, sizeof (Data)) != 0)) {
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/**
+  Train the SCLK frequency for a SPI peripheral.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  The training only applies to SPI NOR flash peripherals.  The saved frequency
+  is verified and used when the peripheral returns the same pattern at the
+  same datasheet frequency.  Otherwise the SCLK frequency is stepped up from
+  the datasheet frequency until the pattern fails to verify, or the
+  frequency reaches SPI_TRAINING_MAX_RATIO times the datasheet frequency.
+  The frequency one step below the highest verified frequency is selected to
+  provide margin.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+
+**/
+VOID
+EFIAPI
+SpiIoTrainClock (
+  IN SPI_IO *SpiIo
+  )
+{
+  UINT32 BaselineClockHz;
+  UINTN DataSize;
+  UINT32 MaximumClockHz;
+  CHAR16 Name[SPI_TRAINING_NAME_LENGTH];
+  UINT8 Pattern[SPI_TRAINING_PATTERN_BYTES];
+  EFI_TPL PreviousTpl;
+  SPI_PREPARED_TRANSACTION *Prepared;
+  UINT32 RequestClockHz;
+  UINT32 SafeClockHz;
+  CONST EFI_SPI_PERIPHERAL *SpiPeripheral;
+  EFI_STATUS Status;
+  SPI_CLOCK_TRAINING_DATA TrainingData;
+  SPI_CLOCK_TRAINING_DATA SavedData;
+
+  //
+  // Only SPI NOR flash parts provide a known pattern
+  //
+  SpiPeripheral = SpiIo->SpiIoProtocol.SpiPeripheral;
+  if ((SpiPeripheral->SpiPeripheralDriverGuid == NULL)
+    || (!CompareGuid (SpiPeripheral->SpiPeripheralDriverGuid,
+                      gSpiNorFlashDriverGuid))) {
+    return;
+  }
+
+  //
+  // Read the pattern at the datasheet frequency
+  //
+  SpiIo->TrainedClockHz = 0;
+  BaselineClockHz = SpiBusClockFrequency (SpiIo, SpiPeripheral,
+                                         SPI_TRANSACTION_WRITE_THEN_READ, 0);
+  Status = SpiTrainingReadPattern (SpiIo, Pattern);
+  if (EFI_ERROR (Status)) {
+    return;
+  }
+  if (((Pattern[0] | Pattern[1] | Pattern[2]) == 0)
+    || ((Pattern[0] & Pattern[1] & Pattern[2]) == 0xff)) {
+    DEBUG ((EFI_D_INFO, "SpiBus: SCLK training skipped, no SPI flash ID\n"));
+    return;
+  }
+  ZeroMem (&TrainingData, sizeof (TrainingData));
+  CopyMem (TrainingData.Pattern, Pattern, sizeof (Pattern));
+  TrainingData.BaselineClockHz = BaselineClockHz;
+
+  //
+  // Use the saved frequency when it is still valid
+  //
+  UnicodeSPrint (Name, sizeof (Name), L"SpiClock%04x", SpiIo->PartIndex);
+  DataSize = sizeof (SavedData);
+  Status = SpiGetVariable (Name, &mSpiClockTrainingGuid, &DataSize,
+                           &SavedData);
+  if ((!EFI_ERROR (Status)) && (DataSize == sizeof (SavedData))
+    && (CompareMem (SavedData.Pattern, Pattern, sizeof (Pattern)) == 0)
+    && (SavedData.BaselineClockHz == BaselineClockHz)
+    && (SavedData.TrainedClockHz != 0)
+    && SpiTrainingVerify (SpiIo, SavedData.TrainedClockHz, Pattern)) {
+    SafeClockHz = SavedData.TrainedClockHz;
+  } else {
+    //
+    // Step the frequency up until the pattern fails to verify
+    //
+    MaximumClockHz = BaselineClockHz * SPI_TRAINING_MAX_RATIO;
+    SafeClockHz = BaselineClockHz;
+    RequestClockHz = BaselineClockHz;
+    while (RequestClockHz < MaximumClockHz) {
+      RequestClockHz += RequestClockHz >> SPI_TRAINING_STEP_SHIFT;
+      if (RequestClockHz > MaximumClockHz) {
+        RequestClockHz = MaximumClockHz;
+      }
+      if (!SpiTrainingVerify (SpiIo, RequestClockHz, Pattern)) {
+        break;
+      }
+
+      //
+      // Provide margin by backing off one step from the verified frequency,
+      // including when the maximum frequency verifies
+      //
+      SafeClockHz = RequestClockHz
+                  - (RequestClockHz / ((1 << SPI_TRAINING_STEP_SHIFT) + 1));
+      if (SafeClockHz < BaselineClockHz) {
+        SafeClockHz = BaselineClockHz;
+      }
+    }
+
+    //
+    // Save the training results
+    //
+    TrainingData.TrainedClockHz = SafeClockHz;
+    Status = SpiSetVariable (Name, &mSpiClockTrainingGuid,
+                             sizeof (TrainingData), &TrainingData);
+    if (EFI_ERROR (Status)) {
+      DEBUG ((EFI_D_INFO, "SpiBus: SCLK training not saved, Status: %r\n",
+              Status));
+    }
+  }
+
+  //
+  // Use the trained frequency for the reads of this peripheral
+  //
+  PreviousTpl = SpiRaiseTpl (TPL_NOTIFY);
+  SpiIo->TrainedClockHz = SafeClockHz;
+  Prepared = SpiIo->PreparedList;
+  while (Prepared != NULL) {
+    Prepared->ClockHz = SpiBusClockFrequency (
+                          SpiIo,
+                          Prepared->SpiPeripheral,
+                          Prepared->BusTransaction.TransactionType,
+                          Prepared->RequestedClockHz);
+    Prepared = Prepared->NextPrepared;
+  }
+  SpiRestoreTpl (PreviousTpl);
+  DEBUG ((EFI_D_INFO, "SpiBus: %s SCLK trained %d.%03d MHz, datasheet %d.%03d MHz\n",
+          Name, SafeClockHz / 1000000, (SafeClockHz % 1000000) / 1000,
+          BaselineClockHz / 1000000, (BaselineClockHz % 1000000) / 1000));
+}
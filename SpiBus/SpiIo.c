@@ -28,107 +28,43 @@ STATIC SPI_DEVICE_PATH mSpiPartDevicePath =
 };
 
 /**
-  Initiate a SPI transaction between the host and a SPI peripheral.
-
-  This routine must be called at or below TPL_NOTIFY.
+  Validate the parameters for a SPI transaction.
 
-  This routine works with the SPI bus layer to pass the SPI transaction to
-  the SPI controller for execution on the SPI bus.  There are four types of
-  supported transactions supported by this routine:
-  * Full Duplex: WriteBuffer and ReadBuffer are the same size.
-  * Write Only: WriteBuffer contains data for SPI peripheral, ReadBytes = 0
-  * Read Only: ReadBuffer to receive data from SPI peripheral, WriteBytes = 0
-  * Write Then Read: WriteBuffer contains control data to write to SPI
-    peripheral before data is placed into the ReadBuffer.  Both WriteBytes and
-    ReadBytes must be non-zero.
+  The buffer addresses are validated by the caller.
 
   @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
   @param[in]  TransactionType   Type of SPI transaction specified by one of the
                                 EFI_SPI_TRANSACTION_TYPE values.
   @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
-                                Debugging may be turned on for a single SPI
-                                transaction.  Only this transaction will display
-                                debugging messages.  All other transactions with
-                                this value set to FALSE will not display any
-                                debugging messages.
-  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use the
-                                maximum clock frequency supported by the SPI
-                                controller and part.  Specify a non-zero value
-                                only when a specific SPI transaction requires a
-                                reduced clock rate.
   @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
   @param[in]  FrameSize         Frame size in bits, range: 1 - 32
-  @param[in]  WriteBytes        The length of the WriteBuffer in bytes.  Specify
-                                zero for read-only operations.
-  @param[in]  WriteBuffer       The buffer containing data to be sent from the
-                                host to the SPI chip.  Specify NULL for read
-                                only operations.
-                                * Frame sizes 1-8 bits: UINT8 (one byte) per
-                                  frame
-                                * Frame sizes 7-16 bits: UINT16 (two bytes) per
-                                  frame
-                                * Frame sizes 17-32 bits: UINT32 (four bytes)
-                                  per frame
-                                The transmit frame is in the least significant
-                                N bits.
-  @param[in]  ReadBytes         The length of the ReadBuffer in bytes.  Specify
-                                zero for write-only operations.
-  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
-                                during the transaction.  Specify NULL for write
-                                only operations.
-                                * Frame sizes 1-8 bits: UINT8 (one byte) per
-                                  frame
-                                * Frame sizes 7-16 bits: UINT16 (two bytes) per
-                                  frame
-                                * Frame sizes 17-32 bits: UINT32 (four bytes)
-                                  per frame
-                                The received frame is in the least significant
-                                N bits.
+  @param[in]  WriteBytes        The length of the write buffer in bytes.
+  @param[in]  ReadBytes         The length of the read buffer in bytes.
 
   @return  This routine returns one of the following status values:
 
-  @retval EFI_SUCCESS           The SPI transaction completed successfully
-  @retval EFI_BAD_BUFFER_SIZE   The WriteBytes value was invalid.
-  @retval EFI_BAD_BUFFER_SIZE   The ReadBytes value was invalid.
+  @retval EFI_SUCCESS           The SPI transaction parameters are valid
   @retval EFI_INVALID_PARAMETER TransactionType is not valid
   @retval EFI_INVALID_PARAMETER BusWidth not supported by SPI peripheral or
                                 SPI host controller
-  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
-  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
-  @retval EFI_INVALID_PARAMETER ReadBytes != WriteBytes for full-duplex type
-  @retval EFI_INVALID_PARAMETER TPL too high
-  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for SPI transaction
+  @retval EFI_INVALID_PARAMETER The WriteBytes or ReadBytes value is not valid
+                                for the TransactionType
   @retval EFI_UNSUPPORTED       The FrameSize is not supported by the SPI
                                 bus layer or the SPI host controller.
-  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
-                                frequency requested by ClockHz
 **/
+STATIC
 EFI_STATUS
-EFIAPI SpiIoTransaction (
+EFIAPI
+SpiIoValidateTransaction (
   IN CONST EFI_SPI_IO_PROTOCOL *This,
   IN EFI_SPI_TRANSACTION_TYPE TransactionType,
   IN BOOLEAN DebugTransaction,
-  IN UINT32 ClockHz OPTIONAL,
   IN UINT32 BusWidth,
   IN UINT32 FrameSize,
   IN UINT32 WriteBytes,
-  IN UINT8 *WriteBuffer,
-  IN UINT32 ReadBytes,
-  OUT UINT8 *ReadBuffer
+  IN UINT32 ReadBytes
   )
 {
-  EFI_SPI_BUS_TRANSACTION *BusTransaction;
-  SPI_IO_TRANSACTION *IoTransaction;
-  EFI_TPL PreviousTpl;
-  SPI_BUS *SpiBus;
-  SPI_IO *SpiIo;
-  EFI_STATUS Status;
-
-  //
-  // Locate the context data structure
-  //
-  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
-
   //
   // Validate the parameters for this SPI transaction
   //
@@ -168,20 +104,8 @@ EFIAPI SpiIoTransaction (
       DEBUG((EFI_D_ERROR, "ERROR - ReadBytes != WriteBytes!\n"));
       return EFI_INVALID_PARAMETER;
     }
-    if (WriteBuffer == NULL) {
-      DEBUG((EFI_D_ERROR, "ERROR - WriteBuffer is NULL!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (ReadBuffer == NULL) {
-      DEBUG((EFI_D_ERROR, "ERROR - ReadBuffer is NULL!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (DebugTransaction) {
+    if (SPI_DEBUG (DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiIo: Full-duplex SPI transaction\n"));
-      DEBUG ((EFI_D_ERROR, "SpiIo: Sending data from 0x%08x, 0x%08x bytes\n",
-              WriteBuffer, WriteBytes));
-      DEBUG ((EFI_D_ERROR, "SpiIo: Receiving data into 0x%08x, 0x%08x bytes\n",
-              ReadBuffer, ReadBytes));
     }
     break;
 
@@ -198,14 +122,8 @@ EFIAPI SpiIoTransaction (
       DEBUG((EFI_D_ERROR, "ERROR - WriteBytes is zero!\n"));
       return EFI_INVALID_PARAMETER;
     }
-    if (WriteBuffer == NULL) {
-      DEBUG((EFI_D_ERROR, "ERROR - WriteBuffer is NULL!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (DebugTransaction) {
+    if (SPI_DEBUG (DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiIo: Write-only SPI transaction\n"));
-      DEBUG ((EFI_D_ERROR, "SpiIo: Sending data from 0x%08x, 0x%08x bytes\n",
-              WriteBuffer, WriteBytes));
     }
     break;
 
@@ -222,139 +140,1024 @@ EFIAPI SpiIoTransaction (
       DEBUG((EFI_D_ERROR, "ERROR - ReadBytes is zero!\n"));
       return EFI_INVALID_PARAMETER;
     }
+    if (SPI_DEBUG (DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiIo: Read-only SPI transaction\n"));
+    }
+    break;
+
+  case SPI_TRANSACTION_WRITE_THEN_READ:
+    //
+    // Data first flowing from the host to the SPI peripheral and then data
+    // flows from the SPI peripheral to the host.  These types of operations
+    // get used for SPI flash devices when control data (opcode, address) must
+    // be passed to the SPI peripheral to specify the data to be read.
+    //
+    if (WriteBytes == 0) {
+      DEBUG((EFI_D_ERROR, "ERROR - WriteBytes is zero!\n"));
+      return EFI_INVALID_PARAMETER;
+    }
+    if (ReadBytes == 0) {
+      DEBUG((EFI_D_ERROR, "ERROR - ReadBytes is zero!\n"));
+      return EFI_INVALID_PARAMETER;
+    }
+    if (SPI_DEBUG (DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiIo: Write-then-read SPI transaction\n"));
+    }
+    break;
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Validate the buffer addresses for a SPI transaction.
+
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  WriteBytes        The length of the write buffer in bytes.
+  @param[in]  WriteBuffer       The buffer containing data to be sent.
+  @param[in]  ReadBytes         The length of the read buffer in bytes.
+  @param[in]  ReadBuffer        The buffer to receive data.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The buffers are valid
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiIoValidateBuffers (
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 WriteBytes,
+  IN UINT8 *WriteBuffer,
+  IN UINT32 ReadBytes,
+  IN UINT8 *ReadBuffer
+  )
+{
+  if (WriteBytes != 0) {
+    if (WriteBuffer == NULL) {
+      DEBUG((EFI_D_ERROR, "ERROR - WriteBuffer is NULL!\n"));
+      return EFI_INVALID_PARAMETER;
+    }
+    if (SPI_DEBUG (DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR, "SpiIo: Sending data from 0x%08x, 0x%08x bytes\n",
+              WriteBuffer, WriteBytes));
+    }
+  }
+  if (ReadBytes != 0) {
     if (ReadBuffer == NULL) {
       DEBUG((EFI_D_ERROR, "ERROR - ReadBuffer is NULL!\n"));
       return EFI_INVALID_PARAMETER;
     }
-    if (DebugTransaction) {
-      DEBUG ((EFI_D_ERROR, "SpiIo: Read-only SPI transaction\n"));
+    if (SPI_DEBUG (DebugTransaction)) {
       DEBUG ((EFI_D_ERROR, "SpiIo: Receiving data into 0x%08x, 0x%08x bytes\n",
               ReadBuffer, ReadBytes));
     }
-    break;
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  Pass a validated SPI transaction to the SPI bus layer.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+  @param[in]  Prepared          Pointer to the SPI_PREPARED_TRANSACTION
+                                structure or NULL for a single transaction
+  @param[in]  ClockHz           Maximum clock frequency for this transaction
+  @param[in]  Request           Pointer to an EFI_SPI_BUS_TRANSACTION structure
+                                containing the validated transaction
+  @param[in]  SegmentCount      Number of entries in the Segments array
+  @param[in]  Segments          Array of write segments for a segmented write
+                                or NULL for other transactions
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for SPI transaction
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiIoStartTransaction (
+  IN SPI_IO *SpiIo,
+  IN SPI_PREPARED_TRANSACTION *Prepared OPTIONAL,
+  IN UINT32 ClockHz,
+  IN CONST EFI_SPI_BUS_TRANSACTION *Request,
+  IN UINT32 SegmentCount,
+  IN CONST EFI_SPI_IO_WRITE_SEGMENT *Segments OPTIONAL
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  BOOLEAN DebugTransaction;
+  SPI_IO_TRANSACTION *IoTransaction;
+  EFI_TPL PreviousTpl;
+  SPI_BUS *SpiBus;
+  EFI_STATUS Status;
+
+  //
+  // Synchronize with the SPI bus layer
+  //
+  DebugTransaction = Request->DebugTransaction;
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "SpiIo: Synchronizing with SPI bus layer\n"));
+  }
+  PreviousTpl = SpiRaiseTpl(TPL_NOTIFY);
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "SpiIo: Calling TPL: %d\n", PreviousTpl));
+    DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", TPL_NOTIFY));
+  }
+
+  //
+  // Verify the TPL
+  //
+  if (PreviousTpl > TPL_NOTIFY) {
+    if (SPI_DEBUG (DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR,
+              "SpiIo: Releasing synchronizing with SPI bus layer\n"));
+      DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", PreviousTpl));
+    }
+    SpiRestoreTpl (PreviousTpl);
+    DEBUG ((EFI_D_ERROR,
+            "ERROR - TPL (%d) > TPL_NOTIFY!\n",
+            PreviousTpl));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // This SPI IO instance owns the IO_TRANSACTION until the TPL is dropped
+  // below TPL notify
+  //
+  SpiBus = SpiIo->SpiBus;
+  IoTransaction = &SpiBus->IoTransaction;
+  ZeroMem (IoTransaction, sizeof(*IoTransaction));
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "SpiIo: Using IoTransaction 0x%08x\n",
+            IoTransaction));
+  }
+
+  //
+  // Initialize the structure for the SPI transaction
+  //
+  IoTransaction->SpiIo = SpiIo;
+  IoTransaction->Prepared = Prepared;
+  IoTransaction->ClockHz = ClockHz;
+  IoTransaction->TransactionType = Request->TransactionType;
+  IoTransaction->SegmentCount = SegmentCount;
+  IoTransaction->Segments = Segments;
+
+  BusTransaction = &IoTransaction->BusTransaction;
+  CopyMem (BusTransaction, Request, sizeof (*BusTransaction));
+  BusTransaction->SpiPeripheral = SpiIo->SpiIoProtocol.SpiPeripheral;
+
+  //
+  // Setup the buffers for the SPI transaction.  A prepared transaction which
+  // does not convert the frames has already made the set up decisions.  The
+  // segments of a segmented write are sent directly from the caller's
+  // buffers.
+  //
+  if (Segments != NULL) {
+    IoTransaction->WriteBytes = BusTransaction->WriteBytes;
+    Status = EFI_SUCCESS;
+  } else if ((Prepared != NULL) && (!Prepared->ConvertFrames)) {
+    IoTransaction->SetupFlags = Prepared->SetupFlags;
+    IoTransaction->WriteBytes = BusTransaction->WriteBytes;
+    Status = EFI_SUCCESS;
+  } else {
+    Status = SpiBusSetupBuffers (SpiBus);
+  }
+  if (!EFI_ERROR(Status)) {
+    //
+    // Start the transaction
+    //
+    Status = SpiBusTransaction (SpiBus);
+  }
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR, "SpiBus: Releasing IoTransaction 0x%08x\n",
+            IoTransaction));
+  }
+
+  //
+  // Release the synchronization with the SPI bus layer
+  //
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR,
+            "SpiIo: Releasing synchronizing with SPI bus layer\n"));
+    DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", PreviousTpl));
+  }
+  SpiRestoreTpl (PreviousTpl);
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR,
+            "SpiIo returning Status: %r\n", Status));
+  }
+
+  //
+  // Return the final status
+  //
+  return Status;
+}
+
+/**
+  Initiate a SPI transaction between the host and a SPI peripheral.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  This routine works with the SPI bus layer to pass the SPI transaction to
+  the SPI controller for execution on the SPI bus.  There are four types of
+  supported transactions supported by this routine:
+  * Full Duplex: WriteBuffer and ReadBuffer are the same size.
+  * Write Only: WriteBuffer contains data for SPI peripheral, ReadBytes = 0
+  * Read Only: ReadBuffer to receive data from SPI peripheral, WriteBytes = 0
+  * Write Then Read: WriteBuffer contains control data to write to SPI
+    peripheral before data is placed into the ReadBuffer.  Both WriteBytes and
+    ReadBytes must be non-zero.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  TransactionType   Type of SPI transaction specified by one of the
+                                EFI_SPI_TRANSACTION_TYPE values.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+                                Debugging may be turned on for a single SPI
+                                transaction.  Only this transaction will display
+                                debugging messages.  All other transactions with
+                                this value set to FALSE will not display any
+                                debugging messages.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use the
+                                maximum clock frequency supported by the SPI
+                                controller and part.  Specify a non-zero value
+                                only when a specific SPI transaction requires a
+                                reduced clock rate.
+  @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
+  @param[in]  FrameSize         Frame size in bits, range: 1 - 32
+  @param[in]  WriteBytes        The length of the WriteBuffer in bytes.  Specify
+                                zero for read-only operations.
+  @param[in]  WriteBuffer       The buffer containing data to be sent from the
+                                host to the SPI chip.  Specify NULL for read
+                                only operations.
+                                * Frame sizes 1-8 bits: UINT8 (one byte) per
+                                  frame
+                                * Frame sizes 7-16 bits: UINT16 (two bytes) per
+                                  frame
+                                * Frame sizes 17-32 bits: UINT32 (four bytes)
+                                  per frame
+                                The transmit frame is in the least significant
+                                N bits.
+  @param[in]  ReadBytes         The length of the ReadBuffer in bytes.  Specify
+                                zero for write-only operations.
+  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
+                                during the transaction.  Specify NULL for write
+                                only operations.
+                                * Frame sizes 1-8 bits: UINT8 (one byte) per
+                                  frame
+                                * Frame sizes 7-16 bits: UINT16 (two bytes) per
+                                  frame
+                                * Frame sizes 17-32 bits: UINT32 (four bytes)
+                                  per frame
+                                The received frame is in the least significant
+                                N bits.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_BAD_BUFFER_SIZE   The WriteBytes value was invalid.
+  @retval EFI_BAD_BUFFER_SIZE   The ReadBytes value was invalid.
+  @retval EFI_INVALID_PARAMETER TransactionType is not valid
+  @retval EFI_INVALID_PARAMETER BusWidth not supported by SPI peripheral or
+                                SPI host controller
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes != WriteBytes for full-duplex type
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for SPI transaction
+  @retval EFI_UNSUPPORTED       The FrameSize is not supported by the SPI
+                                bus layer or the SPI host controller.
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+EFI_STATUS
+EFIAPI SpiIoTransaction (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN EFI_SPI_TRANSACTION_TYPE TransactionType,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN UINT32 BusWidth,
+  IN UINT32 FrameSize,
+  IN UINT32 WriteBytes,
+  IN UINT8 *WriteBuffer,
+  IN UINT32 ReadBytes,
+  OUT UINT8 *ReadBuffer
+  )
+{
+  EFI_SPI_BUS_TRANSACTION Request;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+
+  //
+  // Locate the context data structure
+  //
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+
+  //
+  // Verify that the SPI host controller is available.  The host controller
+  // is removed at SetVirtualAddressMap when it does not support runtime.
+  //
+  if (SpiIo->SpiBus->SpiHcProtocol == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Validate the parameters for this SPI transaction
+  //
+  Status = SpiIoValidateTransaction (This, TransactionType, DebugTransaction,
+                                     BusWidth, FrameSize, WriteBytes,
+                                     ReadBytes);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  Status = SpiIoValidateBuffers (DebugTransaction, WriteBytes, WriteBuffer,
+                                 ReadBytes, ReadBuffer);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Perform the SPI transaction
+  //
+  Request.SpiPeripheral = This->SpiPeripheral;
+  Request.TransactionType = TransactionType;
+  Request.DebugTransaction = SPI_DEBUG (DebugTransaction);
+  Request.BusWidth = BusWidth;
+  Request.FrameSize = FrameSize;
+  Request.WriteBytes = WriteBytes;
+  Request.WriteBuffer = WriteBuffer;
+  Request.ReadBytes = ReadBytes;
+  Request.ReadBuffer = ReadBuffer;
+  Request.Phases = NULL;
+  return SpiIoStartTransaction (SpiIo, NULL, ClockHz, &Request, 0, NULL);
+}
+
+/**
+  Validate a SPI transaction once for repeated use.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  SPI peripheral drivers often perform the same transaction many times, only
+  changing the data in the buffers.  This routine performs the parameter
+  validation, the clock frequency selection and the conversion set up once,
+  allocating any buffers needed by the SPI bus layer.  The returned handle is
+  passed to ExecutePrepared to perform the transaction and to ReleasePrepared
+  to free the resources.  The handle is only valid for this SPI IO protocol
+  instance and the current SPI peripheral.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  TransactionType   Type of SPI transaction specified by one of the
+                                EFI_SPI_TRANSACTION_TYPE values.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use the
+                                maximum clock frequency supported by the SPI
+                                controller and part.
+  @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
+  @param[in]  FrameSize         Frame size in bits, range: 1 - 32
+  @param[in]  WriteBytes        The length of the write buffer in bytes.
+                                Specify zero for read-only operations.
+  @param[in]  ReadBytes         The length of the read buffer in bytes.
+                                Specify zero for write-only operations.
+  @param[out] Prepared          Address to receive the prepared transaction
+                                handle.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The transaction was prepared successfully
+  @retval EFI_INVALID_PARAMETER Prepared is NULL
+  @retval EFI_INVALID_PARAMETER A transaction parameter is not valid, see
+                                EFI_SPI_IO_PROTOCOL_TRANSACTION
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for the prepared
+                                transaction
+  @retval EFI_UNSUPPORTED       The FrameSize is not supported by the SPI
+                                bus layer or the SPI host controller.
+**/
+EFI_STATUS
+EFIAPI
+SpiIoPrepareTransaction (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN EFI_SPI_TRANSACTION_TYPE TransactionType,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN UINT32 BusWidth,
+  IN UINT32 FrameSize,
+  IN UINT32 WriteBytes,
+  IN UINT32 ReadBytes,
+  OUT VOID **Prepared
+  )
+{
+  EFI_SPI_BUS_TRANSACTION *BusTransaction;
+  SPI_PREPARED_TRANSACTION *PreparedTransaction;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+
+  //
+  // Validate the parameters
+  //
+  if (Prepared == NULL) {
+    DEBUG((EFI_D_ERROR, "ERROR - Prepared is NULL!\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  *Prepared = NULL;
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+  if (SpiIo->SpiBus->SpiHcProtocol == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+  if (SpiAtRuntime ()) {
+    return EFI_UNSUPPORTED;
+  }
+  Status = SpiIoValidateTransaction (This, TransactionType, DebugTransaction,
+                                     BusWidth, FrameSize, WriteBytes,
+                                     ReadBytes);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Allocate the prepared transaction
+  //
+  PreparedTransaction = AllocateRuntimeZeroPool (sizeof (*PreparedTransaction));
+  if (PreparedTransaction == NULL) {
+    DEBUG ((EFI_D_ERROR,
+            "ERROR - Failed to allocate SPI_PREPARED_TRANSACTION!\n"));
+    return EFI_OUT_OF_RESOURCES;
+  }
+  PreparedTransaction->Signature = SPI_PREPARED_SIGNATURE;
+  PreparedTransaction->SpiIo = SpiIo;
+  PreparedTransaction->SpiPeripheral = This->SpiPeripheral;
+  PreparedTransaction->ClockHz = ClockHz;
+
+  BusTransaction = &PreparedTransaction->BusTransaction;
+  BusTransaction->SpiPeripheral = This->SpiPeripheral;
+  BusTransaction->TransactionType = TransactionType;
+  BusTransaction->DebugTransaction = SPI_DEBUG (DebugTransaction);
+  BusTransaction->BusWidth = BusWidth;
+  BusTransaction->FrameSize = FrameSize;
+  BusTransaction->WriteBytes = WriteBytes;
+  BusTransaction->ReadBytes = ReadBytes;
+
+  //
+  // Let the SPI bus layer make its decisions
+  //
+  Status = SpiBusPrepareTransaction (SpiIo->SpiBus, PreparedTransaction);
+  if (EFI_ERROR(Status)) {
+    if (PreparedTransaction->Buffer != NULL) {
+      FreePool (PreparedTransaction->Buffer);
+    }
+    FreePool (PreparedTransaction);
+    return Status;
+  }
+
+  //
+  // Add the transaction to the list
+  //
+  PreparedTransaction->NextPrepared = SpiIo->PreparedList;
+  SpiIo->PreparedList = PreparedTransaction;
+  *Prepared = PreparedTransaction;
+  return EFI_SUCCESS;
+}
+
+/**
+  Locate the SPI_PREPARED_TRANSACTION structure for a handle.
+
+  @param[in]  SpiIo             Pointer to a SPI_IO structure.
+  @param[in]  Prepared          Handle returned by PrepareTransaction
+
+  @return  The SPI_PREPARED_TRANSACTION structure or NULL if the handle is not
+           valid for this SPI_IO structure
+
+**/
+STATIC
+SPI_PREPARED_TRANSACTION *
+EFIAPI
+SpiIoPreparedTransaction (
+  IN SPI_IO *SpiIo,
+  IN VOID *Prepared
+  )
+{
+  SPI_PREPARED_TRANSACTION *PreparedTransaction;
+
+  PreparedTransaction = (SPI_PREPARED_TRANSACTION *)Prepared;
+  if ((PreparedTransaction == NULL)
+    || (PreparedTransaction->Signature != SPI_PREPARED_SIGNATURE)
+    || (PreparedTransaction->SpiIo != SpiIo)) {
+    DEBUG((EFI_D_ERROR, "ERROR - Invalid prepared transaction handle!\n"));
+    return NULL;
+  }
+  return PreparedTransaction;
+}
+
+/**
+  Perform a prepared SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The buffer lengths and the other transaction parameters were supplied to
+  PrepareTransaction.  Only the buffers are supplied on each call.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  Prepared          Handle returned by PrepareTransaction
+  @param[in]  WriteBuffer       The buffer containing data to be sent from the
+                                host to the SPI chip.  Specify NULL for read
+                                only operations.
+  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
+                                during the transaction.  Specify NULL for write
+                                only operations.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_INVALID_PARAMETER Prepared is not a valid handle for this SPI IO
+                                protocol instance
+  @retval EFI_INVALID_PARAMETER The SPI peripheral was updated after the
+                                transaction was prepared
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+EFI_STATUS
+EFIAPI
+SpiIoExecutePrepared (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN VOID *Prepared,
+  IN UINT8 *WriteBuffer,
+  OUT UINT8 *ReadBuffer
+  )
+{
+  SPI_PREPARED_TRANSACTION *PreparedTransaction;
+  EFI_SPI_BUS_TRANSACTION Request;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+
+  //
+  // Validate the handle
+  //
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+  PreparedTransaction = SpiIoPreparedTransaction (SpiIo, Prepared);
+  if (PreparedTransaction == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (SpiIo->SpiBus->SpiHcProtocol == NULL) {
+    return EFI_UNSUPPORTED;
+  }
+  if (PreparedTransaction->SpiPeripheral != This->SpiPeripheral) {
+    DEBUG((EFI_D_ERROR, "ERROR - SPI peripheral changed after prepare!\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Validate the buffers
+  //
+  CopyMem (&Request, &PreparedTransaction->BusTransaction, sizeof (Request));
+  Status = SpiIoValidateBuffers (Request.DebugTransaction,
+                                 Request.WriteBytes, WriteBuffer,
+                                 Request.ReadBytes, ReadBuffer);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Perform the SPI transaction
+  //
+  Request.WriteBuffer = (Request.WriteBytes != 0) ? WriteBuffer : NULL;
+  Request.ReadBuffer = (Request.ReadBytes != 0) ? ReadBuffer : NULL;
+  return SpiIoStartTransaction (SpiIo,
+                                PreparedTransaction,
+                                PreparedTransaction->ClockHz,
+                                &Request,
+                                0,
+                                NULL);
+}
+
+/**
+  Release the resources associated with a prepared SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  Prepared          Handle returned by PrepareTransaction
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The prepared transaction was released
+  @retval EFI_INVALID_PARAMETER Prepared is not a valid handle for this SPI IO
+                                protocol instance
+**/
+EFI_STATUS
+EFIAPI
+SpiIoReleasePrepared (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN VOID *Prepared
+  )
+{
+  SPI_PREPARED_TRANSACTION **Previous;
+  SPI_PREPARED_TRANSACTION *PreparedTransaction;
+  SPI_IO *SpiIo;
+
+  //
+  // Validate the handle
+  //
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+  PreparedTransaction = SpiIoPreparedTransaction (SpiIo, Prepared);
+  if (PreparedTransaction == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Remove the transaction from the list
+  //
+  Previous = &SpiIo->PreparedList;
+  while (*Previous != NULL) {
+    if (*Previous == PreparedTransaction) {
+      *Previous = PreparedTransaction->NextPrepared;
+      break;
+    }
+    Previous = &(*Previous)->NextPrepared;
+  }
+
+  //
+  // Free the resources.  Memory is not freed after ExitBootServices.
+  //
+  PreparedTransaction->Signature = 0;
+  if (SpiAtRuntime ()) {
+    return EFI_SUCCESS;
+  }
+  if (PreparedTransaction->Buffer != NULL) {
+    FreePool (PreparedTransaction->Buffer);
+  }
+  FreePool (PreparedTransaction);
+  return EFI_SUCCESS;
+}
+
+/**
+  Send data from multiple buffers to the SPI chip using a single write-only
+  SPI transaction.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The chip select remains asserted while the segments are sent in order, so
+  the SPI chip sees a single write-only transaction.  The data is sent
+  directly from the caller's buffers using 8-bit frames, allowing a command
+  header and the payload data to be sent without copying them into a single
+  buffer.  This routine is only available when SPI_IO_SUPPORTS_STREAMING is
+  set.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use
+                                the maximum clock frequency supported by the
+                                SPI controller and part.
+  @param[in]  BusWidth          Width of the SPI bus in bits: 1, 2, 4
+  @param[in]  SegmentCount      Number of entries in the Segments array
+  @param[in]  Segments          Array of buffers to send to the SPI chip
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_INVALID_PARAMETER SegmentCount is zero or Segments is NULL
+  @retval EFI_INVALID_PARAMETER A segment has zero WriteBytes or a NULL
+                                WriteBuffer
+  @retval EFI_INVALID_PARAMETER BusWidth not supported by SPI peripheral or
+                                SPI host controller
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_UNSUPPORTED       The SPI host controller is not able to hold
+                                the chip select asserted across multiple
+                                transfers
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+EFI_STATUS
+EFIAPI
+SpiIoWriteSegments (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN UINT32 BusWidth,
+  IN UINT32 SegmentCount,
+  IN CONST EFI_SPI_IO_WRITE_SEGMENT *Segments
+  )
+{
+  UINT32 Index;
+  EFI_SPI_BUS_TRANSACTION Request;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+  UINT32 WriteBytes;
 
-  case SPI_TRANSACTION_WRITE_THEN_READ:
-    //
-    // Data first flowing from the host to the SPI peripheral and then data
-    // flows from the SPI peripheral to the host.  These types of operations
-    // get used for SPI flash devices when control data (opcode, address) must
-    // be passed to the SPI peripheral to specify the data to be read.
-    //
-    if (WriteBytes == 0) {
-      DEBUG((EFI_D_ERROR, "ERROR - WriteBytes is zero!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (WriteBuffer == NULL) {
-      DEBUG((EFI_D_ERROR, "ERROR - WriteBuffer is NULL!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (ReadBytes == 0) {
-      DEBUG((EFI_D_ERROR, "ERROR - ReadBytes is zero!\n"));
-      return EFI_INVALID_PARAMETER;
-    }
-    if (ReadBuffer == NULL) {
-      DEBUG((EFI_D_ERROR, "ERROR - ReadBuffer is NULL!\n"));
+  //
+  // Locate the context data structure
+  //
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+
+  //
+  // The chip select must remain asserted between the segments
+  //
+  if ((SpiIo->SpiBus->SpiHcProtocol == NULL)
+    || ((This->Attributes & SPI_IO_SUPPORTS_STREAMING) == 0)) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Validate the segments
+  //
+  if ((SegmentCount == 0) || (Segments == NULL)) {
+    DEBUG((EFI_D_ERROR, "ERROR - No write segments!\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  WriteBytes = 0;
+  for (Index = 0; Index < SegmentCount; Index++) {
+    if ((Segments[Index].WriteBytes == 0)
+      || (Segments[Index].WriteBuffer == NULL)
+      || (Segments[Index].WriteBytes > (MAX_UINT32 - WriteBytes))) {
+      DEBUG((EFI_D_ERROR, "ERROR - Invalid write segment %d!\n", Index));
       return EFI_INVALID_PARAMETER;
     }
-    if (DebugTransaction) {
-      DEBUG ((EFI_D_ERROR, "SpiIo: Write-then-read SPI transaction\n"));
-      DEBUG ((EFI_D_ERROR, "SpiIo: Sending data from 0x%08x, 0x%08x bytes\n",
-              WriteBuffer, WriteBytes));
-      DEBUG ((EFI_D_ERROR, "SpiIo: Receiving data into 0x%08x, 0x%08x bytes\n",
-              ReadBuffer, ReadBytes));
+    if (SPI_DEBUG (DebugTransaction)) {
+      DEBUG ((EFI_D_ERROR,
+              "SpiIo: Segment %d sending 0x%08x bytes from 0x%08x\n",
+              Index, Segments[Index].WriteBytes, Segments[Index].WriteBuffer));
     }
-    break;
+    WriteBytes += Segments[Index].WriteBytes;
   }
 
   //
-  // Synchronize with the SPI bus layer
+  // Validate the parameters for this SPI transaction
   //
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR, "SpiIo: Synchronizing with SPI bus layer\n"));
+  Status = SpiIoValidateTransaction (This, SPI_TRANSACTION_WRITE_ONLY,
+                                     DebugTransaction, BusWidth, 8, WriteBytes,
+                                     0);
+  if (EFI_ERROR(Status)) {
+    return Status;
   }
-  PreviousTpl = SpiRaiseTpl(TPL_NOTIFY);
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR, "SpiIo: Calling TPL: %d\n", PreviousTpl));
-    DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", TPL_NOTIFY));
+
+  //
+  // Perform the SPI transaction
+  //
+  Request.SpiPeripheral = This->SpiPeripheral;
+  Request.TransactionType = SPI_TRANSACTION_WRITE_ONLY;
+  Request.DebugTransaction = SPI_DEBUG (DebugTransaction);
+  Request.BusWidth = BusWidth;
+  Request.FrameSize = 8;
+  Request.WriteBytes = WriteBytes;
+  Request.WriteBuffer = Segments[0].WriteBuffer;
+  Request.ReadBytes = 0;
+  Request.ReadBuffer = NULL;
+  Request.Phases = NULL;
+  return SpiIoStartTransaction (SpiIo, NULL, ClockHz, &Request, SegmentCount,
+                                Segments);
+}
+
+/**
+  Determine if a SPI bus width is supported for this SPI IO instance.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  BusWidth          Width of the SPI bus in bits
+
+  @retval TRUE                  The SPI host and peripheral support the width
+  @retval FALSE                 The bus width is not supported
+
+**/
+STATIC
+BOOLEAN
+EFIAPI
+SpiIoBusWidthSupported (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN UINT32 BusWidth
+  )
+{
+  switch (BusWidth) {
+  case 1:
+    return TRUE;
+
+  case 2:
+    return (BOOLEAN)((This->Attributes
+                      & SPI_IO_SUPPORTS_2_BIT_DATA_BUS_WIDTH) != 0);
+
+  case 4:
+    return (BOOLEAN)((This->Attributes
+                      & SPI_IO_SUPPORTS_4_BIT_DATA_BUS_WIDTH) != 0);
   }
+  return FALSE;
+}
+
+/**
+  Perform a SPI flash transaction described by its phases.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The opcode, address and dummy cycles are described by Phases instead of
+  being placed at the start of the write buffer, so the buffers only contain
+  the data.  SPI host controllers which set HC_SUPPORTS_TRANSACTION_PHASES
+  receive the phases directly, SPI_IO_SUPPORTS_TRANSACTION_PHASES is set for
+  these controllers.  For other controllers the SPI bus layer sends the
+  command phases before the data using 8-bit frames, in which case all of the
+  bus widths must match and the dummy cycles must fill whole bytes.
+
+  @param[in]  This              Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  DebugTransaction  Set TRUE only when debugging is desired.
+  @param[in]  ClockHz           Specify the ClockHz value as zero (0) to use
+                                the maximum clock frequency supported by the
+                                SPI controller and part.
+  @param[in]  Phases            Pointer to the description of the command
+                                phases
+  @param[in]  WriteBytes        The length of the WriteBuffer in bytes.  Must
+                                be zero when ReadBytes is non-zero.  Specify
+                                zero for commands without data.
+  @param[in]  WriteBuffer       The data to send to the SPI chip
+  @param[in]  ReadBytes         The length of the ReadBuffer in bytes.
+                                Specify zero for write operations.
+  @param[in]  ReadBuffer        The buffer to receive data from the SPI chip
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI transaction completed successfully
+  @retval EFI_BAD_BUFFER_SIZE   The data does not fit in a single transaction
+  @retval EFI_INVALID_PARAMETER Phases is NULL or describes invalid phases
+  @retval EFI_INVALID_PARAMETER A bus width is not supported by the SPI
+                                peripheral or SPI host controller
+  @retval EFI_INVALID_PARAMETER Both WriteBytes and ReadBytes are non-zero
+  @retval EFI_INVALID_PARAMETER WriteBytes non-zero and WriteBuffer is NULL
+  @retval EFI_INVALID_PARAMETER ReadBytes non-zero and ReadBuffer is NULL
+  @retval EFI_INVALID_PARAMETER TPL too high
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory for SPI transaction
+  @retval EFI_UNSUPPORTED       The SPI bus layer is not able to send the
+                                phases to this SPI host controller
+  @retval EFI_UNSUPPORTED       The SPI controller was not able to support the
+                                frequency requested by ClockHz
+**/
+EFI_STATUS
+EFIAPI
+SpiIoPhaseTransaction (
+  IN CONST EFI_SPI_IO_PROTOCOL *This,
+  IN BOOLEAN DebugTransaction,
+  IN UINT32 ClockHz OPTIONAL,
+  IN CONST EFI_SPI_TRANSACTION_PHASES *Phases,
+  IN UINT32 WriteBytes,
+  IN UINT8 *WriteBuffer,
+  IN UINT32 ReadBytes,
+  OUT UINT8 *ReadBuffer
+  )
+{
+  UINT8 Command[SPI_BUS_COMMAND_BYTES];
+  UINT32 CommandBytes;
+  UINT32 DummyBytes;
+  UINT32 HeaderBytes;
+  UINT32 Index;
+  EFI_SPI_BUS_TRANSACTION Request;
+  EFI_SPI_IO_WRITE_SEGMENT Segments[2];
+  CONST EFI_SPI_HC_PROTOCOL *SpiHcProtocol;
+  SPI_IO *SpiIo;
+  EFI_STATUS Status;
+  UINT8 *WriteData;
 
   //
-  // Verify the TPL
+  // Locate the context data structure
   //
-  if (PreviousTpl > TPL_NOTIFY) {
-    if (DebugTransaction) {
-      DEBUG ((EFI_D_ERROR,
-              "SpiIo: Releasing synchronizing with SPI bus layer\n"));
-      DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", PreviousTpl));
-    }
-    SpiRestoreTpl (PreviousTpl);
-    DEBUG ((EFI_D_ERROR,
-            "ERROR - TPL (%d) > TPL_NOTIFY!\n",
-            PreviousTpl));
-    return EFI_INVALID_PARAMETER;
+  SpiIo = SPI_IO_CONTEXT_FROM_PROTOCOL(This);
+  SpiHcProtocol = SpiIo->SpiBus->SpiHcProtocol;
+  if (SpiHcProtocol == NULL) {
+    return EFI_UNSUPPORTED;
   }
 
   //
-  // This SPI IO instance owns the IO_TRANSACTION until the TPL is dropped
-  // below TPL notify
+  // Validate the phases
   //
-  SpiBus = SpiIo->SpiBus;
-  IoTransaction = &SpiBus->IoTransaction;
-  ZeroMem (IoTransaction, sizeof(*IoTransaction));
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR, "SpiIo: Using IoTransaction 0x%08x\n",
-            IoTransaction));
+  if (Phases == NULL) {
+    DEBUG((EFI_D_ERROR, "ERROR - Phases is NULL!\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  if ((Phases->AddressBytes != 0) && (Phases->AddressBytes != 3)
+    && (Phases->AddressBytes != 4)) {
+    DEBUG((EFI_D_ERROR, "ERROR - Invalid number of address bytes: %d!\n",
+           Phases->AddressBytes));
+    return EFI_INVALID_PARAMETER;
+  }
+  if ((!SpiIoBusWidthSupported (This, Phases->OpcodeBusWidth))
+    || ((Phases->AddressBytes != 0)
+      && (!SpiIoBusWidthSupported (This, Phases->AddressBusWidth)))
+    || (!SpiIoBusWidthSupported (This, Phases->DataBusWidth))) {
+    DEBUG((EFI_D_ERROR, "ERROR - Phase bus width not supported!\n"));
+    return EFI_INVALID_PARAMETER;
   }
 
   //
-  // Initialize the structure for the SPI transaction
+  // Validate the data phase
   //
-  IoTransaction->SpiIo = SpiIo;
-  IoTransaction->ClockHz = ClockHz;
+  if ((WriteBytes != 0) && (ReadBytes != 0)) {
+    DEBUG((EFI_D_ERROR, "ERROR - Both WriteBytes and ReadBytes non-zero!\n"));
+    return EFI_INVALID_PARAMETER;
+  }
+  Status = SpiIoValidateBuffers (DebugTransaction, WriteBytes, WriteBuffer,
+                                 ReadBytes, ReadBuffer);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  if (SPI_DEBUG (DebugTransaction)) {
+    DEBUG ((EFI_D_ERROR,
+            "SpiIo: Opcode 0x%02x, %d address bytes 0x%08x, %d dummy cycles\n",
+            Phases->Opcode, Phases->AddressBytes, Phases->Address,
+            Phases->DummyCycles));
+  }
 
-  BusTransaction = &IoTransaction->BusTransaction;
-  BusTransaction->SpiPeripheral = SpiIo->SpiIoProtocol.SpiPeripheral;
-  BusTransaction->TransactionType = TransactionType;
-  BusTransaction->DebugTransaction = DebugTransaction;
-  BusTransaction->BusWidth = BusWidth;
-  BusTransaction->FrameSize = FrameSize;
-  BusTransaction->WriteBytes = WriteBytes;
-  BusTransaction->WriteBuffer = WriteBuffer;
-  BusTransaction->ReadBytes = ReadBytes;
-  BusTransaction->ReadBuffer = ReadBuffer;
+  //
+  // Pass the phases directly to the SPI host controller when possible
+  //
+  if ((This->Attributes & SPI_IO_SUPPORTS_TRANSACTION_PHASES) != 0) {
+    HeaderBytes = 0;
+    if ((SpiHcProtocol->Attributes & HC_TRANSFER_SIZE_INCLUDES_OPCODE) != 0) {
+      HeaderBytes += 1;
+    }
+    if ((SpiHcProtocol->Attributes & HC_TRANSFER_SIZE_INCLUDES_ADDRESS) != 0) {
+      HeaderBytes += Phases->AddressBytes;
+    }
+    if ((HeaderBytes > SpiHcProtocol->MaximumTransferBytes)
+      || ((WriteBytes + ReadBytes)
+          > (SpiHcProtocol->MaximumTransferBytes - HeaderBytes))) {
+      DEBUG((EFI_D_ERROR, "ERROR - Phase transaction data too large!\n"));
+      return EFI_BAD_BUFFER_SIZE;
+    }
+    Request.SpiPeripheral = This->SpiPeripheral;
+    Request.TransactionType = (ReadBytes != 0) ? SPI_TRANSACTION_READ_ONLY
+                            : SPI_TRANSACTION_WRITE_ONLY;
+    Request.DebugTransaction = SPI_DEBUG (DebugTransaction);
+    Request.BusWidth = Phases->DataBusWidth;
+    Request.FrameSize = 8;
+    Request.WriteBytes = WriteBytes;
+    Request.WriteBuffer = (WriteBytes != 0) ? WriteBuffer : NULL;
+    Request.ReadBytes = ReadBytes;
+    Request.ReadBuffer = (ReadBytes != 0) ? ReadBuffer : NULL;
+    Request.Phases = Phases;
+    return SpiIoStartTransaction (SpiIo, NULL, ClockHz, &Request, 0, NULL);
+  }
 
   //
-  // Setup the buffers for the SPI transaction
+  // Build the command bytes, all of the phases use the data bus width
   //
-  Status = SpiBusSetupBuffers (SpiBus);
-  if (!EFI_ERROR(Status)) {
-    //
-    // Start the transaction
-    //
-    Status = SpiBusTransaction (SpiBus);
+  DummyBytes = (Phases->DummyCycles * Phases->DataBusWidth) / 8;
+  if ((Phases->OpcodeBusWidth != Phases->DataBusWidth)
+    || ((Phases->AddressBytes != 0)
+      && (Phases->AddressBusWidth != Phases->DataBusWidth))
+    || (((Phases->DummyCycles * Phases->DataBusWidth) % 8) != 0)) {
+    DEBUG((EFI_D_ERROR,
+           "ERROR - SPI host controller does not support the phases!\n"));
+    return EFI_UNSUPPORTED;
   }
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR, "SpiBus: Releasing IoTransaction 0x%08x\n",
-            IoTransaction));
+  CommandBytes = 0;
+  Command[CommandBytes++] = Phases->Opcode;
+  for (Index = Phases->AddressBytes; Index > 0; Index--) {
+    Command[CommandBytes++] = (UINT8)(Phases->Address >> ((Index - 1) * 8));
   }
+  ZeroMem (&Command[CommandBytes], DummyBytes);
+  CommandBytes += DummyBytes;
 
   //
-  // Release the synchronization with the SPI bus layer
+  // Send the command followed by the data
   //
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR,
-            "SpiIo: Releasing synchronizing with SPI bus layer\n"));
-    DEBUG ((EFI_D_ERROR, "SpiIo: TPL: %d\n", PreviousTpl));
+  if (ReadBytes != 0) {
+    return SpiIoTransaction (This, SPI_TRANSACTION_WRITE_THEN_READ,
+                             DebugTransaction, ClockHz, Phases->DataBusWidth,
+                             8, CommandBytes, Command, ReadBytes, ReadBuffer);
   }
-  SpiRestoreTpl (PreviousTpl);
-  if (DebugTransaction) {
-    DEBUG ((EFI_D_ERROR,
-            "SpiIo returning Status: %r\n", Status));
+  if (WriteBytes == 0) {
+    return SpiIoTransaction (This, SPI_TRANSACTION_WRITE_ONLY,
+                             DebugTransaction, ClockHz, Phases->DataBusWidth,
+                             8, CommandBytes, Command, 0, NULL);
+  }
+  if ((This->Attributes & SPI_IO_SUPPORTS_STREAMING) != 0) {
+    Segments[0].WriteBytes = CommandBytes;
+    Segments[0].WriteBuffer = Command;
+    Segments[1].WriteBytes = WriteBytes;
+    Segments[1].WriteBuffer = WriteBuffer;
+    return SpiIoWriteSegments (This, DebugTransaction, ClockHz,
+                               Phases->DataBusWidth, 2, Segments);
   }
 
   //
-  // Return the final status
+  // The chip select is released between transfers, place the command and
+  // data into a single buffer
   //
+  if ((SpiAtRuntime ()) || (WriteBytes > (MAX_UINT32 - CommandBytes))) {
+    return EFI_UNSUPPORTED;
+  }
+  WriteData = AllocatePool (CommandBytes + WriteBytes);
+  if (WriteData == NULL) {
+    DEBUG((EFI_D_ERROR, "ERROR - Failed to allocate the command buffer!\n"));
+    return EFI_OUT_OF_RESOURCES;
+  }
+  CopyMem (WriteData, Command, CommandBytes);
+  CopyMem (&WriteData[CommandBytes], WriteBuffer, WriteBytes);
+  Status = SpiIoTransaction (This, SPI_TRANSACTION_WRITE_ONLY,
+                             DebugTransaction, ClockHz, Phases->DataBusWidth,
+                             8, CommandBytes + WriteBytes, WriteData, 0, NULL);
+  FreePool (WriteData);
   return Status;
 }
 
@@ -443,10 +1246,31 @@ SpiIoShutdown (
   IN SPI_IO *SpiIo
   )
 {
+  SPI_IO **Previous;
+
   //
   // Determine if the job is already done
   //
   if (SpiIo != NULL) {
+    //
+    // Remove the SPI_IO structure from the SPI bus
+    //
+    Previous = &SpiIo->SpiBus->SpiIoList;
+    while (*Previous != NULL) {
+      if (*Previous == SpiIo) {
+        *Previous = SpiIo->NextSpiIo;
+        break;
+      }
+      Previous = &(*Previous)->NextSpiIo;
+    }
+
+    //
+    // Release the prepared transactions
+    //
+    while (SpiIo->PreparedList != NULL) {
+      SpiIoReleasePrepared (&SpiIo->SpiIoProtocol, SpiIo->PreparedList);
+    }
+
     //
     // Free the device path
     //
@@ -470,6 +1294,9 @@ SpiIoShutdown (
 
   @param[in]  SpiBus            A pointer to the SPI_BUS instance.
   @param[in]  SpiPeripheral     A pointer to the EFI_SPI_PERIPHERAL instance.
+  @param[in]  Stub              A pointer to the SPI_IO_STUB instance which
+                                provides the child handle and enumeration
+                                index, NULL creates a new child handle
 
   @return  This routine returns one of the following status values:
 
@@ -482,9 +1309,11 @@ EFI_STATUS
 EFIAPI
 SpiIoStartup (
   IN SPI_BUS *SpiBus,
-  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral
+  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral,
+  IN SPI_IO_STUB *Stub OPTIONAL
   )
 {
+  SPI_DEVICE_PATH DevicePath;
   EFI_HANDLE Handle;
   SPI_IO *SpiIo;
   CONST EFI_SPI_PART *SpiPart;
@@ -537,31 +1366,79 @@ SpiIoStartup (
        != 0) {
     SpiIo->SpiIoProtocol.Attributes |= SPI_IO_TRANSFER_SIZE_INCLUDES_ADDRESS;
   }
+
+  //
+  // The SPI bus layer streams large transactions when the SPI host controller
+  // is able to hold the chip select asserted
+  //
+  if ((SpiBus->SpiHcProtocol->Attributes & HC_SUPPORTS_CHIP_SELECT_HOLD)
+       != 0) {
+    SpiIo->SpiIoProtocol.Attributes |= SPI_IO_SUPPORTS_STREAMING;
+    SpiIo->SpiIoProtocol.MaximumTransferBytes = 0xffffffff;
+  }
+
+  //
+  // The SPI host controller receives the phases without a command buffer
+  //
+  if ((SpiBus->SpiHcProtocol->Attributes & HC_SUPPORTS_TRANSACTION_PHASES)
+       != 0) {
+    SpiIo->SpiIoProtocol.Attributes |= SPI_IO_SUPPORTS_TRANSACTION_PHASES;
+  }
+  SpiIo->SpiIoProtocol.Attributes |= SPI_IO_SUPPORTS_PREPARED_TRANSACTIONS;
   SpiIo->SpiIoProtocol.Transaction = SpiIoTransaction;
   SpiIo->SpiIoProtocol.UpdateSpiPeripheral = SpiIoUpdateSpiPeripheral;
+  SpiIo->SpiIoProtocol.PrepareTransaction = SpiIoPrepareTransaction;
+  SpiIo->SpiIoProtocol.ExecutePrepared = SpiIoExecutePrepared;
+  SpiIo->SpiIoProtocol.ReleasePrepared = SpiIoReleasePrepared;
+  SpiIo->SpiIoProtocol.WriteSegments = SpiIoWriteSegments;
+  SpiIo->SpiIoProtocol.PhaseTransaction = SpiIoPhaseTransaction;
 
   //
-  // Build the device path for this SPI device
+  // Build the device path for this SPI device, a stub has already reserved
+  // the enumeration index
   //
+  CopyMem (&DevicePath, &mSpiPartDevicePath, sizeof (DevicePath));
+  if (Stub != NULL) {
+    DevicePath.Controller.ControllerNumber = Stub->PartIndex;
+  }
+  SpiIo->PartIndex = DevicePath.Controller.ControllerNumber;
   SpiIo->DevicePath = AppendDevicePath (SpiBus->DevicePath,
-                                        &mSpiPartDevicePath.Controller.Header);
+                                        &DevicePath.Controller.Header);
   if (SpiBus == NULL) {
     DEBUG ((EFI_D_ERROR, "ERROR - SpiIo failed to build device path!\n"));
     Status = EFI_OUT_OF_RESOURCES;
     goto Failure;
   }
-  mSpiPartDevicePath.Controller.ControllerNumber++;
+  if (Stub == NULL) {
+    mSpiPartDevicePath.Controller.ControllerNumber++;
+  }
 
   //
-  // Create a child handle for the SPI peripheral
+  // Create a child handle for the SPI peripheral, or use the stub's handle
   //
-  Handle = NULL;
+  Handle = (Stub != NULL) ? Stub->Handle : NULL;
   Status = SpiInstallIoProtocol (&Handle, SpiIo, SpiPeripheral);
   if (EFI_ERROR(Status)) {
     DEBUG ((EFI_D_ERROR, "ERROR - SpiIo failed to install protocols!\n"));
     goto Failure;
   }
 
+  //
+  // Add the SPI_IO structure to the SPI bus
+  //
+  SpiIo->NextSpiIo = SpiBus->SpiIoList;
+  SpiBus->SpiIoList = SpiIo;
+  if (Stub != NULL) {
+    Stub->SpiIo = SpiIo;
+  }
+
+  //
+  // Run the SPI peripheral at its highest reliable clock frequency
+  //
+  if (FeaturePcdGet (PcdSpiClockTraining)) {
+    SpiScheduleClockTraining (SpiIo);
+  }
+
   //
   // Display the peripheral that was connected to the SPI bus
   //
@@ -592,3 +1469,96 @@ DEBUG((EFI_D_ERROR, "Calling SpiIoShutdown, Status: %r\n", Status));
   SpiIoShutdown (SpiIo);
   return Status;
 }
+
+/**
+  Create the SPI IO protocol for a SPI peripheral stub.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  @param[in]  This              Pointer to an EFI_SPI_PERIPHERAL_STUB_PROTOCOL
+                                structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The SPI IO protocol was installed
+  @retval EFI_ALREADY_STARTED   The SPI IO protocol is already installed
+  @retval EFI_UNSUPPORTED       Called after ExitBootServices
+  @retval EFI_OUT_OF_RESOURCES  Insufficient memory to create the SPI IO
+                                protocol
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiIoStubConnect (
+  IN CONST EFI_SPI_PERIPHERAL_STUB_PROTOCOL *This
+  )
+{
+  SPI_IO_STUB *Stub;
+
+  Stub = SPI_IO_STUB_FROM_PROTOCOL (This);
+  if (Stub->SpiIo != NULL) {
+    return EFI_ALREADY_STARTED;
+  }
+  if (SpiAtRuntime ()) {
+    return EFI_UNSUPPORTED;
+  }
+  return SpiIoStartup (Stub->SpiBus, This->SpiPeripheral, Stub);
+}
+
+/**
+  Publish a stub for a SPI peripheral.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The stub reserves the enumeration index and creates the child handle for
+  the SPI peripheral.  The SPI_IO structure, device path and SPI IO protocol
+  are not created until a SPI peripheral driver calls Connect.  Since only
+  the stub protocol is installed, no drivers are connected to the child
+  handle.
+
+  @param[in]  SpiBus            A pointer to the SPI_BUS instance.
+  @param[in]  SpiPeripheral     A pointer to the EFI_SPI_PERIPHERAL instance.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The stub was published successfully
+  @retval EFI_UNSUPPORTED       The environment does not support the stubs
+  @retval EFI_OUT_OF_RESOURCES  The request could not be completed due to a
+                                lack of resources.
+**/
+EFI_STATUS
+EFIAPI
+SpiIoPublishStub (
+  IN SPI_BUS *SpiBus,
+  IN CONST EFI_SPI_PERIPHERAL *SpiPeripheral
+  )
+{
+  EFI_STATUS Status;
+  SPI_IO_STUB *Stub;
+
+  //
+  // Allocate the stub, it is only used before ExitBootServices
+  //
+  Stub = AllocateZeroPool (sizeof (SPI_IO_STUB));
+  if (Stub == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI_IO_STUB!\n"));
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Stub->Signature = SPI_IO_STUB_SIGNATURE;
+  Stub->SpiBus = SpiBus;
+  Stub->PartIndex = mSpiPartDevicePath.Controller.ControllerNumber;
+  Stub->StubProtocol.SpiPeripheral = SpiPeripheral;
+  Stub->StubProtocol.Connect = SpiIoStubConnect;
+
+  //
+  // Create a child handle for the SPI peripheral
+  //
+  Status = SpiInstallStubProtocol (&Stub->Handle, &Stub->StubProtocol);
+  if (EFI_ERROR (Status)) {
+    FreePool (Stub);
+    return Status;
+  }
+  mSpiPartDevicePath.Controller.ControllerNumber++;
+  return EFI_SUCCESS;
+}
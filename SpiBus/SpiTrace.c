@@ -0,0 +1,213 @@
+/** @file
+
+  This module implements the SPI transaction trace.
+
+  Printing the transactions with DebugTransaction changes the timing of the
+  SPI bus.  The trace instead writes a fixed size binary record for each
+  transaction and transaction phase into a preallocated ring.  Writing a
+  record only reads the performance counter and fills in the record, the
+  ring is decoded later on the host using SpiTraceDecode.py.
+
+Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+This program and the accompanying materials are licensed and made available
+under the terms and conditions of the BSD License which accompanies this
+distribution.  The full text of the license may be found at
+http://opensource.org/licenses/bsd-license.php
+
+THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+
+**/
+
+#include "SpiBus.h"
+
+//
+// Trace ring, NULL when the trace is not running
+//
+SPI_TRACE_RING *gSpiTraceRing;
+
+/**
+  Copy the trace ring into a buffer.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]      This          Pointer to an EFI_SPI_TRACE_PROTOCOL structure.
+  @param[in, out] BufferSize    On input the size of the buffer in bytes, on
+                                output the number of bytes required
+  @param[out]     Buffer        Buffer to receive the trace ring
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The trace ring was copied into the buffer
+  @retval EFI_BUFFER_TOO_SMALL  The buffer is too small, BufferSize contains
+                                the required size
+  @retval EFI_INVALID_PARAMETER BufferSize is NULL
+  @retval EFI_NOT_READY         The trace ring is not available
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+SpiTraceDump (
+  IN CONST EFI_SPI_TRACE_PROTOCOL *This,
+  IN OUT UINTN *BufferSize,
+  OUT VOID *Buffer
+  )
+{
+  EFI_TPL PreviousTpl;
+  UINTN RingBytes;
+
+  if (BufferSize == NULL) {
+    return EFI_INVALID_PARAMETER;
+  }
+  if (gSpiTraceRing == NULL) {
+    return EFI_NOT_READY;
+  }
+
+  //
+  // Validate the buffer size
+  //
+  RingBytes = sizeof (SPI_TRACE_RING);
+  if ((*BufferSize < RingBytes) || (Buffer == NULL)) {
+    *BufferSize = RingBytes;
+    return EFI_BUFFER_TOO_SMALL;
+  }
+  *BufferSize = RingBytes;
+
+  //
+  // The SPI transactions run at TPL_NOTIFY, prevent them from writing
+  // records during the copy
+  //
+  PreviousTpl = SpiRaiseTpl (TPL_NOTIFY);
+  CopyMem (Buffer, gSpiTraceRing, RingBytes);
+  SpiRestoreTpl (PreviousTpl);
+  return EFI_SUCCESS;
+}
+
+//
+// Trace protocol
+//
+STATIC EFI_SPI_TRACE_PROTOCOL mSpiTraceProtocol = {
+  SpiTraceDump
+};
+
+/**
+  Write a record into the trace ring.
+
+  This routine must be called at TPL_NOTIFY.
+
+  @param[in]  Event             EFI_SPI_TRACE_EVENT value
+  @param[in]  PartIndex         Enumeration index of the SPI peripheral
+  @param[in]  BusTransaction    Pointer to a EFI_SPI_BUS_TRANSACTION containing
+                                the description of the SPI transaction
+  @param[in]  ClockHz           SCLK frequency, zero (0) when not yet known
+  @param[in]  Status            Transaction status
+
+**/
+VOID
+EFIAPI
+SpiTraceRecord (
+  IN UINT8 Event,
+  IN UINT32 PartIndex,
+  IN CONST EFI_SPI_BUS_TRANSACTION *BusTransaction,
+  IN UINT32 ClockHz,
+  IN EFI_STATUS Status
+  )
+{
+  CONST EFI_SPI_TRANSACTION_PHASES *Phases;
+  EFI_SPI_TRACE_RECORD *Record;
+  SPI_TRACE_RING *Ring;
+  UINT32 WriteBytes;
+
+  Ring = gSpiTraceRing;
+  if (Ring == NULL) {
+    return;
+  }
+
+  //
+  // Fill in the next record
+  //
+  Record = &Ring->Records[Ring->Header.NextRecord & (SPI_TRACE_RECORDS - 1)];
+  Ring->Header.NextRecord += 1;
+  Record->Timestamp = GetPerformanceCounter ();
+  Record->PartIndex = (UINT16)PartIndex;
+  Record->Event = Event;
+  Record->TransactionType = (UINT8)BusTransaction->TransactionType;
+  Record->ClockHz = ClockHz;
+  WriteBytes = BusTransaction->WriteBytes;
+  Record->WriteBytes = WriteBytes;
+  Record->ReadBytes = BusTransaction->ReadBytes;
+  Record->Status = (UINT32)Status;
+  if (EFI_ERROR (Status)) {
+    Record->Status |= BIT31;
+  }
+
+  //
+  // Save the opcode and address, or the first bytes of the write data
+  //
+  Phases = BusTransaction->Phases;
+  if (Phases != NULL) {
+    Record->Data[0] = Phases->Opcode;
+    Record->Data[1] = (UINT8)(Phases->Address >> 16);
+    Record->Data[2] = (UINT8)(Phases->Address >> 8);
+    Record->Data[3] = (UINT8)Phases->Address;
+  } else if ((WriteBytes >= sizeof (Record->Data))
+    && (BusTransaction->WriteBuffer != NULL)) {
+    WriteUnaligned32 ((UINT32 *)&Record->Data[0],
+                      ReadUnaligned32 ((UINT32 *)BusTransaction->WriteBuffer));
+  } else {
+    WriteUnaligned32 ((UINT32 *)&Record->Data[0], 0);
+    if (BusTransaction->WriteBuffer != NULL) {
+      CopyMem (&Record->Data[0], BusTransaction->WriteBuffer, WriteBytes);
+    }
+  }
+}
+
+/**
+  Start the SPI transaction trace.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  Allocate the trace ring and install the EFI_SPI_TRACE_PROTOCOL.  The SPI
+  transactions run without the trace when the ring is not available.
+
+**/
+VOID
+EFIAPI
+SpiTraceInitialize (
+  VOID
+  )
+{
+  UINT64 EndValue;
+  SPI_TRACE_RING *Ring;
+  UINT64 StartValue;
+  EFI_STATUS Status;
+
+  //
+  // Allocate the trace ring, the trace continues at runtime
+  //
+  Ring = AllocateRuntimeZeroPool (sizeof (SPI_TRACE_RING));
+  if (Ring == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI trace ring!\n"));
+    return;
+  }
+  Ring->Header.Signature = EFI_SPI_TRACE_SIGNATURE;
+  Ring->Header.RecordCount = SPI_TRACE_RECORDS;
+  Ring->Header.TimerFrequency = GetPerformanceCounterProperties (&StartValue,
+                                                                 &EndValue);
+  Ring->Header.TimerStartValue = StartValue;
+  Ring->Header.TimerEndValue = EndValue;
+
+  //
+  // Make the trace ring available for dumping
+  //
+  Status = SpiInstallTraceProtocol (&mSpiTraceProtocol);
+  if (EFI_ERROR (Status)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - SpiBus failed to install trace protocol!\n"));
+    FreePool (Ring);
+    return;
+  }
+  gSpiTraceRing = Ring;
+  DEBUG ((EFI_D_INFO, "SpiBus: Trace ring 0x%08x, %d records\n", Ring,
+          SPI_TRACE_RECORDS));
+}
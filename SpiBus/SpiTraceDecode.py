@@ -0,0 +1,111 @@
+## @file
+#
+#  Decode a dump of the SPI transaction trace ring into a timeline.
+#
+#  The dump is the buffer returned by EFI_SPI_TRACE_PROTOCOL.Dump: an
+#  EFI_SPI_TRACE_HEADER followed by RecordCount EFI_SPI_TRACE_RECORD entries.
+#
+#  Usage: python SpiTraceDecode.py <dump file>
+#
+#  Copyright (c) 2017, Intel Corporation. All rights reserved.<BR>
+#
+#  This program and the accompanying materials are licensed and made available
+#  under the terms and conditions of the BSD License which accompanies this
+#  distribution. The full text of the license may be found at
+#  http://opensource.org/licenses/bsd-license.php
+#  THE PROGRAM IS DISTRIBUTED UNDER THE BSD LICENSE ON AN "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
+#
+##
+
+import struct
+import sys
+
+#
+# Layouts from Include/Protocol/SpiTrace.h
+#
+SPI_TRACE_SIGNATURE = 0x52545053    # 'SPTR'
+HEADER_FORMAT = '<IIIIQQQ'
+RECORD_FORMAT = '<QHBBIII4sI'
+
+EVENT_NAMES = ['TRANSACTION_START', 'TRANSACTION_END', 'PHASE_START',
+               'PHASE_END']
+TYPE_NAMES = ['FULL_DUPLEX', 'WRITE_ONLY', 'READ_ONLY', 'WRITE_THEN_READ']
+
+def DecodeTrace(Data):
+    HeaderBytes = struct.calcsize(HEADER_FORMAT)
+    RecordBytes = struct.calcsize(RECORD_FORMAT)
+    (Signature, RecordCount, NextRecord, Reserved, Frequency, StartValue,
+     EndValue) = struct.unpack_from(HEADER_FORMAT, Data, 0)
+    if Signature != SPI_TRACE_SIGNATURE:
+        raise ValueError('Not a SPI trace dump, signature 0x%08x' % Signature)
+    if len(Data) < HeaderBytes + RecordCount * RecordBytes:
+        raise ValueError('SPI trace dump is truncated')
+
+    #
+    # Place the records in the order they were written
+    #
+    if NextRecord > RecordCount:
+        Order = [(NextRecord + Index) % RecordCount
+                 for Index in range(RecordCount)]
+    else:
+        Order = list(range(NextRecord))
+    Records = [struct.unpack_from(RECORD_FORMAT, Data,
+                                  HeaderBytes + Index * RecordBytes)
+               for Index in Order]
+
+    #
+    # Convert the performance counter into microseconds, the counter may
+    # count down and wraps at the end value
+    #
+    CountDown = StartValue > EndValue
+    Range = abs(EndValue - StartValue) + 1
+    def Elapsed(Start, Stop):
+        Ticks = (Start - Stop) if CountDown else (Stop - Start)
+        return (Ticks % Range) * 1000000.0 / Frequency if Frequency else 0.0
+
+    print('%d records, %d dropped, timer %d Hz'
+          % (len(Records), max(0, NextRecord - RecordCount), Frequency))
+    print('%12s %12s %-17s %4s %-14s %6s %6s %10s %-11s %s'
+          % ('Time (uS)', 'Delta (uS)', 'Event', 'Part', 'Type', 'Write',
+             'Read', 'Clock (Hz)', 'Data', 'Status'))
+    First = None
+    Previous = None
+    ClockHz = {}
+    for (Timestamp, PartIndex, Event, TransactionType, Clock, WriteBytes,
+         ReadBytes, Bytes, Status) in Records:
+        if First is None:
+            First = Timestamp
+            Previous = Timestamp
+
+        #
+        # The phases run at the clock frequency of the transaction
+        #
+        if Event == 0:
+            ClockHz[PartIndex] = Clock
+        if Clock == 0:
+            Clock = ClockHz.get(PartIndex, 0)
+
+        if Event in (0, 2):
+            StatusText = ''
+        elif Status & 0x80000000:
+            StatusText = 'ERROR %d' % (Status & 0x7fffffff)
+        else:
+            StatusText = 'SUCCESS'
+        print('%12.3f %12.3f %-17s %4d %-14s %6d %6d %10d %-11s %s'
+              % (Elapsed(First, Timestamp), Elapsed(Previous, Timestamp),
+                 EVENT_NAMES[Event] if Event < len(EVENT_NAMES) else Event,
+                 PartIndex,
+                 TYPE_NAMES[TransactionType]
+                 if TransactionType < len(TYPE_NAMES) else TransactionType,
+                 WriteBytes, ReadBytes, Clock,
+                 ' '.join('%02x' % Byte for Byte in bytearray(Bytes)),
+                 StatusText))
+        Previous = Timestamp
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.stderr.write('Usage: %s <dump file>\n' % sys.argv[0])
+        sys.exit(1)
+    with open(sys.argv[1], 'rb') as File:
+        DecodeTrace(File.read())
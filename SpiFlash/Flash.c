@@ -17,6 +17,11 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 VOID *gFlashProtocolRegistration;
 
+//
+// List of SPI NOR flash parts managed by this driver
+//
+FLASH *gFlashList;
+
 /**
   Read the 3 byte manufacture and device ID from the SPI flash.
 
@@ -176,8 +181,11 @@ FlashLfReadData (
   UINT32 ReadBytes;
   UINT8 ReadCommand[4];
   UINT32 ReadFrequency;
+  EFI_STATUS ResumeStatus;
   CONST EFI_SPI_IO_PROTOCOL *SpiIo;
+  UINT64 StartTime;
   EFI_STATUS Status;
+  BOOLEAN Suspended;
 
   //
   // Validate the inputs
@@ -203,10 +211,21 @@ FlashLfReadData (
   SpiIo = Flash->SpiIo;
 
   //
-  // Determine if the transfer needs to be broken up
+  // Suspend an erase or program operation in progress
+  //
+  Status = FlashSuspendOperation (Flash, FlashAddress, LengthInBytes,
+                                  &Suspended, &StartTime);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Determine if the transfer needs to be broken up.  When the SPI bus layer
+  // streams the data, the opcode and address are only sent once.
   //
   ReadFrequency = Flash->FlashConfig->ReadFrequency;
-  if (SpiIo->MaximumTransferBytes >= LengthInBytes) {
+  if (((SpiIo->Attributes & SPI_IO_SUPPORTS_STREAMING) != 0)
+    || (SpiIo->MaximumTransferBytes >= LengthInBytes)) {
     //
     // Build the read command
     //
@@ -284,6 +303,14 @@ FlashLfReadData (
       FlashAddress += ReadBytes;
     } while (LengthInBytes > 0);
   }
+
+  //
+  // Resume the suspended operation
+  //
+  ResumeStatus = FlashResumeOperation (Flash, Suspended, StartTime);
+  if (!EFI_ERROR(Status)) {
+    Status = ResumeStatus;
+  }
   if (EFI_ERROR(Status)) {
     DEBUG ((EFI_D_ERROR,
             "ERROR - Failed to read flash data, Status: %r!\n", Status));
@@ -323,8 +350,11 @@ FlashReadData (
   FLASH *Flash;
   UINT32 ReadBytes;
   UINT8 ReadCommand[5];
+  EFI_STATUS ResumeStatus;
   CONST EFI_SPI_IO_PROTOCOL *SpiIo;
+  UINT64 StartTime;
   EFI_STATUS Status;
+  BOOLEAN Suspended;
 
   //
   // Determine if low frequency reads should be used
@@ -352,10 +382,21 @@ FlashReadData (
   }
 
   //
-  // Determine if the transfer needs to be broken up
+  // Suspend an erase or program operation in progress
+  //
+  Status = FlashSuspendOperation (Flash, FlashAddress, LengthInBytes,
+                                  &Suspended, &StartTime);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Determine if the transfer needs to be broken up.  When the SPI bus layer
+  // streams the data, the opcode and address are only sent once.
   //
   SpiIo = Flash->SpiIo;
-  if (SpiIo->MaximumTransferBytes >= LengthInBytes) {
+  if (((SpiIo->Attributes & SPI_IO_SUPPORTS_STREAMING) != 0)
+    || (SpiIo->MaximumTransferBytes >= LengthInBytes)) {
     //
     // Build the read command
     //
@@ -435,6 +476,14 @@ FlashReadData (
       FlashAddress += ReadBytes;
     } while (LengthInBytes > 0);
   }
+
+  //
+  // Resume the suspended operation
+  //
+  ResumeStatus = FlashResumeOperation (Flash, Suspended, StartTime);
+  if (!EFI_ERROR(Status)) {
+    Status = ResumeStatus;
+  }
   if (EFI_ERROR(Status)) {
     DEBUG ((EFI_D_ERROR,
             "ERROR - Failed to read flash data, Status: %r!\n", Status));
@@ -557,7 +606,8 @@ FlashWriteEnable (
   @return  This routine returns one of the following status values:
 
   @retval EFI_SUCCESS           The status write was successful.
-  @retval EFI_OUT_OF_RESOURCES  Failed to allocate the write buffer.
+  @retval EFI_OUT_OF_RESOURCES  The status does not fit in the write buffer.
+  @retval EFI_NOT_READY         An asynchronous erase is in progress.
 
 **/
 EFI_STATUS
@@ -576,15 +626,18 @@ FlashWriteStatus (
   // Get the driver data structures
   //
   Flash = FLASH_CONTEXT_FROM_PROTOCOL (This);
+  if ((Flash->EraseEvent != NULL) || Flash->InBusyCallback) {
+    return EFI_NOT_READY;
+  }
 
   //
-  // Allocate the write buffer
+  // Use the preallocated write buffer
   //
-  WriteBuffer = AllocatePool (LengthInBytes + 1);
-  if (WriteBuffer == NULL) {
-    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate write buffer!\n"));
+  if (LengthInBytes >= Flash->WriteBufferBytes) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash status too long!\n"));
     return EFI_OUT_OF_RESOURCES;
   }
+  WriteBuffer = Flash->WriteBuffer;
 
   //
   // Write the flash status to the SPI NOR flash part
@@ -610,11 +663,45 @@ FlashWriteStatus (
               "ERROR - Failed to write flash status!\n"));
     }
   }
+  return Status;
+}
 
-  //
-  // Done with the write buffer
-  //
-  FreePool (WriteBuffer);
+/**
+  Determine if the flash part is busy with a write or erase operation.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+  @param[out] Busy              Set TRUE while the operation is in progress
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The flash status was read successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+FlashOperationBusy (
+  IN FLASH *Flash,
+  OUT BOOLEAN *Busy
+  )
+{
+  UINT8 Command;
+  UINT8 FlashStatus;
+  EFI_STATUS Status;
+
+  Command = SPI_NOR_READ_STATUS;
+  if (Flash->ReadStatusTransaction != NULL) {
+    Status = Flash->SpiIo->ExecutePrepared (Flash->SpiIo,
+                                            Flash->ReadStatusTransaction,
+                                            &Command,
+                                            &FlashStatus);
+  } else {
+    Status = FlashReadStatus (&Flash->LegacySpiFlash.FlashProtocol,
+                              sizeof(FlashStatus),
+                              &FlashStatus);
+  }
+  *Busy = (BOOLEAN)((FlashStatus & SPI_STATUS1_BUSY) != 0);
   return Status;
 }
 
@@ -623,9 +710,14 @@ FlashWriteStatus (
 
   This routine must be called at or below TPL_NOTIFY.
 
-  This routine polls the flash part until the operation is complete.
+  This routine polls the flash part until the operation is complete.  The
+  busy callback is called between the polls until the expected busy time
+  elapses.
 
   @param[in]  Flash             Pointer to an FLASH data structure.
+  @param[in]  ExpectedNs        Typical duration of the operation in
+                                nanoseconds, zero (0) to skip the busy
+                                callback
 
   @return  This routine returns one of the following status values:
 
@@ -635,10 +727,13 @@ FlashWriteStatus (
 EFI_STATUS
 EFIAPI
 FlashWaitOperationComplete (
-  IN FLASH *Flash
+  IN FLASH *Flash,
+  IN UINT64 ExpectedNs
   )
 {
-  UINT8 FlashStatus;
+  UINT64 Budget;
+  BOOLEAN Busy;
+  UINT64 Expected;
   EFI_STATUS Status;
   UINT64 Time;
   UINT64 Timeout;
@@ -646,31 +741,365 @@ FlashWaitOperationComplete (
   //
   // Write and erase operations should take much less than 1 second
   //
-  Timeout = GetTimeInNanoSecond (GetPerformanceCounter ())
-            + ( 1ULL * 1000 * 1000 * 1000);
+  Time = GetTimeInNanoSecond (GetPerformanceCounter ());
+  Expected = Time + ExpectedNs;
+  Timeout = Time + ( 1ULL * 1000 * 1000 * 1000);
 
   //
   // Wait for the SPI NOR flash part to complete the write or erase operation
   //
   do {
-    Status = FlashReadStatus (&Flash->LegacySpiFlash.FlashProtocol,
-                              sizeof(FlashStatus),
-                              &FlashStatus);
+    Status = FlashOperationBusy (Flash, &Busy);
     if (EFI_ERROR(Status)) {
       return Status;
     }
+    if (Busy) {
+      //
+      // Check for timeout
+      //
+      Time = GetTimeInNanoSecond (GetPerformanceCounter ());
+      if (Time >= Timeout) {
+        return EFI_TIMEOUT;
+      }
 
-    //
-    // Check for timeout
-    //
-    Time = GetTimeInNanoSecond (GetPerformanceCounter ());
-    if (Time >= Timeout) {
-      return EFI_TIMEOUT;
+      //
+      // Let the caller use the processor while the flash part is busy, the
+      // callback must return before the timeout
+      //
+      if ((Flash->BusyCallback != NULL) && (!Flash->InBusyCallback)
+        && (Time < Expected)) {
+        Budget = MIN (Expected, Timeout) - Time;
+        Flash->InBusyCallback = TRUE;
+        Flash->BusyCallback (Flash->BusyContext, Budget);
+        Flash->InBusyCallback = FALSE;
+      }
     }
-  } while ((FlashStatus & SPI_STATUS1_BUSY) != 0);
+  } while (Busy);
+  return EFI_SUCCESS;
+}
+
+/**
+  Register the routine to call while the flash part is busy.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_PROTOCOL data
+                                structure.
+  @param[in]  BusyCallback      Routine to call between the status polls,
+                                NULL to remove the callback
+  @param[in]  Context           Value to pass to BusyCallback
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The callback was registered successfully.
+  @retval EFI_NOT_READY         Called from the busy callback
+
+**/
+EFI_STATUS
+EFIAPI
+FlashSetBusyCallback (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN EFI_SPI_NOR_FLASH_BUSY_CALLBACK BusyCallback OPTIONAL,
+  IN VOID *Context OPTIONAL
+  )
+{
+  FLASH *Flash;
+
+  Flash = FLASH_CONTEXT_FROM_PROTOCOL (This);
+  if (Flash->InBusyCallback) {
+    return EFI_NOT_READY;
+  }
+  Flash->BusyCallback = BusyCallback;
+  Flash->BusyContext = Context;
   return EFI_SUCCESS;
 }
 
+/**
+  Send a single byte command to the SPI flash part.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  @param[in]  SpiIo             Pointer to an EFI_SPI_IO_PROTOCOL data structure
+  @param[in]  Command           Command byte to send
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The command was sent successfully.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FlashSendCommand (
+  IN CONST EFI_SPI_IO_PROTOCOL *SpiIo,
+  IN UINT8 Command
+  )
+{
+  return SpiIo->Transaction(
+                  SpiIo,                       // EFI_SPI_IO_PROTOCOL
+                  SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
+                  FALSE,                       // DebugTransaction
+                  0,                           // Use maximum clock frequency
+                  1,                           // Bus width in bits
+                  8,                           // 8-bits per frame
+                  sizeof(Command),             // WriteBytes
+                  &Command,                    // WriteBuffer
+                  0,                           // ReadBytes
+                  NULL                         // ReadBuffer
+                  );
+}
+
+/**
+  Prepare the SPI flash part for a read.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  A read may arrive from a higher TPL while an erase or program operation is
+  waiting for completion.  When the flash part supports suspend and resume
+  and the read does not overlap the data being erased or programmed, the
+  operation is suspended.  Otherwise the read waits for the operation to
+  complete.  Each call must be followed by a call to FlashResumeOperation.
+  Memory mapped reads of the flash do not call this routine and are not
+  protected from a busy flash part.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+  @param[in]  FlashAddress      Address in the flash to start reading
+  @param[in]  LengthInBytes     Read length in bytes
+  @param[out] Suspended         Set TRUE when this call suspended the operation
+  @param[out] StartTime         Time in nanoseconds when the read arrived
+                                during an operation, zero otherwise
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The flash part is ready for the read.
+  @retval EFI_TIMEOUT           The operation did not complete or suspend.
+
+**/
+EFI_STATUS
+EFIAPI
+FlashSuspendOperation (
+  IN FLASH *Flash,
+  IN UINT32 FlashAddress,
+  IN UINT32 LengthInBytes,
+  OUT BOOLEAN *Suspended,
+  OUT UINT64 *StartTime
+  )
+{
+  CONST EFI_SPI_NOR_FLASH_CONFIGURATION_DATA *FlashConfig;
+  EFI_STATUS Status;
+
+  *Suspended = FALSE;
+  *StartTime = 0;
+  if (!Flash->OperationInProgress) {
+    return EFI_SUCCESS;
+  }
+  *StartTime = GetTimeInNanoSecond (GetPerformanceCounter ());
+
+  //
+  // Another read has already suspended the operation, wait for the flash
+  // part to enter the suspended state
+  //
+  if (Flash->OperationSuspended) {
+    return FlashWaitOperationComplete (Flash, 0);
+  }
+
+  //
+  // Suspend the operation when the read does not overlap the data being
+  // erased or programmed
+  //
+  FlashConfig = Flash->FlashConfig;
+  if (((FlashConfig->Attributes & SPI_NOR_SUPPORTS_SUSPEND_RESUME) != 0)
+    && ((FlashAddress >= (Flash->OperationAddress + Flash->OperationBytes))
+      || ((FlashAddress + LengthInBytes) <= Flash->OperationAddress))) {
+    Flash->OperationSuspended = TRUE;
+    Status = FlashSendCommand (Flash->SpiIo, FlashConfig->SuspendOpcode);
+    if (!EFI_ERROR(Status)) {
+      //
+      // Wait for the flash part to enter the suspended state
+      //
+      Status = FlashWaitOperationComplete (Flash, 0);
+      if (EFI_ERROR(Status)) {
+        FlashSendCommand (Flash->SpiIo, FlashConfig->ResumeOpcode);
+        Flash->OperationSuspended = FALSE;
+        return Status;
+      }
+      *Suspended = TRUE;
+      return EFI_SUCCESS;
+    }
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash failed to suspend the operation\n"));
+    Flash->OperationSuspended = FALSE;
+  }
+
+  //
+  // Wait for the operation to complete
+  //
+  Status = FlashWaitOperationComplete (Flash, 0);
+  if (!EFI_ERROR(Status)) {
+    Flash->OperationInProgress = FALSE;
+  }
+  return Status;
+}
+
+/**
+  Resume the operation suspended by FlashSuspendOperation.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  This routine also records the worst case latency of the reads which arrive
+  during an erase or program operation in the MaximumReadLatency field of the
+  EFI_SPI_NOR_FLASH_PROTOCOL.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+  @param[in]  Suspended         Suspended value from FlashSuspendOperation
+  @param[in]  StartTime         StartTime value from FlashSuspendOperation
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The operation was resumed successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+FlashResumeOperation (
+  IN FLASH *Flash,
+  IN BOOLEAN Suspended,
+  IN UINT64 StartTime
+  )
+{
+  EFI_SPI_NOR_FLASH_PROTOCOL *FlashProtocol;
+  UINT64 Latency;
+  EFI_STATUS Status;
+
+  //
+  // Resume the erase or program operation
+  //
+  Status = EFI_SUCCESS;
+  if (Suspended) {
+    Status = FlashSendCommand (Flash->SpiIo, Flash->FlashConfig->ResumeOpcode);
+    if (EFI_ERROR(Status)) {
+      DEBUG ((EFI_D_ERROR, "ERROR - Flash failed to resume the operation\n"));
+    }
+    Flash->OperationSuspended = FALSE;
+  }
+
+  //
+  // Record the worst case read latency
+  //
+  if (StartTime != 0) {
+    FlashProtocol = &Flash->LegacySpiFlash.FlashProtocol;
+    Latency = GetTimeInNanoSecond (GetPerformanceCounter ()) - StartTime;
+    if (Latency > FlashProtocol->MaximumReadLatency) {
+      FlashProtocol->MaximumReadLatency = Latency;
+      DEBUG ((EFI_D_INFO,
+              "SPI Flash: Worst case read latency during %a: %Ld nSec\n",
+              Suspended ? "suspend" : "operation",
+              Latency));
+    }
+  }
+  return Status;
+}
+
+/**
+  Send a page program command to the SPI flash.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The page data is sent directly from the caller's buffer when the SPI bus
+  layer accepts the command phases or segmented writes.  Otherwise the
+  program header and the page data are copied into the temporary buffer.
+
+  @param[in]  SpiIo             Pointer to an EFI_SPI_IO_PROTOCOL structure.
+  @param[in]  FlashAddress      Address in the flash to start writing
+  @param[in]  LengthInBytes     Write length in bytes, must fit in a single
+                                SPI transaction
+  @param[in]  Buffer            Address of a buffer containing the data
+  @param[in]  WriteBuffer       Address of the temporary buffer
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The page program command was sent successfully.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FlashPageProgram (
+  IN CONST EFI_SPI_IO_PROTOCOL *SpiIo,
+  IN UINT32 FlashAddress,
+  IN UINT32 LengthInBytes,
+  IN UINT8 *Buffer,
+  IN UINT8 *WriteBuffer
+  )
+{
+  EFI_SPI_TRANSACTION_PHASES Phases;
+  EFI_SPI_IO_WRITE_SEGMENT Segments[2];
+
+  if ((SpiIo->Attributes & SPI_IO_SUPPORTS_TRANSACTION_PHASES) != 0) {
+    //
+    // Describe the opcode and address, the SPI host controller sends them
+    //
+    Phases.Opcode = SPI_NOR_PAGE_PROGRAM;
+    Phases.OpcodeBusWidth = 1;
+    Phases.AddressBytes = 3;
+    Phases.AddressBusWidth = 1;
+    Phases.Address = FlashAddress;
+    Phases.DummyCycles = 0;
+    Phases.DataBusWidth = 1;
+    return SpiIo->PhaseTransaction (
+                    SpiIo,                       // EFI_SPI_IO_PROTOCOL
+                    FALSE,                       // DebugTransaction
+                    0,                           // Use maximum clock frequency
+                    &Phases,                     // Phases
+                    LengthInBytes,               // WriteBytes
+                    Buffer,                      // WriteBuffer
+                    0,                           // ReadBytes
+                    NULL                         // ReadBuffer
+                    );
+  }
+
+  //
+  // Prepare the write buffer
+  //
+  WriteBuffer[0] = SPI_NOR_PAGE_PROGRAM;
+  WriteBuffer[1] = (UINT8)(FlashAddress >> 16);
+  WriteBuffer[2] = (UINT8)(FlashAddress >> 8);
+  WriteBuffer[3] = (UINT8)FlashAddress;
+  if ((SpiIo->Attributes & SPI_IO_SUPPORTS_STREAMING) != 0) {
+    //
+    // Send the page data directly from the caller's buffer
+    //
+    Segments[0].WriteBytes = 4;
+    Segments[0].WriteBuffer = &WriteBuffer[0];
+    Segments[1].WriteBytes = LengthInBytes;
+    Segments[1].WriteBuffer = Buffer;
+    return SpiIo->WriteSegments (
+                    SpiIo,                       // EFI_SPI_IO_PROTOCOL
+                    FALSE,                       // DebugTransaction
+                    0,                           // Use maximum clock frequency
+                    1,                           // Bus width in bits
+                    2,                           // SegmentCount
+                    &Segments[0]                 // Segments
+                    );
+  }
+  CopyMem (&WriteBuffer[4], Buffer, LengthInBytes);
+
+  //
+  // Write the data from the SPI NOR flash part
+  //
+  return SpiIo->Transaction(
+                  SpiIo,                       // EFI_SPI_IO_PROTOCOL
+                  SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
+                  FALSE,                       // DebugTransaction
+                  0,                           // Use maximum clock frequency
+                  1,                           // Bus width in bits
+                  8,                           // 8-bits per frame
+                  4 + LengthInBytes,           // WriteBytes
+                  &WriteBuffer[0],             // WriteBuffer
+                  0,                           // ReadBytes
+                  NULL                         // ReadBuffer
+                  );
+}
+
 /**
   Write data to the SPI flash.
 
@@ -682,7 +1111,9 @@ FlashWaitOperationComplete (
   @param[in]  FlashAddress      Address in the flash to start writing
   @param[in]  LengthInBytes     Write length in bytes
   @param[in]  Buffer            Address of a buffer containing the data
-  @param[in]  WriteBuffer       Address of the temporary buffer
+  @param[in]  WriteBuffer       Address of the temporary buffer, not used
+                                for the page data when the SPI bus layer
+                                supports phases or segmented writes
 
   @return  This routine returns one of the following status values:
 
@@ -711,34 +1142,15 @@ FlashWrite (
     //
     // Enable writes to the SPI flash
     //
+    Flash->OperationAddress = FlashAddress;
+    Flash->OperationBytes = LengthInBytes;
     Status = FlashWriteEnable (SpiIo);
     if (!EFI_ERROR(Status)) {
-      //
-      // Prepare the write buffer
-      //
-      WriteBuffer[0] = SPI_NOR_PAGE_PROGRAM;
-      WriteBuffer[1] = (UINT8)(FlashAddress >> 16);
-      WriteBuffer[2] = (UINT8)(FlashAddress >> 8);
-      WriteBuffer[3] = (UINT8)FlashAddress;
-      CopyMem (&WriteBuffer[4], Buffer, LengthInBytes);
-
-      //
-      // Write the data from the SPI NOR flash part
-      //
-      Status = SpiIo->Transaction(
-                    SpiIo,                       // EFI_SPI_IO_PROTOCOL
-                    SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
-                    FALSE,                       // DebugTransaction
-                    0,                           // Use maximum clock frequency
-                    1,                           // Bus width in bits
-                    8,                           // 8-bits per frame
-                    4 + LengthInBytes,           // WriteBytes
-                    &WriteBuffer[0],             // WriteBuffer
-                    0,                           // ReadBytes
-                    NULL                         // ReadBuffer
-                    );
+      Status = FlashPageProgram (SpiIo, FlashAddress, LengthInBytes, Buffer,
+                                 WriteBuffer);
       if (!EFI_ERROR(Status)) {
-        Status = FlashWaitOperationComplete (Flash);
+        Flash->OperationInProgress = TRUE;
+        Status = FlashWaitOperationComplete (Flash, FLASH_PROGRAM_TYPICAL_NS);
       }
     }
   } else {
@@ -753,14 +1165,6 @@ FlashWrite (
       WriteBytes -= 3;
     }
     do {
-      //
-      // Enable writes to the SPI flash
-      //
-      Status = FlashWriteEnable (SpiIo);
-      if (EFI_ERROR(Status)) {
-        break;
-      }
-
       //
       // Determine the number of bytes to transfer
       //
@@ -769,33 +1173,25 @@ FlashWrite (
       }
 
       //
-      // Prepare the write buffer
+      // Enable writes to the SPI flash
       //
-      WriteBuffer[0] = SPI_NOR_PAGE_PROGRAM;
-      WriteBuffer[1] = (UINT8)(FlashAddress >> 16);
-      WriteBuffer[2] = (UINT8)(FlashAddress >> 8);
-      WriteBuffer[3] = (UINT8)FlashAddress;
-      CopyMem (&WriteBuffer[4], Buffer, WriteBytes);
+      Flash->OperationAddress = FlashAddress;
+      Flash->OperationBytes = WriteBytes;
+      Status = FlashWriteEnable (SpiIo);
+      if (EFI_ERROR(Status)) {
+        break;
+      }
 
       //
-      // Write the data from the SPI NOR flash part
+      // Write the data to the SPI NOR flash part
       //
-      Status = SpiIo->Transaction(
-                    SpiIo,                       // EFI_SPI_IO_PROTOCOL
-                    SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
-                    FALSE,                       // DebugTransaction
-                    0,                           // Use maximum clock frequency
-                    1,                           // Bus width in bits
-                    8,                           // 8-bits per frame
-                    4 + WriteBytes,              // WriteBytes
-                    &WriteBuffer[0],             // WriteBuffer
-                    0,                           // ReadBytes
-                    NULL                         // ReadBuffer
-                    );
+      Status = FlashPageProgram (SpiIo, FlashAddress, WriteBytes, Buffer,
+                                 WriteBuffer);
       if (EFI_ERROR(Status)) {
         break;
       }
-      Status = FlashWaitOperationComplete (Flash);
+      Flash->OperationInProgress = TRUE;
+      Status = FlashWaitOperationComplete (Flash, FLASH_PROGRAM_TYPICAL_NS);
       if (EFI_ERROR(Status)) {
         break;
       }
@@ -808,6 +1204,7 @@ FlashWrite (
       FlashAddress += WriteBytes;
     } while (LengthInBytes > 0);
   }
+  Flash->OperationInProgress = FALSE;
   if (EFI_ERROR(Status)) {
     DEBUG ((EFI_D_ERROR,
             "ERROR - Failed to write flash data, Status: %r!\n", Status));
@@ -837,6 +1234,7 @@ FlashWrite (
   @retval EFI_INVALID_PARAMETER The LengthInBytes > This->FlashSize
                                                     - FlashAddress
   @retval EFI_OUT_OF_RESOURCES  Insufficient memory to copy buffer.
+  @retval EFI_NOT_READY         An asynchronous erase is in progress.
 
 **/
 EFI_STATUS
@@ -875,17 +1273,15 @@ FlashWriteData (
   // Get the driver data structures
   //
   Flash = FLASH_CONTEXT_FROM_PROTOCOL (This);
+  if ((Flash->EraseEvent != NULL) || Flash->InBusyCallback) {
+    return EFI_NOT_READY;
+  }
 
   //
-  // Allocate the write buffer
+  // Use the preallocated write buffer
   //
   WritePageBytes = Flash->FlashConfig->WritePageBytes;
-  WriteBuffer = AllocatePool (1 + 3 + WritePageBytes);
-  if (WriteBuffer == NULL) {
-    DEBUG ((EFI_D_ERROR,
-            "ERROR - SpiFlashDxe write buffer allocation failed!\n"));
-    return EFI_OUT_OF_RESOURCES;
-  }
+  WriteBuffer = Flash->WriteBuffer;
 
   //
   // If the data is not flash page aligned, write the first portion of the data
@@ -942,11 +1338,78 @@ FlashWriteData (
       LengthInBytes -= WriteBytes;
     }
   }
+  return Status;
+}
+
+/**
+  Start erasing a block in the SPI flash.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  This routine sends the erase command to the SPI flash part and returns
+  without waiting for the erase operation to complete.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+  @param[in]  FlashAddress      Address of the block to erase
+  @param[in]  EraseOpcode       Opcode to perform the erase operation
+  @param[in]  BlockBytes        Number of bytes in the erase block
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The erase operation was started successfully.
+
+**/
+EFI_STATUS
+EFIAPI
+FlashStartErase (
+  IN FLASH *Flash,
+  IN UINT32 FlashAddress,
+  IN UINT8 EraseOpcode,
+  IN UINT32 BlockBytes
+  )
+{
+  UINT8 Command [4];
+  CONST EFI_SPI_IO_PROTOCOL *SpiIo;
+  EFI_STATUS Status;
+
+  //
+  // Build the erase command
+  //
+  Command [0] = EraseOpcode;
+  Command [1] = (UINT8)(FlashAddress >> 16);
+  Command [2] = (UINT8)(FlashAddress >> 8);
+  Command [3] = (UINT8)FlashAddress;
 
   //
-  // Done with the temporary write buffer
+  // Erase the block
   //
-  FreePool (WriteBuffer);
+  Flash->OperationAddress = FlashAddress;
+  Flash->OperationBytes = BlockBytes;
+  SpiIo = Flash->SpiIo;
+  Status = FlashWriteEnable (SpiIo);
+  if (!EFI_ERROR(Status)) {
+    Status = SpiIo->Transaction(
+                  SpiIo,                       // EFI_SPI_IO_PROTOCOL
+                  SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
+                  FALSE,                       // DebugTransaction
+                  0,                           // Use maximum clock frequency
+                  1,                           // Bus width in bits
+                  8,                           // 8-bits per frame
+                  sizeof(Command),             // WriteBytes
+                  &Command[0],                 // WriteBuffer
+                  0,                           // ReadBytes
+                  NULL                         // ReadBuffer
+                  );
+  }
+  if (EFI_ERROR(Status)) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash failed to erase %d bytes at 0x%08x\n",
+            BlockBytes, FlashAddress));
+  } else {
+    //
+    // A read which arrives from now on must wait for or suspend the erase
+    //
+    Flash->OperationInProgress = TRUE;
+  }
   return Status;
 }
 
@@ -978,9 +1441,8 @@ FlashEraseBlocks (
   IN UINT32 BlockCount
   )
 {
-  UINT8 Command [4];
+  UINT64 ExpectedNs;
   UINT32 FlashSize;
-  CONST EFI_SPI_IO_PROTOCOL *SpiIo;
   EFI_STATUS Status;
 
   //
@@ -1002,41 +1464,18 @@ FlashEraseBlocks (
   // Erase the blocks
   //
   Status = EFI_SUCCESS;
-  Command [0] = EraseOpcode;
+  ExpectedNs = (BlockBytes > SIZE_4KB) ? FLASH_ERASE_BLOCK_TYPICAL_NS
+                                       : FLASH_ERASE_4KB_TYPICAL_NS;
   FlashAddress &= ~(BlockBytes - 1);
-  SpiIo = Flash->SpiIo;
   while (BlockCount-- > 0) {
-    //
-    // Build the erase command
-    //
-    Command [1] = (UINT8)(FlashAddress >> 16);
-    Command [2] = (UINT8)(FlashAddress >> 8);
-    Command [3] = (UINT8)FlashAddress;
-
     //
     // Erase the next block
     //
-    Status = FlashWriteEnable (SpiIo);
-    if (!EFI_ERROR(Status)) {
-      Status = SpiIo->Transaction(
-                    SpiIo,                       // EFI_SPI_IO_PROTOCOL
-                    SPI_TRANSACTION_WRITE_ONLY,  // TransactionType
-                    FALSE,                       // DebugTransaction
-                    0,                           // Use maximum clock frequency
-                    1,                           // Bus width in bits
-                    8,                           // 8-bits per frame
-                    sizeof(Command),             // WriteBytes
-                    &Command[0],                 // WriteBuffer
-                    0,                           // ReadBytes
-                    NULL                         // ReadBuffer
-                    );
-    }
+    Status = FlashStartErase (Flash, FlashAddress, EraseOpcode, BlockBytes);
     if (EFI_ERROR(Status)) {
-      DEBUG ((EFI_D_ERROR, "ERROR - Flash failed to erase %d bytes at 0x%08x\n",
-              BlockBytes, FlashAddress));
       break;
     }
-    Status = FlashWaitOperationComplete (Flash);
+    Status = FlashWaitOperationComplete (Flash, ExpectedNs);
     if (EFI_ERROR(Status)) {
       break;
     }
@@ -1046,6 +1485,7 @@ FlashEraseBlocks (
     //
     FlashAddress += BlockBytes;
   }
+  Flash->OperationInProgress = FALSE;
   return Status;
 }
 
@@ -1165,6 +1605,7 @@ FlashEraseBlock (
   @retval EFI_INVALID_PARAMETER FlashAddress >= This->FlashSize
   @retval EFI_INVALID_PARAMETER BlockCount * 4 KiB > This->FlashSize
                                                      - FlashAddress
+  @retval EFI_NOT_READY         An asynchronous erase is in progress.
 **/
 EFI_STATUS
 EFIAPI
@@ -1184,6 +1625,9 @@ FlashErase (
   // Align the flash address to 4 KiB
   //
   Flash = FLASH_CONTEXT_FROM_PROTOCOL (This);
+  if ((Flash->EraseEvent != NULL) || Flash->InBusyCallback) {
+    return EFI_NOT_READY;
+  }
   FlashAddress &= ~(BIT12 - 1);
 
   //
@@ -1538,10 +1982,27 @@ FlashShutdown (
   IN FLASH *Flash
   )
 {
+  FLASH **Previous;
+
   //
   // Determine if the job is already done
   //
   if (Flash != NULL) {
+    //
+    // Stop any asynchronous erase
+    //
+    FlashEraseAsyncStop (Flash);
+
+    //
+    // Release the prepared transaction while the SPI IO protocol is still
+    // open
+    //
+    if (Flash->ReadStatusTransaction != NULL) {
+      Flash->SpiIo->ReleasePrepared (Flash->SpiIo,
+                                     Flash->ReadStatusTransaction);
+      Flash->ReadStatusTransaction = NULL;
+    }
+
     //
     // Release the SPI IO protocol
     //
@@ -1555,8 +2016,23 @@ FlashShutdown (
     }
 
     //
-    // Free the data structure
+    // Remove the flash part from the list
+    //
+    Previous = &gFlashList;
+    while (*Previous != NULL) {
+      if (*Previous == Flash) {
+        *Previous = Flash->NextFlash;
+        break;
+      }
+      Previous = &(*Previous)->NextFlash;
+    }
+
+    //
+    // Free the data structures
     //
+    if (Flash->WriteBuffer != NULL) {
+      FreePool (Flash->WriteBuffer);
+    }
     FreePool (Flash);
   }
 }
@@ -1600,7 +2076,7 @@ FlashStartup (
   //
   // Allocate the controller data structure
   //
-  Flash = AllocateZeroPool (sizeof (FLASH));
+  Flash = AllocateRuntimeZeroPool (sizeof (FLASH));
   if (Flash == NULL) {
     DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate SPI_BUS!\n"));
     return EFI_OUT_OF_RESOURCES;
@@ -1641,6 +2117,8 @@ FlashStartup (
   FlashProtocol->WriteStatus = FlashWriteStatus;
   FlashProtocol->WriteData = FlashWriteData;
   FlashProtocol->Erase = FlashErase;
+  FlashProtocol->EraseAsync = FlashEraseAsync;
+  FlashProtocol->SetBusyCallback = FlashSetBusyCallback;
 
   //
   // Initialize the legacy SPI flash controller interface
@@ -1738,6 +2216,42 @@ DEBUG ((EFI_D_ERROR, "SPI Flash: %s: %s: %s %s (%02x %02x %02x)\n", FlashProtoco
     goto Failure;
   }
 
+  //
+  // Allocate the write buffer: command, 3 address bytes and one page of data
+  //
+  Flash->WriteBufferBytes = 1 + 3 + FlashConfig->WritePageBytes;
+  Flash->WriteBuffer = AllocateRuntimePool (Flash->WriteBufferBytes);
+  if (Flash->WriteBuffer == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate write buffer!\n"));
+    Status = EFI_OUT_OF_RESOURCES;
+    goto Failure;
+  }
+
+  //
+  // Prepare the read status transaction used to poll for the completion of
+  // the write and erase operations.  The polling falls back to
+  // FlashReadStatus when the SPI IO protocol does not support prepared
+  // transactions or the preparation fails.
+  //
+  Flash->ReadStatusTransaction = NULL;
+  if ((Flash->SpiIo->Attributes & SPI_IO_SUPPORTS_PREPARED_TRANSACTIONS)
+       != 0) {
+    Status = Flash->SpiIo->PrepareTransaction (
+                      Flash->SpiIo,              // EFI_SPI_IO_PROTOCOL
+                      SPI_TRANSACTION_WRITE_THEN_READ, // TransactionType
+                      FALSE,                     // DebugTransaction
+                      0,                         // Use maximum clock frequency
+                      1,                         // Bus width in bits
+                      8,                         // 8-bits per frame
+                      1,                         // WriteBytes
+                      1,                         // ReadBytes
+                      &Flash->ReadStatusTransaction
+                      );
+    if (EFI_ERROR(Status)) {
+      Flash->ReadStatusTransaction = NULL;
+    }
+  }
+
   //
   // Update the flash configuration
   //
@@ -1850,6 +2364,12 @@ DEBUG ((EFI_D_ERROR, "SPI Flash: %s: %s: %s %s (%02x %02x %02x)\n", FlashProtoco
             "ERROR - Flash failed to install EFI_SPI_NOR_FLASH_PROTOCOL!\n"));
     goto Failure;
   }
+
+  //
+  // Add this flash part to the list
+  //
+  Flash->NextFlash = gFlashList;
+  gFlashList = Flash;
   return EFI_SUCCESS;
 
 Failure:
@@ -18,6 +18,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 
 #include <Uefi.h>
 #include <Library/AsciiDump.h>
+#include <Library/BaseLib.h>
 #include <Library/BaseMemoryLib.h>
 #include <Library/DebugLib.h>
 #include <Library/MemoryAllocationLib.h>
@@ -28,6 +29,7 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 #include <Protocol/LegacySpiFlash.h>
 #include <Protocol/SpiIo.h>
 #include <Protocol/SpiNorFlash.h>
+#include <Protocol/SpiNorFlashBatch.h>
 
 extern EFI_GUID gSpiNorFlashProtocolGuid;
 
@@ -39,6 +41,55 @@ typedef struct _FLASH
   // Structure identification
   //
   UINT32 Signature;
+
+  //
+  // Next flash part in gFlashList
+  //
+  struct _FLASH *NextFlash;
+
+  //
+  // Buffer for the command, address and one page of write data, allocated
+  // once to keep the memory allocation services off the write path
+  //
+  UINT8 *WriteBuffer;
+  UINT32 WriteBufferBytes;
+
+  //
+  // Prepared read status transaction used to poll for operation completion
+  //
+  VOID *ReadStatusTransaction;
+
+  //
+  // Erase or program operation in progress.  A read which arrives before the
+  // operation completes suspends the operation when the flash part supports
+  // suspend and resume, otherwise the read waits for the operation to
+  // complete.
+  //
+  BOOLEAN OperationInProgress;
+  BOOLEAN OperationSuspended;
+  UINT32 OperationAddress;
+  UINT32 OperationBytes;
+
+  //
+  // Routine called between the status polls while a write or erase
+  // operation is in progress.  InBusyCallback prevents the callback from
+  // being reentered and the busy part from being written or erased.
+  //
+  EFI_SPI_NOR_FLASH_BUSY_CALLBACK BusyCallback;
+  VOID *BusyContext;
+  BOOLEAN InBusyCallback;
+
+  //
+  // Asynchronous erase state.  EraseEvent is the caller's completion event
+  // and is NULL when no asynchronous erase is in progress.  EraseAddress and
+  // EraseBlockCount describe the 4 KiB blocks which remain to be erased.
+  //
+  EFI_EVENT EraseTimer;
+  EFI_EVENT EraseEvent;
+  EFI_STATUS *EraseStatus;
+  UINT32 EraseAddress;
+  UINT32 EraseBlockCount;
+  UINT64 EraseTimeout;
   EFI_DRIVER_BINDING_PROTOCOL *DriverBinding;
   EFI_HANDLE ControllerHandle;
   EFI_DEVICE_PATH_PROTOCOL *DevicePath;
@@ -50,6 +101,64 @@ typedef struct _FLASH
 #define FLASH_CONTEXT_FROM_PROTOCOL(protocol)         \
     CR (protocol, FLASH, LegacySpiFlash.FlashProtocol, FLASH_SIGNATURE)
 
+//
+// Asynchronous erase timing.  The first status poll is delayed by the
+// typical erase time for the block size, then the status is polled every
+// millisecond until the erase completes or the maximum erase time expires.
+//
+#define FLASH_ERASE_4KB_DELAY           EFI_TIMER_PERIOD_MILLISECONDS (30)
+#define FLASH_ERASE_BLOCK_DELAY         EFI_TIMER_PERIOD_MILLISECONDS (120)
+#define FLASH_ERASE_POLL_PERIOD         EFI_TIMER_PERIOD_MILLISECONDS (1)
+#define FLASH_ERASE_TIMEOUT_NS          (2ULL * 1000 * 1000 * 1000)
+
+//
+// Convert an EFI timer period in 100 ns units into nanoseconds
+//
+#define FLASH_TIMER_PERIOD_TO_NS(Period)  MultU64x32 ((Period), 100)
+
+//
+// Typical busy times in nanoseconds, used to compute the time budget of the
+// busy callback
+//
+#define FLASH_PROGRAM_TYPICAL_NS        (700ULL * 1000)
+#define FLASH_ERASE_4KB_TYPICAL_NS      (30ULL * 1000 * 1000)
+#define FLASH_ERASE_BLOCK_TYPICAL_NS    (120ULL * 1000 * 1000)
+
+//
+// Batch request ring shared between the DXE and SMM SPI NOR flash drivers.
+// The ring is allocated once by the DXE driver and passed to the SMM driver
+// as the SMM communication buffer.  The DXE driver is the only writer of Head
+// and the SMM driver is the only writer of Tail, so no lock is required.
+// Both values are free running counters, the entry index is the counter
+// modulo FLASH_BATCH_ENTRIES.  The data for the read and write operations
+// immediately follows the ring structure.  The SMM driver places the status
+// of the whole batch into Status: EFI_ACCESS_DENIED once SMM is locked and
+// EFI_INVALID_PARAMETER when the ring is not valid.
+//
+#define FLASH_BATCH_SIGNATURE   SIGNATURE_32 ('F', 'B', 'a', 't')
+#define FLASH_BATCH_ENTRIES     32
+#define FLASH_BATCH_DATA_BYTES  SIZE_64KB
+
+typedef struct _FLASH_BATCH_ENTRY
+{
+  UINT32 Operation;
+  UINT32 PartIndex;
+  UINT32 FlashAddress;
+  UINT32 LengthInBytes;
+  UINT32 DataOffset;
+  EFI_STATUS Status;
+} FLASH_BATCH_ENTRY;
+
+typedef struct _FLASH_BATCH_RING
+{
+  UINT32 Signature;
+  volatile UINT32 Head;
+  volatile UINT32 Tail;
+  UINT32 DataBytes;
+  EFI_STATUS Status;
+  FLASH_BATCH_ENTRY Entry[FLASH_BATCH_ENTRIES];
+} FLASH_BATCH_RING;
+
 VOID
 EFIAPI
 FlashDisplayManufactureName (
@@ -64,6 +173,51 @@ SpiInstallProtocol (
   IN VOID *Protocol
   );
 
+EFI_STATUS
+EFIAPI
+FlashEraseAsync (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN UINT32 FlashAddress,
+  IN UINT32 BlockCount,
+  IN EFI_EVENT Event,
+  OUT EFI_STATUS *EraseStatus
+  );
+
+VOID
+EFIAPI
+FlashEraseAsyncStop (
+  IN FLASH *Flash
+  );
+
+UINT8
+EFIAPI
+FlashEraseBlockOpcode (
+  IN FLASH *Flash
+  );
+
+EFI_STATUS
+EFIAPI
+FlashOperationBusy (
+  IN FLASH *Flash,
+  OUT BOOLEAN *Busy
+  );
+
+EFI_STATUS
+EFIAPI
+FlashResumeOperation (
+  IN FLASH *Flash,
+  IN BOOLEAN Suspended,
+  IN UINT64 StartTime
+  );
+
+EFI_STATUS
+EFIAPI
+FlashSetBusyCallback (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN EFI_SPI_NOR_FLASH_BUSY_CALLBACK BusyCallback OPTIONAL,
+  IN VOID *Context OPTIONAL
+  );
+
 EFI_STATUS
 EFIAPI
 FlashStartup (
@@ -71,6 +225,25 @@ FlashStartup (
   IN CONST EFI_SPI_IO_PROTOCOL *SpiIo
   );
 
+EFI_STATUS
+EFIAPI
+FlashStartErase (
+  IN FLASH *Flash,
+  IN UINT32 FlashAddress,
+  IN UINT8 EraseOpcode,
+  IN UINT32 BlockBytes
+  );
+
+EFI_STATUS
+EFIAPI
+FlashSuspendOperation (
+  IN FLASH *Flash,
+  IN UINT32 FlashAddress,
+  IN UINT32 LengthInBytes,
+  OUT BOOLEAN *Suspended,
+  OUT UINT64 *StartTime
+  );
+
 EFI_STATUS
 EFIAPI
 SpiCloseProtocol(
@@ -80,6 +253,7 @@ SpiCloseProtocol(
   IN EFI_HANDLE               ControllerHandle
   );
 
+extern FLASH *gFlashList;
 extern EFI_GUID *gFlashIoProtocolGuid;
 extern EFI_GUID *gFlashProtocolGuid;
 extern EFI_GUID *gFlashLegacyProtocolGuid;
@@ -14,11 +14,37 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
 #include "SpiFlash.h"
+#include <Guid/EventGroup.h>
+#include <Library/UefiRuntimeLib.h>
+#include <Protocol/DxeSmmReadyToLock.h>
+#include <Protocol/SmmCommunication.h>
+#include <Protocol/SpiPeripheralStub.h>
 
 EFI_GUID *gFlashIoProtocolGuid = &gEfiSpiNorFlashDriverGuid;
 EFI_GUID *gFlashProtocolGuid = &gEfiSpiNorFlashProtocolGuid;
 EFI_GUID *gFlashLegacyProtocolGuid = &gEfiLegacySpiFlashProtocolGuid;
 VOID *gFlashIoProtocolRegistration;
+VOID *mStubProtocolRegistration;
+
+EFI_SMM_COMMUNICATE_HEADER *mBatchBuffer;
+EFI_SMM_COMMUNICATION_PROTOCOL *mSmmCommunication;
+VOID *mSmmCommunicationRegistration;
+BOOLEAN mBatchLocked;
+VOID *mSmmReadyToLockRegistration;
+
+EFI_STATUS
+EFIAPI
+FlashBatchSubmit (
+  IN CONST EFI_SPI_NOR_FLASH_BATCH_PROTOCOL *This,
+  IN UINT32 RequestCount,
+  IN OUT EFI_SPI_NOR_FLASH_BATCH_REQUEST *Requests
+  );
+
+EFI_SPI_NOR_FLASH_BATCH_PROTOCOL mFlashBatchProtocol = {
+  FLASH_BATCH_ENTRIES,
+  FLASH_BATCH_DATA_BYTES,
+  FlashBatchSubmit
+};
 
 /**
   Install the a protocol for the driver.
@@ -161,6 +187,820 @@ FlashIoProtocolAvailable (
   }
 }
 
+/**
+  Zero or more SPI peripheral stubs are available
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  The SPI bus layer publishes a stub for each SPI peripheral when the SPI IO
+  protocol creation is deferred.  Connect the stubs for the SPI NOR flash
+  parts, the resulting SPI IO protocols are handled by
+  FlashIoProtocolAvailable.
+
+  @param[in]  Event             Event whose notification function is being
+                                invoked.
+  @param[in]  Context           Pointer to the notification function's context.
+
+**/
+VOID
+EFIAPI
+FlashStubProtocolAvailable (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  EFI_HANDLE *HandleArray;
+  UINTN HandleCount;
+  UINTN Index;
+  CONST EFI_SPI_PERIPHERAL *SpiPeripheral;
+  EFI_STATUS Status;
+  EFI_SPI_PERIPHERAL_STUB_PROTOCOL *Stub;
+
+  //
+  // Locate the SPI peripheral stubs in the system
+  //
+  Status = gBS->LocateHandleBuffer (
+                  ByProtocol,
+                  &gEfiSpiPeripheralStubProtocolGuid,
+                  NULL,
+                  &HandleCount,
+                  &HandleArray
+                  );
+  if (!EFI_ERROR(Status)) {
+    //
+    // Connect the SPI NOR flash parts
+    //
+    for (Index = 0; Index < HandleCount; Index++) {
+      Status = gBS->HandleProtocol (
+                      HandleArray[Index],
+                      &gEfiSpiPeripheralStubProtocolGuid,
+                      (VOID **)&Stub
+                      );
+      if (EFI_ERROR(Status)) {
+        continue;
+      }
+      SpiPeripheral = Stub->SpiPeripheral;
+      if ((SpiPeripheral->SpiPeripheralDriverGuid == NULL)
+        || (!CompareGuid (SpiPeripheral->SpiPeripheralDriverGuid,
+                          gFlashIoProtocolGuid))) {
+        continue;
+      }
+      Status = Stub->Connect (Stub);
+      if (EFI_ERROR(Status) && (Status != EFI_ALREADY_STARTED)) {
+        DEBUG ((EFI_D_ERROR,
+                "ERROR - Flash unable to connect SPI stub, Status: %r\n",
+                Status));
+      }
+    }
+
+    //
+    // Done with the array
+    //
+    FreePool (HandleArray);
+  }
+}
+
+/**
+  Submit a batch of flash operations to the SMM SPI NOR flash driver.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  This routine places the requests into the FLASH_BATCH_RING and generates a
+  single SMI to process all of the entries.  Read and write requests larger
+  than the remaining data area are split across multiple entries.  When the
+  ring fills, the SMI is generated and the remaining requests are placed into
+  the ring for the next SMI.  The SMM driver only accepts batches until SMM
+  is locked at the end of DXE.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_BATCH_PROTOCOL
+                                data structure.
+  @param[in]  RequestCount      Number of requests in the Requests array
+  @param[in, out] Requests      Array of flash requests
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           All of the requests completed successfully.
+  @retval EFI_INVALID_PARAMETER Requests is NULL
+  @retval EFI_UNSUPPORTED       Called after ExitBootServices
+  @retval EFI_ACCESS_DENIED     Called after SMM was locked
+  @retval other                 The Status value of the first request which
+                                failed
+
+**/
+EFI_STATUS
+EFIAPI
+FlashBatchSubmit (
+  IN CONST EFI_SPI_NOR_FLASH_BATCH_PROTOCOL *This,
+  IN UINT32 RequestCount,
+  IN OUT EFI_SPI_NOR_FLASH_BATCH_REQUEST *Requests
+  )
+{
+  UINTN CommSize;
+  EFI_STATUS CommStatus;
+  UINT32 Completed;
+  UINT8 *Data;
+  UINT32 DataOffset;
+  FLASH_BATCH_ENTRY *Entry;
+  UINT32 EntryCount;
+  UINT32 EntryOffset[FLASH_BATCH_ENTRIES];
+  UINT32 EntryRequest[FLASH_BATCH_ENTRIES];
+  EFI_STATUS EntryStatus;
+  UINT32 Index;
+  UINT32 LengthInBytes;
+  UINT32 Offset;
+  EFI_SPI_NOR_FLASH_BATCH_REQUEST *Request;
+  UINT32 RequestIndex;
+  FLASH_BATCH_RING *Ring;
+  UINT32 Start;
+  EFI_TPL TplPrevious;
+
+  //
+  // Validate the parameters
+  //
+  if ((Requests == NULL) && (RequestCount != 0)) {
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // The SMM communication protocol is only available during boot
+  //
+  if (EfiAtRuntime ()) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // The SMM SPI NOR flash driver rejects the batches once SMM is locked
+  //
+  if (mBatchLocked) {
+    return EFI_ACCESS_DENIED;
+  }
+
+  //
+  // Locate the ring and data area
+  //
+  Ring = (FLASH_BATCH_RING *)&mBatchBuffer->Data[0];
+  Data = (UINT8 *)(Ring + 1);
+
+  //
+  // Only one batch may use the ring at a time
+  //
+  TplPrevious = gBS->RaiseTPL (TPL_NOTIFY);
+  Offset = 0;
+  RequestIndex = 0;
+  while (RequestIndex < RequestCount) {
+    //
+    // Place as many requests into the ring as possible
+    //
+    Start = Ring->Head;
+    EntryCount = 0;
+    DataOffset = 0;
+    while ((RequestIndex < RequestCount) && (EntryCount < FLASH_BATCH_ENTRIES)) {
+      Request = &Requests[RequestIndex];
+
+      //
+      // Validate the request
+      //
+      if (Offset == 0) {
+        Request->Status = EFI_SUCCESS;
+        if ((Request->LengthInBytes == 0)
+          || (Request->Operation > SPI_NOR_FLASH_BATCH_ERASE)
+          || ((Request->Operation == SPI_NOR_FLASH_BATCH_ERASE)
+            && (((Request->FlashAddress & (SIZE_4KB - 1)) != 0)
+              || ((Request->LengthInBytes & (SIZE_4KB - 1)) != 0)))
+          || ((Request->Operation != SPI_NOR_FLASH_BATCH_ERASE)
+            && (Request->Buffer == NULL))) {
+          Request->Status = EFI_INVALID_PARAMETER;
+          RequestIndex += 1;
+          continue;
+        }
+      }
+
+      //
+      // Copy the write data into the data area
+      //
+      LengthInBytes = Request->LengthInBytes - Offset;
+      if (Request->Operation != SPI_NOR_FLASH_BATCH_ERASE) {
+        if (LengthInBytes > (FLASH_BATCH_DATA_BYTES - DataOffset)) {
+          LengthInBytes = FLASH_BATCH_DATA_BYTES - DataOffset;
+        }
+        if (LengthInBytes == 0) {
+          break;
+        }
+        if (Request->Operation == SPI_NOR_FLASH_BATCH_WRITE) {
+          CopyMem (&Data[DataOffset], &Request->Buffer[Offset], LengthInBytes);
+        }
+      }
+
+      //
+      // Fill in the ring entry
+      //
+      Entry = &Ring->Entry[(Start + EntryCount) % FLASH_BATCH_ENTRIES];
+      Entry->Operation = Request->Operation;
+      Entry->PartIndex = Request->PartIndex;
+      Entry->FlashAddress = Request->FlashAddress + Offset;
+      Entry->LengthInBytes = LengthInBytes;
+      Entry->DataOffset = DataOffset;
+      Entry->Status = EFI_NOT_READY;
+      EntryRequest[EntryCount] = RequestIndex;
+      EntryOffset[EntryCount] = Offset;
+      EntryCount += 1;
+
+      //
+      // Account for the portion of the request placed in the ring
+      //
+      if (Request->Operation != SPI_NOR_FLASH_BATCH_ERASE) {
+        DataOffset += LengthInBytes;
+      }
+      Offset += LengthInBytes;
+      if (Offset >= Request->LengthInBytes) {
+        Offset = 0;
+        RequestIndex += 1;
+      }
+    }
+    if (EntryCount == 0) {
+      break;
+    }
+
+    //
+    // Publish the entries and generate the SMI
+    //
+    Ring->Status = EFI_NOT_READY;
+    MemoryFence ();
+    Ring->Head = Start + EntryCount;
+    mBatchBuffer->MessageLength = sizeof (FLASH_BATCH_RING)
+                                + FLASH_BATCH_DATA_BYTES;
+    CommSize = OFFSET_OF (EFI_SMM_COMMUNICATE_HEADER, Data)
+             + mBatchBuffer->MessageLength;
+    CommStatus = mSmmCommunication->Communicate (mSmmCommunication,
+                                                 mBatchBuffer,
+                                                 &CommSize);
+    if (EFI_ERROR(CommStatus)) {
+      DEBUG ((EFI_D_ERROR,
+              "ERROR - Flash batch SMI failed, Status: %r\n",
+              CommStatus));
+    } else if (EFI_ERROR(Ring->Status) && (Ring->Status != EFI_NOT_READY)) {
+      //
+      // The SMM driver rejected the batch
+      //
+      DEBUG ((EFI_D_ERROR,
+              "ERROR - Flash batch rejected, Status: %r\n",
+              Ring->Status));
+      CommStatus = Ring->Status;
+      if (CommStatus == EFI_ACCESS_DENIED) {
+        mBatchLocked = TRUE;
+      }
+    }
+
+    //
+    // Return the status and the read data for each of the entries
+    //
+    Completed = Ring->Tail - Start;
+    if (Completed > EntryCount) {
+      Completed = 0;
+    }
+    for (Index = 0; Index < EntryCount; Index++) {
+      Entry = &Ring->Entry[(Start + Index) % FLASH_BATCH_ENTRIES];
+      Request = &Requests[EntryRequest[Index]];
+      if (Index < Completed) {
+        EntryStatus = Entry->Status;
+      } else {
+        EntryStatus = EFI_ERROR(CommStatus) ? CommStatus : EFI_DEVICE_ERROR;
+      }
+      if (EFI_ERROR(EntryStatus)) {
+        if (!EFI_ERROR(Request->Status)) {
+          Request->Status = EntryStatus;
+        }
+      } else if (Request->Operation == SPI_NOR_FLASH_BATCH_READ) {
+        CopyMem (&Request->Buffer[EntryOffset[Index]],
+                 &Data[Entry->DataOffset],
+                 Entry->LengthInBytes);
+      }
+    }
+
+    //
+    // Discard any entries which the SMM driver did not process
+    //
+    if (Ring->Tail != Ring->Head) {
+      Ring->Head = Ring->Tail;
+    }
+  }
+  gBS->RestoreTPL (TplPrevious);
+
+  //
+  // Return the status of the first failing request
+  //
+  for (Index = 0; Index < RequestCount; Index++) {
+    if (EFI_ERROR(Requests[Index].Status)) {
+      return Requests[Index].Status;
+    }
+  }
+  return EFI_SUCCESS;
+}
+
+/**
+  The SMM communication protocol is available
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  Allocate the FLASH_BATCH_RING which is shared with the SMM SPI NOR flash
+  driver and install the EFI_SPI_NOR_FLASH_BATCH_PROTOCOL.
+
+  @param[in]  Event             Event whose notification function is being
+                                invoked.
+  @param[in]  Context           Pointer to the notification function's context.
+
+**/
+VOID
+EFIAPI
+FlashSmmCommunicationAvailable (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  EFI_HANDLE Handle;
+  FLASH_BATCH_RING *Ring;
+  EFI_STATUS Status;
+
+  //
+  // Determine if the batch protocol is already installed
+  //
+  if (mSmmCommunication != NULL) {
+    return;
+  }
+
+  //
+  // Locate the SMM communication protocol
+  //
+  Status = gBS->LocateProtocol (&gEfiSmmCommunicationProtocolGuid,
+                                NULL,
+                                (VOID **)&mSmmCommunication);
+  if (EFI_ERROR(Status)) {
+    mSmmCommunication = NULL;
+    return;
+  }
+
+  //
+  // Allocate the communication buffer containing the ring
+  //
+  mBatchBuffer = AllocateRuntimeZeroPool (
+                   OFFSET_OF (EFI_SMM_COMMUNICATE_HEADER, Data)
+                   + sizeof (FLASH_BATCH_RING)
+                   + FLASH_BATCH_DATA_BYTES);
+  if (mBatchBuffer == NULL) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Failed to allocate flash batch ring!\n"));
+    mSmmCommunication = NULL;
+    return;
+  }
+  CopyGuid (&mBatchBuffer->HeaderGuid,
+            &gEfiSpiSmmNorFlashBatchCommunicationGuid);
+  Ring = (FLASH_BATCH_RING *)&mBatchBuffer->Data[0];
+  Ring->Signature = FLASH_BATCH_SIGNATURE;
+  Ring->DataBytes = FLASH_BATCH_DATA_BYTES;
+
+  //
+  // Install the batch protocol
+  //
+  Handle = NULL;
+  Status = SpiInstallProtocol (&Handle,
+                               &gEfiSpiNorFlashBatchProtocolGuid,
+                               &mFlashBatchProtocol);
+  if (EFI_ERROR(Status)) {
+    DEBUG ((EFI_D_ERROR,
+            "ERROR - Failed to install flash batch protocol, Status: %r\n",
+            Status));
+    FreePool (mBatchBuffer);
+    mBatchBuffer = NULL;
+    mSmmCommunication = NULL;
+  }
+}
+
+/**
+  SMM is about to be locked.
+
+  This routine must be called at or below TPL_NOTIFY.
+
+  The SMM SPI NOR flash driver stops accepting batches when SMM is locked.
+
+  @param[in]  Event             Event whose notification function is being
+                                invoked.
+  @param[in]  Context           Pointer to the notification function's context.
+
+**/
+VOID
+EFIAPI
+FlashSmmReadyToLock (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  VOID *Interface;
+  EFI_STATUS Status;
+
+  //
+  // Ignore the initial notification
+  //
+  Status = gBS->LocateProtocol (&gEfiDxeSmmReadyToLockProtocolGuid,
+                                NULL,
+                                &Interface);
+  if (!EFI_ERROR(Status)) {
+    mBatchLocked = TRUE;
+  }
+}
+
+/**
+  Start erasing the next block of an asynchronous erase.
+
+  This routine runs at TPL_CALLBACK.
+
+  4 KiB blocks are erased until the address is aligned to the erase block
+  size, then erase blocks are used while enough of the region remains.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The erase of the next block was started.
+
+**/
+STATIC
+EFI_STATUS
+EFIAPI
+FlashEraseAsyncNext (
+  IN FLASH *Flash
+  )
+{
+  UINT32 BlockBytes;
+  UINT32 Blocks;
+  UINT64 Delay;
+  UINT32 EraseBlockBytes;
+  UINT8 EraseOpcode;
+  EFI_STATUS Status;
+
+  //
+  // Determine the size of the next erase
+  //
+  EraseBlockBytes = Flash->FlashConfig->EraseBlockBytes;
+  Blocks = EraseBlockBytes >> 12;
+  if (((Flash->EraseAddress & (EraseBlockBytes - 1)) == 0)
+    && (Flash->EraseBlockCount >= Blocks)) {
+    EraseOpcode = FlashEraseBlockOpcode (Flash);
+    BlockBytes = EraseBlockBytes;
+    Delay = FLASH_ERASE_BLOCK_DELAY;
+  } else {
+    EraseOpcode = SPI_NOR_ERASE_4KB;
+    BlockBytes = SIZE_4KB;
+    Blocks = 1;
+    Delay = FLASH_ERASE_4KB_DELAY;
+  }
+
+  //
+  // Start the erase
+  //
+  Status = FlashStartErase (Flash, Flash->EraseAddress, EraseOpcode,
+                            BlockBytes);
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+  Flash->EraseAddress += BlockBytes;
+  Flash->EraseBlockCount -= Blocks;
+
+  //
+  // Check the status after the typical erase time
+  //
+  Flash->EraseTimeout = GetTimeInNanoSecond (GetPerformanceCounter ())
+                      + FLASH_ERASE_TIMEOUT_NS;
+  return gBS->SetTimer (Flash->EraseTimer, TimerRelative, Delay);
+}
+
+/**
+  Complete an asynchronous erase.
+
+  After a timeout the flash part may still be busy, OperationInProgress
+  remains set so that the next read waits for the erase to complete.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+  @param[in]  Status            Completion status of the erase
+
+**/
+STATIC
+VOID
+EFIAPI
+FlashEraseAsyncComplete (
+  IN FLASH *Flash,
+  IN EFI_STATUS Status
+  )
+{
+  EFI_EVENT Event;
+
+  if (EFI_ERROR(Status)) {
+    DEBUG ((EFI_D_ERROR,
+            "ERROR - Asynchronous erase failed at 0x%08x, Status: %r\n",
+            Flash->OperationAddress, Status));
+  }
+  if (Status != EFI_TIMEOUT) {
+    Flash->OperationInProgress = FALSE;
+  }
+  gBS->SetTimer (Flash->EraseTimer, TimerCancel, 0);
+  *Flash->EraseStatus = Status;
+  Event = Flash->EraseEvent;
+  Flash->EraseEvent = NULL;
+  gBS->SignalEvent (Event);
+}
+
+/**
+  Poll the flash status for an asynchronous erase.
+
+  This routine runs at TPL_CALLBACK.
+
+  @param[in]  Event             The erase timer event
+  @param[in]  Context           Pointer to the FLASH data structure
+
+**/
+STATIC
+VOID
+EFIAPI
+FlashEraseAsyncTimer (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  BOOLEAN Busy;
+  FLASH *Flash;
+  EFI_STATUS Status;
+
+  Flash = (FLASH *)Context;
+  if (Flash->EraseEvent == NULL) {
+    return;
+  }
+
+  //
+  // A read has suspended the erase, the suspended part reports not busy.
+  // Poll again after the read resumes the erase and do not count the
+  // suspended time against the timeout.
+  //
+  if (Flash->OperationSuspended) {
+    Flash->EraseTimeout += FLASH_TIMER_PERIOD_TO_NS (FLASH_ERASE_POLL_PERIOD);
+    gBS->SetTimer (Event, TimerRelative, FLASH_ERASE_POLL_PERIOD);
+    return;
+  }
+
+  //
+  // Determine if the current block is erased
+  //
+  Status = FlashOperationBusy (Flash, &Busy);
+  if (!EFI_ERROR(Status)) {
+    if (Busy) {
+      //
+      // Poll again later
+      //
+      if (GetTimeInNanoSecond (GetPerformanceCounter ())
+          < Flash->EraseTimeout) {
+        gBS->SetTimer (Event, TimerRelative, FLASH_ERASE_POLL_PERIOD);
+        return;
+      }
+      Status = EFI_TIMEOUT;
+    } else if (Flash->EraseBlockCount > 0) {
+      //
+      // Erase the next block
+      //
+      Status = FlashEraseAsyncNext (Flash);
+      if (!EFI_ERROR(Status)) {
+        return;
+      }
+    }
+  }
+
+  //
+  // The erase is complete
+  //
+  FlashEraseAsyncComplete (Flash, Status);
+}
+
+/**
+  Start erasing one or more 4KiB regions in the SPI flash.
+
+  This routine must be called at or below TPL_CALLBACK.
+
+  This routine issues the first erase command and returns without waiting
+  for the erase to complete.  A timer event polls the flash status and
+  issues the next erase command when the previous block is erased.  When the
+  entire region is erased or an error occurs, the status is placed in
+  EraseStatus and Event is signaled.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_PROTOCOL data
+                                structure.
+  @param[in]  FlashAddress      Address within a 4 KiB block to start erasing
+  @param[in]  BlockCount        Number of 4 KiB blocks to erase
+  @param[in]  Event             Event to signal when the erase completes
+  @param[out] EraseStatus       Address of the buffer to receive the status of
+                                the erase operation
+
+  @return  This routine returns one of the following status values:
+
+  @retval EFI_SUCCESS           The erase was started successfully.
+  @retval EFI_INVALID_PARAMETER FlashAddress >= This->FlashSize
+  @retval EFI_INVALID_PARAMETER BlockCount * 4 KiB > This->FlashSize
+                                                     - FlashAddress
+  @retval EFI_INVALID_PARAMETER Event or EraseStatus is NULL
+  @retval EFI_NOT_READY         Another write or erase operation is in
+                                progress
+  @retval EFI_UNSUPPORTED       Called after ExitBootServices
+**/
+EFI_STATUS
+EFIAPI
+FlashEraseAsync (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN UINT32 FlashAddress,
+  IN UINT32 BlockCount,
+  IN EFI_EVENT Event,
+  OUT EFI_STATUS *EraseStatus
+  )
+{
+  BOOLEAN Busy;
+  FLASH *Flash;
+  UINT32 FlashSize;
+  EFI_TPL PreviousTpl;
+  EFI_STATUS Status;
+
+  //
+  // The timer services are not available at runtime
+  //
+  if (EfiAtRuntime ()) {
+    return EFI_UNSUPPORTED;
+  }
+
+  //
+  // Validate the inputs
+  //
+  Flash = FLASH_CONTEXT_FROM_PROTOCOL (This);
+  if ((Event == NULL) || (EraseStatus == NULL)) {
+    return EFI_INVALID_PARAMETER;
+  }
+  FlashAddress &= ~(SIZE_4KB - 1);
+  FlashSize = Flash->FlashConfig->FlashSize;
+  if (FlashAddress >= FlashSize) {
+    DEBUG((EFI_D_ERROR, "ERROR - FlashAddress (0x%08x) >= 0x%08x\n", FlashAddress, FlashSize));
+    return EFI_INVALID_PARAMETER;
+  }
+  if (BlockCount > ((FlashSize - FlashAddress) >> 12)) {
+    DEBUG((EFI_D_ERROR, "ERROR - BlockCount (0x%08x) > 0x%08x\n",
+          BlockCount, (FlashSize - FlashAddress) >> 12));
+    return EFI_INVALID_PARAMETER;
+  }
+
+  //
+  // Create the erase timer
+  //
+  if (Flash->EraseTimer == NULL) {
+    Status = gBS->CreateEvent (
+                    EVT_TIMER | EVT_NOTIFY_SIGNAL,
+                    TPL_CALLBACK,
+                    FlashEraseAsyncTimer,
+                    Flash,
+                    &Flash->EraseTimer
+                    );
+    if (EFI_ERROR(Status)) {
+      Flash->EraseTimer = NULL;
+      return Status;
+    }
+  }
+
+  //
+  // Synchronize with the erase timer
+  //
+  PreviousTpl = gBS->RaiseTPL (TPL_CALLBACK);
+
+  //
+  // A previous erase may have timed out while the flash part was still
+  // busy, the operation is done once the part reports not busy
+  //
+  if ((Flash->EraseEvent == NULL) && Flash->OperationInProgress
+    && (!Flash->OperationSuspended)) {
+    Status = FlashOperationBusy (Flash, &Busy);
+    if ((!EFI_ERROR(Status)) && (!Busy)) {
+      Flash->OperationInProgress = FALSE;
+    }
+  }
+  if ((Flash->EraseEvent != NULL) || Flash->OperationInProgress) {
+    gBS->RestoreTPL (PreviousTpl);
+    return EFI_NOT_READY;
+  }
+
+  //
+  // Start the erase
+  //
+  Flash->EraseEvent = Event;
+  Flash->EraseStatus = EraseStatus;
+  Flash->EraseAddress = FlashAddress;
+  Flash->EraseBlockCount = BlockCount;
+  *EraseStatus = EFI_NOT_READY;
+  if (BlockCount == 0) {
+    FlashEraseAsyncComplete (Flash, EFI_SUCCESS);
+    Status = EFI_SUCCESS;
+  } else {
+    Status = FlashEraseAsyncNext (Flash);
+    if (EFI_ERROR(Status)) {
+      Flash->OperationInProgress = FALSE;
+      Flash->EraseEvent = NULL;
+    }
+  }
+  gBS->RestoreTPL (PreviousTpl);
+  return Status;
+}
+
+/**
+  Stop an asynchronous erase and release the erase timer.
+
+  The caller's event is signaled with EFI_ABORTED when an erase is in
+  progress.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+
+**/
+VOID
+EFIAPI
+FlashEraseAsyncStop (
+  IN FLASH *Flash
+  )
+{
+  if (Flash->EraseEvent != NULL) {
+    FlashEraseAsyncComplete (Flash, EFI_ABORTED);
+  }
+  if (Flash->EraseTimer != NULL) {
+    gBS->CloseEvent (Flash->EraseTimer);
+    Flash->EraseTimer = NULL;
+  }
+}
+
+/**
+  Convert the SPI flash driver pointers to virtual addresses.
+
+  This routine is called once by SetVirtualAddressMap.  The flash list link is
+  converted last since it is used to walk the list.
+
+  @param[in]  Event             The virtual address change event
+  @param[in]  Context           Not used
+
+**/
+STATIC
+VOID
+EFIAPI
+FlashVirtualAddressChange (
+  IN EFI_EVENT Event,
+  IN VOID *Context
+  )
+{
+  FLASH *Flash;
+  EFI_SPI_NOR_FLASH_PROTOCOL *FlashProtocol;
+  EFI_LEGACY_SPI_FLASH_PROTOCOL *LegacySpiFlash;
+  FLASH *NextFlash;
+
+  Flash = gFlashList;
+  while (Flash != NULL) {
+    NextFlash = Flash->NextFlash;
+    EfiConvertPointer (0, (VOID **)&Flash->SpiIo);
+    EfiConvertPointer (0, (VOID **)&Flash->FlashConfig);
+    EfiConvertPointer (0, (VOID **)&Flash->WriteBuffer);
+    EfiConvertPointer (EFI_OPTIONAL_PTR,
+                    (VOID **)&Flash->ReadStatusTransaction);
+
+    //
+    // The busy callback is boot services code
+    //
+    Flash->BusyCallback = NULL;
+    Flash->BusyContext = NULL;
+
+    //
+    // Convert the SPI NOR flash protocol
+    //
+    LegacySpiFlash = &Flash->LegacySpiFlash;
+    FlashProtocol = &LegacySpiFlash->FlashProtocol;
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->SpiPeripheral);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->GetFlashId);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->ReadData);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->LfReadData);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->ReadStatus);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->WriteStatus);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->WriteData);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->Erase);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->EraseAsync);
+    EfiConvertPointer (0, (VOID **)&FlashProtocol->SetBusyCallback);
+
+    //
+    // Convert the legacy SPI flash protocol
+    //
+    EfiConvertPointer (0, (VOID **)&LegacySpiFlash->BiosBaseAddress);
+    EfiConvertPointer (0, (VOID **)&LegacySpiFlash->ClearSpiProtect);
+    EfiConvertPointer (0, (VOID **)&LegacySpiFlash->IsRangeProtected);
+    EfiConvertPointer (0, (VOID **)&LegacySpiFlash->ProtectNextRange);
+    EfiConvertPointer (0, (VOID **)&LegacySpiFlash->LockController);
+
+    EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&Flash->NextFlash);
+    Flash = NextFlash;
+  }
+  EfiConvertPointer (EFI_OPTIONAL_PTR, (VOID **)&gFlashList);
+}
+
 /**
   The entry point for the SPI flash driver.
 
@@ -179,6 +1019,22 @@ FlashEntryPoint (
   )
 {
   EFI_EVENT Event;
+  EFI_STATUS Status;
+
+  //
+  // Convert the pointers when the OS switches to virtual addressing
+  //
+  Status = gBS->CreateEventEx (
+                  EVT_NOTIFY_SIGNAL,
+                  TPL_NOTIFY,
+                  FlashVirtualAddressChange,
+                  NULL,
+                  &gEfiEventVirtualAddressChangeGuid,
+                  &Event
+                  );
+  if (EFI_ERROR (Status)) {
+    return Status;
+  }
 
   //
   // Create a flash driver instance for each SPI NOR flash part
@@ -192,5 +1048,40 @@ FlashEntryPoint (
   if (Event == NULL) {
     return EFI_OUT_OF_RESOURCES;
   }
+
+  //
+  // Connect the SPI NOR flash parts published as stubs by the SPI bus layer
+  //
+  Event = EfiCreateProtocolNotifyEvent (&gEfiSpiPeripheralStubProtocolGuid,
+                                        TPL_CALLBACK,
+                                        FlashStubProtocolAvailable,
+                                        NULL,
+                                        &mStubProtocolRegistration
+                                        );
+  if (Event == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+
+  //
+  // Provide batched access to the SMM SPI NOR flash driver
+  //
+  Event = EfiCreateProtocolNotifyEvent (&gEfiSmmCommunicationProtocolGuid,
+                                        TPL_CALLBACK,
+                                        FlashSmmCommunicationAvailable,
+                                        NULL,
+                                        &mSmmCommunicationRegistration
+                                        );
+  if (Event == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
+  Event = EfiCreateProtocolNotifyEvent (&gEfiDxeSmmReadyToLockProtocolGuid,
+                                        TPL_CALLBACK,
+                                        FlashSmmReadyToLock,
+                                        NULL,
+                                        &mSmmReadyToLockRegistration
+                                        );
+  if (Event == NULL) {
+    return EFI_OUT_OF_RESOURCES;
+  }
   return EFI_SUCCESS;
 }
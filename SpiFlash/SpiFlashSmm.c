@@ -14,12 +14,59 @@ WITHOUT WARRANTIES OR REPRESENTATIONS OF ANY KIND, EITHER EXPRESS OR IMPLIED.
 **/
 
 #include "SpiFlash.h"
+#include <Library/SmmMemLib.h>
 #include <Library/SmmServicesTableLib.h>
+#include <Protocol/SmmReadyToLock.h>
 
 EFI_GUID *gFlashIoProtocolGuid = &gEfiSpiSmmNorFlashDriverGuid;
 EFI_GUID *gFlashProtocolGuid = &gEfiSpiSmmNorFlashProtocolGuid;
 EFI_GUID *gFlashLegacyProtocolGuid = &gEfiLegacySpiSmmFlashProtocolGuid;
 VOID *gFlashIoProtocolRegistration;
+EFI_HANDLE mBatchDispatchHandle;
+BOOLEAN mBatchLocked;
+VOID *mSmmReadyToLockRegistration;
+
+/**
+  Asynchronous erase is not available in SMM.
+
+  @param[in]  This              Pointer to an EFI_SPI_NOR_FLASH_PROTOCOL data
+                                structure.
+  @param[in]  FlashAddress      Address within a 4 KiB block to start erasing
+  @param[in]  BlockCount        Number of 4 KiB blocks to erase
+  @param[in]  Event             Event to signal when the erase completes
+  @param[out] EraseStatus       Address of the buffer to receive the status of
+                                the erase operation
+
+  @retval EFI_UNSUPPORTED       The timer services are not available in SMM
+**/
+EFI_STATUS
+EFIAPI
+FlashEraseAsync (
+  IN CONST EFI_SPI_NOR_FLASH_PROTOCOL *This,
+  IN UINT32 FlashAddress,
+  IN UINT32 BlockCount,
+  IN EFI_EVENT Event,
+  OUT EFI_STATUS *EraseStatus
+  )
+{
+  return EFI_UNSUPPORTED;
+}
+
+/**
+  Stop an asynchronous erase.
+
+  SMM does not support asynchronous erase, so there is nothing to stop.
+
+  @param[in]  Flash             Pointer to a FLASH data structure.
+
+**/
+VOID
+EFIAPI
+FlashEraseAsyncStop (
+  IN FLASH *Flash
+  )
+{
+}
 
 /**
   Install the a protocol for the driver.
@@ -134,6 +181,229 @@ FlashIoProtocolAvailable (
   return Status;
 }
 
+/**
+  Locate the SPI NOR flash part selected by a batch request.
+
+  The parts are numbered in the order the SMM SPI NOR flash driver started
+  them.  gFlashList holds the most recently started part first.
+
+  @param[in]  PartIndex         Index of the SPI NOR flash part
+
+  @return  The EFI_SPI_NOR_FLASH_PROTOCOL of the part or NULL if not found
+
+**/
+STATIC
+CONST EFI_SPI_NOR_FLASH_PROTOCOL *
+EFIAPI
+FlashBatchLocatePart (
+  IN UINT32 PartIndex
+  )
+{
+  FLASH *Flash;
+  UINT32 PartCount;
+
+  PartCount = 0;
+  for (Flash = gFlashList; Flash != NULL; Flash = Flash->NextFlash) {
+    PartCount += 1;
+  }
+  if (PartIndex >= PartCount) {
+    return NULL;
+  }
+  Flash = gFlashList;
+  while (--PartCount > PartIndex) {
+    Flash = Flash->NextFlash;
+  }
+  return &Flash->LegacySpiFlash.FlashProtocol;
+}
+
+/**
+  Process the batch of flash requests posted by the DXE SPI NOR flash driver.
+
+  This routine runs in SMM.
+
+  Walk the request ring from Tail to Head performing each of the flash
+  operations.  The status of each operation is placed into the corresponding
+  ring entry and Tail is advanced after each operation completes.  The ring is
+  located outside of SMRAM and may be modified by non-SMM code, so each entry
+  is copied into SMRAM before it is validated.  The requests are not
+  authenticated, so no requests are accepted once SMM is locked.  The status
+  of the whole batch is placed into the ring's Status field.
+
+  @param[in]  DispatchHandle    The unique handle assigned to this handler by
+                                SmiHandlerRegister().
+  @param[in]  Context           Points to an optional handler context which was
+                                specified when the handler was registered.
+  @param[in, out] CommBuffer    Pointer to the FLASH_BATCH_RING
+  @param[in, out] CommBufferSize  The size of the CommBuffer.
+
+  @retval EFI_SUCCESS           The SMI was handled
+
+**/
+EFI_STATUS
+EFIAPI
+FlashBatchSmiHandler (
+  IN     EFI_HANDLE  DispatchHandle,
+  IN     CONST VOID  *Context         OPTIONAL,
+  IN OUT VOID        *CommBuffer      OPTIONAL,
+  IN OUT UINTN       *CommBufferSize  OPTIONAL
+  )
+{
+  UINT8 *Data;
+  UINT32 DataBytes;
+  FLASH_BATCH_ENTRY Entry;
+  CONST EFI_SPI_NOR_FLASH_PROTOCOL *FlashProtocol;
+  UINT32 Head;
+  FLASH_BATCH_RING *Ring;
+  EFI_STATUS Status;
+  UINT32 Tail;
+
+  //
+  // Validate the communication buffer
+  //
+  if ((CommBuffer == NULL) || (CommBufferSize == NULL)
+    || (*CommBufferSize < sizeof (FLASH_BATCH_RING))
+    || (!SmmIsBufferOutsideSmmValid ((UINTN)CommBuffer, *CommBufferSize))) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash batch buffer is invalid!\n"));
+    return EFI_SUCCESS;
+  }
+  Ring = CommBuffer;
+
+  //
+  // The flash parts may not be modified from outside of SMM once SMM is
+  // locked
+  //
+  if (mBatchLocked) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash batch rejected, SMM is locked!\n"));
+    Ring->Status = EFI_ACCESS_DENIED;
+    return EFI_SUCCESS;
+  }
+
+  DataBytes = Ring->DataBytes;
+  if ((Ring->Signature != FLASH_BATCH_SIGNATURE)
+    || (DataBytes > (*CommBufferSize - sizeof (FLASH_BATCH_RING)))) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash batch ring is invalid!\n"));
+    Ring->Status = EFI_INVALID_PARAMETER;
+    return EFI_SUCCESS;
+  }
+  Data = (UINT8 *)(Ring + 1);
+
+  //
+  // Verify that the ring indices are consistent
+  //
+  Head = Ring->Head;
+  Tail = Ring->Tail;
+  if ((UINT32)(Head - Tail) > FLASH_BATCH_ENTRIES) {
+    DEBUG ((EFI_D_ERROR, "ERROR - Flash batch ring indices are invalid!\n"));
+    Ring->Status = EFI_INVALID_PARAMETER;
+    return EFI_SUCCESS;
+  }
+
+  //
+  // Process the requests
+  //
+  while (Tail != Head) {
+    CopyMem (&Entry,
+             &Ring->Entry[Tail % FLASH_BATCH_ENTRIES],
+             sizeof (Entry));
+
+    //
+    // Validate the data portion of the request, erase operations must start
+    // and end on a 4 KiB boundary
+    //
+    Status = EFI_SUCCESS;
+    if (Entry.Operation == SPI_NOR_FLASH_BATCH_ERASE) {
+      if ((Entry.LengthInBytes == 0)
+        || ((Entry.FlashAddress & (SIZE_4KB - 1)) != 0)
+        || ((Entry.LengthInBytes & (SIZE_4KB - 1)) != 0)) {
+        Status = EFI_INVALID_PARAMETER;
+      }
+    } else if ((Entry.DataOffset > DataBytes)
+      || (Entry.LengthInBytes > (DataBytes - Entry.DataOffset))) {
+      Status = EFI_INVALID_PARAMETER;
+    }
+
+    //
+    // Locate the SPI NOR flash part
+    //
+    FlashProtocol = NULL;
+    if (!EFI_ERROR(Status)) {
+      FlashProtocol = FlashBatchLocatePart (Entry.PartIndex);
+      if (FlashProtocol == NULL) {
+        Status = EFI_NOT_FOUND;
+      }
+    }
+
+    //
+    // Perform the flash operation
+    //
+    if (!EFI_ERROR(Status)) {
+      switch (Entry.Operation) {
+      default:
+        Status = EFI_UNSUPPORTED;
+        break;
+
+      case SPI_NOR_FLASH_BATCH_READ:
+        Status = FlashProtocol->ReadData (FlashProtocol,
+                                          Entry.FlashAddress,
+                                          Entry.LengthInBytes,
+                                          &Data[Entry.DataOffset]);
+        break;
+
+      case SPI_NOR_FLASH_BATCH_WRITE:
+        Status = FlashProtocol->WriteData (FlashProtocol,
+                                           Entry.FlashAddress,
+                                           Entry.LengthInBytes,
+                                           &Data[Entry.DataOffset]);
+        break;
+
+      case SPI_NOR_FLASH_BATCH_ERASE:
+        Status = FlashProtocol->Erase (FlashProtocol,
+                                       Entry.FlashAddress,
+                                       Entry.LengthInBytes / SIZE_4KB);
+        break;
+      }
+    }
+
+    //
+    // Return the status and release the entry
+    //
+    Ring->Entry[Tail % FLASH_BATCH_ENTRIES].Status = Status;
+    Tail += 1;
+    MemoryFence ();
+    Ring->Tail = Tail;
+  }
+  Ring->Status = EFI_SUCCESS;
+  return EFI_SUCCESS;
+}
+
+/**
+  SMM is about to be locked.
+
+  Stop accepting batches of flash requests from outside of SMM.
+
+  @param[in] Protocol   Points to the protocol's unique identifier.
+  @param[in] Interface  Points to the interface instance.
+  @param[in] Handle     The handle on which the interface was installed.
+
+  @retval EFI_SUCCESS   The batch SMI handler is no longer registered
+
+**/
+EFI_STATUS
+EFIAPI
+FlashSmmReadyToLock (
+  IN CONST EFI_GUID  *Protocol,
+  IN VOID            *Interface,
+  IN EFI_HANDLE      Handle
+  )
+{
+  mBatchLocked = TRUE;
+  if (mBatchDispatchHandle != NULL) {
+    gSmst->SmiHandlerUnRegister (mBatchDispatchHandle);
+    mBatchDispatchHandle = NULL;
+  }
+  return EFI_SUCCESS;
+}
+
 /**
   The entry point for the SPI flash driver.
 
@@ -161,5 +431,29 @@ FlashEntryPoint (
                   FlashIoProtocolAvailable,
                   &gFlashIoProtocolRegistration
                   );
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Accept batches of flash requests from the DXE SPI NOR flash driver
+  //
+  Status = gSmst->SmiHandlerRegister (
+                  FlashBatchSmiHandler,
+                  &gEfiSpiSmmNorFlashBatchCommunicationGuid,
+                  &mBatchDispatchHandle
+                  );
+  if (EFI_ERROR(Status)) {
+    return Status;
+  }
+
+  //
+  // Stop accepting the batches when SMM is locked
+  //
+  Status = gSmst->SmmRegisterProtocolNotify (
+                  &gEfiSmmReadyToLockProtocolGuid,
+                  FlashSmmReadyToLock,
+                  &mSmmReadyToLockRegistration
+                  );
   return Status;
 }